@@ -1,10 +1,11 @@
 #include "ap_int.h"
-#include "ap_fixed.h"
 #include "hls_stream.h"
+#include "../common/perf_counters.h"
+#include "../common/axi_word.h"
 
-// Fixed-point data types for HLS
-// 16-bit fixed-point: 8 integer bits, 8 fractional bits
-typedef ap_fixed<16, 8> data_t;
+// The host's int8 feature maps (qint8_t), so ReLU6 clamps at 6 exactly as
+// CPUConvolution::relu6 does
+typedef ap_int<8> data_t;
 
 // Activation types
 enum ActivationType {
@@ -30,82 +31,80 @@ data_t relu6(data_t x) {
     return (tmp < six) ? tmp : six;
 }
 
-// Leaky ReLU: x if x > 0, else 0.1*x
+// Leaky ReLU: x if x > 0, else about 0.1*x (26/256, rounded down)
 data_t leaky_relu(data_t x) {
     #pragma HLS INLINE
     data_t zero = 0;
-    data_t alpha = 0.1;
-    data_t result = (x > zero) ? x : (data_t)(x * alpha);
+    ap_int<16> scaled = x * 26;
+    data_t result = (x > zero) ? x : (data_t)(scaled >> 8);
     return result;
 }
 
-// Main activation accelerator
+// Main activation accelerator. The feature maps move a word of
+// WORD_ELEMS elements per beat; a size that ends inside a word still
+// writes the whole last word. Conv layers clamp with ReLU and ReLU6 in the
+// conv block's output stage and batch norm is folded into their weights by
+// quantize_model.py, so this block only serves activations that follow
+// something else.
 void activation_accelerator(
-    data_t *input,      // Input feature map (DDR)
-    data_t *output,     // Output feature map (DDR)
+    word_t *input,      // Input feature map (DDR)
+    word_t *output,     // Output feature map (DDR)
     int size,           // Total number of elements
     ActivationType act_type,
-    // Batch Norm parameters (optional, can be fused)
-    data_t *gamma,
-    data_t *beta,
-    data_t *mean,
-    data_t *variance,
-    data_t epsilon,
-    bool use_batch_norm
+    volatile perf_t *cycle_count,           // Free-running cycle counter
+    perf_t perf[PERF_COUNTER_COUNT]         // Performance counters (read-only)
 ) {
-    #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem0
-    #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem1
-    #pragma HLS INTERFACE m_axi port=gamma offset=slave bundle=gmem2
-    #pragma HLS INTERFACE m_axi port=beta offset=slave bundle=gmem2
-    #pragma HLS INTERFACE m_axi port=mean offset=slave bundle=gmem2
-    #pragma HLS INTERFACE m_axi port=variance offset=slave bundle=gmem2
+    #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem0 max_read_burst_length=256
+    #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem1 max_write_burst_length=256
     
     #pragma HLS INTERFACE s_axilite port=size bundle=control
     #pragma HLS INTERFACE s_axilite port=act_type bundle=control
-    #pragma HLS INTERFACE s_axilite port=epsilon bundle=control
-    #pragma HLS INTERFACE s_axilite port=use_batch_norm bundle=control
+    #pragma HLS INTERFACE ap_none port=cycle_count
+    #pragma HLS INTERFACE s_axilite port=perf bundle=control
     #pragma HLS INTERFACE s_axilite port=return bundle=control
 
-    // Local buffers for batch norm parameters
-    // Assuming channels is small enough to fit in BRAM, or we process channel-wise
-    // For MobileNet, max channels is 1024. 
-    // Here we implement a simple element-wise processing for simplicity
-    
-    // Pre-compute batch norm factors if needed
-    // y = gamma * (x - mean) / sqrt(var + eps) + beta
-    // y = x * (gamma/std) + (beta - gamma*mean/std)
-    // y = x * norm_factor + bias_factor
-    
-    // Note: In a real optimized implementation, these would be pre-computed on CPU
-    // and passed as weights/bias to the accelerator. 
-    // We include logic here for completeness but recommend offline fusion.
-    
-    // For this implementation, we assume input is [N, H, W, C] flattened
-    // We process elements sequentially for simplicity in this version
+    static perf_t perf_totals[PERF_COUNTER_COUNT];
+    PerfMonitor monitor(cycle_count);
+
+    // Input is [N, H, W, C] flattened, a word of elements per cycle in one
+    // burst each way
+    int words = (size + WORD_ELEMS - 1) / WORD_ELEMS;
     
+    monitor.begin_phase();
     ACTIVATION_LOOP:
-    for (int i = 0; i < size; i++) {
+    for (int i = 0; i < words; i++) {
         #pragma HLS PIPELINE II=1
         
-        data_t val = input[i];
-        data_t result;
+        word_t in = input[i];
+        word_t out;
         
-        // Apply activation
-        switch (act_type) {
-            case RELU:
-                result = relu(val);
-                break;
-            case RELU6:
-                result = relu6(val);
-                break;
-            case LEAKY_RELU:
-                result = leaky_relu(val);
-                break;
-            default:
-                result = relu(val);
-                break;
+        ACTIVATION_LANES:
+        for (int l = 0; l < WORD_ELEMS; l++) {
+            #pragma HLS UNROLL
+            data_t val = word_element(in, l);
+            data_t result;
+            
+            // Apply activation
+            switch (act_type) {
+                case RELU:
+                    result = relu(val);
+                    break;
+                case RELU6:
+                    result = relu6(val);
+                    break;
+                case LEAKY_RELU:
+                    result = leaky_relu(val);
+                    break;
+                default:
+                    result = relu(val);
+                    break;
+            }
+            set_word_element(out, l, result);
         }
         
-        output[i] = result;
+        output[i] = out;
     }
+    monitor.end_stream(words, words);
+    
+    monitor.publish(perf_totals, perf);
 }
@@ -0,0 +1,221 @@
+#include "ap_int.h"
+#include "../common/perf_counters.h"
+#include "../common/axi_word.h"
+#include "../../../models/configs/mobilenet_config.h"
+
+// The host's quantized types (qint8_t, qint32_t), so the feature vector,
+// the FC weights [classes][inputs] and the bias are used as the host
+// registered them
+typedef ap_int<8> data_t;            // Features and logits
+typedef ap_int<8> weight_t;          // Weights
+typedef ap_int<32> bias_t;           // Biases, at the accumulator's scale
+typedef ap_int<32> acc_t;            // Accumulator
+typedef ap_uint<64> exp_sum_t;       // Softmax denominator, CLASSIFIER_EXP_SHIFT fixed point
+
+#define MAX_INPUTS CLASSIFIER_MAX_INPUTS
+#define MAX_CLASSES CLASSIFIER_MAX_CLASSES
+#define MAX_TOP_K CLASSIFIER_MAX_TOP_K
+#define LOGIT_BINS 256
+
+// Words of weights the MAC loop runs per class at least, padding short
+// rows with idle cycles, so a histogram bin's read-add-write has finished
+// before the next class's logit can land in it
+#define CLS_MIN_WORDS 4
+
+// Back to int8 as CPUConvolution::fully_connected does: drop 8 fraction
+// bits and saturate, no activation
+static data_t requantize(acc_t sum) {
+    #pragma HLS INLINE
+    acc_t shifted = sum >> 8;
+    if (shifted > 127) shifted = 127;
+    if (shifted < -128) shifted = -128;
+    return (data_t)shifted;
+}
+
+// Insert a class into the ranking, kept sorted best first in registers.
+// Only a strictly greater logit moves an entry down, so among equal
+// logits the class seen first (the lower one) stays ahead.
+static void rank_class(ap_int<9> best_logits[MAX_TOP_K], ap_uint<12> best_classes[MAX_TOP_K],
+                       data_t logit, ap_uint<12> cls, int top_k) {
+    #pragma HLS INLINE
+    bool displaced[MAX_TOP_K];
+    #pragma HLS ARRAY_PARTITION variable=displaced complete
+    for (int j = 0; j < MAX_TOP_K; j++) {
+        #pragma HLS UNROLL
+        displaced[j] = j < top_k && logit > best_logits[j];
+    }
+
+    // The first displaced slot takes the class, the rest shift down one
+    for (int j = MAX_TOP_K - 1; j >= 0; j--) {
+        #pragma HLS UNROLL
+        if (displaced[j]) {
+            if (j == 0 || !displaced[j - 1]) {
+                best_logits[j] = logit;
+                best_classes[j] = cls;
+            } else {
+                best_logits[j] = best_logits[j - 1];
+                best_classes[j] = best_classes[j - 1];
+            }
+        }
+    }
+}
+
+// Classifier accelerator: the final fully connected layer, ranked on chip.
+// The feature vector and biases are loaded once; the weights then stream
+// row by row as one sequential burst, a word (WORD_ELEMS MACs) per cycle.
+// Each finished logit goes into a top_k ranking and a histogram of logit
+// values, from which the softmax denominator sum(exp(logit - best)) is
+// taken with CLASSIFIER_EXP_TERMS table lookups rather than an exp per
+// class. Only that and the ranking are written (a ClassifierOutput).
+void classifier_accelerator(
+    word_t *input,          // Feature vector [inputs] (DDR)
+    word_t *weights,        // FC weights [classes][inputs] (DDR)
+    word_t *bias,           // FC bias [classes] (DDR)
+    word_t *output,         // ClassifierOutput (DDR)
+    int inputs,             // Multiple of WORD_ELEMS, at most MAX_INPUTS
+    int classes,            // At most MAX_CLASSES
+    int top_k,              // 1 to MAX_TOP_K, at most classes
+    volatile perf_t *cycle_count,           // Free-running cycle counter
+    perf_t perf[PERF_COUNTER_COUNT]         // Performance counters (read-only)
+) {
+    #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem0 depth=128
+    #pragma HLS INTERFACE m_axi port=weights offset=slave bundle=gmem1 depth=131072 max_read_burst_length=256
+    #pragma HLS INTERFACE m_axi port=bias offset=slave bundle=gmem2 depth=2048
+    #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem3 depth=5
+    #pragma HLS INTERFACE s_axilite port=inputs bundle=control
+    #pragma HLS INTERFACE s_axilite port=classes bundle=control
+    #pragma HLS INTERFACE s_axilite port=top_k bundle=control
+    #pragma HLS INTERFACE ap_none port=cycle_count
+    #pragma HLS INTERFACE s_axilite port=perf bundle=control
+    #pragma HLS INTERFACE s_axilite port=return bundle=control
+
+    static perf_t perf_totals[PERF_COUNTER_COUNT];
+    static const ap_uint<32> exp_table[CLASSIFIER_EXP_TERMS] = CLASSIFIER_EXP_TABLE;
+    PerfMonitor monitor(cycle_count);
+
+    data_t features[MAX_INPUTS];
+    #pragma HLS ARRAY_PARTITION variable=features cyclic factor=WORD_ELEMS
+    bias_t bias_buffer[MAX_CLASSES];
+    #pragma HLS ARRAY_PARTITION variable=bias_buffer cyclic factor=WORD_FIELDS
+    ap_uint<13> histogram[LOGIT_BINS];
+
+    // Ranking; -256 is below every int8 logit, so empty slots always lose
+    ap_int<9> best_logits[MAX_TOP_K];
+    ap_uint<12> best_classes[MAX_TOP_K];
+    #pragma HLS ARRAY_PARTITION variable=best_logits complete
+    #pragma HLS ARRAY_PARTITION variable=best_classes complete
+
+    int words = inputs / WORD_ELEMS;
+    int row_words = words < CLS_MIN_WORDS ? CLS_MIN_WORDS : words;
+    int bias_words = (classes + WORD_FIELDS - 1) / WORD_FIELDS;
+
+    monitor.begin_phase();
+    LOAD_FEATURES:
+    for (int w = 0; w < words; w++) {
+        #pragma HLS PIPELINE II=1
+        word_t word = input[w];
+        for (int l = 0; l < WORD_ELEMS; l++) {
+            #pragma HLS UNROLL
+            features[w * WORD_ELEMS + l] = word_element(word, l);
+        }
+    }
+    LOAD_BIAS:
+    for (int i = 0; i < bias_words; i++) {
+        #pragma HLS PIPELINE II=1
+        word_t word = bias[i];
+        for (int f = 0; f < WORD_FIELDS; f++) {
+            #pragma HLS UNROLL
+            bias_buffer[i * WORD_FIELDS + f] = (bias_t)word_field(word, f);
+        }
+    }
+    monitor.end_read(words + bias_words);
+
+    monitor.begin_phase();
+    CLEAR_HISTOGRAM:
+    for (int b = 0; b < LOGIT_BINS; b++) {
+        #pragma HLS PIPELINE II=1
+        histogram[b] = 0;
+    }
+    for (int j = 0; j < MAX_TOP_K; j++) {
+        #pragma HLS UNROLL
+        best_logits[j] = -256;
+        best_classes[j] = 0;
+    }
+    monitor.end_compute();
+
+    // One flattened loop over every weight word, so the row ends cost no
+    // pipeline drain
+    monitor.begin_phase();
+    acc_t acc = 0;
+    int o = 0;
+    int w = 0;
+    CLASSIFY:
+    for (int n = 0; n < classes * row_words; n++) {
+        #pragma HLS PIPELINE II=1
+        #pragma HLS DEPENDENCE variable=histogram inter false
+        if (w < words) {
+            word_t word = weights[o * words + w];
+            acc_t partial = 0;
+            MAC_LANES:
+            for (int l = 0; l < WORD_ELEMS; l++) {
+                #pragma HLS UNROLL
+                partial += features[w * WORD_ELEMS + l] * (weight_t)word_element(word, l);
+            }
+            acc += partial;
+        }
+        if (w == row_words - 1) {
+            data_t logit = requantize(acc + bias_buffer[o]);
+            histogram[(ap_uint<8>)(logit + 128)]++;
+            rank_class(best_logits, best_classes, logit, o, top_k);
+            acc = 0;
+            w = 0;
+            o++;
+        } else {
+            w++;
+        }
+    }
+    monitor.end_stream(classes * words, 0);
+
+    // Every class within CLASSIFIER_EXP_TERMS of the best contributes its
+    // bin's count times exp(-distance)
+    monitor.begin_phase();
+    ap_int<9> best = best_logits[0];
+    exp_sum_t exp_sum = 0;
+    EXP_SUM:
+    for (int d = 0; d < CLASSIFIER_EXP_TERMS; d++) {
+        #pragma HLS PIPELINE II=1
+        ap_int<10> bin = best - d;
+        if (bin >= -128) {
+            exp_sum += (exp_sum_t)histogram[(ap_uint<8>)(bin + 128)] * exp_table[d];
+        }
+    }
+    monitor.end_compute();
+
+    // The ClassifierOutput fields: denominator low and high, then the
+    // ranked entries
+    monitor.begin_phase();
+    int out_words = (2 + top_k + WORD_FIELDS - 1) / WORD_FIELDS;
+    WRITE_RESULT:
+    for (int ow = 0; ow < out_words; ow++) {
+        #pragma HLS PIPELINE II=1
+        word_t word = 0;
+        for (int f = 0; f < WORD_FIELDS; f++) {
+            #pragma HLS UNROLL
+            int i = ow * WORD_FIELDS + f;
+            ap_uint<32> value = 0;
+            if (i == 0) {
+                value = exp_sum.range(31, 0);
+            } else if (i == 1) {
+                value = exp_sum.range(63, 32);
+            } else if (i - 2 < top_k) {
+                value = ((ap_uint<32>)best_classes[i - 2] << 8) |
+                        (ap_uint<32>)(ap_uint<8>)best_logits[i - 2].range(7, 0);
+            }
+            set_word_field(word, f, value);
+        }
+        output[ow] = word;
+    }
+    monitor.end_write(out_words);
+
+    monitor.publish(perf_totals, perf);
+}
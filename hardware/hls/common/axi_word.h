@@ -0,0 +1,38 @@
+#ifndef AXI_WORD_H
+#define AXI_WORD_H
+
+#include "ap_int.h"
+#include "../../../models/configs/mobilenet_config.h"
+
+// One beat of an accelerator memory port. Tensors are packed in address
+// order, lowest address in the low bits: WORD_ELEMS int8 elements, or
+// WORD_FIELDS 32-bit values (biases, descriptor words). Reading a tensor
+// word by word in address order makes each run one burst.
+typedef ap_uint<AXI_DATA_WIDTH> word_t;
+
+#define WORD_ELEMS AXI_WORD_BYTES
+#define WORD_FIELDS (AXI_DATA_WIDTH / 32)
+
+// Element i of a word
+static inline ap_int<8> word_element(const word_t &word, int i) {
+    #pragma HLS INLINE
+    return (ap_int<8>)word.range(8 * i + 7, 8 * i);
+}
+
+static inline void set_word_element(word_t &word, int i, ap_int<8> value) {
+    #pragma HLS INLINE
+    word.range(8 * i + 7, 8 * i) = value.range(7, 0);
+}
+
+// 32-bit value i of a word
+static inline ap_uint<32> word_field(const word_t &word, int i) {
+    #pragma HLS INLINE
+    return word.range(32 * i + 31, 32 * i);
+}
+
+static inline void set_word_field(word_t &word, int i, ap_uint<32> value) {
+    #pragma HLS INLINE
+    word.range(32 * i + 31, 32 * i) = value;
+}
+
+#endif // AXI_WORD_H
@@ -0,0 +1,23 @@
+#ifndef GAP_AVERAGE_H
+#define GAP_AVERAGE_H
+
+#include "ap_int.h"
+#include "../../../models/configs/mobilenet_config.h"
+
+// Words of channels an accumulating loop runs per pixel at least, padding
+// narrow maps with idle cycles, so a word's read-add-write has finished
+// before the next pixel adds to it again
+#define GAP_MIN_WORDS 4
+
+// A channel's sum over the map divided by its pixel count, truncated
+// toward zero like the host's int32 division, as one multiply with the
+// host's GAP_RECIPROCAL(pixels)
+static inline ap_int<8> gap_average(ap_int<32> sum, ap_uint<32> reciprocal) {
+    #pragma HLS INLINE
+    ap_uint<20> magnitude = sum < 0 ? (ap_int<32>)-sum : sum;
+    ap_uint<52> product = magnitude * reciprocal;
+    ap_int<8> average = product >> GAP_RECIP_SHIFT;
+    return sum < 0 ? (ap_int<8>)-average : average;
+}
+
+#endif // GAP_AVERAGE_H
@@ -0,0 +1,103 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "ap_int.h"
+
+// Performance counters every accelerator exports over AXI-Lite as its
+// perf[] register array. They accumulate across runs and wrap at 2^32;
+// software reads them before and after a run and takes the difference.
+#define PERF_TOTAL_CYCLES 0         // Cycles from start to done
+#define PERF_BUSY_CYCLES 1          // Cycles in compute phases
+#define PERF_READ_BEATS 2           // AXI read data beats
+#define PERF_WRITE_BEATS 3          // AXI write data beats
+#define PERF_READ_STALL_CYCLES 4    // Cycles in read phases not moving a beat
+#define PERF_WRITE_STALL_CYCLES 5   // Cycles in write phases not moving a beat
+#define PERF_COUNTER_COUNT 6
+
+typedef ap_uint<32> perf_t;
+
+// Times the phases of one run against the free-running cycle counter wired
+// into the IP's cycle_count port (c_counter_binary on FCLK0 in the block
+// design). Beats are counted by the kernel where it issues them; whatever
+// part of a read or write phase did not move a beat is a stall.
+class PerfMonitor {
+private:
+    volatile perf_t *clock;
+    perf_t run_start;
+    perf_t phase_start;
+    perf_t busy_cycles;
+    perf_t read_cycles;
+    perf_t write_cycles;
+    perf_t read_beats;
+    perf_t write_beats;
+
+public:
+    PerfMonitor(volatile perf_t *cycle_count)
+        : clock(cycle_count), busy_cycles(0), read_cycles(0), write_cycles(0),
+          read_beats(0), write_beats(0) {
+        #pragma HLS INLINE
+        run_start = *clock;
+        phase_start = run_start;
+    }
+
+    void begin_phase() {
+        #pragma HLS INLINE
+        phase_start = *clock;
+    }
+
+    void end_read(perf_t beats) {
+        #pragma HLS INLINE
+        read_cycles += *clock - phase_start;
+        read_beats += beats;
+    }
+
+    void end_write(perf_t beats) {
+        #pragma HLS INLINE
+        write_cycles += *clock - phase_start;
+        write_beats += beats;
+    }
+
+    void end_compute() {
+        #pragma HLS INLINE
+        busy_cycles += *clock - phase_start;
+    }
+
+    // A pipelined loop that reads and writes in every iteration. The loop
+    // counts as compute; cycles beyond one per read beat are charged as
+    // read stalls.
+    void end_stream(perf_t reads, perf_t writes) {
+        #pragma HLS INLINE
+        perf_t cycles = *clock - phase_start;
+        busy_cycles += cycles;
+        read_cycles += cycles;
+        read_beats += reads;
+        write_cycles += writes;
+        write_beats += writes;
+    }
+
+    // Beats read by a process running alongside the timed phases (the conv
+    // block's prefetch): counted, but no cycles of their own
+    void add_reads(perf_t beats) {
+        #pragma HLS INLINE
+        read_beats += beats;
+    }
+
+    // Add this run to the running totals and copy them to the register array
+    void publish(perf_t totals[PERF_COUNTER_COUNT], perf_t perf[PERF_COUNTER_COUNT]) {
+        #pragma HLS INLINE
+        totals[PERF_TOTAL_CYCLES] += *clock - run_start;
+        totals[PERF_BUSY_CYCLES] += busy_cycles;
+        totals[PERF_READ_BEATS] += read_beats;
+        totals[PERF_WRITE_BEATS] += write_beats;
+        totals[PERF_READ_STALL_CYCLES] += (read_cycles > read_beats) ? (perf_t)(read_cycles - read_beats) : (perf_t)0;
+        totals[PERF_WRITE_STALL_CYCLES] += (write_cycles > write_beats) ? (perf_t)(write_cycles - write_beats) : (perf_t)0;
+
+        PUBLISH:
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            #pragma HLS UNROLL
+            perf[i] = totals[i];
+        }
+    }
+};
+
+#endif // PERF_COUNTERS_H
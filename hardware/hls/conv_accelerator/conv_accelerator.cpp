@@ -1,19 +1,79 @@
 #include "ap_int.h"
-#include "ap_fixed.h"
 #include "hls_stream.h"
+#include "hls_streamofblocks.h"
+#include "../common/perf_counters.h"
+#include "../common/axi_word.h"
+#include "../common/gap_average.h"
+#include "../../../models/configs/mobilenet_config.h"
 
-// Fixed-point data types for HLS
-typedef ap_fixed<16, 8> data_t;      // 16-bit fixed-point: 8 integer bits, 8 fractional bits
-typedef ap_fixed<16, 8> weight_t;    // Weight data type
-typedef ap_fixed<32, 16> acc_t;      // Accumulator type (wider to prevent overflow)
+// The host's quantized types (qint8_t, qint32_t), so tensors are used as
+// the host lays them out
+typedef ap_int<8> data_t;            // Feature maps
+typedef ap_int<8> weight_t;          // Weights
+typedef ap_int<32> bias_t;           // Biases, at the accumulator's scale
+typedef ap_int<32> acc_t;            // Accumulator
+
+// Back to int8 as CPUConvolution does: drop 8 fraction bits, saturate,
+// then the optional ReLU or ReLU6 (a clamp to [0, 6], like
+// CPUConvolution::relu6), so neither needs a pass of its own
+static data_t requantize(acc_t sum, bool relu, bool relu6) {
+    #pragma HLS INLINE
+    acc_t shifted = sum >> 8;
+    acc_t high = relu6 ? 6 : 127;
+    acc_t low = (relu || relu6) ? 0 : -128;
+    if (shifted > high) shifted = high;
+    if (shifted < low) shifted = low;
+    return (data_t)shifted;
+}
+
+// Two int8 products sharing the factor x from one DSP48 multiply. The
+// 25-bit port takes a * 2^16 + b, which fits for any int8 a and b, so the
+// product is a*x * 2^16 + b*x. b*x always fits a signed 16-bit field, so
+// the low 16 bits give it back exactly and the rest is a*x.
+#define PACK_SHIFT 16
+
+static void packed_mul(data_t x, weight_t a, weight_t b, acc_t &ax, acc_t &bx) {
+    #pragma HLS INLINE
+    ap_int<25> packed = ((ap_int<25>)a << PACK_SHIFT) + b;
+    ap_int<33> product = packed * x;
+    #pragma HLS BIND_OP variable=product op=mul impl=dsp
+    ap_int<PACK_SHIFT> low = product(PACK_SHIFT - 1, 0);
+    bx = low;
+    ax = (product - low) >> PACK_SHIFT;
+}
 
 // Configuration parameters
 #define MAX_KERNEL_SIZE 3
 #define MAX_CHANNELS 1024
-#define MAX_HEIGHT 224
-#define MAX_WIDTH 224
-#define PE_NUM 16                    // Number of parallel processing elements
-#define SIMD_FACTOR 8                // SIMD parallelism
+#define PE_NUM CONV_PE_NUM           // Output channels of the pointwise array
+#define SIMD_FACTOR CONV_SIMD_FACTOR // Input channels per pointwise PE per cycle
+
+// Conv modes (mode field of the CONFIG register)
+#define MODE_DENSE 0                 // Full k x k x in_c kernel per output channel
+#define MODE_DEPTHWISE 1             // One k x k kernel per channel, out_c == in_c
+#define MODE_POINTWISE 2             // 1x1 kernel, no window loops
+#define MODE_SEPARABLE 3             // 3x3 depthwise into pointwise, on chip in between
+
+// Program mode: layer descriptors of 16 words (ConvLayerDescriptor in
+// mobilenet_config.h), addresses in bytes from the pointer bases
+#define MAX_PROGRAM_LAYERS 64
+#define DESC_WORDS 16
+#define DESC_BEATS (DESC_WORDS / WORD_FIELDS)
+#define DESC_INPUT_ADDR 0
+#define DESC_OUTPUT_ADDR 1
+#define DESC_WEIGHT_ADDR 2
+#define DESC_BIAS_ADDR 3
+#define DESC_CONFIG 4                // kernel[31:24] stride[23:16] padding[15:8] prefetch[7]
+                                     // mid_relu6[6] mode[5:4] relu6[3] pool[2] mid_relu[1] relu[0]
+#define DESC_IN_HEIGHT 5
+#define DESC_IN_WIDTH 6
+#define DESC_IN_CHANNELS 7
+#define DESC_OUT_CHANNELS 8
+#define DESC_OUT_STRIDE 9
+#define DESC_PW_WEIGHT_ADDR 10
+#define DESC_PW_BIAS_ADDR 11
+#define DESC_POOL_RECIP 12
+#define DESC_BATCH 13
 
 // Convolution layer configuration structure
 struct ConvConfig {
@@ -24,188 +84,1305 @@ struct ConvConfig {
     int kernel_size;
     int stride;
     int padding;
+    int mode;
+    int output_stride;           // Channels between output pixels (output_channels unless
+                                 // this run fills a slice of a wider layer)
     bool use_relu;
+    bool use_relu6;              // Clamp the output to [0, 6] instead
+    bool mid_relu;               // Separable mode: ReLU on the depthwise output
+    bool mid_relu6;              // Separable mode: ReLU6 on the depthwise output
+    bool pool;                   // Write the output's average over the map instead
+                                 // (streamed pointwise and separable layers only)
+    unsigned int pool_reciprocal;    // GAP_RECIPROCAL(output pixels)
+    int batch;                   // Images, their maps back to back (0 = one)
 };
 
-// Line buffer for sliding window
-template<int CHANNELS, int WIDTH, int KERNEL_SIZE>
+// Line buffer for sliding window: the last KERNEL_SIZE-1 input rows,
+// LENGTH elements each (a row's columns times its channels). Elements are
+// pushed in row order, LANES at a time; each push returns the column of
+// KERNEL_SIZE values ending at the new ones and moves the rows up.
+template<int LENGTH, int KERNEL_SIZE, int LANES>
 class LineBuffer {
 private:
-    data_t buffer[KERNEL_SIZE-1][WIDTH][CHANNELS];
+    data_t buffer[KERNEL_SIZE-1][LENGTH];
     
 public:
-    void shift_up() {
+    LineBuffer() {
+        #pragma HLS ARRAY_PARTITION variable=buffer complete dim=1
+        #pragma HLS ARRAY_PARTITION variable=buffer cyclic factor=LANES dim=2
+    }
+    
+    // pos is the first element's index in the row, a multiple of LANES
+    void shift_in(int pos, const data_t in[LANES], data_t column[KERNEL_SIZE][LANES]) {
         #pragma HLS INLINE
-        for (int k = 0; k < KERNEL_SIZE-2; k++) {
+        for (int l = 0; l < LANES; l++) {
             #pragma HLS UNROLL
-            for (int w = 0; w < WIDTH; w++) {
-                for (int c = 0; c < CHANNELS; c++) {
-                    #pragma HLS PIPELINE
-                    buffer[k][w][c] = buffer[k+1][w][c];
-                }
+            for (int r = 0; r < KERNEL_SIZE-1; r++) {
+                #pragma HLS UNROLL
+                column[r][l] = buffer[r][pos + l];
             }
+            column[KERNEL_SIZE-1][l] = in[l];
+            for (int r = 0; r < KERNEL_SIZE-2; r++) {
+                #pragma HLS UNROLL
+                buffer[r][pos + l] = buffer[r+1][pos + l];
+            }
+            buffer[KERNEL_SIZE-2][pos + l] = in[l];
         }
     }
+};
+
+// Tile sizes (TILE_HEIGHT x TILE_WIDTH outputs by TILE_CHANNELS channels)
+// and the input window such a tile needs at the largest stride and kernel
+#define MAX_STRIDE 2
+#define IN_TILE_HEIGHT ((TILE_HEIGHT - 1) * MAX_STRIDE + MAX_KERNEL_SIZE)
+#define IN_TILE_WIDTH ((TILE_WIDTH - 1) * MAX_STRIDE + MAX_KERNEL_SIZE)
+
+// Blocks passed between the dataflow stages. Each stream_of_blocks holds
+// two, so a stage fills one while the next stage drains the other.
+typedef data_t InputTile[IN_TILE_HEIGHT][IN_TILE_WIDTH][TILE_CHANNELS];
+typedef weight_t WeightTile[TILE_CHANNELS][TILE_CHANNELS][MAX_KERNEL_SIZE][MAX_KERNEL_SIZE];
+typedef acc_t OutputTile[TILE_HEIGHT][TILE_WIDTH][TILE_CHANNELS];
+
+// How a layer divides into tiles. Each output tile takes in_groups input
+// tiles, one per TILE_CHANNELS input channels (one in depthwise mode,
+// where output channel group g reads input channel group g). A batch
+// repeats every tile position once per image.
+struct TileGrid {
+    int output_height;
+    int output_width;
+    int rows;
+    int cols;
+    int out_groups;
+    int in_groups;
+    int images;
+};
+
+static TileGrid tile_grid(const ConvConfig &config) {
+    #pragma HLS INLINE
+    TileGrid grid;
+    grid.output_height = (config.input_height + 2 * config.padding - config.kernel_size) / config.stride + 1;
+    grid.output_width = (config.input_width + 2 * config.padding - config.kernel_size) / config.stride + 1;
+    grid.rows = (grid.output_height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    grid.cols = (grid.output_width + TILE_WIDTH - 1) / TILE_WIDTH;
+    grid.out_groups = (config.output_channels + TILE_CHANNELS - 1) / TILE_CHANNELS;
+    grid.in_groups = (config.mode == MODE_DEPTHWISE)
+        ? 1 : (config.input_channels + TILE_CHANNELS - 1) / TILE_CHANNELS;
+    grid.images = config.batch > 1 ? config.batch : 1;
+    return grid;
+}
+
+// Stage 1: fetch the input window and weights of each tile step. Taps
+// outside the image and channels beyond the layer's are zero-filled. A
+// tile's rows seldom start on a word, so each run of consecutive elements
+// (a tile row when one group holds all the layer's channels, else one
+// pixel's share of the group; one output channel's kernel) is read as a
+// burst over the words it spans and unpacked one element per cycle. In a
+// batch each image's tile follows at the same position; with one input
+// group the weight tile is the same for all of them and loads once.
+void load_tiles(
+    const word_t *input,
+    const word_t *weights,
+    ConvConfig config,
+    TileGrid grid,
+    hls::stream_of_blocks<InputTile> &input_tiles,
+    hls::stream_of_blocks<WeightTile> &weight_tiles,
+    perf_t &read_beats
+) {
+    bool depthwise = config.mode == MODE_DEPTHWISE;
+    int k = config.kernel_size;
+    int taps = k * k;
+    int in_tile_h = (TILE_HEIGHT - 1) * config.stride + k;
+    int in_tile_w = (TILE_WIDTH - 1) * config.stride + k;
+    int weights_per_output = depthwise ? 1 : TILE_CHANNELS;
+    int image_size = config.input_height * config.input_width * config.input_channels;
+    perf_t beats = 0;
     
-    void insert_line(data_t line[WIDTH][CHANNELS]) {
-        #pragma HLS INLINE
-        for (int w = 0; w < WIDTH; w++) {
-            for (int c = 0; c < CHANNELS; c++) {
-                #pragma HLS PIPELINE
-                buffer[KERNEL_SIZE-2][w][c] = line[w][c];
+    LOAD_ROWS:
+    for (int tr = 0; tr < grid.rows; tr++) {
+        LOAD_COLS:
+        for (int tc = 0; tc < grid.cols; tc++) {
+            LOAD_OUT_GROUPS:
+            for (int og = 0; og < grid.out_groups; og++) {
+                LOAD_IMAGES:
+                for (int n = 0; n < grid.images; n++) {
+                    LOAD_IN_GROUPS:
+                    for (int ig = 0; ig < grid.in_groups; ig++) {
+                        int ic_base = (depthwise ? og : ig) * TILE_CHANNELS;
+                        int oc_base = og * TILE_CHANNELS;
+                        int ih_base = tr * TILE_HEIGHT * config.stride - config.padding;
+                        int iw_base = tc * TILE_WIDTH * config.stride - config.padding;
+                        int group_channels = config.input_channels - ic_base;
+                        if (group_channels > TILE_CHANNELS) group_channels = TILE_CHANNELS;
+                        
+                        // Tile columns inside the image
+                        int c_first = iw_base < 0 ? -iw_base : 0;
+                        int c_last = config.input_width - iw_base;
+                        if (c_last > in_tile_w) c_last = in_tile_w;
+                        bool row_runs = group_channels == config.input_channels;
+                        int runs = row_runs ? 1 : c_last - c_first;
+                        int run_length = row_runs ? (c_last - c_first) * group_channels : group_channels;
+                        
+                        hls::write_lock<InputTile> in(input_tiles);
+                        CLEAR_INPUT:
+                        for (int r = 0; r < in_tile_h; r++) {
+                            for (int c = 0; c < in_tile_w; c++) {
+                                #pragma HLS PIPELINE II=1
+                                for (int ch = 0; ch < TILE_CHANNELS; ch++) {
+                                    #pragma HLS UNROLL
+                                    in[r][c][ch] = 0;
+                                }
+                            }
+                        }
+                        
+                        LOAD_INPUT:
+                        for (int r = 0; r < in_tile_h; r++) {
+                            int ih = ih_base + r;
+                            if (ih < 0 || ih >= config.input_height) continue;
+                            for (int run = 0; run < runs; run++) {
+                                int first = n * image_size +
+                                            (ih * config.input_width + iw_base + c_first + run) *
+                                            config.input_channels + ic_base;
+                                int c = c_first + run, ch = 0;
+                                word_t word;
+                                LOAD_RUN:
+                                for (int j = 0; j < run_length; j++) {
+                                    #pragma HLS PIPELINE II=1
+                                    int e = first + j;
+                                    if (j == 0 || e % WORD_ELEMS == 0) {
+                                        word = input[e / WORD_ELEMS];
+                                        beats++;
+                                    }
+                                    in[r][c][ch] = word_element(word, e % WORD_ELEMS);
+                                    if (++ch == group_channels) {
+                                        ch = 0;
+                                        c++;
+                                    }
+                                }
+                            }
+                        }
+                        
+                        // The batch's later images reuse the first one's weight tile
+                        if (n > 0 && grid.in_groups == 1) {
+                            continue;
+                        }
+                        
+                        // A depthwise kernel is [c][k][k] in DDR and lands in w[c][0]
+                        int kernel_length = (depthwise ? 1 : group_channels) * taps;
+                        hls::write_lock<WeightTile> w(weight_tiles);
+                        LOAD_WEIGHTS:
+                        for (int oc = 0; oc < TILE_CHANNELS; oc++) {
+                            int o = oc_base + oc;
+                            int first = depthwise ? o * taps : (o * config.input_channels + ic_base) * taps;
+                            int ic = 0, kh = 0, kw = 0;
+                            word_t word;
+                            LOAD_KERNEL:
+                            for (int j = 0; j < weights_per_output * taps; j++) {
+                                #pragma HLS PIPELINE II=1
+                                int e = first + j;
+                                weight_t value = 0;
+                                if (o < config.output_channels && j < kernel_length) {
+                                    if (j == 0 || e % WORD_ELEMS == 0) {
+                                        word = weights[e / WORD_ELEMS];
+                                        beats++;
+                                    }
+                                    value = word_element(word, e % WORD_ELEMS);
+                                }
+                                w[oc][ic][kh][kw] = value;
+                                
+                                // kw fastest, then kh, then the input channel
+                                if (++kw == k) {
+                                    kw = 0;
+                                    if (++kh == k) {
+                                        kh = 0;
+                                        ic++;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
             }
         }
     }
+    read_beats = beats;
+}
+
+// Add input group ig's input tile times its weight tile into an output
+// tile. All TILE_CHANNELS output channels advance together: every cycle
+// one input tap is broadcast to the lanes (its own channel per lane in
+// depthwise mode), each multiplying it by its own weight. Templated on
+// the block locks, which index like the tiles they hold.
+template<typename In, typename W, typename Acc>
+static void accumulate_tile(const ConvConfig &config, int ig, In &in, W &w, Acc &acc) {
+    #pragma HLS INLINE
+    bool depthwise = config.mode == MODE_DEPTHWISE;
+    int k = config.kernel_size;
     
-    data_t get(int row, int col, int ch) {
-        #pragma HLS INLINE
-        return buffer[row][col][ch];
+    // Only the channels the layer has, so a 3-channel first layer
+    // does not spend 32 cycles per tap
+    int channels = depthwise ? 1 : config.input_channels - ig * TILE_CHANNELS;
+    if (channels > TILE_CHANNELS) channels = TILE_CHANNELS;
+    int reduce_length = channels * k * k;
+    
+    COMPUTE_PIXELS:
+    for (int p = 0; p < TILE_HEIGHT * TILE_WIDTH; p++) {
+        int oh = p / TILE_WIDTH;
+        int ow = p % TILE_WIDTH;
+        int r_base = oh * config.stride;
+        int c_base = ow * config.stride;
+        
+        acc_t sum[TILE_CHANNELS];
+        #pragma HLS ARRAY_PARTITION variable=sum complete
+        INIT_LANES:
+        for (int oc = 0; oc < TILE_CHANNELS; oc++) {
+            #pragma HLS UNROLL
+            sum[oc] = (ig == 0) ? (acc_t)0 : acc[oh][ow][oc];
+        }
+        
+        int ic = 0, kh = 0, kw = 0;
+        REDUCE:
+        for (int i = 0; i < reduce_length; i++) {
+            #pragma HLS PIPELINE II=1
+            #pragma HLS LOOP_TRIPCOUNT min=1 max=TILE_CHANNELS*MAX_KERNEL_SIZE*MAX_KERNEL_SIZE
+            data_t tap = in[r_base + kh][c_base + kw][ic];
+            LANES:
+            for (int oc = 0; oc < TILE_CHANNELS; oc++) {
+                #pragma HLS UNROLL
+                data_t x = depthwise ? in[r_base + kh][c_base + kw][oc] : tap;
+                sum[oc] += x * w[oc][ic][kh][kw];
+            }
+            
+            // kw fastest, then kh, then the input channel
+            if (++kw == k) {
+                kw = 0;
+                if (++kh == k) {
+                    kh = 0;
+                    ic++;
+                }
+            }
+        }
+        
+        STORE_LANES:
+        for (int oc = 0; oc < TILE_CHANNELS; oc++) {
+            #pragma HLS UNROLL
+            acc[oh][ow][oc] = sum[oc];
+        }
     }
-};
+}
 
-// Convolution computation kernel
-void conv2d_compute(
-    data_t input_window[MAX_KERNEL_SIZE][MAX_KERNEL_SIZE][MAX_CHANNELS],
-    weight_t weights[MAX_CHANNELS][MAX_CHANNELS][MAX_KERNEL_SIZE][MAX_KERNEL_SIZE],
-    data_t bias[MAX_CHANNELS],
-    data_t output[MAX_CHANNELS],
-    ConvConfig config
+// Stage 2: accumulate each output tile over its input tiles. With one
+// input group, a batch's images share the weight tile, which stays locked
+// while each image's tile goes through.
+void compute_tiles(
+    ConvConfig config,
+    TileGrid grid,
+    hls::stream_of_blocks<InputTile> &input_tiles,
+    hls::stream_of_blocks<WeightTile> &weight_tiles,
+    hls::stream_of_blocks<OutputTile> &output_tiles
 ) {
-    #pragma HLS INLINE off
-    
-    // Initialize accumulators
-    acc_t acc[MAX_CHANNELS];
-    #pragma HLS ARRAY_PARTITION variable=acc complete
+    COMPUTE_TILES:
+    for (int t = 0; t < grid.rows * grid.cols * grid.out_groups; t++) {
+        if (grid.in_groups == 1) {
+            hls::read_lock<WeightTile> w(weight_tiles);
+            COMPUTE_SHARED:
+            for (int n = 0; n < grid.images; n++) {
+                hls::write_lock<OutputTile> acc(output_tiles);
+                hls::read_lock<InputTile> in(input_tiles);
+                accumulate_tile(config, 0, in, w, acc);
+            }
+            continue;
+        }
+        
+        COMPUTE_IMAGES:
+        for (int n = 0; n < grid.images; n++) {
+            hls::write_lock<OutputTile> acc(output_tiles);
+            COMPUTE_IN_GROUPS:
+            for (int ig = 0; ig < grid.in_groups; ig++) {
+                hls::read_lock<InputTile> in(input_tiles);
+                hls::read_lock<WeightTile> w(weight_tiles);
+                accumulate_tile(config, ig, in, w, acc);
+            }
+        }
+    }
+}
+
+// Stage 3: add bias, apply ReLU and write the part of each output tile
+// that lies inside the layer, a word of channels per cycle
+void store_tiles(
+    const word_t *bias,
+    word_t *output,
+    ConvConfig config,
+    TileGrid grid,
+    hls::stream_of_blocks<OutputTile> &output_tiles,
+    perf_t &read_beats,
+    perf_t &write_beats
+) {
+    bias_t bias_buffer[MAX_CHANNELS];
+    #pragma HLS ARRAY_PARTITION variable=bias_buffer cyclic factor=WORD_ELEMS
+    int output_stride = config.output_stride ? config.output_stride : config.output_channels;
+    int bias_words = config.output_channels / WORD_FIELDS;
     
-    for (int oc = 0; oc < config.output_channels; oc++) {
-        #pragma HLS PIPELINE
-        acc[oc] = bias[oc];
+    LOAD_BIAS:
+    for (int i = 0; i < bias_words; i++) {
+        #pragma HLS PIPELINE II=1
+        word_t word = bias[i];
+        for (int f = 0; f < WORD_FIELDS; f++) {
+            #pragma HLS UNROLL
+            bias_buffer[i * WORD_FIELDS + f] = (bias_t)word_field(word, f);
+        }
     }
+    read_beats = bias_words;
+    perf_t beats = 0;
     
-    // Perform convolution
-    for (int oc = 0; oc < config.output_channels; oc++) {
-        for (int ic = 0; ic < config.input_channels; ic++) {
-            for (int kh = 0; kh < config.kernel_size; kh++) {
-                for (int kw = 0; kw < config.kernel_size; kw++) {
-                    #pragma HLS PIPELINE II=1
-                    acc[oc] += input_window[kh][kw][ic] * weights[oc][ic][kh][kw];
+    STORE_ROWS:
+    for (int tr = 0; tr < grid.rows; tr++) {
+        STORE_COLS:
+        for (int tc = 0; tc < grid.cols; tc++) {
+            STORE_OUT_GROUPS:
+            for (int og = 0; og < grid.out_groups; og++) {
+                STORE_IMAGES:
+                for (int n = 0; n < grid.images; n++) {
+                    hls::read_lock<OutputTile> acc(output_tiles);
+                    int image_base = n * grid.output_height * grid.output_width * output_stride;
+                    
+                    STORE_OUTPUT:
+                    for (int p = 0; p < TILE_HEIGHT * TILE_WIDTH; p++) {
+                        for (int wd = 0; wd < TILE_CHANNELS / WORD_ELEMS; wd++) {
+                            #pragma HLS PIPELINE II=1
+                            int oh = tr * TILE_HEIGHT + p / TILE_WIDTH;
+                            int ow = tc * TILE_WIDTH + p % TILE_WIDTH;
+                            int o = og * TILE_CHANNELS + wd * WORD_ELEMS;
+                            if (oh < grid.output_height && ow < grid.output_width && o < config.output_channels) {
+                                word_t word;
+                                for (int l = 0; l < WORD_ELEMS; l++) {
+                                    #pragma HLS UNROLL
+                                    acc_t sum = acc[p / TILE_WIDTH][p % TILE_WIDTH][wd * WORD_ELEMS + l] +
+                                                bias_buffer[o + l];
+                                    set_word_element(word, l, requantize(sum, config.use_relu, config.use_relu6));
+                                }
+                                output[(image_base + (oh * grid.output_width + ow) * output_stride + o) / WORD_ELEMS] = word;
+                                beats++;
+                            }
+                        }
+                    }
                 }
             }
         }
     }
+    write_beats = beats;
+}
+
+// One convolution layer as a three-stage dataflow pipeline: while tile k
+// computes, tile k+1 loads and tile k-1 is written back. On-chip storage
+// is two blocks per stream instead of whole feature maps and weight sets:
+// input tiles 2 x 32 banks of 29 x 29 x 8 bit and accumulators 2 x 32
+// banks of 196 x 32 bit, one BRAM18 each (64 BRAM36), with the weight
+// tiles in LUTRAM. The 32 lanes take 32 DSP48s; in depthwise mode each
+// multiplies its own tap, so they are not packed.
+void conv_tiled(
+    const word_t *input,
+    const word_t *weights,
+    const word_t *bias,
+    word_t *output,
+    ConvConfig config,
+    TileGrid grid,
+    perf_t &read_beats,
+    perf_t &bias_beats,
+    perf_t &write_beats
+) {
+    #pragma HLS DATAFLOW
+    
+    hls::stream_of_blocks<InputTile> input_tiles;
+    #pragma HLS ARRAY_PARTITION variable=input_tiles complete dim=3
+    hls::stream_of_blocks<WeightTile> weight_tiles;
+    #pragma HLS ARRAY_PARTITION variable=weight_tiles complete dim=1
+    #pragma HLS BIND_STORAGE variable=weight_tiles type=ram_2p impl=lutram
+    hls::stream_of_blocks<OutputTile> output_tiles;
+    #pragma HLS ARRAY_PARTITION variable=output_tiles complete dim=3
+    
+    load_tiles(input, weights, config, grid, input_tiles, weight_tiles, read_beats);
+    compute_tiles(config, grid, input_tiles, weight_tiles, output_tiles);
+    store_tiles(bias, output, config, grid, output_tiles, bias_beats, write_beats);
+}
+
+// Streaming engines. Depthwise, pointwise and separable layers share one
+// dataflow pipeline, one instance of each stage whatever the mode:
+//
+//   dw_read -> dw_window -> pw_gather -> pw_compute -> pw_store
+//                                 pw_load_weights --^
+//
+// dw_read streams the input in NHWC order, a port word of channels at a
+// time, and dw_window runs the 3x3 depthwise windows over it (a pointwise
+// layer passes straight through). Words travel packed between the stages.
+// pw_gather packs the result into pixel blocks for the pointwise array; a
+// depthwise layer's outputs go on to pw_store unchanged. In a separable
+// block the depthwise output, ReLU'd and requantized to data_t, only ever
+// sits in the FIFO between the halves: the block reads its input and
+// writes its output, nothing else touches DDR.
+
+// Depthwise: 3x3 windows through line buffers, so each input element is
+// read from DDR once rather than once per window it falls in. Padded
+// input rows are pushed DW_LANES channels at a time, DW_STEPS pushes per
+// word. The line buffers return each push's column of three rows and a
+// per-channel history of the two previous columns completes the window
+// (in NHWC the window slides per channel, so its registers are a small
+// memory indexed by channel). Every push that completes a window on the
+// stride grid yields DW_LANES outputs: one output pixel group per cycle.
+#define DW_LANES CONV_DW_LANES
+#define DW_STEPS (WORD_ELEMS / DW_LANES)
+#define DW_LINE_LENGTH CONV_DW_LINE_LENGTH
+
+// Pointwise: an output-stationary PE_NUM x SIMD_FACTOR array. Pixels go
+// through in blocks of PW_PIXELS, each held on chip with all its input
+// channels while the output channels stream through the array in groups
+// of PE_NUM. Each PE owns one output channel's sums for the block; every
+// cycle the SIMD_FACTOR input channels of one pixel are broadcast to all
+// PEs, each multiplying them by its own weights, so the array does
+// PE_NUM * SIMD_FACTOR MACs per cycle. The broadcast input is the factor
+// two neighbouring PEs share, so each pair multiplies on one DSP48
+// (packed_mul).
+#define PW_PIXELS CONV_PW_PIXELS
+#define PE_WORDS (PE_NUM / WORD_ELEMS)  // Output words of one pixel per group
+
+// Depth of the array's multiply-add pipeline. Blocks are padded to at
+// least this many pixels so a sum is written back before it is read again.
+#define PW_PIPELINE_DEPTH 8
+
+typedef data_t PwInputBlock[PW_PIXELS][MAX_CHANNELS];
+typedef weight_t PwWeightGroup[PE_NUM][MAX_CHANNELS];
+typedef acc_t PwOutputGroup[PW_PIXELS][PE_NUM];
+
+#ifndef __SYNTHESIS__
+// Cycles spent in the array, counted in C simulation for the testbench
+unsigned long long pw_array_cycles = 0;
+#endif
+
+// How a pointwise layer divides into pixel blocks and channel groups
+struct PwGrid {
+    int pixels;
+    int blocks;
+    int groups;                 // Output channel groups of PE_NUM
+    int steps;                  // Input channel steps of SIMD_FACTOR
+};
+
+// What the streaming pipeline covers for a layer
+struct StreamGrid {
+    int padded_height;          // Input rows and columns read, padding included
+    int padded_width;
+    int words;                  // Input words per pixel
+    int output_pixels;          // Per image
+    int images;
+    PwGrid pw;                  // No blocks for a depthwise layer
+};
+
+static StreamGrid stream_grid(const ConvConfig &config, const TileGrid &tiles) {
+    #pragma HLS INLINE
+    StreamGrid grid;
+    bool pointwise = config.mode == MODE_POINTWISE;
+    grid.padded_height = pointwise ? config.input_height
+                                   : (tiles.output_height - 1) * config.stride + MAX_KERNEL_SIZE;
+    grid.padded_width = pointwise ? config.input_width
+                                  : (tiles.output_width - 1) * config.stride + MAX_KERNEL_SIZE;
+    grid.words = config.input_channels / WORD_ELEMS;
+    grid.output_pixels = tiles.output_height * tiles.output_width;
+    grid.images = tiles.images;
+    
+    // A batch's images follow each other through the stream, so a block
+    // can hold the last pixels of one and the first of the next
+    grid.pw.pixels = (config.mode == MODE_DEPTHWISE) ? 0 : grid.images * grid.output_pixels;
+    grid.pw.blocks = (grid.pw.pixels + PW_PIXELS - 1) / PW_PIXELS;
+    grid.pw.groups = (config.output_channels + PE_NUM - 1) / PE_NUM;
+    grid.pw.steps = (config.input_channels + SIMD_FACTOR - 1) / SIMD_FACTOR;
+    return grid;
+}
+
+static bool stream_supported(const ConvConfig &config, const TileGrid &tiles) {
+    #pragma HLS INLINE
+    if (config.mode == MODE_DENSE || config.input_channels % WORD_ELEMS != 0) {
+        return false;
+    }
+    if (config.mode == MODE_POINTWISE) {
+        return config.kernel_size == 1 && config.stride == 1 && config.padding == 0;
+    }
+    int padded_width = (tiles.output_width - 1) * config.stride + MAX_KERNEL_SIZE;
+    return config.kernel_size == MAX_KERNEL_SIZE && (config.stride == 1 || config.stride == 2) &&
+           padded_width * config.input_channels <= DW_LINE_LENGTH;
+}
+
+// Pixels in pointwise block b, and the rows the array runs for it
+static int pw_block_pixels(const PwGrid &grid, int b) {
+    #pragma HLS INLINE
+    int left = grid.pixels - b * PW_PIXELS;
+    return left < PW_PIXELS ? left : PW_PIXELS;
+}
+
+static int pw_block_rows(const PwGrid &grid, int b) {
+    #pragma HLS INLINE
+    int pixels = pw_block_pixels(grid, b);
+    return pixels < PW_PIPELINE_DEPTH ? PW_PIPELINE_DEPTH : pixels;
+}
+
+// The input, one word per pixel and channel group, zero in the padding.
+// Each input row's words are consecutive, so a row is one burst. A
+// batch's images are read one after the other.
+void dw_read(
+    const word_t *input,
+    ConvConfig config,
+    StreamGrid grid,
+    hls::stream<word_t> &pixels,
+    perf_t &read_beats
+) {
+    int image_words = config.input_height * config.input_width * grid.words;
+    perf_t beats = 0;
     
-    // Apply activation and write output
-    for (int oc = 0; oc < config.output_channels; oc++) {
-        #pragma HLS PIPELINE
-        data_t result = (data_t)acc[oc];
-        if (config.use_relu && result < 0) {
-            result = 0;
+    DW_READ_IMAGES:
+    for (int n = 0; n < grid.images; n++) {
+        DW_READ:
+        for (int r = 0; r < grid.padded_height; r++) {
+            for (int c = 0; c < grid.padded_width; c++) {
+                for (int g = 0; g < grid.words; g++) {
+                    #pragma HLS PIPELINE II=1
+                    int ih = r - config.padding;
+                    int iw = c - config.padding;
+                    word_t word = 0;
+                    if (ih >= 0 && ih < config.input_height && iw >= 0 && iw < config.input_width) {
+                        word = input[n * image_words + (ih * config.input_width + iw) * grid.words + g];
+                        beats++;
+                    }
+                    pixels.write(word);
+                }
+            }
         }
-        output[oc] = result;
     }
+    read_beats = beats;
 }
 
-// Main convolution accelerator function
-void conv_accelerator(
-    data_t *input,           // Input feature map (DDR)
-    weight_t *weights,       // Convolution weights (DDR)
-    data_t *bias,            // Bias values (DDR)
-    data_t *output,          // Output feature map (DDR)
-    ConvConfig config        // Layer configuration
-) {
-    #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem0 depth=50176
-    #pragma HLS INTERFACE m_axi port=weights offset=slave bundle=gmem1 depth=589824
-    #pragma HLS INTERFACE m_axi port=bias offset=slave bundle=gmem2 depth=1024
-    #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem3 depth=50176
-    #pragma HLS INTERFACE s_axilite port=config bundle=control
-    #pragma HLS INTERFACE s_axilite port=return bundle=control
+void dw_window(
+    const weight_t weights[MAX_KERNEL_SIZE * MAX_KERNEL_SIZE][MAX_CHANNELS],
+    const bias_t bias[MAX_CHANNELS],
+    ConvConfig config,
+    StreamGrid grid,
+    hls::stream<word_t> &pixels,
+    hls::stream<word_t> &results
+) {
+    LineBuffer<DW_LINE_LENGTH, MAX_KERNEL_SIZE, DW_LANES> lines;
+    data_t history[MAX_KERNEL_SIZE][MAX_KERNEL_SIZE - 1][MAX_CHANNELS];
+    #pragma HLS ARRAY_PARTITION variable=history complete dim=1
+    #pragma HLS ARRAY_PARTITION variable=history complete dim=2
+    #pragma HLS ARRAY_PARTITION variable=history cyclic factor=DW_LANES dim=3
+    #pragma HLS BIND_STORAGE variable=history type=ram_2p impl=lutram
     
-    // Local buffers for tiling
-    data_t input_buffer[MAX_HEIGHT][MAX_WIDTH][MAX_CHANNELS];
-    #pragma HLS ARRAY_PARTITION variable=input_buffer cyclic factor=16 dim=3
+    if (config.mode == MODE_POINTWISE) {
+        DW_BYPASS:
+        for (int i = 0; i < grid.images * grid.padded_height * grid.padded_width * grid.words; i++) {
+            #pragma HLS PIPELINE II=1
+            results.write(pixels.read());
+        }
+        return;
+    }
     
-    weight_t weight_buffer[MAX_CHANNELS][MAX_CHANNELS][MAX_KERNEL_SIZE][MAX_KERNEL_SIZE];
-    #pragma HLS ARRAY_PARTITION variable=weight_buffer cyclic factor=16 dim=1
+    bool relu = (config.mode == MODE_SEPARABLE) ? config.mid_relu : config.use_relu;
+    bool relu6 = (config.mode == MODE_SEPARABLE) ? config.mid_relu6 : config.use_relu6;
+    word_t in, out;
     
-    data_t bias_buffer[MAX_CHANNELS];
-    #pragma HLS ARRAY_PARTITION variable=bias_buffer complete
+    // A batch's images follow on row after row. Nothing is cleared between
+    // them: a window only ends once all its rows are the new image's.
+    DW_WINDOW:
+    for (int row = 0; row < grid.images * grid.padded_height; row++) {
+        int r = row % grid.padded_height;
+        for (int c = 0; c < grid.padded_width; c++) {
+            for (int i = 0; i < grid.words * DW_STEPS; i++) {
+                #pragma HLS PIPELINE II=1
+                int g = i / DW_STEPS;
+                int step = i % DW_STEPS;
+                if (step == 0) {
+                    in = pixels.read();
+                }
+                
+                data_t lanes[DW_LANES];
+                #pragma HLS ARRAY_PARTITION variable=lanes complete
+                for (int l = 0; l < DW_LANES; l++) {
+                    #pragma HLS UNROLL
+                    lanes[l] = word_element(in, step * DW_LANES + l);
+                }
+                data_t column[MAX_KERNEL_SIZE][DW_LANES];
+                #pragma HLS ARRAY_PARTITION variable=column complete dim=0
+                lines.shift_in((c * grid.words + g) * WORD_ELEMS + step * DW_LANES, lanes, column);
+                
+                // A window ends here if it starts on the stride grid
+                int top = r - (MAX_KERNEL_SIZE - 1);
+                int left = c - (MAX_KERNEL_SIZE - 1);
+                bool on_grid = top >= 0 && left >= 0 &&
+                               (config.stride == 1 || ((top & 1) == 0 && (left & 1) == 0));
+                
+                DW_LANES_LOOP:
+                for (int l = 0; l < DW_LANES; l++) {
+                    #pragma HLS UNROLL
+                    int ch = g * WORD_ELEMS + step * DW_LANES + l;
+                    acc_t sum = bias[ch];
+                    DW_TAPS:
+                    for (int kh = 0; kh < MAX_KERNEL_SIZE; kh++) {
+                        #pragma HLS UNROLL
+                        int tap = kh * MAX_KERNEL_SIZE;
+                        sum += history[kh][0][ch] * weights[tap][ch] +
+                               history[kh][1][ch] * weights[tap + 1][ch] +
+                               column[kh][l] * weights[tap + 2][ch];
+                        history[kh][0][ch] = history[kh][1][ch];
+                        history[kh][1][ch] = column[kh][l];
+                    }
+                    set_word_element(out, step * DW_LANES + l, requantize(sum, relu, relu6));
+                }
+                if (step == DW_STEPS - 1 && on_grid) {
+                    results.write(out);
+                }
+            }
+        }
+    }
+}
+
+// Unpack the words into pointwise blocks, padding rows and channels with
+// zeros, or pass a depthwise layer's outputs on to the store stage
+void pw_gather(
+    ConvConfig config,
+    StreamGrid grid,
+    hls::stream<word_t> &words,
+    hls::stream_of_blocks<PwInputBlock> &input_blocks,
+    hls::stream<word_t> &passthrough
+) {
+    if (config.mode == MODE_DEPTHWISE) {
+        DW_PASS:
+        for (int i = 0; i < grid.images * grid.output_pixels * grid.words; i++) {
+            #pragma HLS PIPELINE II=1
+            passthrough.write(words.read());
+        }
+        return;
+    }
     
-    // Load weights and biases (reused across all output pixels)
-    LOAD_WEIGHTS:
-    for (int oc = 0; oc < config.output_channels; oc++) {
-        for (int ic = 0; ic < config.input_channels; ic++) {
-            for (int kh = 0; kh < config.kernel_size; kh++) {
-                for (int kw = 0; kw < config.kernel_size; kw++) {
-                    #pragma HLS PIPELINE II=1
-                    int idx = ((oc * config.input_channels + ic) * config.kernel_size + kh) * config.kernel_size + kw;
-                    weight_buffer[oc][ic][kh][kw] = weights[idx];
+    int in_padded = grid.pw.steps * SIMD_FACTOR;
+    PW_GATHER_BLOCKS:
+    for (int b = 0; b < grid.pw.blocks; b++) {
+        int pixels = pw_block_pixels(grid.pw, b);
+        int rows = pw_block_rows(grid.pw, b);
+        hls::write_lock<PwInputBlock> in(input_blocks);
+        PW_GATHER:
+        for (int p = 0; p < rows; p++) {
+            for (int ic = 0; ic < in_padded; ic += WORD_ELEMS) {
+                #pragma HLS PIPELINE II=1
+                #pragma HLS LOOP_TRIPCOUNT min=SIMD_FACTOR/WORD_ELEMS max=MAX_CHANNELS/WORD_ELEMS
+                word_t word = 0;
+                if (p < pixels && ic < config.input_channels) {
+                    word = words.read();
+                }
+                for (int l = 0; l < WORD_ELEMS; l++) {
+                    #pragma HLS UNROLL
+                    in[p][ic + l] = word_element(word, l);
                 }
             }
         }
     }
+}
+
+// Weights of each output channel group, once per block, zero beyond the
+// layer's channels. A group's rows follow each other in DDR, so a group
+// is one burst of a word per cycle. A separable block's come from
+// pw_weights.
+void pw_load_weights(
+    const word_t *weights,
+    const word_t *pw_weights,
+    ConvConfig config,
+    StreamGrid grid,
+    hls::stream_of_blocks<PwWeightGroup> &weight_groups,
+    perf_t &read_beats
+) {
+    bool separable = config.mode == MODE_SEPARABLE;
+    int in_padded = grid.pw.steps * SIMD_FACTOR;
+    perf_t beats = 0;
     
-    LOAD_BIAS:
-    for (int oc = 0; oc < config.output_channels; oc++) {
-        #pragma HLS PIPELINE
-        bias_buffer[oc] = bias[oc];
+    PW_WEIGHT_GROUPS:
+    for (int i = 0; i < grid.pw.blocks * grid.pw.groups; i++) {
+        int g = i % grid.pw.groups;
+        hls::write_lock<PwWeightGroup> w(weight_groups);
+        PW_LOAD_WEIGHTS:
+        for (int pe = 0; pe < PE_NUM; pe++) {
+            for (int ic = 0; ic < in_padded; ic += WORD_ELEMS) {
+                #pragma HLS PIPELINE II=1
+                #pragma HLS LOOP_TRIPCOUNT min=SIMD_FACTOR/WORD_ELEMS max=MAX_CHANNELS/WORD_ELEMS
+                int o = g * PE_NUM + pe;
+                word_t word = 0;
+                if (o < config.output_channels && ic < config.input_channels) {
+                    int idx = (o * config.input_channels + ic) / WORD_ELEMS;
+                    word = separable ? pw_weights[idx] : weights[idx];
+                    beats++;
+                }
+                for (int l = 0; l < WORD_ELEMS; l++) {
+                    #pragma HLS UNROLL
+                    w[pe][ic + l] = word_element(word, l);
+                }
+            }
+        }
+    }
+    read_beats = beats;
+}
+
+// The array: one pixel's SIMD_FACTOR input channels per cycle, pixels
+// fastest so each PE's weights stay put for a whole pass over the block
+void pw_compute(
+    StreamGrid grid,
+    hls::stream_of_blocks<PwInputBlock> &input_blocks,
+    hls::stream_of_blocks<PwWeightGroup> &weight_groups,
+    hls::stream_of_blocks<PwOutputGroup> &output_groups
+) {
+    PW_BLOCKS:
+    for (int b = 0; b < grid.pw.blocks; b++) {
+        int rows = pw_block_rows(grid.pw, b);
+        hls::read_lock<PwInputBlock> in(input_blocks);
+        
+        PW_GROUPS:
+        for (int g = 0; g < grid.pw.groups; g++) {
+            hls::read_lock<PwWeightGroup> w(weight_groups);
+            hls::write_lock<PwOutputGroup> acc(output_groups);
+            
+            int step = 0, p = 0;
+            PW_ARRAY:
+            for (int i = 0; i < grid.pw.steps * rows; i++) {
+                #pragma HLS PIPELINE II=1
+                #pragma HLS LOOP_TRIPCOUNT min=PW_PIPELINE_DEPTH max=MAX_CHANNELS/SIMD_FACTOR*PW_PIXELS
+                #pragma HLS DEPENDENCE variable=acc inter false
+                PE_PAIRS:
+                for (int pe = 0; pe < PE_NUM; pe += 2) {
+                    #pragma HLS UNROLL
+                    acc_t sum_a = (step == 0) ? (acc_t)0 : acc[p][pe];
+                    acc_t sum_b = (step == 0) ? (acc_t)0 : acc[p][pe + 1];
+                    SIMD:
+                    for (int s = 0; s < SIMD_FACTOR; s++) {
+                        #pragma HLS UNROLL
+                        int ic = step * SIMD_FACTOR + s;
+                        acc_t product_a, product_b;
+                        packed_mul(in[p][ic], w[pe][ic], w[pe + 1][ic], product_a, product_b);
+                        sum_a += product_a;
+                        sum_b += product_b;
+                    }
+                    acc[p][pe] = sum_a;
+                    acc[p][pe + 1] = sum_b;
+                }
+                
+                if (++p == rows) {
+                    p = 0;
+                    step++;
+                }
+            }
+#ifndef __SYNTHESIS__
+            pw_array_cycles += (unsigned long long)grid.pw.steps * rows + PW_PIPELINE_DEPTH;
+#endif
+        }
+    }
+}
+
+// Add bias, apply ReLU and write the outputs; a depthwise layer's finished
+// words are written as they come. Each group's outputs are packed a pixel
+// per cycle into the block's output rows, which go out once the block's
+// last group is in: a burst per pixel, or one for the whole block when
+// the layer's output is contiguous. With config.pool the finished pixels
+// are summed per channel instead, and only the averages are written after
+// each image's last pixel, so the map never reaches DDR.
+void pw_store(
+    const bias_t bias[MAX_CHANNELS],
+    word_t *output,
+    ConvConfig config,
+    StreamGrid grid,
+    hls::stream_of_blocks<PwOutputGroup> &output_groups,
+    hls::stream<word_t> &passthrough,
+    perf_t &write_beats
+) {
+    if (config.mode == MODE_DEPTHWISE) {
+        DW_STORE:
+        for (int i = 0; i < grid.images * grid.output_pixels * grid.words; i++) {
+            #pragma HLS PIPELINE II=1
+            output[i] = passthrough.read();
+        }
+        write_beats = grid.images * grid.output_pixels * grid.words;
+        return;
     }
     
-    // Calculate output dimensions
-    int output_height = (config.input_height + 2 * config.padding - config.kernel_size) / config.stride + 1;
-    int output_width = (config.input_width + 2 * config.padding - config.kernel_size) / config.stride + 1;
+    word_t rows[PW_PIXELS][MAX_CHANNELS / WORD_ELEMS];
+    #pragma HLS ARRAY_PARTITION variable=rows cyclic factor=PE_WORDS dim=2
+    acc_t pool_sums[MAX_CHANNELS];
+    #pragma HLS ARRAY_PARTITION variable=pool_sums cyclic factor=WORD_ELEMS
+    int output_words = config.output_channels / WORD_ELEMS;
+    int stride_words = (config.output_stride ? config.output_stride : config.output_channels) / WORD_ELEMS;
+    int row_words = (config.pool && output_words < GAP_MIN_WORDS) ? GAP_MIN_WORDS : output_words;
+    perf_t beats = 0;
     
-    // Sliding window convolution with line buffers
-    int output_idx = 0;
+    if (config.pool) {
+        POOL_CLEAR:
+        for (int wd = 0; wd < output_words; wd++) {
+            #pragma HLS PIPELINE II=1
+            #pragma HLS LOOP_TRIPCOUNT min=1 max=MAX_CHANNELS/WORD_ELEMS
+            for (int l = 0; l < WORD_ELEMS; l++) {
+                #pragma HLS UNROLL
+                pool_sums[wd * WORD_ELEMS + l] = 0;
+            }
+        }
+    }
     
-    OUTPUT_HEIGHT:
-    for (int oh = 0; oh < output_height; oh++) {
-        OUTPUT_WIDTH:
-        for (int ow = 0; ow < output_width; ow++) {
-            #pragma HLS PIPELINE off
-            
-            // Extract input window
-            data_t input_window[MAX_KERNEL_SIZE][MAX_KERNEL_SIZE][MAX_CHANNELS];
-            #pragma HLS ARRAY_PARTITION variable=input_window complete dim=1
-            #pragma HLS ARRAY_PARTITION variable=input_window complete dim=2
-            
-            int ih_base = oh * config.stride - config.padding;
-            int iw_base = ow * config.stride - config.padding;
-            
-            WINDOW_HEIGHT:
-            for (int kh = 0; kh < config.kernel_size; kh++) {
-                WINDOW_WIDTH:
-                for (int kw = 0; kw < config.kernel_size; kw++) {
-                    int ih = ih_base + kh;
-                    int iw = iw_base + kw;
-                    
-                    WINDOW_CHANNELS:
-                    for (int ic = 0; ic < config.input_channels; ic++) {
+    PW_STORE_GROUPS:
+    for (int i = 0; i < grid.pw.blocks * grid.pw.groups; i++) {
+        int b = i / grid.pw.groups;
+        int g = i % grid.pw.groups;
+        int pixels = pw_block_pixels(grid.pw, b);
+        {
+            hls::read_lock<PwOutputGroup> acc(output_groups);
+            PW_PACK:
+            for (int p = 0; p < pixels; p++) {
+                #pragma HLS PIPELINE II=1
+                #pragma HLS LOOP_TRIPCOUNT min=1 max=PW_PIXELS
+                for (int wd = 0; wd < PE_WORDS; wd++) {
+                    #pragma HLS UNROLL
+                    int o = g * PE_NUM + wd * WORD_ELEMS;
+                    if (o < config.output_channels) {
+                        word_t word;
+                        for (int l = 0; l < WORD_ELEMS; l++) {
+                            #pragma HLS UNROLL
+                            set_word_element(word, l, requantize(acc[p][wd * WORD_ELEMS + l] + bias[o + l],
+                                                                 config.use_relu, config.use_relu6));
+                        }
+                        rows[p][g * PE_WORDS + wd] = word;
+                    }
+                }
+            }
+        }
+        
+        // Finished pixels go out a word per cycle, or into the pooled sums
+        if (g == grid.pw.groups - 1) {
+            PW_WRITE:
+            for (int p = 0; p < pixels; p++) {
+                for (int wd = 0; wd < row_words; wd++) {
+                    #pragma HLS PIPELINE II=1
+                    #pragma HLS LOOP_TRIPCOUNT min=1 max=MAX_CHANNELS/WORD_ELEMS
+                    #pragma HLS DEPENDENCE variable=pool_sums inter false
+                    if (wd >= output_words) {
+                        continue;
+                    }
+                    if (config.pool) {
+                        for (int l = 0; l < WORD_ELEMS; l++) {
+                            #pragma HLS UNROLL
+                            pool_sums[wd * WORD_ELEMS + l] += word_element(rows[p][wd], l);
+                        }
+                    } else {
+                        output[(b * PW_PIXELS + p) * stride_words + wd] = rows[p][wd];
+                        beats++;
+                    }
+                }
+                
+                // An image's averages go out, and its sums clear for the next
+                int q = b * PW_PIXELS + p;
+                if (config.pool && q % grid.output_pixels == grid.output_pixels - 1) {
+                    POOL_WRITE:
+                    for (int wd = 0; wd < output_words; wd++) {
                         #pragma HLS PIPELINE II=1
-                        
-                        // Handle padding
-                        if (ih >= 0 && ih < config.input_height && iw >= 0 && iw < config.input_width) {
-                            int input_idx = (ih * config.input_width + iw) * config.input_channels + ic;
-                            input_window[kh][kw][ic] = input[input_idx];
-                        } else {
-                            input_window[kh][kw][ic] = 0;
+                        #pragma HLS LOOP_TRIPCOUNT min=1 max=MAX_CHANNELS/WORD_ELEMS
+                        word_t word;
+                        for (int l = 0; l < WORD_ELEMS; l++) {
+                            #pragma HLS UNROLL
+                            set_word_element(word, l, gap_average(pool_sums[wd * WORD_ELEMS + l],
+                                                                  config.pool_reciprocal));
+                            pool_sums[wd * WORD_ELEMS + l] = 0;
                         }
+                        output[q / grid.output_pixels * output_words + wd] = word;
+                        beats++;
                     }
                 }
             }
-            
-            // Compute convolution for this output pixel
-            data_t output_pixel[MAX_CHANNELS];
-            #pragma HLS ARRAY_PARTITION variable=output_pixel complete
-            
-            conv2d_compute(input_window, weight_buffer, bias_buffer, output_pixel, config);
-            
-            // Write output
-            WRITE_OUTPUT:
-            for (int oc = 0; oc < config.output_channels; oc++) {
-                #pragma HLS PIPELINE
-                output[output_idx * config.output_channels + oc] = output_pixel[oc];
+        }
+    }
+    write_beats = beats;
+}
+
+void conv_stream(
+    const word_t *input,
+    const word_t *weights,
+    const word_t *pw_weights,
+    const weight_t dw_weights[MAX_KERNEL_SIZE * MAX_KERNEL_SIZE][MAX_CHANNELS],
+    const bias_t dw_bias[MAX_CHANNELS],
+    const bias_t pw_bias[MAX_CHANNELS],
+    word_t *output,
+    ConvConfig config,
+    StreamGrid grid,
+    perf_t &read_beats,
+    perf_t &weight_beats,
+    perf_t &write_beats
+) {
+    #pragma HLS DATAFLOW
+    
+    hls::stream<word_t> pixels("stream_pixels");
+    #pragma HLS STREAM variable=pixels depth=16
+    hls::stream<word_t> words("stream_words");
+    #pragma HLS STREAM variable=words depth=16
+    hls::stream<word_t> passthrough("stream_passthrough");
+    #pragma HLS STREAM variable=passthrough depth=16
+    
+    hls::stream_of_blocks<PwInputBlock> input_blocks;
+    #pragma HLS ARRAY_PARTITION variable=input_blocks cyclic factor=SIMD_FACTOR dim=2
+    hls::stream_of_blocks<PwWeightGroup> weight_groups;
+    #pragma HLS ARRAY_PARTITION variable=weight_groups complete dim=1
+    #pragma HLS ARRAY_PARTITION variable=weight_groups cyclic factor=SIMD_FACTOR dim=2
+    #pragma HLS BIND_STORAGE variable=weight_groups type=ram_2p impl=lutram
+    hls::stream_of_blocks<PwOutputGroup> output_groups;
+    #pragma HLS ARRAY_PARTITION variable=output_groups complete dim=2
+    #pragma HLS BIND_STORAGE variable=output_groups type=ram_2p impl=lutram
+    
+    dw_read(input, config, grid, pixels, read_beats);
+    dw_window(dw_weights, dw_bias, config, grid, pixels, words);
+    pw_gather(config, grid, words, input_blocks, passthrough);
+    pw_load_weights(weights, pw_weights, config, grid, weight_groups, weight_beats);
+    pw_compute(grid, input_blocks, weight_groups, output_groups);
+    pw_store(pw_bias, output, config, grid, output_groups, passthrough, write_beats);
+}
+
+// What a streamed layer needs on chip before its stream starts: the
+// depthwise kernels and bias, and the pointwise bias. Program mode keeps
+// two banks of it, one for the layer running and one being prefetched.
+typedef weight_t DwWeightBank[MAX_KERNEL_SIZE * MAX_KERNEL_SIZE][MAX_CHANNELS];
+typedef bias_t BiasBank[MAX_CHANNELS];
+
+// Load a streamed layer's bank; returns the beats read. Depthwise kernels
+// are [c][3][3], so a word can span two channels.
+static perf_t load_preload(
+    const word_t *weights,
+    const word_t *bias,
+    const word_t *pw_bias,
+    ConvConfig config,
+    DwWeightBank dw_weights,
+    BiasBank dw_bias,
+    BiasBank pw_bias_buffer
+) {
+    #pragma HLS INLINE off
+    
+    int channels = config.input_channels;
+    int taps = MAX_KERNEL_SIZE * MAX_KERNEL_SIZE;
+    int weight_words = (channels * taps + WORD_ELEMS - 1) / WORD_ELEMS;
+    perf_t beats = 0;
+    
+    if (config.mode != MODE_POINTWISE) {
+        DW_LOAD_WEIGHTS:
+        for (int i = 0; i < weight_words; i++) {
+            #pragma HLS PIPELINE II=1
+            #pragma HLS LOOP_TRIPCOUNT min=2 max=MAX_CHANNELS*9/WORD_ELEMS
+            word_t word = weights[i];
+            for (int l = 0; l < WORD_ELEMS; l++) {
+                #pragma HLS UNROLL
+                int e = i * WORD_ELEMS + l;
+                if (e < channels * taps) {
+                    dw_weights[e % taps][e / taps] = word_element(word, l);
+                }
             }
-            output_idx++;
         }
+        DW_LOAD_BIAS:
+        for (int i = 0; i < channels / WORD_FIELDS; i++) {
+            #pragma HLS PIPELINE II=1
+            word_t word = bias[i];
+            for (int f = 0; f < WORD_FIELDS; f++) {
+                #pragma HLS UNROLL
+                dw_bias[i * WORD_FIELDS + f] = (bias_t)word_field(word, f);
+            }
+        }
+        beats += weight_words + channels / WORD_FIELDS;
+    }
+    if (config.mode != MODE_DEPTHWISE) {
+        const word_t *source = (config.mode == MODE_SEPARABLE) ? pw_bias : bias;
+        PW_LOAD_BIAS:
+        for (int i = 0; i < config.output_channels / WORD_FIELDS; i++) {
+            #pragma HLS PIPELINE II=1
+            word_t word = source[i];
+            for (int f = 0; f < WORD_FIELDS; f++) {
+                #pragma HLS UNROLL
+                pw_bias_buffer[i * WORD_FIELDS + f] = (bias_t)word_field(word, f);
+            }
+        }
+        beats += config.output_channels / WORD_FIELDS;
+    }
+    return beats;
+}
+
+// A depthwise, pointwise or separable layer on the streaming pipeline,
+// its bank loaded. Storage: the line buffers 2 x 14592 x 8 bit (8
+// BRAM36), the pointwise input blocks 2 x PW_PIXELS x 1024 x 8 bit in
+// SIMD_FACTOR banks (32 BRAM36) and the output rows PW_PIXELS x 1024 x 8
+// bit (16 BRAM36); the two banks of weights and biases, the column
+// history, the accumulators and the pooled sums sit in LUTRAM. The
+// depthwise lanes take 18 DSP48s and the array's 256 MACs 128, 178 of the
+// ~180 budgeted with the tiled engine's 32; the eight reciprocal
+// multipliers of the pooled averages add 16 more.
+void conv_streamed(
+    word_t *input,
+    word_t *weights,
+    word_t *pw_weights,
+    word_t *output,
+    ConvConfig config,
+    TileGrid tiles,
+    DwWeightBank dw_weights,
+    BiasBank dw_bias,
+    BiasBank pw_bias_buffer,
+    PerfMonitor &monitor
+) {
+    #pragma HLS INLINE off
+    
+    StreamGrid grid = stream_grid(config, tiles);
+    perf_t read_beats, weight_beats, write_beats;
+    monitor.begin_phase();
+    conv_stream(input, weights, pw_weights, dw_weights, dw_bias, pw_bias_buffer, output, config, grid,
+                read_beats, weight_beats, write_beats);
+    monitor.end_stream(read_beats + weight_beats, write_beats);
+}
+
+// One convolution layer. The stages overlap, so the whole layer counts as
+// one stream: compute time, with read cycles beyond one per beat as stalls.
+// A streamed layer loads its bank first unless it was prefetched.
+void conv_layer(
+    word_t *input,
+    word_t *weights,
+    word_t *bias,
+    word_t *pw_weights,
+    word_t *pw_bias,
+    word_t *output,
+    ConvConfig config,
+    DwWeightBank dw_weights,
+    BiasBank dw_bias,
+    BiasBank pw_bias_buffer,
+    bool preloaded,
+    PerfMonitor &monitor
+) {
+    #pragma HLS INLINE off
+    
+    TileGrid grid = tile_grid(config);
+    if (stream_supported(config, grid)) {
+        if (!preloaded) {
+            monitor.begin_phase();
+            perf_t beats = load_preload(weights, bias, pw_bias, config, dw_weights, dw_bias, pw_bias_buffer);
+            monitor.end_read(beats);
+        }
+        conv_streamed(input, weights, pw_weights, output, config, grid, dw_weights, dw_bias, pw_bias_buffer,
+                      monitor);
+        return;
+    }
+    // Only the streaming pipeline runs separable blocks and pools its
+    // output; the driver checks the shape before sending either
+    if (config.mode == MODE_SEPARABLE || config.pool) {
+        return;
+    }
+    
+    perf_t read_beats, bias_beats, write_beats;
+    
+    monitor.begin_phase();
+    conv_tiled(input, weights, bias, output, config, grid, read_beats, bias_beats, write_beats);
+    monitor.end_stream(read_beats + bias_beats, write_beats);
+}
+
+// Read descriptor i of a program
+static void fetch_descriptor(const word_t *program, int i, ap_uint<32> desc[DESC_WORDS]) {
+    #pragma HLS INLINE
+    FETCH_DESCRIPTOR:
+    for (int w = 0; w < DESC_BEATS; w++) {
+        #pragma HLS PIPELINE II=1
+        word_t word = program[i * DESC_BEATS + w];
+        for (int f = 0; f < WORD_FIELDS; f++) {
+            #pragma HLS UNROLL
+            desc[w * WORD_FIELDS + f] = word_field(word, f);
+        }
+    }
+}
+
+static ConvConfig decode_descriptor(const ap_uint<32> desc[DESC_WORDS]) {
+    #pragma HLS INLINE
+    ConvConfig layer;
+    layer.kernel_size = desc[DESC_CONFIG].range(31, 24);
+    layer.stride = desc[DESC_CONFIG].range(23, 16);
+    layer.padding = desc[DESC_CONFIG].range(15, 8);
+    layer.mode = desc[DESC_CONFIG].range(5, 4);
+    layer.use_relu = desc[DESC_CONFIG][0];
+    layer.mid_relu = desc[DESC_CONFIG][1];
+    layer.pool = desc[DESC_CONFIG][2];
+    layer.use_relu6 = desc[DESC_CONFIG][3];
+    layer.mid_relu6 = desc[DESC_CONFIG][6];
+    layer.pool_reciprocal = desc[DESC_POOL_RECIP];
+    layer.input_height = desc[DESC_IN_HEIGHT];
+    layer.input_width = desc[DESC_IN_WIDTH];
+    layer.input_channels = desc[DESC_IN_CHANNELS];
+    layer.output_channels = desc[DESC_OUT_CHANNELS];
+    layer.output_stride = desc[DESC_OUT_STRIDE];
+    layer.batch = desc[DESC_BATCH];
+    return layer;
+}
+
+// The prefetcher: descriptor i and, when its layer streams, that layer's
+// bank, read over gmem2 (program and prefetch) while the layer before it
+// runs on the other ports
+void prefetch_layer(
+    const word_t *program,
+    const word_t *prefetch,
+    int i,
+    bool enable,
+    ap_uint<32> desc[DESC_WORDS],
+    DwWeightBank dw_weights,
+    BiasBank dw_bias,
+    BiasBank pw_bias_buffer,
+    perf_t &read_beats
+) {
+    #pragma HLS INLINE off
+    
+    perf_t beats = 0;
+    if (enable) {
+        fetch_descriptor(program, i, desc);
+        ConvConfig layer = decode_descriptor(desc);
+        beats = DESC_BEATS;
+        if (stream_supported(layer, tile_grid(layer))) {
+            beats += load_preload(prefetch + desc[DESC_WEIGHT_ADDR] / AXI_WORD_BYTES,
+                                  prefetch + desc[DESC_BIAS_ADDR] / AXI_WORD_BYTES,
+                                  prefetch + desc[DESC_PW_BIAS_ADDR] / AXI_WORD_BYTES,
+                                  layer, dw_weights, dw_bias, pw_bias_buffer);
+        }
+    }
+    read_beats = beats;
+}
+
+// One program step: the layer in desc from one bank and, alongside it,
+// the next descriptor and its bank into the other. The two share no
+// memory, so they run as one dataflow region.
+void conv_step(
+    word_t *input,
+    word_t *weights,
+    word_t *bias,
+    word_t *pw_weights,
+    word_t *pw_bias,
+    word_t *output,
+    const ap_uint<32> desc[DESC_WORDS],
+    DwWeightBank dw_weights,
+    BiasBank dw_bias,
+    BiasBank pw_bias_buffer,
+    bool preloaded,
+    const word_t *program,
+    const word_t *prefetch,
+    int next,
+    bool fetch_next,
+    ap_uint<32> next_desc[DESC_WORDS],
+    DwWeightBank next_dw_weights,
+    BiasBank next_dw_bias,
+    BiasBank next_pw_bias,
+    perf_t &prefetch_beats,
+    PerfMonitor &monitor
+) {
+    #pragma HLS DATAFLOW
+    
+    conv_layer(input + desc[DESC_INPUT_ADDR] / AXI_WORD_BYTES,
+               weights + desc[DESC_WEIGHT_ADDR] / AXI_WORD_BYTES,
+               bias + desc[DESC_BIAS_ADDR] / AXI_WORD_BYTES,
+               pw_weights + desc[DESC_PW_WEIGHT_ADDR] / AXI_WORD_BYTES,
+               pw_bias + desc[DESC_PW_BIAS_ADDR] / AXI_WORD_BYTES,
+               output + desc[DESC_OUTPUT_ADDR] / AXI_WORD_BYTES,
+               decode_descriptor(desc), dw_weights, dw_bias, pw_bias_buffer, preloaded, monitor);
+    prefetch_layer(program, prefetch, next, fetch_next, next_desc,
+                   next_dw_weights, next_dw_bias, next_pw_bias, prefetch_beats);
+}
+
+// Main convolution accelerator function. With program_length 0 it runs the
+// layer in config; otherwise it walks program_length descriptors from
+// program and raises done once, after the last one. A descriptor with
+// CONV_CONFIG_PREFETCH has the next one fetched, and its bank loaded
+// through the prefetch port, while its own layer runs. Every port moves
+// whole words (axi_word.h).
+void conv_accelerator(
+    word_t *input,           // Input feature map (DDR)
+    word_t *weights,         // Convolution weights (DDR)
+    word_t *bias,            // Bias values (DDR)
+    word_t *pw_weights,      // Separable mode: pointwise weights (DDR)
+    word_t *pw_bias,         // Separable mode: pointwise bias (DDR)
+    word_t *output,          // Output feature map (DDR)
+    ConvConfig config,       // Layer configuration
+    const word_t *program,                  // Layer descriptors (DDR)
+    int program_length,                     // Descriptors to run, 0 = config only
+    const word_t *prefetch,                 // Program mode: next layer's kernels and biases (DDR)
+    volatile perf_t *cycle_count,           // Free-running cycle counter
+    perf_t perf[PERF_COUNTER_COUNT]         // Performance counters (read-only)
+) {
+    #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem0 depth=50176 max_read_burst_length=256
+    #pragma HLS INTERFACE m_axi port=weights offset=slave bundle=gmem1 depth=131072 max_read_burst_length=256
+    #pragma HLS INTERFACE m_axi port=bias offset=slave bundle=gmem2 depth=512
+    #pragma HLS INTERFACE m_axi port=pw_weights offset=slave bundle=gmem1 depth=131072 max_read_burst_length=256
+    #pragma HLS INTERFACE m_axi port=pw_bias offset=slave bundle=gmem2 depth=512
+    #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem3 depth=100352 max_write_burst_length=256
+    #pragma HLS INTERFACE m_axi port=program offset=slave bundle=gmem2 depth=512
+    #pragma HLS INTERFACE m_axi port=prefetch offset=slave bundle=gmem2 depth=131072 max_read_burst_length=256
+    #pragma HLS INTERFACE s_axilite port=config bundle=control
+    #pragma HLS INTERFACE s_axilite port=program_length bundle=control
+    #pragma HLS INTERFACE ap_none port=cycle_count
+    #pragma HLS INTERFACE s_axilite port=perf bundle=control
+    #pragma HLS INTERFACE s_axilite port=return bundle=control
+    #pragma HLS ALLOCATION function instances=conv_step limit=1
+    
+    static perf_t perf_totals[PERF_COUNTER_COUNT];
+    PerfMonitor monitor(cycle_count);
+    
+    // Two banks of depthwise weights and biases, used in turn in program
+    // mode; a single layer only needs the first
+    DwWeightBank dw_weights_a, dw_weights_b;
+    #pragma HLS ARRAY_PARTITION variable=dw_weights_a complete dim=1
+    #pragma HLS ARRAY_PARTITION variable=dw_weights_a cyclic factor=DW_LANES dim=2
+    #pragma HLS BIND_STORAGE variable=dw_weights_a type=ram_2p impl=lutram
+    #pragma HLS ARRAY_PARTITION variable=dw_weights_b complete dim=1
+    #pragma HLS ARRAY_PARTITION variable=dw_weights_b cyclic factor=DW_LANES dim=2
+    #pragma HLS BIND_STORAGE variable=dw_weights_b type=ram_2p impl=lutram
+    BiasBank dw_bias_a, dw_bias_b;
+    #pragma HLS ARRAY_PARTITION variable=dw_bias_a cyclic factor=DW_LANES dim=1
+    #pragma HLS BIND_STORAGE variable=dw_bias_a type=ram_2p impl=lutram
+    #pragma HLS ARRAY_PARTITION variable=dw_bias_b cyclic factor=DW_LANES dim=1
+    #pragma HLS BIND_STORAGE variable=dw_bias_b type=ram_2p impl=lutram
+    BiasBank pw_bias_a, pw_bias_b;
+    #pragma HLS ARRAY_PARTITION variable=pw_bias_a cyclic factor=PE_NUM
+    #pragma HLS ARRAY_PARTITION variable=pw_bias_b cyclic factor=PE_NUM
+    
+    if (program_length == 0) {
+        conv_layer(input, weights, bias, pw_weights, pw_bias, output, config,
+                   dw_weights_a, dw_bias_a, pw_bias_a, false, monitor);
+        monitor.publish(perf_totals, perf);
+        return;
+    }
+    
+    // Descriptor addresses are absolute when the driver sets the pointer
+    // bases to 0, so each layer indexes from its own offsets. Step i runs
+    // from bank a when i is even, b when odd; its prefetch fills the other.
+    ap_uint<32> desc_a[DESC_WORDS], desc_b[DESC_WORDS];
+    monitor.begin_phase();
+    fetch_descriptor(program, 0, desc_a);
+    monitor.end_read(DESC_BEATS);
+    bool prefetched = false;
+    
+    PROGRAM:
+    for (int i = 0; i < program_length; i++) {
+        #pragma HLS LOOP_TRIPCOUNT min=1 max=MAX_PROGRAM_LAYERS
+        bool even = i % 2 == 0;
+        
+        // Without the announcement, the next descriptor waits for this layer
+        if (i > 0 && !prefetched) {
+            monitor.begin_phase();
+            fetch_descriptor(program, i, even ? desc_a : desc_b);
+            monitor.end_read(DESC_BEATS);
+        }
+        bool announce = (even ? desc_a : desc_b)[DESC_CONFIG][7] && i + 1 < program_length;
+        
+        perf_t prefetch_beats;
+        if (even) {
+            conv_step(input, weights, bias, pw_weights, pw_bias, output, desc_a,
+                      dw_weights_a, dw_bias_a, pw_bias_a, prefetched,
+                      program, prefetch, i + 1, announce, desc_b,
+                      dw_weights_b, dw_bias_b, pw_bias_b, prefetch_beats, monitor);
+        } else {
+            conv_step(input, weights, bias, pw_weights, pw_bias, output, desc_b,
+                      dw_weights_b, dw_bias_b, pw_bias_b, prefetched,
+                      program, prefetch, i + 1, announce, desc_a,
+                      dw_weights_a, dw_bias_a, pw_bias_a, prefetch_beats, monitor);
+        }
+        monitor.add_reads(prefetch_beats);
+        prefetched = announce;
     }
+    monitor.publish(perf_totals, perf);
 }
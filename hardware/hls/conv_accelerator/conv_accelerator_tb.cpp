@@ -0,0 +1,290 @@
+// C simulation testbench for the conv accelerator's pointwise array.
+// Runs 1x1 layers of MobileNet's shapes against the software's
+// CPUConvolution, which the int8 datapath has to match bit for bit, and
+// reports the MACs per cycle the array achieves (PE_NUM * SIMD_FACTOR at
+// best) and the AXI beats each layer moves, per array cycle. Run by
+// csim_design in run_hls.tcl, and by cosim_design when COSIM is set, where
+// the beats over the latency in the cosim report are the measured rate.
+// The last layer's shape runs again with its output pooled on chip, as it
+// is in front of MobileNet's global average pooling, and the odd-sized
+// layer clamps with ReLU6 in the output stage. A 4x4 layer, the size of
+// the late layers at 128x128 input, runs as a batch of four images, whose
+// pixels share the array's blocks and weight passes. Last, a chain of pointwise
+// layers runs as a program with every descriptor announcing the next, so
+// the layers after the first start from prefetched banks.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "ap_int.h"
+#include "../common/perf_counters.h"
+#include "../common/axi_word.h"
+#include "../../../models/configs/mobilenet_config.h"
+#include "../../../software/common/cpu_convolution.h"
+
+#define MODE_POINTWISE 2
+
+struct ConvConfig {
+    int input_height;
+    int input_width;
+    int input_channels;
+    int output_channels;
+    int kernel_size;
+    int stride;
+    int padding;
+    int mode;
+    int output_stride;
+    bool use_relu;
+    bool use_relu6;
+    bool mid_relu;
+    bool mid_relu6;
+    bool pool;
+    unsigned int pool_reciprocal;
+    int batch;
+};
+
+void conv_accelerator(
+    word_t *input,
+    word_t *weights,
+    word_t *bias,
+    word_t *pw_weights,
+    word_t *pw_bias,
+    word_t *output,
+    ConvConfig config,
+    const word_t *program,
+    int program_length,
+    const word_t *prefetch,
+    volatile perf_t *cycle_count,
+    perf_t perf[PERF_COUNTER_COUNT]
+);
+
+extern unsigned long long pw_array_cycles;
+
+struct Shape {
+    int height;
+    int width;
+    int input_channels;
+    int output_channels;
+    bool pool;
+    bool relu6;
+    int batch;
+};
+
+// Pointwise layers of MobileNetV1 1.0/224, the classifier, and one with
+// channel counts that do not fill the array
+static const Shape shapes[] = {
+    {112, 112, 32, 64, false, false, 1},
+    {56, 56, 128, 128, false, false, 1},
+    {28, 28, 256, 256, false, false, 1},
+    {14, 14, 512, 512, false, false, 1},
+    {7, 7, 1024, 1024, false, false, 1},
+    {7, 7, 1024, 1024, true, false, 1},
+    {1, 1, 1024, 1000, false, false, 1},
+    {5, 5, 24, 40, false, true, 1},
+    {4, 4, 512, 512, false, false, 4},
+    {4, 4, 512, 512, true, false, 4},
+};
+
+// Any int8, and biases of the size quantize_model.py produces
+static qint8_t random_value() {
+    return (qint8_t)(rand() % 256 - 128);
+}
+
+static qint32_t random_bias() {
+    return rand() % 8192 - 4096;
+}
+
+// Host tensors packed into port words, lowest address in the low bits
+static std::vector<word_t> pack(const qint8_t *data, size_t count) {
+    std::vector<word_t> words((count + WORD_ELEMS - 1) / WORD_ELEMS, 0);
+    for (size_t i = 0; i < count; i++) {
+        set_word_element(words[i / WORD_ELEMS], i % WORD_ELEMS, data[i]);
+    }
+    return words;
+}
+
+static std::vector<word_t> pack_bias(const qint32_t *data, size_t count) {
+    std::vector<word_t> words((count + WORD_FIELDS - 1) / WORD_FIELDS, 0);
+    for (size_t i = 0; i < count; i++) {
+        words[i / WORD_FIELDS].range(32 * (i % WORD_FIELDS) + 31, 32 * (i % WORD_FIELDS)) = (uint32_t)data[i];
+    }
+    return words;
+}
+
+// The counters accumulate across calls, so each shape takes a difference
+static perf_t last_perf[PERF_COUNTER_COUNT];
+
+static bool run_shape(const Shape &shape) {
+    int pixels = shape.height * shape.width;
+    int in_c = shape.input_channels;
+    int out_c = shape.output_channels;
+    int images = shape.batch;
+    int image_outputs = (shape.pool ? 1 : pixels) * out_c;
+    
+    std::vector<qint8_t> host_input(images * pixels * in_c);
+    std::vector<qint8_t> host_weights(out_c * in_c);
+    std::vector<qint32_t> host_bias(out_c);
+    std::vector<qint8_t> expected(images * pixels * out_c);
+    for (size_t i = 0; i < host_input.size(); i++) host_input[i] = random_value();
+    for (size_t i = 0; i < host_weights.size(); i++) host_weights[i] = random_value();
+    for (size_t i = 0; i < host_bias.size(); i++) host_bias[i] = random_bias();
+    
+    std::vector<word_t> input = pack(&host_input[0], host_input.size());
+    std::vector<word_t> weights = pack(&host_weights[0], host_weights.size());
+    std::vector<word_t> bias = pack_bias(&host_bias[0], host_bias.size());
+    std::vector<word_t> output((size_t)images * image_outputs / WORD_ELEMS);
+    
+    ConvConfig config;
+    config.input_height = shape.height;
+    config.input_width = shape.width;
+    config.input_channels = in_c;
+    config.output_channels = out_c;
+    config.kernel_size = 1;
+    config.stride = 1;
+    config.padding = 0;
+    config.mode = MODE_POINTWISE;
+    config.output_stride = 0;
+    config.use_relu = !shape.relu6;
+    config.use_relu6 = shape.relu6;
+    config.mid_relu = false;
+    config.mid_relu6 = false;
+    config.pool = shape.pool;
+    config.pool_reciprocal = GAP_RECIPROCAL(pixels);
+    config.batch = images;
+    
+    perf_t clock = 0;
+    perf_t perf[PERF_COUNTER_COUNT];
+    pw_array_cycles = 0;
+    conv_accelerator(&input[0], &weights[0], &bias[0], 0, 0, &output[0], config, 0, 0, 0, &clock, perf);
+    
+    // Each image's reference moves down to its slot in the batch's output
+    for (int n = 0; n < images; n++) {
+        qint8_t *image = &expected[n * pixels * out_c];
+        CPUConvolution::conv2d(&host_input[n * pixels * in_c], &host_weights[0], &host_bias[0], image,
+                               shape.height, shape.width, in_c, out_c, 1, 1, 0);
+        if (shape.relu6) {
+            CPUConvolution::relu6(image, pixels * out_c);
+        } else {
+            CPUConvolution::relu(image, pixels * out_c);
+        }
+        if (shape.pool) {
+            CPUConvolution::global_avg_pool(image, image, shape.height, shape.width, out_c);
+        }
+        memmove(&expected[n * image_outputs], image, image_outputs);
+    }
+    
+    int mismatches = 0;
+    for (int i = 0; i < images * image_outputs; i++) {
+        int value = word_element(output[i / WORD_ELEMS], i % WORD_ELEMS);
+        if (value != expected[i] && mismatches++ < 5) {
+            printf("  mismatch at image %d pixel %d channel %d: %d, expected %d\n", i / image_outputs,
+                   i % image_outputs / out_c, i % out_c, value, expected[i]);
+        }
+    }
+    
+    unsigned read_beats = perf[PERF_READ_BEATS] - last_perf[PERF_READ_BEATS];
+    unsigned write_beats = perf[PERF_WRITE_BEATS] - last_perf[PERF_WRITE_BEATS];
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) last_perf[i] = perf[i];
+    
+    double macs = (double)images * pixels * in_c * out_c;
+    double per_cycle = macs / (double)pw_array_cycles;
+    printf("%4dx%-4d %4d -> %-4d%s %12.0f %12llu %9.1f %6.1f%% %10u %10u %6.2f  %s",
+           shape.height, shape.width, in_c, out_c, shape.pool ? " gap" : shape.relu6 ? " r6 " : "    ", macs, pw_array_cycles, per_cycle,
+           100.0 * per_cycle / (CONV_PE_NUM * CONV_SIMD_FACTOR), read_beats, write_beats,
+           (double)(read_beats + write_beats) / (double)pw_array_cycles, mismatches ? "FAIL" : "ok");
+    if (images > 1) {
+        printf("  (%d images)", images);
+    }
+    printf("\n");
+    return mismatches == 0;
+}
+
+// Program mode: each layer feeds the next through one memory image, with
+// descriptor addresses as byte offsets into it
+static const int chain_channels[] = {64, 96, 128, 64};
+#define CHAIN_LAYERS 3
+#define CHAIN_SIZE 14
+
+static uint32_t place(std::vector<word_t> &memory, const std::vector<word_t> &words) {
+    uint32_t offset = memory.size() * WORD_ELEMS;
+    memory.insert(memory.end(), words.begin(), words.end());
+    return offset;
+}
+
+static bool run_program() {
+    int pixels = CHAIN_SIZE * CHAIN_SIZE;
+    std::vector<word_t> memory;
+    std::vector<qint8_t> expected(pixels * chain_channels[0]);
+    for (size_t i = 0; i < expected.size(); i++) expected[i] = random_value();
+    uint32_t input_addr = place(memory, pack(&expected[0], expected.size()));
+    
+    ConvLayerDescriptor desc[CHAIN_LAYERS];
+    for (int i = 0; i < CHAIN_LAYERS; i++) {
+        int in_c = chain_channels[i];
+        int out_c = chain_channels[i + 1];
+        std::vector<qint8_t> host_weights(out_c * in_c);
+        std::vector<qint32_t> host_bias(out_c);
+        for (size_t j = 0; j < host_weights.size(); j++) host_weights[j] = random_value();
+        for (size_t j = 0; j < host_bias.size(); j++) host_bias[j] = random_bias();
+        
+        memset(&desc[i], 0, sizeof(desc[i]));
+        desc[i].input_addr = input_addr;
+        desc[i].weight_addr = place(memory, pack(&host_weights[0], host_weights.size()));
+        desc[i].bias_addr = place(memory, pack_bias(&host_bias[0], host_bias.size()));
+        desc[i].output_addr = place(memory, std::vector<word_t>(pixels * out_c / WORD_ELEMS, 0));
+        desc[i].config = CONV_CONFIG_PACK(1, 1, 0, MODE_POINTWISE, true);
+        if (i + 1 < CHAIN_LAYERS) {
+            desc[i].config |= CONV_CONFIG_PREFETCH;
+        }
+        desc[i].in_height = CHAIN_SIZE;
+        desc[i].in_width = CHAIN_SIZE;
+        desc[i].in_channels = in_c;
+        desc[i].out_channels = out_c;
+        desc[i].out_stride = out_c;
+        input_addr = desc[i].output_addr;
+        
+        std::vector<qint8_t> layer_output(pixels * out_c);
+        CPUConvolution::conv2d(&expected[0], &host_weights[0], &host_bias[0], &layer_output[0],
+                               CHAIN_SIZE, CHAIN_SIZE, in_c, out_c, 1, 1, 0);
+        CPUConvolution::relu(&layer_output[0], (int)layer_output.size());
+        expected.swap(layer_output);
+    }
+    std::vector<word_t> program = pack_bias((const qint32_t*)desc, sizeof(desc) / sizeof(qint32_t));
+    
+    ConvConfig config = {};
+    perf_t clock = 0;
+    perf_t perf[PERF_COUNTER_COUNT];
+    conv_accelerator(&memory[0], &memory[0], &memory[0], &memory[0], &memory[0], &memory[0], config,
+                     &program[0], CHAIN_LAYERS, &memory[0], &clock, perf);
+    
+    int mismatches = 0;
+    uint32_t output = desc[CHAIN_LAYERS - 1].output_addr;
+    for (size_t i = 0; i < expected.size(); i++) {
+        size_t e = output + i;
+        int value = word_element(memory[e / WORD_ELEMS], e % WORD_ELEMS);
+        if (value != expected[i] && mismatches++ < 5) {
+            printf("  mismatch at element %zu: %d, expected %d\n", i, value, expected[i]);
+        }
+    }
+    printf("\nProgram of %d prefetched pointwise layers: %s\n", CHAIN_LAYERS, mismatches ? "FAIL" : "ok");
+    return mismatches == 0;
+}
+
+int main() {
+    printf("Pointwise array: %d PEs x %d input channels = %d MACs/cycle peak\n\n",
+           CONV_PE_NUM, CONV_SIMD_FACTOR, CONV_PE_NUM * CONV_SIMD_FACTOR);
+    printf("shape          in -> out              MACs       cycles MACs/cyc   peak   rd beats   wr beats beats/cyc\n");
+    
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        if (!run_shape(shapes[i])) failed++;
+    }
+    if (!run_program()) failed++;
+    
+    if (failed) {
+        printf("\n%d shapes FAILED\n", failed);
+        return 1;
+    }
+    printf("\nAll shapes match the reference\n");
+    return 0;
+}
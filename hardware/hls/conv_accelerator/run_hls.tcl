@@ -12,6 +12,7 @@ open_project -reset ${proj_name}
 
 # Add source files
 add_files conv_accelerator.cpp
+add_files -tb conv_accelerator_tb.cpp
 
 # Set top function
 set_top ${top_func}
@@ -28,10 +29,24 @@ create_clock -period ${period} -name default
 # Synthesis configuration
 config_compile -name_max_length 80
 
+# Check the kernel against the reference and measure the pointwise
+# array's MACs per cycle
+puts "Running C Simulation..."
+csim_design
+
 # Run C synthesis
 puts "Running C Synthesis..."
 csynth_design
 
+# Optionally rerun the testbench against the RTL. The testbench prints the
+# AXI beats per layer; over each call's latency in the cosim report they
+# give the bandwidth the ports actually reach.
+if {[info exists ::env(COSIM)]} {
+    puts "Running C/RTL Co-simulation..."
+    cosim_design -trace_level none
+    puts "Check ${proj_name}/solution1/sim/report/conv_accelerator_cosim.rpt"
+}
+
 # Export RTL as IP
 puts "Exporting IP..."
 export_design -format ip_catalog \
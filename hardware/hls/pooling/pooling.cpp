@@ -1,15 +1,21 @@
 #include "ap_int.h"
-#include "ap_fixed.h"
 #include "hls_stream.h"
+#include "../common/perf_counters.h"
+#include "../common/axi_word.h"
+#include "../common/gap_average.h"
 
-// Data types
-typedef ap_fixed<16, 8> data_t;
-typedef ap_fixed<32, 16> acc_t; // Accumulator type
+// The host's int8 feature maps (qint8_t). Averages truncate toward zero
+// like the int32 division in CPUConvolution::global_avg_pool.
+typedef ap_int<8> data_t;
+typedef ap_int<32> acc_t; // Accumulator type
+
+#define MAX_CHANNELS 1024
 
 // Pooling types
 enum PoolingType {
     MAX_POOL,
-    AVG_POOL
+    AVG_POOL,
+    GLOBAL_AVG_POOL     // Whole map per channel; pool_size, stride, padding unused
 };
 
 // Configuration structure
@@ -20,6 +26,7 @@ struct PoolConfig {
     int pool_size;      // Pooling window size (e.g., 2 for 2x2)
     int stride;
     int padding;
+    unsigned int reciprocal;    // Global average only: GAP_RECIPROCAL(input_height * input_width)
 };
 
 // Max pooling function
@@ -46,37 +53,117 @@ data_t avg_pool_window(data_t window[], int size) {
     return (data_t)(sum / size);
 }
 
-// Main pooling accelerator
+// Global average pooling (commonly used in MobileNet): one value per
+// channel over the whole feature map. Runs inside pooling_accelerator when
+// pool_type is GLOBAL_AVG_POOL. The map is read once, front to back as one
+// sequential burst, a word per cycle into per-channel sums banked by word
+// lane; each sum is then scaled by the host's reciprocal instead of a
+// division per channel.
+void global_avg_pooling(
+    word_t *input,              // Input feature map [H x W x C]
+    word_t *output,             // Output vector [C]
+    int height,
+    int width,
+    int channels,
+    ap_uint<32> reciprocal,     // GAP_RECIPROCAL(height * width)
+    PerfMonitor &monitor
+) {
+    #pragma HLS INLINE off
+    
+    acc_t sums[MAX_CHANNELS];
+    #pragma HLS ARRAY_PARTITION variable=sums cyclic factor=WORD_ELEMS
+    
+    int spatial_size = height * width;
+    int words = channels / WORD_ELEMS;
+    int pixel_words = words < GAP_MIN_WORDS ? GAP_MIN_WORDS : words;
+    
+    monitor.begin_phase();
+    GAP_CLEAR:
+    for (int w = 0; w < words; w++) {
+        #pragma HLS PIPELINE II=1
+        for (int l = 0; l < WORD_ELEMS; l++) {
+            #pragma HLS UNROLL
+            sums[w * WORD_ELEMS + l] = 0;
+        }
+    }
+    
+    GAP_ACCUMULATE:
+    for (int s = 0; s < spatial_size; s++) {
+        for (int w = 0; w < pixel_words; w++) {
+            #pragma HLS PIPELINE II=1
+            #pragma HLS DEPENDENCE variable=sums inter false
+            if (w < words) {
+                word_t word = input[s * words + w];
+                for (int l = 0; l < WORD_ELEMS; l++) {
+                    #pragma HLS UNROLL
+                    sums[w * WORD_ELEMS + l] += word_element(word, l);
+                }
+            }
+        }
+    }
+    
+    GAP_WRITE:
+    for (int w = 0; w < words; w++) {
+        #pragma HLS PIPELINE II=1
+        word_t result;
+        for (int l = 0; l < WORD_ELEMS; l++) {
+            #pragma HLS UNROLL
+            set_word_element(result, l, gap_average(sums[w * WORD_ELEMS + l], reciprocal));
+        }
+        output[w] = result;
+    }
+    monitor.end_stream(spatial_size * words, words);
+}
+
+// Main pooling accelerator. Pixels are whole words of channels
+// (channels a multiple of WORD_ELEMS), each pooled a word at a time.
 void pooling_accelerator(
-    data_t *input,              // Input feature map
-    data_t *output,             // Output feature map
+    word_t *input,              // Input feature map
+    word_t *output,             // Output feature map
     PoolConfig config,          // Pooling configuration
-    PoolingType pool_type       // MAX_POOL or AVG_POOL
+    PoolingType pool_type,      // MAX_POOL, AVG_POOL or GLOBAL_AVG_POOL
+    volatile perf_t *cycle_count,           // Free-running cycle counter
+    perf_t perf[PERF_COUNTER_COUNT]         // Performance counters (read-only)
 ) {
-    #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem0 depth=50176
-    #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem1 depth=50176
+    #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem0 depth=6272
+    #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem1 depth=6272
     #pragma HLS INTERFACE s_axilite port=config bundle=control
     #pragma HLS INTERFACE s_axilite port=pool_type bundle=control
+    #pragma HLS INTERFACE ap_none port=cycle_count
+    #pragma HLS INTERFACE s_axilite port=perf bundle=control
     #pragma HLS INTERFACE s_axilite port=return bundle=control
     
+    static perf_t perf_totals[PERF_COUNTER_COUNT];
+    PerfMonitor monitor(cycle_count);
+    perf_t read_beats = 0;
+    
+    if (pool_type == GLOBAL_AVG_POOL) {
+        global_avg_pooling(input, output, config.input_height, config.input_width,
+                           config.channels, config.reciprocal, monitor);
+        monitor.publish(perf_totals, perf);
+        return;
+    }
+    
     // Calculate output dimensions
     int output_height = (config.input_height + 2 * config.padding - config.pool_size) / config.stride + 1;
     int output_width = (config.input_width + 2 * config.padding - config.pool_size) / config.stride + 1;
     
+    int words = config.channels / WORD_ELEMS;
     int output_idx = 0;
     
     // Process each output position
+    monitor.begin_phase();
     OUTPUT_HEIGHT:
     for (int oh = 0; oh < output_height; oh++) {
         OUTPUT_WIDTH:
         for (int ow = 0; ow < output_width; ow++) {
             CHANNELS:
-            for (int c = 0; c < config.channels; c++) {
+            for (int w = 0; w < words; w++) {
                 #pragma HLS PIPELINE II=1
                 
-                // Extract pooling window
-                data_t window[9];  // Maximum 3x3 window
-                #pragma HLS ARRAY_PARTITION variable=window complete
+                // Extract pooling windows, one per channel of the word
+                data_t window[WORD_ELEMS][9];  // Maximum 3x3 window
+                #pragma HLS ARRAY_PARTITION variable=window complete dim=0
                 
                 int window_idx = 0;
                 int ih_base = oh * config.stride - config.padding;
@@ -90,64 +177,42 @@ void pooling_accelerator(
                         int iw = iw_base + pw;
                         
                         // Handle padding
-                        if (ih >= 0 && ih < config.input_height && 
-                            iw >= 0 && iw < config.input_width) {
-                            int input_idx = (ih * config.input_width + iw) * config.channels + c;
-                            window[window_idx] = input[input_idx];
-                        } else {
+                        word_t word = 0;
+                        bool inside = ih >= 0 && ih < config.input_height &&
+                                      iw >= 0 && iw < config.input_width;
+                        if (inside) {
+                            word = input[(ih * config.input_width + iw) * words + w];
+                            read_beats++;
+                        }
+                        for (int l = 0; l < WORD_ELEMS; l++) {
+                            #pragma HLS UNROLL
                             // For max pooling, use minimum value; for avg pooling, use 0
-                            window[window_idx] = (pool_type == MAX_POOL) ? -128 : 0;
+                            window[l][window_idx] = inside ? word_element(word, l)
+                                                           : (data_t)((pool_type == MAX_POOL) ? -128 : 0);
                         }
                         window_idx++;
                     }
                 }
                 
                 // Compute pooling result
-                data_t result;
+                word_t result;
                 int window_size = config.pool_size * config.pool_size;
                 
-                if (pool_type == MAX_POOL) {
-                    result = max_pool_window(window, window_size);
-                } else {
-                    result = avg_pool_window(window, window_size);
+                for (int l = 0; l < WORD_ELEMS; l++) {
+                    #pragma HLS UNROLL
+                    if (pool_type == MAX_POOL) {
+                        set_word_element(result, l, max_pool_window(window[l], window_size));
+                    } else {
+                        set_word_element(result, l, avg_pool_window(window[l], window_size));
+                    }
                 }
                 
-                output[output_idx * config.channels + c] = result;
+                output[output_idx * words + w] = result;
             }
             output_idx++;
         }
     }
-}
-
-// Global average pooling (commonly used in MobileNet)
-void global_avg_pooling(
-    data_t *input,              // Input feature map [H x W x C]
-    data_t *output,             // Output vector [C]
-    int height,
-    int width,
-    int channels
-) {
-    #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem0
-    #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem1
-    #pragma HLS INTERFACE s_axilite port=height bundle=control
-    #pragma HLS INTERFACE s_axilite port=width bundle=control
-    #pragma HLS INTERFACE s_axilite port=channels bundle=control
-    #pragma HLS INTERFACE s_axilite port=return bundle=control
+    monitor.end_stream(read_beats, output_height * output_width * words);
     
-    int spatial_size = height * width;
-    
-    CHANNELS:
-    for (int c = 0; c < channels; c++) {
-        #pragma HLS PIPELINE off
-        
-        acc_t sum = 0;
-        
-        SPATIAL:
-        for (int s = 0; s < spatial_size; s++) {
-            #pragma HLS PIPELINE II=1
-            sum += input[s * channels + c];
-        }
-        
-        output[c] = (data_t)(sum / spatial_size);
-    }
+    monitor.publish(perf_totals, perf);
 }
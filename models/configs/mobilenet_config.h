@@ -92,8 +92,16 @@ extern const QuantParams FC_QUANT;
 // ============================================================================
 
 // Parallel processing units
-#define CONV_PE_NUM 16          // Number of parallel processing elements for convolution
-#define CONV_SIMD_FACTOR 8      // SIMD parallelism within each PE
+#define CONV_PE_NUM 16          // Output channels of the pointwise PE array (even: PEs
+                                // share DSP48s in pairs; a multiple of AXI_WORD_BYTES)
+#define CONV_SIMD_FACTOR 16     // Input channels each PE takes per cycle
+#define CONV_PW_PIXELS 64       // Pixels per block of the pointwise engine
+#define CONV_DW_LANES 2         // Channels the depthwise engine computes per cycle
+
+// Longest padded input row (columns x channels) the depthwise engine's line
+// buffers hold. At int8 that covers every MobileNetV1 depthwise layer, the
+// longest row being (7 + 2) x 1024.
+#define CONV_DW_LINE_LENGTH ((MAX_FEATURE_MAP_WIDTH + 2) * 128)
 
 // Tiling parameters for large feature maps
 #define TILE_HEIGHT 14
@@ -104,20 +112,217 @@ extern const QuantParams FC_QUANT;
 #define AXI_DATA_WIDTH 64       // 64-bit AXI data bus
 #define AXI_BURST_LEN 256       // Maximum burst length
 
-// Memory-mapped register addresses (example offsets)
+// The accelerators' memory ports move whole bus words: AXI_WORD_BYTES int8
+// elements per beat. Every tensor they access starts on a word, and the
+// conv block's output rows (output_c and output_stride) and pooling's
+// channel counts are whole words.
+#define AXI_WORD_BYTES (AXI_DATA_WIDTH / 8)
+
+// Memory-mapped accelerator blocks. Each IP core has its own 64KB AXI-Lite
+// window; register macros are byte offsets within a block.
 #define FPGA_BASE_ADDR 0x43C00000
-#define CONV_CTRL_REG (FPGA_BASE_ADDR + 0x00)
-#define CONV_STATUS_REG (FPGA_BASE_ADDR + 0x04)
-#define CONV_INPUT_ADDR_REG (FPGA_BASE_ADDR + 0x08)
-#define CONV_OUTPUT_ADDR_REG (FPGA_BASE_ADDR + 0x0C)
-#define CONV_WEIGHT_ADDR_REG (FPGA_BASE_ADDR + 0x10)
-#define CONV_CONFIG_REG (FPGA_BASE_ADDR + 0x14)
+#define CONV_BASE_ADDR FPGA_BASE_ADDR
+#define ACTIVATION_BASE_ADDR 0x43C10000
+#define POOLING_BASE_ADDR 0x43C20000
+#define CLASSIFIER_BASE_ADDR 0x43C30000
+#define ACCEL_BLOCK_SIZE 0x10000
+
+// Scatter-gather AXI DMA (Xilinx AXI DMA, 64KB window) for tensor copies
+#define AXI_DMA_BASE_ADDR 0x40400000
+
+// Registers every block has at the same offset
+#define ACCEL_CTRL_REG 0x00
+#define ACCEL_STATUS_REG 0x04
+#define ACCEL_IRQ_ENABLE_REG 0x2C   // 1 = raise the interrupt line on done
+#define ACCEL_IRQ_STATUS_REG 0x30   // pending bit, write 1 to clear
+
+// Performance counters (read-only). They accumulate across runs and wrap
+// at 2^32; read them before and after a run and take the difference.
+#define ACCEL_PERF_TOTAL_CYCLES_REG 0x40    // Start to done
+#define ACCEL_PERF_BUSY_CYCLES_REG 0x44     // Computing
+#define ACCEL_PERF_READ_BEATS_REG 0x48      // AXI read data beats
+#define ACCEL_PERF_WRITE_BEATS_REG 0x4C     // AXI write data beats
+#define ACCEL_PERF_READ_STALL_REG 0x50      // Read phases waiting on data
+#define ACCEL_PERF_WRITE_STALL_REG 0x54     // Write phases waiting on the bus
+
+// Conv block
+#define CONV_CTRL_REG ACCEL_CTRL_REG
+#define CONV_STATUS_REG ACCEL_STATUS_REG
+#define CONV_INPUT_ADDR_REG 0x08
+#define CONV_OUTPUT_ADDR_REG 0x0C
+#define CONV_WEIGHT_ADDR_REG 0x10
+#define CONV_CONFIG_REG 0x14        // kernel[31:24] stride[23:16] padding[15:8] prefetch[7] mid_relu6[6]
+                                    // mode[5:4] relu6[3] pool[2] mid_relu[1] relu[0]
+#define CONV_BIAS_ADDR_REG 0x18
+#define CONV_IN_HEIGHT_REG 0x1C     // ConvConfig dimensions, one register each
+#define CONV_IN_WIDTH_REG 0x20
+#define CONV_IN_CHANNELS_REG 0x24
+#define CONV_OUT_CHANNELS_REG 0x28
+#define CONV_OUT_STRIDE_REG 0x34    // Channels between output pixels, 0 = output channels
+#define CONV_PW_WEIGHT_ADDR_REG 0x58    // Separable mode: pointwise kernel
+#define CONV_PW_BIAS_ADDR_REG 0x5C      // Separable mode: pointwise bias
+#define CONV_POOL_RECIP_REG 0x60        // CONV_CONFIG_POOL: GAP_RECIPROCAL(output pixels)
+#define CONV_PREFETCH_ADDR_REG 0x64     // Program mode: base of the prefetch port, 0
+#define CONV_BATCH_REG 0x68             // Images in the run, 0 = one
+
+// Conv modes. Depthwise convolves each channel with its own k x k kernel
+// (weights [c][k][k], output channels = input channels); pointwise is a
+// 1x1 conv without the window loops. Separable is a 3x3 depthwise layer
+// (weight and bias registers) feeding a pointwise layer (the PW registers)
+// on chip: only the block's input and output touch DDR. Output channels
+// are the pointwise layer's; CONV_CONFIG_MID_RELU or CONV_CONFIG_MID_RELU6
+// applies ReLU or ReLU6 between. CONV_CONFIG_RELU6 clamps the output to
+// [0, 6] in the output stage, as the relu bit clamps it at 0.
+// CONV_CONFIG_POOL makes a streamed pointwise or separable layer average
+// its output over the map in the output stage and write only the output_c
+// pooled values.
+//
+// With CONV_BATCH_REG = N the run convolves N images with the one set of
+// weights: their input maps follow each other in DDR, and so do the output
+// maps (or each image's output_c pooled values). The block loads a layer's
+// preload and each weight tile once and takes every image through it.
+#define CONV_MODE_DENSE 0
+#define CONV_MODE_DEPTHWISE 1
+#define CONV_MODE_POINTWISE 2
+#define CONV_MODE_SEPARABLE 3
+#define CONV_CONFIG_MID_RELU (1u << 1)
+#define CONV_CONFIG_POOL (1u << 2)
+#define CONV_CONFIG_RELU6 (1u << 3)
+#define CONV_CONFIG_MID_RELU6 (1u << 6)
+#define CONV_CONFIG_PREFETCH (1u << 7)
+
+// Conv program mode. With CONV_PROGRAM_LEN_REG non-zero, START runs that
+// many layer descriptors from CONV_PROGRAM_ADDR_REG back to back and raises
+// one done interrupt at the end; the per-layer registers are ignored and
+// the seven address registers must be 0, since descriptor addresses are
+// absolute. A descriptor holds what the per-layer registers would.
+// CONV_CONFIG_PREFETCH in a descriptor announces the next one: while the
+// layer runs, the block fetches the next descriptor and loads that layer's
+// depthwise kernels and biases into its second bank, so it starts without
+// a preload. Nothing prefetched may be written by the layer running.
+#define CONV_PROGRAM_ADDR_REG 0x38
+#define CONV_PROGRAM_LEN_REG 0x3C
+#define CONV_PROGRAM_MAX_LAYERS 64
+
+struct ConvLayerDescriptor {
+    uint32_t input_addr;
+    uint32_t output_addr;
+    uint32_t weight_addr;
+    uint32_t bias_addr;
+    uint32_t config;            // CONV_CONFIG_PACK
+    uint32_t in_height;
+    uint32_t in_width;
+    uint32_t in_channels;
+    uint32_t out_channels;
+    uint32_t out_stride;
+    uint32_t pw_weight_addr;    // Separable mode only
+    uint32_t pw_bias_addr;
+    uint32_t pool_reciprocal;   // CONV_CONFIG_POOL only
+    uint32_t batch;             // Images, 0 = one
+    uint32_t reserved[2];       // Pads a descriptor to one 64-byte burst
+};
+
+// Activation block
+#define ACT_INPUT_ADDR_REG 0x08
+#define ACT_OUTPUT_ADDR_REG 0x0C
+#define ACT_SIZE_REG 0x10           // Elements
+#define ACT_TYPE_REG 0x14           // ACT_TYPE_*
+
+#define ACT_TYPE_RELU 0
+#define ACT_TYPE_RELU6 1
+
+// Pooling block
+#define POOL_INPUT_ADDR_REG 0x08
+#define POOL_OUTPUT_ADDR_REG 0x0C
+#define POOL_IN_HEIGHT_REG 0x10
+#define POOL_IN_WIDTH_REG 0x14
+#define POOL_CHANNELS_REG 0x18
+#define POOL_CONFIG_REG 0x1C        // size[31:24] stride[23:16] padding[15:8] type[1:0]
+#define POOL_RECIP_REG 0x20         // Global average: GAP_RECIPROCAL(height * width)
+
+#define POOL_TYPE_MAX 0
+#define POOL_TYPE_AVG 1
+#define POOL_TYPE_GLOBAL_AVG 2      // Whole feature map to one value per channel
+
+// Global average pooling divides each channel's sum by the pixel count
+// with a multiply the host precomputes: (|sum| * GAP_RECIPROCAL(pixels)) >>
+// GAP_RECIP_SHIFT with the sign put back. For int8 maps of up to
+// GAP_MAX_PIXELS pixels that is exactly the truncating division.
+#define GAP_RECIP_SHIFT 31
+#define GAP_MAX_PIXELS 4096
+#define GAP_RECIPROCAL(pixels) \
+    ((uint32_t)(((1ull << GAP_RECIP_SHIFT) + (pixels) - 1) / (pixels)))
+
+// Classifier block: a fully connected layer (weights [classes][inputs],
+// int32 bias, >> 8 and saturated like the host) that keeps only the top_k
+// best logits and the softmax denominator, so the host never reads the
+// whole logit vector
+#define CLS_INPUT_ADDR_REG 0x08
+#define CLS_OUTPUT_ADDR_REG 0x0C    // A ClassifierOutput
+#define CLS_WEIGHT_ADDR_REG 0x10
+#define CLS_BIAS_ADDR_REG 0x14
+#define CLS_INPUTS_REG 0x18         // Multiple of AXI_WORD_BYTES
+#define CLS_CLASSES_REG 0x1C
+#define CLS_TOP_K_REG 0x20
+
+#define CLASSIFIER_MAX_INPUTS 1024
+#define CLASSIFIER_MAX_CLASSES 4096
+#define CLASSIFIER_MAX_TOP_K 8
+
+// The denominator is sum(exp(logit - best)) over every class, counted from
+// a histogram of the int8 logits: exp(-d) for d = 0 .. CLASSIFIER_EXP_TERMS-1
+// in CLASSIFIER_EXP_SHIFT fixed point; further terms round to zero
+#define CLASSIFIER_EXP_SHIFT 31
+#define CLASSIFIER_EXP_TERMS 23
+#define CLASSIFIER_EXP_TABLE { \
+    2147483648u, 790015084u, 290630308u, 106916915u, 39332535u, 14469631u, \
+    5323080u, 1958252u, 720401u, 265021u, 97496u, 35867u, 13195u, 4854u, \
+    1786u, 657u, 242u, 89u, 33u, 12u, 4u, 2u, 1u }
+
+// What the classifier writes: the 64-bit denominator, then top_k entries
+// (class << 8 | logit byte), best first and, among equal logits, lowest
+// class first
+struct ClassifierOutput {
+    uint32_t exp_sum_low;
+    uint32_t exp_sum_high;
+    uint32_t top[CLASSIFIER_MAX_TOP_K];
+};
+
+#define CLASSIFIER_ENTRY(cls, logit) (((uint32_t)(cls) << 8) | ((uint32_t)(logit) & 0xFFu))
+#define CLASSIFIER_ENTRY_CLASS(entry) ((int)((entry) >> 8))
+#define CLASSIFIER_ENTRY_LOGIT(entry) ((int8_t)((entry) & 0xFFu))
+
+// Accelerator clock (FCLK0), for converting cycle counts to time
+#define FPGA_CLOCK_MHZ 100
+
+#define CONV_CONFIG_PACK(kernel, stride, padding, mode, relu) \
+    (((uint32_t)(kernel) << 24) | ((uint32_t)(stride) << 16) | \
+     ((uint32_t)(padding) << 8) | (((uint32_t)(mode) & 3u) << 4) | ((relu) ? 1u : 0u))
+
+// Whether the fused separable engine takes a depthwise layer of this shape
+#define CONV_SEPARABLE_FITS(input_w, channels, kernel, stride, padding) \
+    ((kernel) == 3 && ((stride) == 1 || (stride) == 2) && (channels) % AXI_WORD_BYTES == 0 && \
+     ((((input_w) + 2 * (padding) - 3) / (stride)) * (stride) + 3) * (channels) <= CONV_DW_LINE_LENGTH)
+
+#define POOL_CONFIG_PACK(size, stride, padding, type) \
+    (((uint32_t)(size) << 24) | ((uint32_t)(stride) << 16) | \
+     ((uint32_t)(padding) << 8) | ((uint32_t)(type) & 3u))
 
 // Control register bits
 #define CTRL_START_BIT (1 << 0)
 #define CTRL_RESET_BIT (1 << 1)
 #define STATUS_DONE_BIT (1 << 0)
 #define STATUS_IDLE_BIT (1 << 1)
+#define IRQ_DONE_BIT (1 << 0)
+
+// UIO devices (name in /sys/class/uio/uioN/name) carrying each block's
+// done interrupt, IRQ_F2P[0..2] and IRQ_F2P[5] for the classifier, and the
+// DMA's S2MM interrupt, IRQ_F2P[4]
+#define CONV_UIO_NAME "conv_accelerator"
+#define ACTIVATION_UIO_NAME "activation_accelerator"
+#define POOLING_UIO_NAME "pooling_accelerator"
+#define CLASSIFIER_UIO_NAME "classifier_accelerator"
+#define AXI_DMA_UIO_NAME "axi_dma"
 
 // ============================================================================
 // Performance Configuration
@@ -11,13 +11,15 @@ import argparse
 import os
 import struct
 
-def quantize_mobilenet_v1(model_path, output_dir):
+def quantize_mobilenet_v1(model_path, output_dir, alpha=1.0, resolution=224):
     """
     Quantize MobileNetV1 model to INT8
     
     Args:
         model_path: Path to pre-trained model (.h5 or SavedModel)
         output_dir: Directory to save quantized weights
+        alpha: Width multiplier of the pre-trained variant (1.0, 0.75, 0.5, 0.25)
+        resolution: Input resolution of the pre-trained variant (224, 192, 160, 128)
     """
     print(f"Loading model from {model_path}...")
     
@@ -25,8 +27,8 @@ def quantize_mobilenet_v1(model_path, output_dir):
     if model_path.endswith('.h5'):
         model = keras.models.load_model(model_path)
     else:
-        model = keras.applications.MobileNet(weights='imagenet', 
-                                             input_shape=(224, 224, 3))
+        model = keras.applications.MobileNet(weights='imagenet', alpha=alpha,
+                                             input_shape=(resolution, resolution, 3))
     
     print("Model loaded successfully")
     print(f"Total layers: {len(model.layers)}")
@@ -39,9 +41,12 @@ def quantize_mobilenet_v1(model_path, output_dir):
     # Quantization parameters
     quant_params = {}
     
+    # Layer graph in execution order, written to weights/network.txt
+    network_layers = []
+    
     # Process each layer
     layer_idx = 0
-    for layer in model.layers:
+    for index, layer in enumerate(model.layers):
         if isinstance(layer, (keras.layers.Conv2D, keras.layers.DepthwiseConv2D)):
             print(f"\nProcessing layer: {layer.name}")
             
@@ -54,6 +59,14 @@ def quantize_mobilenet_v1(model_path, output_dir):
             kernel = weights[0]  # Convolution kernel
             bias = weights[1] if len(weights) > 1 else np.zeros(kernel.shape[-1])
             
+            # Batch norm runs nowhere at inference: fold it into the kernel
+            # and bias it follows
+            bn = following_batch_norm(model, index)
+            if bn is not None:
+                kernel, bias = fold_batch_norm(kernel, bias, bn,
+                                               isinstance(layer, keras.layers.DepthwiseConv2D))
+                print(f"  Folded {bn.name}")
+            
             # Compute quantization parameters
             kernel_min, kernel_max = kernel.min(), kernel.max()
             kernel_scale = (kernel_max - kernel_min) / 255.0
@@ -84,6 +97,9 @@ def quantize_mobilenet_v1(model_path, output_dir):
                 'bias_shape': bias.shape
             }
             
+            network_layers.append(describe_layer(layer, layer_idx, quant_params[layer.name],
+                                                 following_activation(model, index)))
+            
             print(f"  Kernel shape: {kernel.shape}")
             print(f"  Kernel scale: {kernel_scale:.6f}")
             print(f"  Kernel zero point: {kernel_zero_point}")
@@ -91,6 +107,11 @@ def quantize_mobilenet_v1(model_path, output_dir):
             
             layer_idx += 1
     
+    # Generate the network description read by the runtime executor
+    input_shape = model.input_shape
+    generate_network_description(network_layers, model.name, input_shape[1:],
+                                 os.path.join(output_dir, 'weights', 'network.txt'))
+    
     # Generate C header file with quantization parameters
     generate_c_header(quant_params, os.path.join(output_dir, 'configs', 'quant_params.h'))
     
@@ -101,6 +122,122 @@ def quantize_mobilenet_v1(model_path, output_dir):
     print(f"Total quantized layers: {layer_idx}")
     print(f"Output directory: {output_dir}")
 
+def following_batch_norm(model, index):
+    """The BatchNormalization layer fed by model.layers[index], if any"""
+    
+    # Keras' MobileNet lists each conv's batch norm straight after it
+    if index + 1 < len(model.layers):
+        layer = model.layers[index + 1]
+        if isinstance(layer, keras.layers.BatchNormalization):
+            return layer
+    return None
+
+def following_activation(model, index):
+    """The network.txt activation applied to model.layers[index]'s output"""
+    
+    # The activation follows the conv's batch norm as its own layer
+    # (conv1_relu is ReLU(6.)), or is built into the conv
+    for layer in model.layers[index + 1:index + 3]:
+        if isinstance(layer, keras.layers.BatchNormalization):
+            continue
+        if isinstance(layer, keras.layers.ReLU):
+            return 'relu6' if layer.max_value == 6 else 'relu'
+        if isinstance(layer, keras.layers.Activation):
+            return activation_name(layer.activation)
+        break
+    return activation_name(model.layers[index].activation)
+
+def activation_name(function):
+    """Map a Keras activation function to its network.txt token"""
+    
+    name = getattr(function, '__name__', '')
+    return name if name in ('relu', 'relu6') else 'none'
+
+def fold_batch_norm(kernel, bias, bn, depthwise):
+    """
+    Fold an inference-mode batch norm into the conv before it:
+    gamma * (conv(x) + bias - mean) / sqrt(variance + epsilon) + beta
+    is conv'(x) + bias' with each output channel's kernel scaled by
+    gamma / sqrt(variance + epsilon)
+    """
+    
+    params = bn.get_weights()
+    gamma = params.pop(0) if bn.scale else np.ones_like(params[-1])
+    beta = params.pop(0) if bn.center else np.zeros_like(params[-1])
+    mean, variance = params
+    scale = gamma / np.sqrt(variance + bn.epsilon)
+    
+    # Depthwise kernels are [k][k][c][1], one output per input channel;
+    # dense kernels end in the output channel
+    if depthwise:
+        kernel = kernel * scale.reshape(1, 1, -1, 1)
+    else:
+        kernel = kernel * scale
+    bias = (bias - mean) * scale + beta
+    return kernel, bias
+
+def describe_layer(layer, layer_idx, params, activation):
+    """Build the network.txt record for a Conv2D/DepthwiseConv2D layer"""
+    
+    kernel_shape = params['kernel_shape']
+    kernel_size = kernel_shape[0]
+    stride = layer.strides[0]
+    
+    if isinstance(layer, keras.layers.DepthwiseConv2D):
+        op, out_c = 'dwconv', 0
+    elif layer.name == 'conv_preds':
+        op, out_c = 'fc', kernel_shape[-1]
+    elif kernel_size == 1:
+        op, out_c = 'pwconv', kernel_shape[-1]
+    else:
+        op, out_c = 'conv', kernel_shape[-1]
+    
+    # Keras pads strided convs with an explicit ZeroPadding2D layer and
+    # 'valid' padding; the runtime kernels use symmetric 'same' padding,
+    # which gives the same output size
+    padding = kernel_size // 2
+    
+    return {
+        'op': op,
+        'name': layer.name,
+        'out_c': out_c,
+        'kernel_size': kernel_size,
+        'stride': stride,
+        'padding': padding,
+        'activation': activation,
+        'weight_index': layer_idx,
+        'kernel_scale': params['kernel_scale'],
+        'kernel_zero_point': params['kernel_zero_point'],
+        'bias_scale': params['bias_scale'],
+    }
+
+def generate_network_description(network_layers, model_name, input_shape, output_file):
+    """Generate the layer graph consumed by the C++ NetworkGraph loader"""
+    
+    def record(op, name, out_c=0, kernel_size=0, stride=1, padding=0,
+               activation='none', weight_index=-1, kernel_scale=0.0,
+               kernel_zero_point=0, bias_scale=0.0):
+        return (f"layer {op} {name} {out_c} {kernel_size} {stride} {padding} "
+                f"{activation} {weight_index} {kernel_scale:.8f} "
+                f"{kernel_zero_point} {bias_scale:.8f}\n")
+    
+    with open(output_file, 'w') as f:
+        f.write("# layer <op> <name> <out_c> <kernel> <stride> <padding> <activation>\n")
+        f.write("#       <weight_index> <kernel_scale> <kernel_zero_point> <bias_scale>\n")
+        f.write(f"name {model_name}\n")
+        f.write(f"input {input_shape[0]} {input_shape[1]} {input_shape[2]}\n")
+        
+        for layer in network_layers:
+            # Global average pooling sits between the last block and the
+            # classifier
+            if layer['op'] == 'fc':
+                f.write(record('gap', 'global_average_pooling'))
+            f.write(record(**layer))
+        
+        f.write(record('softmax', 'softmax'))
+    
+    print(f"Generated network description: {output_file}")
+
 def generate_c_header(quant_params, output_file):
     """Generate C header file with quantization parameters"""
     
@@ -173,10 +310,14 @@ def main():
                         help='Model path or "imagenet" to download pre-trained')
     parser.add_argument('--output', type=str, default='../models/quantized',
                         help='Output directory for quantized weights')
+    parser.add_argument('--alpha', type=float, default=1.0,
+                        help='Width multiplier of the MobileNetV1 variant')
+    parser.add_argument('--resolution', type=int, default=224,
+                        help='Input resolution of the MobileNetV1 variant')
     
     args = parser.parse_args()
     
-    quantize_mobilenet_v1(args.model, args.output)
+    quantize_mobilenet_v1(args.model, args.output, args.alpha, args.resolution)
 
 if __name__ == '__main__':
     main()
@@ -57,12 +57,25 @@ else
 fi
 echo ""
 
+# Build classifier accelerator
+echo "=== Building Classifier Accelerator ==="
+cd ../classifier
+$HLS_TOOL -f run_hls.tcl
+if [ $? -eq 0 ]; then
+    echo "✓ Classifier accelerator built successfully"
+else
+    echo "✗ Classifier accelerator build failed"
+    exit 1
+fi
+echo ""
+
 echo "=== All HLS Builds Complete ==="
 echo ""
 echo "IP cores exported to:"
 echo "  - hardware/hls/conv_accelerator/conv_accelerator_proj/solution1/impl/ip/"
 echo "  - hardware/hls/activation/activation_accelerator_proj/solution1/impl/ip/"
 echo "  - hardware/hls/pooling/pooling_accelerator_proj/solution1/impl/ip/"
+echo "  - hardware/hls/classifier/classifier_accelerator_proj/solution1/impl/ip/"
 echo ""
 echo "Next steps:"
 echo "  1. Open Vivado"
@@ -14,6 +14,7 @@ set ip_repos [list \
     "../hardware/hls/conv_accelerator/conv_accelerator_proj/solution1/impl/ip" \
     "../hardware/hls/activation/activation_accelerator_proj/solution1/impl/ip" \
     "../hardware/hls/pooling/pooling_accelerator_proj/solution1/impl/ip" \
+    "../hardware/hls/classifier/classifier_accelerator_proj/solution1/impl/ip" \
 ]
 set_property  ip_repo_paths  ${ip_repos} [current_project]
 update_ip_catalog
@@ -48,6 +49,24 @@ if {[catch {apply_bd_automation -rule xilinx.com:bd_rule:processing_system7 -con
 create_bd_cell -type ip -vlnv user:cnn:Conv2D_Accelerator:1.0 conv_accelerator_0
 create_bd_cell -type ip -vlnv user:cnn:Activation_Accelerator:1.0 activation_accelerator_0
 create_bd_cell -type ip -vlnv user:cnn:Pooling_Accelerator:1.0 pooling_accelerator_0
+create_bd_cell -type ip -vlnv user:cnn:Classifier_Accelerator:1.0 classifier_accelerator_0
+
+# Scatter-gather AXI DMA for tensor copies. MM2S is looped back into S2MM
+# through a stream FIFO, so one descriptor chain gathers the source and
+# another scatters the destination (tiles in and out of feature maps).
+create_bd_cell -type ip -vlnv xilinx.com:ip:axi_dma:7.1 axi_dma_0
+set_property -dict [list \
+    CONFIG.c_include_sg {1} \
+    CONFIG.c_sg_length_width {23} \
+    CONFIG.c_sg_include_stscntrl_strm {0} \
+    CONFIG.c_m_axi_mm2s_data_width {64} \
+    CONFIG.c_m_axis_mm2s_tdata_width {64} \
+    CONFIG.c_m_axi_s2mm_data_width {64} \
+    CONFIG.c_mm2s_burst_size {256} \
+    CONFIG.c_s2mm_burst_size {256} \
+] [get_bd_cells axi_dma_0]
+create_bd_cell -type ip -vlnv xilinx.com:ip:axis_data_fifo:2.0 axi_dma_loopback_fifo
+set_property -dict [list CONFIG.FIFO_DEPTH {512}] [get_bd_cells axi_dma_loopback_fifo]
 
 # 6. Interconnects
 # SmartConnect for High Performance Data Transfer (HLS -> DDR)
@@ -56,9 +75,14 @@ create_bd_cell -type ip -vlnv xilinx.com:ip:smartconnect:1.0 axi_mem_interconnec
 # Configure SmartConnect for 6 Slave interfaces (4 for Conv, 1 Act, 1 Pool)
 set_property -dict [list CONFIG.NUM_SI {6}] [get_bd_cells axi_mem_interconnect]
 
-# AXI Interconnect for Control (Zynq -> HLS)
+# Second SmartConnect for the DMA's SG, MM2S and S2MM masters, on HP1 so
+# copies do not queue behind the accelerators on HP0
+create_bd_cell -type ip -vlnv xilinx.com:ip:smartconnect:1.0 axi_dma_interconnect
+set_property -dict [list CONFIG.NUM_SI {3}] [get_bd_cells axi_dma_interconnect]
+
+# AXI Interconnect for Control (Zynq -> HLS, DMA)
 create_bd_cell -type ip -vlnv xilinx.com:ip:axi_interconnect:2.1 ps7_0_axi_periph
-set_property -dict [list CONFIG.NUM_MI {3}] [get_bd_cells ps7_0_axi_periph]
+set_property -dict [list CONFIG.NUM_MI {5}] [get_bd_cells ps7_0_axi_periph]
 
 # 7. Clocks and Resets
 create_bd_cell -type ip -vlnv xilinx.com:ip:proc_sys_reset:5.0 rst_ps7_0_100M
@@ -75,7 +99,7 @@ connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins rst_ps7
 connect_bd_net [get_bd_pins processing_system7_0/FCLK_RESET0_N] [get_bd_pins rst_ps7_0_100M/ext_reset_in]
 
 # Connect Clocks to HLS IPs and Interconnects
-set ip_list [list conv_accelerator_0 activation_accelerator_0 pooling_accelerator_0 axi_mem_interconnect ps7_0_axi_periph]
+set ip_list [list conv_accelerator_0 activation_accelerator_0 pooling_accelerator_0 classifier_accelerator_0 axi_mem_interconnect axi_dma_interconnect ps7_0_axi_periph]
 foreach ip $ip_list {
     connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins $ip/aclk]
 }
@@ -83,6 +107,13 @@ foreach ip $ip_list {
 foreach ip $ip_list {
     connect_bd_net [get_bd_pins rst_ps7_0_100M/peripheral_aresetn] [get_bd_pins $ip/aresetn]
 }
+# The DMA and the FIFO name their clock and reset pins differently
+foreach pin [list s_axi_lite_aclk m_axi_sg_aclk m_axi_mm2s_aclk m_axi_s2mm_aclk] {
+    connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins axi_dma_0/$pin]
+}
+connect_bd_net [get_bd_pins rst_ps7_0_100M/peripheral_aresetn] [get_bd_pins axi_dma_0/axi_resetn]
+connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins axi_dma_loopback_fifo/s_axis_aclk]
+connect_bd_net [get_bd_pins rst_ps7_0_100M/peripheral_aresetn] [get_bd_pins axi_dma_loopback_fifo/s_axis_aresetn]
 # Connect Interconnect specific clocks/resets
 connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins ps7_0_axi_periph/S00_ACLK]
 connect_bd_net [get_bd_pins rst_ps7_0_100M/peripheral_aresetn] [get_bd_pins ps7_0_axi_periph/S00_ARESETN]
@@ -92,7 +123,21 @@ connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins ps7_0_a
 connect_bd_net [get_bd_pins rst_ps7_0_100M/peripheral_aresetn] [get_bd_pins ps7_0_axi_periph/M01_ARESETN]
 connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins ps7_0_axi_periph/M02_ACLK]
 connect_bd_net [get_bd_pins rst_ps7_0_100M/peripheral_aresetn] [get_bd_pins ps7_0_axi_periph/M02_ARESETN]
-
+connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins ps7_0_axi_periph/M03_ACLK]
+connect_bd_net [get_bd_pins rst_ps7_0_100M/peripheral_aresetn] [get_bd_pins ps7_0_axi_periph/M03_ARESETN]
+connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins ps7_0_axi_periph/M04_ACLK]
+connect_bd_net [get_bd_pins rst_ps7_0_100M/peripheral_aresetn] [get_bd_pins ps7_0_axi_periph/M04_ARESETN]
+
+# Free-running cycle counter sampled by every accelerator's performance
+# counters (cycle_count port)
+create_bd_cell -type ip -vlnv xilinx.com:ip:c_counter_binary:12.0 cycle_counter
+set_property -dict [list CONFIG.Output_Width {32}] [get_bd_cells cycle_counter]
+connect_bd_net [get_bd_pins processing_system7_0/FCLK_CLK0] [get_bd_pins cycle_counter/CLK]
+connect_bd_net [get_bd_pins cycle_counter/Q] \
+    [get_bd_pins conv_accelerator_0/cycle_count] \
+    [get_bd_pins activation_accelerator_0/cycle_count] \
+    [get_bd_pins pooling_accelerator_0/cycle_count] \
+    [get_bd_pins classifier_accelerator_0/cycle_count]
 
 # 8. Data Connections (HLS -> SmartConnect -> Zynq HP)
 # Conv Accelerator (4 ports)
@@ -112,30 +157,55 @@ connect_bd_intf_net [get_bd_intf_pins activation_accelerator_0/m_axi_gmem2] [get
 # Pooling (2 ports)
 connect_bd_intf_net [get_bd_intf_pins pooling_accelerator_0/m_axi_gmem0] [get_bd_intf_pins axi_mem_interconnect/S07_AXI]
 connect_bd_intf_net [get_bd_intf_pins pooling_accelerator_0/m_axi_gmem1] [get_bd_intf_pins axi_mem_interconnect/S08_AXI]
+# Classifier (4 ports - features, weights, bias, result)
+set_property -dict [list CONFIG.NUM_SI {13}] [get_bd_cells axi_mem_interconnect]
+connect_bd_intf_net [get_bd_intf_pins classifier_accelerator_0/m_axi_gmem0] [get_bd_intf_pins axi_mem_interconnect/S09_AXI]
+connect_bd_intf_net [get_bd_intf_pins classifier_accelerator_0/m_axi_gmem1] [get_bd_intf_pins axi_mem_interconnect/S10_AXI]
+connect_bd_intf_net [get_bd_intf_pins classifier_accelerator_0/m_axi_gmem2] [get_bd_intf_pins axi_mem_interconnect/S11_AXI]
+connect_bd_intf_net [get_bd_intf_pins classifier_accelerator_0/m_axi_gmem3] [get_bd_intf_pins axi_mem_interconnect/S12_AXI]
 
 # Connect SmartConnect Master to Zynq HP0 (We can use just one HP port for simplicity, or distribute them)
 # For simplicity, we route all through HP0. SmartConnect handles arbitration.
 connect_bd_intf_net [get_bd_intf_pins axi_mem_interconnect/M00_AXI] [get_bd_intf_pins processing_system7_0/S_AXI_HP0]
 
+# DMA: descriptor fetch, read and write masters on HP1; the stream loops
+# back through the FIFO
+connect_bd_intf_net [get_bd_intf_pins axi_dma_0/M_AXI_SG] [get_bd_intf_pins axi_dma_interconnect/S00_AXI]
+connect_bd_intf_net [get_bd_intf_pins axi_dma_0/M_AXI_MM2S] [get_bd_intf_pins axi_dma_interconnect/S01_AXI]
+connect_bd_intf_net [get_bd_intf_pins axi_dma_0/M_AXI_S2MM] [get_bd_intf_pins axi_dma_interconnect/S02_AXI]
+connect_bd_intf_net [get_bd_intf_pins axi_dma_interconnect/M00_AXI] [get_bd_intf_pins processing_system7_0/S_AXI_HP1]
+connect_bd_intf_net [get_bd_intf_pins axi_dma_0/M_AXIS_MM2S] [get_bd_intf_pins axi_dma_loopback_fifo/S_AXIS]
+connect_bd_intf_net [get_bd_intf_pins axi_dma_loopback_fifo/M_AXIS] [get_bd_intf_pins axi_dma_0/S_AXIS_S2MM]
+
 
 # 9. Control Connections (Zynq GP -> Interconnect -> HLS Slave)
 connect_bd_intf_net [get_bd_intf_pins processing_system7_0/M_AXI_GP0] [get_bd_intf_pins ps7_0_axi_periph/S00_AXI]
 connect_bd_intf_net [get_bd_intf_pins ps7_0_axi_periph/M00_AXI] [get_bd_intf_pins conv_accelerator_0/s_axi_control]
 connect_bd_intf_net [get_bd_intf_pins ps7_0_axi_periph/M01_AXI] [get_bd_intf_pins activation_accelerator_0/s_axi_control]
 connect_bd_intf_net [get_bd_intf_pins ps7_0_axi_periph/M02_AXI] [get_bd_intf_pins pooling_accelerator_0/s_axi_control]
+connect_bd_intf_net [get_bd_intf_pins ps7_0_axi_periph/M03_AXI] [get_bd_intf_pins axi_dma_0/S_AXI_LITE]
+connect_bd_intf_net [get_bd_intf_pins ps7_0_axi_periph/M04_AXI] [get_bd_intf_pins classifier_accelerator_0/s_axi_control]
 
 
 # 10. Interrupts
 create_bd_cell -type ip -vlnv xilinx.com:ip:xlconcat:2.1 xlconcat_0
-set_property -dict [list CONFIG.NUM_PORTS {3}] [get_bd_cells xlconcat_0]
+# The driver waits on S2MM only: it completes last, and MM2S's line (In3)
+# is wired for completeness but not bound to a UIO device. The classifier
+# came later and takes In5.
+set_property -dict [list CONFIG.NUM_PORTS {6}] [get_bd_cells xlconcat_0]
 connect_bd_net [get_bd_pins conv_accelerator_0/interrupt] [get_bd_pins xlconcat_0/In0]
 connect_bd_net [get_bd_pins activation_accelerator_0/interrupt] [get_bd_pins xlconcat_0/In1]
 connect_bd_net [get_bd_pins pooling_accelerator_0/interrupt] [get_bd_pins xlconcat_0/In2]
+connect_bd_net [get_bd_pins axi_dma_0/mm2s_introut] [get_bd_pins xlconcat_0/In3]
+connect_bd_net [get_bd_pins axi_dma_0/s2mm_introut] [get_bd_pins xlconcat_0/In4]
+connect_bd_net [get_bd_pins classifier_accelerator_0/interrupt] [get_bd_pins xlconcat_0/In5]
 connect_bd_net [get_bd_pins xlconcat_0/dout] [get_bd_pins processing_system7_0/IRQ_F2P]
 
 
 # 11. Address Assignment
 assign_bd_address
+set_property offset 0x40400000 [get_bd_addr_segs {processing_system7_0/Data/SEG_axi_dma_0_Reg}]
+set_property offset 0x43C30000 [get_bd_addr_segs {processing_system7_0/Data/SEG_classifier_accelerator_0_Reg}]
 
 
 # 12. Validate and Save
@@ -0,0 +1,48 @@
+#include "cpu_backend.h"
+#include "cpu_convolution.h"
+
+void CPUBackend::apply_activation(const LayerDesc &layer, qint8_t *data) {
+    int size = (int)layer.output_elements();
+    if (layer.activation == ACTIVATION_RELU) {
+        CPUConvolution::relu(data, size);
+    } else if (layer.activation == ACTIVATION_RELU6) {
+        CPUConvolution::relu6(data, size);
+    }
+}
+
+bool CPUBackend::conv2d(const LayerDesc &layer, const qint8_t *input,
+                        const LayerWeights &weights, qint8_t *output) {
+    CPUConvolution::conv2d(input, weights.kernel.data(), weights.bias.data(), output,
+                           layer.input_h, layer.input_w, layer.input_c,
+                           layer.output_c, layer.kernel_size, layer.stride, layer.padding);
+    apply_activation(layer, output);
+    return true;
+}
+
+bool CPUBackend::depthwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                                  const LayerWeights &weights, qint8_t *output) {
+    CPUConvolution::depthwise_conv2d(input, weights.kernel.data(), weights.bias.data(), output,
+                                     layer.input_h, layer.input_w, layer.input_c,
+                                     layer.kernel_size, layer.stride, layer.padding);
+    apply_activation(layer, output);
+    return true;
+}
+
+bool CPUBackend::pointwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                                  const LayerWeights &weights, qint8_t *output) {
+    return conv2d(layer, input, weights, output);
+}
+
+bool CPUBackend::global_avg_pool(const LayerDesc &layer, const qint8_t *input,
+                                 qint8_t *output) {
+    CPUConvolution::global_avg_pool(input, output, layer.input_h, layer.input_w, layer.input_c);
+    return true;
+}
+
+bool CPUBackend::fully_connected(const LayerDesc &layer, const qint8_t *input,
+                                 const LayerWeights &weights, qint8_t *output) {
+    CPUConvolution::fully_connected(input, weights.kernel.data(), weights.bias.data(), output,
+                                    layer.input_c, layer.output_c);
+    apply_activation(layer, output);
+    return true;
+}
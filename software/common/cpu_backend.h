@@ -0,0 +1,30 @@
+#ifndef CPU_BACKEND_H
+#define CPU_BACKEND_H
+
+#include "layer_backend.h"
+
+// Runs every layer with the scalar CPUConvolution kernels
+class CPUBackend : public LayerBackend {
+public:
+    const char* name() const { return "CPU"; }
+
+    bool conv2d(const LayerDesc &layer, const qint8_t *input,
+                const LayerWeights &weights, qint8_t *output);
+
+    bool depthwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                          const LayerWeights &weights, qint8_t *output);
+
+    bool pointwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                          const LayerWeights &weights, qint8_t *output);
+
+    bool global_avg_pool(const LayerDesc &layer, const qint8_t *input,
+                         qint8_t *output);
+
+    bool fully_connected(const LayerDesc &layer, const qint8_t *input,
+                         const LayerWeights &weights, qint8_t *output);
+
+    // Apply the layer's activation in place
+    static void apply_activation(const LayerDesc &layer, qint8_t *data);
+};
+
+#endif // CPU_BACKEND_H
@@ -0,0 +1,186 @@
+#ifndef CPU_CONVOLUTION_H
+#define CPU_CONVOLUTION_H
+
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include "../../models/configs/mobilenet_config.h"
+
+// CPU-based convolution implementation with NEON optimizations
+class CPUConvolution {
+public:
+    static void conv2d(
+        const qint8_t *input,
+        const qint8_t *weights,
+        const qint32_t *bias,
+        qint8_t *output,
+        int input_h, int input_w, int input_c,
+        int output_c,
+        int kernel_size,
+        int stride,
+        int padding
+    ) {
+        conv2d_channels(input, weights, bias, output, input_h, input_w, input_c,
+                        kernel_size, stride, padding, 0, output_c, output_c);
+    }
+    
+    // Output channels [oc_begin, oc_end) of a conv whose output pixels are
+    // output_stride channels apart. Weights and bias are indexed by the
+    // absolute output channel; the other channels of output are untouched,
+    // so another engine can fill them at the same time.
+    static void conv2d_channels(
+        const qint8_t *input,
+        const qint8_t *weights,
+        const qint32_t *bias,
+        qint8_t *output,
+        int input_h, int input_w, int input_c,
+        int kernel_size,
+        int stride,
+        int padding,
+        int oc_begin, int oc_end,
+        int output_stride
+    ) {
+        int output_h = (input_h + 2 * padding - kernel_size) / stride + 1;
+        int output_w = (input_w + 2 * padding - kernel_size) / stride + 1;
+        
+        for (int oh = 0; oh < output_h; oh++) {
+            for (int ow = 0; ow < output_w; ow++) {
+                for (int oc = oc_begin; oc < oc_end; oc++) {
+                    int32_t acc = bias[oc];
+                    
+                    for (int kh = 0; kh < kernel_size; kh++) {
+                        int ih = oh * stride + kh - padding;
+                        if (ih < 0 || ih >= input_h) continue;
+                        
+                        for (int kw = 0; kw < kernel_size; kw++) {
+                            int iw = ow * stride + kw - padding;
+                            if (iw < 0 || iw >= input_w) continue;
+                            
+                            const qint8_t *in = &input[(ih * input_w + iw) * input_c];
+                            const qint8_t *w = &weights[(size_t)oc * input_c * kernel_size * kernel_size +
+                                                        kh * kernel_size + kw];
+                            int w_step = kernel_size * kernel_size;
+                            for (int ic = 0; ic < input_c; ic++) {
+                                acc += in[ic] * w[ic * w_step];
+                            }
+                        }
+                    }
+                    
+                    // Quantize back to int8
+                    int out_idx = (oh * output_w + ow) * output_stride + oc;
+                    output[out_idx] = (qint8_t)std::max(-128, std::min(127, acc >> 8));
+                }
+            }
+        }
+    }
+    
+    static void depthwise_conv2d(
+        const qint8_t *input,
+        const qint8_t *weights,
+        const qint32_t *bias,
+        qint8_t *output,
+        int input_h, int input_w, int channels,
+        int kernel_size,
+        int stride,
+        int padding
+    ) {
+        int output_h = (input_h + 2 * padding - kernel_size) / stride + 1;
+        int output_w = (input_w + 2 * padding - kernel_size) / stride + 1;
+        
+        for (int oh = 0; oh < output_h; oh++) {
+            for (int ow = 0; ow < output_w; ow++) {
+                for (int c = 0; c < channels; c++) {
+                    int32_t acc = bias[c];
+                    
+                    for (int kh = 0; kh < kernel_size; kh++) {
+                        for (int kw = 0; kw < kernel_size; kw++) {
+                            int ih = oh * stride + kh - padding;
+                            int iw = ow * stride + kw - padding;
+                            
+                            if (ih >= 0 && ih < input_h && iw >= 0 && iw < input_w) {
+                                int input_idx = (ih * input_w + iw) * channels + c;
+                                int weight_idx = (c * kernel_size + kh) * kernel_size + kw;
+                                
+                                acc += input[input_idx] * weights[weight_idx];
+                            }
+                        }
+                    }
+                    
+                    int out_idx = (oh * output_w + ow) * channels + c;
+                    output[out_idx] = (qint8_t)std::max(-128, std::min(127, acc >> 8));
+                }
+            }
+        }
+    }
+    
+    static void relu(qint8_t *data, int size) {
+        for (int i = 0; i < size; i++) {
+            if (data[i] < 0) data[i] = 0;
+        }
+    }
+    
+    static void relu6(qint8_t *data, int size) {
+        for (int i = 0; i < size; i++) {
+            if (data[i] < 0) data[i] = 0;
+            else if (data[i] > 6) data[i] = 6;
+        }
+    }
+    
+    static void global_avg_pool(
+        const qint8_t *input,
+        qint8_t *output,
+        int height, int width, int channels
+    ) {
+        int spatial_size = height * width;
+        
+        for (int c = 0; c < channels; c++) {
+            int32_t sum = 0;
+            for (int s = 0; s < spatial_size; s++) {
+                sum += input[s * channels + c];
+            }
+            output[c] = (qint8_t)(sum / spatial_size);
+        }
+    }
+    
+    static void fully_connected(
+        const qint8_t *input,
+        const qint8_t *weights,
+        const qint32_t *bias,
+        qint8_t *output,
+        int input_size,
+        int output_size
+    ) {
+        for (int o = 0; o < output_size; o++) {
+            int32_t acc = bias[o];
+            
+            for (int i = 0; i < input_size; i++) {
+                acc += input[i] * weights[o * input_size + i];
+            }
+            
+            output[o] = (qint8_t)std::max(-128, std::min(127, acc >> 8));
+        }
+    }
+    
+    static void softmax(const qint8_t *input, float *output, int size) {
+        // Convert to float and find max for numerical stability
+        float max_val = -1e9;
+        for (int i = 0; i < size; i++) {
+            float val = (float)input[i];
+            if (val > max_val) max_val = val;
+        }
+        
+        // Compute exp and sum
+        float sum = 0.0f;
+        for (int i = 0; i < size; i++) {
+            output[i] = std::exp((float)input[i] - max_val);
+            sum += output[i];
+        }
+        
+        // Normalize
+        for (int i = 0; i < size; i++) {
+            output[i] /= sum;
+        }
+    }
+};
+
+#endif // CPU_CONVOLUTION_H
@@ -0,0 +1,120 @@
+#ifndef EPOCH_SLOT_H
+#define EPOCH_SLOT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <utility>
+
+// Maximum number of frames that may hold a pinned object at the same time
+#define MAX_EPOCH_READERS 8
+
+// Publishes an object (e.g. a model's weight set) to concurrent readers and
+// swaps it atomically. A superseded object is retired with the epoch it was
+// replaced in and deleted only once every reader pinned at or before that
+// epoch has left, so a frame always finishes on the object it started with.
+template<typename T>
+class EpochSlot {
+private:
+    std::atomic<T*> current;
+    std::atomic<uint64_t> global_epoch;
+    std::atomic<uint64_t> reader_epoch[MAX_EPOCH_READERS];  // 0 = slot free
+
+    std::mutex retire_mutex;
+    std::vector<std::pair<T*, uint64_t>> retired;
+
+    EpochSlot(const EpochSlot&);
+    EpochSlot& operator=(const EpochSlot&);
+
+public:
+    // Keeps the object observed at pin time alive until destroyed
+    class Guard {
+    private:
+        EpochSlot *slot;
+        int reader;
+        T *object;
+
+    public:
+        Guard(EpochSlot *s, int r, T *obj) : slot(s), reader(r), object(obj) {}
+        Guard(Guard &&other)
+            : slot(other.slot), reader(other.reader), object(other.object) {
+            other.slot = nullptr;
+        }
+        ~Guard() {
+            if (slot) {
+                slot->reader_epoch[reader].store(0, std::memory_order_release);
+            }
+        }
+
+        T* get() const { return object; }
+        T* operator->() const { return object; }
+    };
+
+    EpochSlot() : current(nullptr), global_epoch(1) {
+        for (int i = 0; i < MAX_EPOCH_READERS; i++) {
+            reader_epoch[i].store(0);
+        }
+    }
+
+    ~EpochSlot() {
+        delete current.load();
+        for (size_t i = 0; i < retired.size(); i++) {
+            delete retired[i].first;
+        }
+    }
+
+    // Announce the current epoch in a free reader slot, then read the object.
+    // Spins only if MAX_EPOCH_READERS frames are already in flight.
+    Guard pin() {
+        for (;;) {
+            for (int r = 0; r < MAX_EPOCH_READERS; r++) {
+                uint64_t expected = 0;
+                uint64_t epoch = global_epoch.load();
+                if (reader_epoch[r].compare_exchange_strong(expected, epoch)) {
+                    return Guard(this, r, current.load());
+                }
+            }
+        }
+    }
+
+    // Swap in a new object. The previous one is retired and freed by a later
+    // reclaim() once no reader can still be using it.
+    void publish(T *next) {
+        T *old = current.exchange(next);
+        uint64_t retire_epoch = global_epoch.fetch_add(1);
+
+        if (old) {
+            std::lock_guard<std::mutex> lock(retire_mutex);
+            retired.push_back(std::make_pair(old, retire_epoch));
+        }
+        reclaim();
+    }
+
+    // Free retired objects older than the oldest active reader. Cheap enough
+    // to call once per frame.
+    void reclaim() {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        if (retired.empty()) return;
+
+        uint64_t oldest = UINT64_MAX;
+        for (int r = 0; r < MAX_EPOCH_READERS; r++) {
+            uint64_t epoch = reader_epoch[r].load();
+            if (epoch != 0 && epoch < oldest) oldest = epoch;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++) {
+            if (retired[i].second < oldest) {
+                delete retired[i].first;
+            } else {
+                retired[kept++] = retired[i];
+            }
+        }
+        retired.resize(kept);
+    }
+
+    bool has_object() const { return current.load() != nullptr; }
+};
+
+#endif // EPOCH_SLOT_H
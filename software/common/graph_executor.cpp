@@ -0,0 +1,297 @@
+#include "graph_executor.h"
+#include "cpu_convolution.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+GraphExecutor::GraphExecutor(LayerBackend &layer_backend)
+    : backend(layer_backend), buffer1(nullptr), buffer2(nullptr),
+      buffer_size(0), backend_buffers(false), compiled_weights(0), compiled_input(nullptr),
+      compiled_images(0), compiled_layers(0), verbose(true), use_programs(false), top_k(0), batch(1) {
+}
+
+GraphExecutor::~GraphExecutor() {
+    release_buffers();
+}
+
+void GraphExecutor::release_buffers() {
+    if (backend_buffers) {
+        backend.free_buffer(buffer1);
+        backend.free_buffer(buffer2);
+    }
+    host_buffer1.clear();
+    host_buffer2.clear();
+    buffer1 = buffer2 = nullptr;
+    buffer_size = 0;
+    backend_buffers = false;
+}
+
+bool GraphExecutor::prepare(const NetworkGraph &graph) {
+    size_t size = graph.max_activation_elements() * std::max(batch, 1);
+    if (buffer_size >= size) {
+        return true;
+    }
+    release_buffers();
+    compiled_weights = 0;
+
+    buffer1 = backend.allocate_buffer(size);
+    buffer2 = buffer1 ? backend.allocate_buffer(size) : nullptr;
+    if (buffer1 && buffer2) {
+        backend_buffers = true;
+    } else {
+        if (buffer1) backend.free_buffer(buffer1);
+        host_buffer1.resize(size);
+        host_buffer2.resize(size);
+        buffer1 = host_buffer1.data();
+        buffer2 = host_buffer2.data();
+    }
+    buffer_size = size;
+    return true;
+}
+
+bool GraphExecutor::run_layer(const LayerDesc &layer,
+                              const LayerWeights *weights, const qint8_t *input,
+                              qint8_t *output, float *output_probs, int images) {
+    // Conv layers take the whole batch at once
+    switch (layer.op) {
+        case OP_CONV:
+            return backend.conv2d(layer, input, *weights, output);
+        case OP_DEPTHWISE:
+            return backend.depthwise_conv2d(layer, input, *weights, output);
+        case OP_POINTWISE:
+            return backend.pointwise_conv2d(layer, input, *weights, output);
+        default:
+            break;
+    }
+
+    for (int n = 0; n < images; n++) {
+        const qint8_t *image_input = input + n * layer.input_elements();
+        qint8_t *image_output = output + n * layer.output_elements();
+        switch (layer.op) {
+            case OP_GLOBAL_AVG_POOL:
+                if (!backend.global_avg_pool(layer, image_input, image_output)) return false;
+                break;
+            case OP_FC:
+                if (!backend.fully_connected(layer, image_input, *weights, image_output)) return false;
+                break;
+            case OP_SOFTMAX:
+                if (!backend.finish()) return false;
+                CPUConvolution::softmax(image_input, output_probs + n * layer.output_elements(),
+                                        (int)layer.output_elements());
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+size_t GraphExecutor::fused_layers(const NetworkGraph &graph, size_t i) const {
+    const std::vector<LayerDesc> &layers = graph.layers;
+    size_t pw = i;
+    if (i + 1 < layers.size() && layers[i].op == OP_DEPTHWISE &&
+        layers[i + 1].op == OP_POINTWISE && backend.can_fuse_separable(layers[i], layers[i + 1])) {
+        pw = i + 1;
+    } else if (layers[i].op != OP_POINTWISE) {
+        return 1;
+    }
+    if (pw + 1 < layers.size() && layers[pw + 1].op == OP_GLOBAL_AVG_POOL &&
+        backend.can_fuse_pool(layers[pw], layers[pw + 1])) {
+        return pw + 2 - i;
+    }
+    return pw + 1 - i;
+}
+
+void GraphExecutor::compile(ModelWeights &weights, const qint8_t *input, int images) {
+    const NetworkGraph &graph = weights.graph();
+    std::vector<BoundLayer> layers;
+
+    // Same ping-pong as run_images(): a fused group's layers all write its
+    // one output, and every layer of it reads the group's input
+    const qint8_t *current_input = input;
+    qint8_t *current_output = buffer1;
+    qint8_t *spare = buffer2;
+    for (size_t i = 0; i < graph.layers.size();) {
+        size_t end = i + fused_layers(graph, i);
+        for (; i < end; i++) {
+            const LayerDesc &layer = graph.layers[i];
+            BoundLayer bound;
+            bound.layer = &layer;
+            bound.weights = nullptr;
+            bound.input = current_input;
+            bound.output = current_output;
+
+            // Try again next frame rather than hold up a streaming load
+            if (layer.has_weights()) {
+                if (!weights.is_layer_ready(layer.weight_index)) return;
+                bound.weights = weights.wait_for_layer(layer.weight_index);
+                if (!bound.weights) return;
+            }
+            layers.push_back(bound);
+        }
+
+        current_input = current_output;
+        std::swap(current_output, spare);
+    }
+
+    compiled_layers = backend.compile(layers);
+    compiled_weights = weights.id();
+    compiled_input = input;
+    compiled_images = images;
+    if (verbose && compiled_layers > 0) {
+        std::cout << "Compiled " << compiled_layers << " layers into one "
+                  << backend.name() << " program" << std::endl;
+    }
+}
+
+bool GraphExecutor::run(ModelWeights &weights, const qint8_t *input, float *output_probs) {
+    const NetworkGraph &graph = weights.graph();
+    prepare(graph);
+
+    // A back end that cannot take the batch gets it one image at a time
+    int images = std::max(batch, 1);
+    if (!backend.set_batch(images)) {
+        images = 1;
+        backend.set_batch(1);
+    }
+    for (int n = 0; n < std::max(batch, 1); n += images) {
+        if (!run_images(weights, input + n * graph.input_elements(),
+                        output_probs + n * graph.num_classes(), images)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool GraphExecutor::run_images(ModelWeights &weights, const qint8_t *input, float *output_probs,
+                               int images) {
+    const NetworkGraph &graph = weights.graph();
+    const qint8_t *current_input = input;
+    qint8_t *current_output = buffer1;
+    qint8_t *spare = buffer2;
+
+    size_t first = 0;
+    if (use_programs) {
+        if (compiled_weights != weights.id() || compiled_input != input || compiled_images != images) {
+            compile(weights, input, images);
+        }
+        if (compiled_weights == weights.id() && compiled_input == input && compiled_images == images &&
+            compiled_layers > 0) {
+            if (!backend.run_compiled()) {
+                std::cerr << "Program failed to start on " << backend.name() << std::endl;
+                return false;
+            }
+            // The program takes whole fused groups
+            while (first < (size_t)compiled_layers) {
+                first += fused_layers(graph, first);
+                current_input = current_output;
+                std::swap(current_output, spare);
+            }
+        }
+    }
+
+    for (size_t i = first; i < graph.layers.size(); i++) {
+        const LayerDesc &layer = graph.layers[i];
+
+        // Blocks only if the streaming loader has not reached this layer yet
+        const LayerWeights *lw = nullptr;
+        if (layer.has_weights()) {
+            lw = weights.wait_for_layer(layer.weight_index);
+            if (!lw) return false;
+        }
+
+        if (verbose) {
+            std::cout << layer.name << " (" << backend.name() << "): "
+                      << layer.input_h << "x" << layer.input_w << "x" << layer.input_c << " -> "
+                      << layer.output_h << "x" << layer.output_w << "x" << layer.output_c
+                      << std::endl;
+        }
+
+        // A fused group writes one output and takes one ping-pong step.
+        // Its output never goes to spare, which is still current_input
+        // once a layer has run and would be overwritten while it streams.
+        size_t fused = fused_layers(graph, i);
+        if (fused > 1) {
+            const LayerDesc &last = graph.layers[i + fused - 1];
+            const LayerDesc *pw = layer.op == OP_DEPTHWISE ? &graph.layers[i + 1] : nullptr;
+            const LayerWeights *pw_weights = nullptr;
+            if (pw) {
+                pw_weights = weights.wait_for_layer(pw->weight_index);
+                if (!pw_weights) return false;
+                if (verbose) {
+                    std::cout << pw->name << " (" << backend.name() << ", fused): "
+                              << pw->input_h << "x" << pw->input_w << "x" << pw->input_c << " -> "
+                              << pw->output_h << "x" << pw->output_w << "x" << pw->output_c
+                              << std::endl;
+                }
+            }
+            if (verbose && last.op == OP_GLOBAL_AVG_POOL) {
+                std::cout << last.name << " (" << backend.name() << ", fused): "
+                          << last.input_h << "x" << last.input_w << "x" << last.input_c
+                          << " -> " << last.output_c << std::endl;
+            }
+
+            bool ok;
+            if (!pw) {
+                ok = backend.pointwise_pool(layer, current_input, *lw, last, current_output);
+            } else if (last.op == OP_GLOBAL_AVG_POOL) {
+                ok = backend.separable_pool(layer, current_input, *lw, *pw, *pw_weights, last,
+                                            current_output);
+            } else {
+                ok = backend.separable_block(layer, current_input, *lw, *pw, *pw_weights,
+                                             current_output);
+            }
+            if (!ok) {
+                std::cerr << "Layers " << layer.name << " to " << last.name << " failed on "
+                          << backend.name() << std::endl;
+                return false;
+            }
+            current_input = current_output;
+            std::swap(current_output, spare);
+            i += fused - 1;
+            continue;
+        }
+
+        // The classifier ranks the logits where they are produced; the
+        // softmax is then just the ranked classes over the denominator
+        if (top_k > 0 && i + 1 < graph.layers.size() && layer.op == OP_FC &&
+            graph.layers[i + 1].op == OP_SOFTMAX && backend.can_classify(layer, top_k)) {
+            const LayerDesc &softmax = graph.layers[i + 1];
+            if (verbose) {
+                std::cout << softmax.name << " (" << backend.name() << ", fused): top "
+                          << top_k << " of " << layer.output_c << std::endl;
+            }
+            for (int n = 0; n < images; n++) {
+                ClassifierResult result;
+                if (!backend.classify(layer, current_input + n * layer.input_elements(), *lw, top_k,
+                                      &result)) {
+                    std::cerr << "Layers " << layer.name << " and " << softmax.name << " failed on "
+                              << backend.name() << std::endl;
+                    return false;
+                }
+                float *probs = output_probs + n * softmax.output_elements();
+                std::fill(probs, probs + softmax.output_elements(), 0.0f);
+                for (int k = 0; k < result.count; k++) {
+                    probs[result.classes[k]] =
+                        (float)(std::exp((double)result.logits[k] - result.logits[0]) / result.exp_sum);
+                }
+            }
+            i++;
+            continue;
+        }
+
+        if (!run_layer(layer, lw, current_input, current_output, output_probs, images)) {
+            std::cerr << "Layer " << layer.name << " failed on " << backend.name() << std::endl;
+            return false;
+        }
+
+        current_input = current_output;
+        std::swap(current_output, spare);
+    }
+
+    if (!backend.finish()) {
+        std::cerr << "Queued layers failed on " << backend.name() << std::endl;
+        return false;
+    }
+    return true;
+}
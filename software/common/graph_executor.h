@@ -0,0 +1,80 @@
+#ifndef GRAPH_EXECUTOR_H
+#define GRAPH_EXECUTOR_H
+
+#include <vector>
+#include "../../models/configs/mobilenet_config.h"
+#include "network_graph.h"
+#include "model_weights.h"
+#include "layer_backend.h"
+
+// Runs a NetworkGraph layer by layer on a LayerBackend. Feature maps
+// ping-pong between two buffers sized from the graph, so smaller width or
+// resolution variants use correspondingly less memory. Softmax runs on the
+// CPU, over every class unless the back end ranks the classes itself. A
+// batch of images runs its conv layers in one call per layer when the back
+// end takes batches, and frame by frame otherwise.
+class GraphExecutor {
+private:
+    LayerBackend &backend;
+
+    // Ping-pong buffers; either the back end's device memory or host_buffers
+    qint8_t *buffer1;
+    qint8_t *buffer2;
+    size_t buffer_size;
+    bool backend_buffers;
+    std::vector<qint8_t> host_buffer1;
+    std::vector<qint8_t> host_buffer2;
+
+    // What the back end's current program was compiled for: weight set id,
+    // input buffer, images and how many leading layers it covers
+    uint64_t compiled_weights;
+    const qint8_t *compiled_input;
+    int compiled_images;
+    int compiled_layers;
+
+    void release_buffers();
+
+    // Graph layers from i on that the back end runs as one command: a
+    // depthwise/pointwise pair, optionally with the pooling after it, or a
+    // pointwise layer with its pooling. A fused group writes one output
+    // and takes one step of the ping-pong, however many layers it covers.
+    size_t fused_layers(const NetworkGraph &graph, size_t i) const;
+    void compile(ModelWeights &weights, const qint8_t *input, int images);
+
+    // images images through the graph, their inputs and maps back to back
+    bool run_images(ModelWeights &weights, const qint8_t *input, float *output_probs, int images);
+
+    bool run_layer(const LayerDesc &layer,
+                   const LayerWeights *weights, const qint8_t *input,
+                   qint8_t *output, float *output_probs, int images);
+
+public:
+    bool verbose;
+
+    // Offer the layers to the back end as a program once all weights are
+    // resident, and run the frame's leading layers as that program
+    bool use_programs;
+
+    // When non-zero and the back end can classify, the final fully
+    // connected layer and softmax yield only the top_k classes'
+    // probabilities; every other class reads 0
+    int top_k;
+
+    // Images per run(), 1 by default
+    int batch;
+
+    explicit GraphExecutor(LayerBackend &layer_backend);
+    ~GraphExecutor();
+
+    // Grow the ping-pong buffers to fit the graph at batch images (no-op if
+    // already large enough)
+    bool prepare(const NetworkGraph &graph);
+
+    // Run one frame of batch images, input holding them back to back. Layers
+    // whose weights are still streaming in are waited on individually.
+    // output_probs holds graph.num_classes() floats per image. Returns once
+    // every layer, including any the back end queued, has finished.
+    bool run(ModelWeights &weights, const qint8_t *input, float *output_probs);
+};
+
+#endif // GRAPH_EXECUTOR_H
@@ -0,0 +1,101 @@
+#ifndef LAYER_BACKEND_H
+#define LAYER_BACKEND_H
+
+#include "../../models/configs/mobilenet_config.h"
+#include "network_graph.h"
+#include "model_weights.h"
+
+// A layer together with the tensors the executor will run it on, offered
+// to LayerBackend::compile()
+struct BoundLayer {
+    const LayerDesc *layer;
+    const LayerWeights *weights;    // nullptr for layers without weights
+    const qint8_t *input;
+    qint8_t *output;
+};
+
+// A fully connected layer's best classes, as a classifier engine returns
+// them in place of the logits
+struct ClassifierResult {
+    int count;
+    int classes[CLASSIFIER_MAX_TOP_K];      // Best first, ties in class order
+    qint8_t logits[CLASSIFIER_MAX_TOP_K];
+    double exp_sum;                         // Over every class: exp(logit - logits[0])
+};
+
+// Compute back end driven by GraphExecutor. Each call runs one layer of the
+// graph on NHWC int8 feature maps; the layer descriptor carries the shapes,
+// stride, padding and activation. Returns false if the layer failed.
+class LayerBackend {
+public:
+    virtual ~LayerBackend() {}
+
+    virtual const char* name() const = 0;
+
+    // Memory for the executor's feature maps. Back ends that need
+    // device-visible memory return it here; nullptr means host memory will do.
+    virtual qint8_t* allocate_buffer(size_t size) { return nullptr; }
+    virtual void free_buffer(qint8_t *buffer) {}
+
+    // Back ends may queue layers and return before they have run. finish()
+    // waits for everything queued and reports whether it all succeeded; the
+    // executor calls it before reading results on the CPU.
+    virtual bool finish() { return true; }
+
+    // Back ends that can run several layers as one submission may fold the
+    // frame's leading layers into a program. compile() returns how many it
+    // took (0, the default, for none) and replaces any earlier program;
+    // run_compiled() then queues the program in place of those layers.
+    virtual int compile(const std::vector<BoundLayer> &layers) { return 0; }
+    virtual bool run_compiled() { return false; }
+
+    // Back ends whose conv engine can take several images through one set
+    // of weights accept a batch. From then on compile() and the conv calls
+    // (conv2d to separable_pool) take that many images, their maps back to
+    // back; the other calls stay per image. The default takes one.
+    virtual bool set_batch(int images) { return images == 1; }
+
+    virtual bool conv2d(const LayerDesc &layer, const qint8_t *input,
+                        const LayerWeights &weights, qint8_t *output) = 0;
+
+    virtual bool depthwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                                  const LayerWeights &weights, qint8_t *output) = 0;
+
+    virtual bool pointwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                                  const LayerWeights &weights, qint8_t *output) = 0;
+
+    // Back ends that can run a depthwise layer straight into the pointwise
+    // layer after it, without the intermediate map going through memory,
+    // say so per pair; separable_block() then runs both, writing only the
+    // pointwise layer's output.
+    virtual bool can_fuse_separable(const LayerDesc &dw, const LayerDesc &pw) const { return false; }
+    virtual bool separable_block(const LayerDesc &dw, const qint8_t *input,
+                                 const LayerWeights &dw_weights, const LayerDesc &pw,
+                                 const LayerWeights &pw_weights, qint8_t *output) { return false; }
+
+    // Likewise for a global average pooling layer straight after a
+    // pointwise layer (alone or fused with its depthwise layer): the map is
+    // pooled as it is produced and only the pooled vector is written.
+    virtual bool can_fuse_pool(const LayerDesc &pw, const LayerDesc &pool) const { return false; }
+    virtual bool pointwise_pool(const LayerDesc &pw, const qint8_t *input, const LayerWeights &weights,
+                                const LayerDesc &pool, qint8_t *output) { return false; }
+    virtual bool separable_pool(const LayerDesc &dw, const qint8_t *input,
+                                const LayerWeights &dw_weights, const LayerDesc &pw,
+                                const LayerWeights &pw_weights, const LayerDesc &pool,
+                                qint8_t *output) { return false; }
+
+    virtual bool global_avg_pool(const LayerDesc &layer, const qint8_t *input,
+                                 qint8_t *output) = 0;
+
+    virtual bool fully_connected(const LayerDesc &layer, const qint8_t *input,
+                                 const LayerWeights &weights, qint8_t *output) = 0;
+
+    // Back ends with a classifier engine can run a fully connected layer
+    // that feeds the softmax and return only its top_k classes and the
+    // softmax denominator; classify() waits for the result.
+    virtual bool can_classify(const LayerDesc &fc, int top_k) const { return false; }
+    virtual bool classify(const LayerDesc &fc, const qint8_t *input, const LayerWeights &weights,
+                          int top_k, ClassifierResult *result) { return false; }
+};
+
+#endif // LAYER_BACKEND_H
@@ -0,0 +1,190 @@
+#include "model_weights.h"
+#include <fstream>
+#include <iostream>
+
+static std::atomic<uint64_t> next_set_id(1);
+
+ModelWeights::ModelWeights(WeightUploader *weight_uploader)
+    : uploader(weight_uploader), set_id(next_set_id++) {
+}
+
+ModelWeights::~ModelWeights() {
+    if (loader_thread.joinable()) {
+        loader_thread.join();
+    }
+    if (uploader) {
+        for (size_t i = 0; i < layers.size(); i++) {
+            if (layers[i].device_handle) {
+                uploader->release(layers[i].device_handle);
+            }
+        }
+    }
+}
+
+bool ModelWeights::load_graph(const std::string &weights_dir) {
+    std::string path = weights_dir + "/" + NETWORK_DESCRIPTION_FILE;
+
+    if (!network.load(path)) {
+        // Weight directories written before network.txt existed hold the
+        // full-size model
+        std::ifstream probe(path);
+        if (probe) {
+            return false;
+        }
+        std::cout << "No " << NETWORK_DESCRIPTION_FILE << " in " << weights_dir
+                  << ", assuming MobileNetV1 1.0/" << INPUT_HEIGHT << std::endl;
+        network = NetworkGraph::mobilenet_v1(1.0f, INPUT_HEIGHT);
+    }
+
+    int count = network.num_weight_layers();
+    layers.assign(count, LayerWeights());
+    layer_state = std::vector<std::atomic<int>>(count);
+    for (int i = 0; i < count; i++) {
+        layer_state[i].store(LAYER_PENDING);
+    }
+    return true;
+}
+
+bool ModelWeights::load_layer(const std::string &weights_dir, const LayerDesc &desc) {
+    int k = desc.kernel_size;
+    int ic = desc.input_c;
+    int oc = desc.output_c;
+    bool depthwise = (desc.op == OP_DEPTHWISE);
+
+    // Keras stores kernels as HWIO; depthwise kernels as HWC1
+    size_t kernel_size = desc.kernel_elements();
+    std::vector<qint8_t> raw(kernel_size);
+
+    std::string prefix = weights_dir + "/layer_" + std::to_string(desc.weight_index);
+    std::ifstream kernel_file(prefix + "_kernel.bin", std::ios::binary);
+    if (!kernel_file.read((char*)raw.data(), kernel_size)) {
+        std::cerr << "Failed to read " << prefix << "_kernel.bin" << std::endl;
+        return false;
+    }
+
+    LayerWeights &lw = layers[desc.weight_index];
+    lw.kernel.resize(kernel_size);
+
+    if (depthwise) {
+        for (int kh = 0; kh < k; kh++) {
+            for (int kw = 0; kw < k; kw++) {
+                for (int c = 0; c < oc; c++) {
+                    lw.kernel[(c * k + kh) * k + kw] = raw[(kh * k + kw) * oc + c];
+                }
+            }
+        }
+    } else {
+        for (int kh = 0; kh < k; kh++) {
+            for (int kw = 0; kw < k; kw++) {
+                for (int i = 0; i < ic; i++) {
+                    for (int o = 0; o < oc; o++) {
+                        lw.kernel[((o * ic + i) * k + kh) * k + kw] =
+                            raw[((kh * k + kw) * ic + i) * oc + o];
+                    }
+                }
+            }
+        }
+    }
+
+    // Layers without a bias term are written with a short zero bias file,
+    // so read whatever is there and zero-fill up to the channel count
+    lw.bias.assign(oc, 0);
+    std::ifstream bias_file(prefix + "_bias.bin", std::ios::binary);
+    if (!bias_file) {
+        std::cerr << "Failed to open " << prefix << "_bias.bin" << std::endl;
+        return false;
+    }
+    bias_file.read((char*)lw.bias.data(), oc * sizeof(qint32_t));
+
+    if (uploader) {
+        lw.device_handle = uploader->upload(desc, lw);
+        if (!lw.device_handle) {
+            std::cerr << "Failed to upload " << desc.name << " to device memory" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void ModelWeights::set_layer_state(int layer, LayerState state) {
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        layer_state[layer].store(state, std::memory_order_release);
+    }
+    state_cv.notify_all();
+}
+
+bool ModelWeights::load(const std::string &weights_dir) {
+    if (!load_graph(weights_dir)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < network.layers.size(); i++) {
+        const LayerDesc &desc = network.layers[i];
+        if (!desc.has_weights()) continue;
+
+        if (!load_layer(weights_dir, desc)) {
+            set_layer_state(desc.weight_index, LAYER_FAILED);
+            return false;
+        }
+        set_layer_state(desc.weight_index, LAYER_READY);
+    }
+    return true;
+}
+
+void ModelWeights::stream_layers(std::string weights_dir) {
+    for (size_t i = 0; i < network.layers.size(); i++) {
+        const LayerDesc &desc = network.layers[i];
+        if (!desc.has_weights()) continue;
+
+        if (!load_layer(weights_dir, desc)) {
+            // Fail every layer not loaded yet so no waiter blocks forever
+            for (int layer = 0; layer < num_layers(); layer++) {
+                if (!is_layer_ready(layer)) {
+                    set_layer_state(layer, LAYER_FAILED);
+                }
+            }
+            return;
+        }
+        set_layer_state(desc.weight_index, LAYER_READY);
+    }
+}
+
+bool ModelWeights::start_streaming(const std::string &weights_dir) {
+    if (!load_graph(weights_dir)) {
+        return false;
+    }
+    loader_thread = std::thread(&ModelWeights::stream_layers, this, weights_dir);
+    return true;
+}
+
+bool ModelWeights::wait_until_loaded() {
+    if (loader_thread.joinable()) {
+        loader_thread.join();
+    }
+    for (int layer = 0; layer < num_layers(); layer++) {
+        if (layer_state[layer].load(std::memory_order_acquire) != LAYER_READY) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const LayerWeights* ModelWeights::wait_for_layer(int layer) {
+    // Fast path: once a layer is resident this is a single acquire load
+    int state = layer_state[layer].load(std::memory_order_acquire);
+
+    if (state == LAYER_PENDING) {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        state_cv.wait(lock, [&] {
+            return layer_state[layer].load(std::memory_order_acquire) != LAYER_PENDING;
+        });
+        state = layer_state[layer].load(std::memory_order_acquire);
+    }
+
+    return (state == LAYER_READY) ? &layers[layer] : nullptr;
+}
+
+bool ModelWeights::is_layer_ready(int layer) const {
+    return layer_state[layer].load(std::memory_order_acquire) == LAYER_READY;
+}
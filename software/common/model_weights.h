@@ -0,0 +1,100 @@
+#ifndef MODEL_WEIGHTS_H
+#define MODEL_WEIGHTS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "../../models/configs/mobilenet_config.h"
+#include "network_graph.h"
+
+// Name of the network description inside a weights directory
+#define NETWORK_DESCRIPTION_FILE "network.txt"
+
+// Quantized parameters of a single layer, repacked from the Keras HWIO
+// layout into the layout the compute kernels index:
+//   standard / pointwise / FC: [out_c][in_c][kh][kw]
+//   depthwise:                 [c][kh][kw]
+struct LayerWeights {
+    std::vector<qint8_t> kernel;
+    std::vector<qint32_t> bias;
+
+    // Handle of the device-resident copy, 0 if the layer lives only in
+    // host memory
+    uint32_t device_handle;
+
+    LayerWeights() : device_handle(0) {}
+};
+
+// Copies each layer into device memory as it is loaded. Implemented by
+// front ends whose back end reads weights from its own memory; the
+// ModelWeights releases its handles when it is deleted.
+class WeightUploader {
+public:
+    virtual ~WeightUploader() {}
+
+    // Returns the handle of the device copy, 0 on failure
+    virtual uint32_t upload(const LayerDesc &desc, const LayerWeights &weights) = 0;
+    virtual void release(uint32_t handle) = 0;
+};
+
+// Weight store shared by the CPU and FPGA front ends, together with the
+// network description the weights belong to. Layers can be loaded all at
+// once, or streamed by a background thread in network order so that
+// inference can start before the tail layers are resident. Layers are
+// indexed by LayerDesc::weight_index.
+class ModelWeights {
+private:
+    enum LayerState {
+        LAYER_PENDING = 0,
+        LAYER_READY = 1,
+        LAYER_FAILED = -1
+    };
+
+    NetworkGraph network;
+    WeightUploader *uploader;
+    uint64_t set_id;
+    std::vector<LayerWeights> layers;
+    std::vector<std::atomic<int>> layer_state;
+
+    std::mutex state_mutex;
+    std::condition_variable state_cv;
+    std::thread loader_thread;
+
+    bool load_graph(const std::string &weights_dir);
+    bool load_layer(const std::string &weights_dir, const LayerDesc &desc);
+    void set_layer_state(int layer, LayerState state);
+    void stream_layers(std::string weights_dir);
+
+public:
+    // With an uploader, every layer is copied to device memory before it is
+    // reported ready
+    explicit ModelWeights(WeightUploader *weight_uploader = nullptr);
+    ~ModelWeights();
+
+    // Load the network description and every layer before returning
+    bool load(const std::string &weights_dir);
+
+    // Load the network description, then start loading layers in network
+    // order on a background thread
+    bool start_streaming(const std::string &weights_dir);
+
+    // Block until the streaming thread has finished; true if all layers loaded
+    bool wait_until_loaded();
+
+    // Block until the given layer is resident. Returns nullptr if it failed
+    // to load.
+    const LayerWeights* wait_for_layer(int layer);
+
+    bool is_layer_ready(int layer) const;
+    int num_layers() const { return (int)layers.size(); }
+    const NetworkGraph& graph() const { return network; }
+
+    // Unique per weight set for the life of the process, unlike its address
+    uint64_t id() const { return set_id; }
+};
+
+#endif // MODEL_WEIGHTS_H
@@ -0,0 +1,290 @@
+#include "network_graph.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+size_t LayerDesc::kernel_elements() const {
+    switch (op) {
+        case OP_CONV:
+        case OP_POINTWISE:
+        case OP_FC:
+            return (size_t)output_c * input_c * kernel_size * kernel_size;
+        case OP_DEPTHWISE:
+            return (size_t)output_c * kernel_size * kernel_size;
+        default:
+            return 0;
+    }
+}
+
+NetworkGraph::NetworkGraph() : input_h(0), input_w(0), input_c(0) {
+}
+
+static bool parse_op(const std::string &token, LayerOp *op) {
+    if (token == "conv") *op = OP_CONV;
+    else if (token == "dwconv") *op = OP_DEPTHWISE;
+    else if (token == "pwconv") *op = OP_POINTWISE;
+    else if (token == "gap") *op = OP_GLOBAL_AVG_POOL;
+    else if (token == "fc") *op = OP_FC;
+    else if (token == "softmax") *op = OP_SOFTMAX;
+    else return false;
+    return true;
+}
+
+static bool parse_activation(const std::string &token, int *activation) {
+    if (token == "none") *activation = ACTIVATION_NONE;
+    else if (token == "relu") *activation = ACTIVATION_RELU;
+    else if (token == "relu6") *activation = ACTIVATION_RELU6;
+    else return false;
+    return true;
+}
+
+// Format, one record per line ('#' starts a comment):
+//   name  <model name>
+//   input <height> <width> <channels>
+//   layer <op> <name> <out_c> <kernel> <stride> <padding> <activation>
+//         <weight_index> <kernel_scale> <kernel_zero_point> <bias_scale>
+// An out_c of 0 keeps the input channel count.
+bool NetworkGraph::load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    layers.clear();
+    std::string line;
+    int line_no = 0;
+
+    while (std::getline(file, line)) {
+        line_no++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+
+        std::istringstream in(line);
+        std::string record;
+        if (!(in >> record)) continue;
+
+        if (record == "name") {
+            in >> name;
+        } else if (record == "input") {
+            if (!(in >> input_h >> input_w >> input_c)) {
+                std::cerr << path << ":" << line_no << ": malformed input record" << std::endl;
+                return false;
+            }
+        } else if (record == "layer") {
+            LayerDesc layer;
+            std::string op_token, act_token;
+            in >> op_token >> layer.name >> layer.output_c >> layer.kernel_size
+               >> layer.stride >> layer.padding >> act_token >> layer.weight_index
+               >> layer.kernel_scale >> layer.kernel_zero_point >> layer.bias_scale;
+
+            if (!in) {
+                std::cerr << path << ":" << line_no << ": malformed layer record" << std::endl;
+                return false;
+            }
+            if (!parse_op(op_token, &layer.op)) {
+                std::cerr << path << ":" << line_no << ": unknown op '" << op_token << "'" << std::endl;
+                return false;
+            }
+            if (!parse_activation(act_token, &layer.activation)) {
+                std::cerr << path << ":" << line_no << ": unknown activation '" << act_token << "'" << std::endl;
+                return false;
+            }
+            layers.push_back(layer);
+        } else {
+            std::cerr << path << ":" << line_no << ": unknown record '" << record << "'" << std::endl;
+            return false;
+        }
+    }
+
+    return finalize();
+}
+
+// Propagate shapes from the input through every layer and check that the
+// result is something the executor can run. Weight indices must number the
+// weighted layers 0..N-1 in order, since they name the layer_N_*.bin files.
+bool NetworkGraph::finalize() {
+    int h = input_h, w = input_w, c = input_c;
+    int next_weight_index = 0;
+
+    if (h <= 0 || w <= 0 || c <= 0 || layers.empty()) {
+        std::cerr << "Network description has no input shape or layers" << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < layers.size(); i++) {
+        LayerDesc &layer = layers[i];
+        layer.input_h = h;
+        layer.input_w = w;
+        layer.input_c = c;
+
+        switch (layer.op) {
+            case OP_CONV:
+            case OP_DEPTHWISE:
+            case OP_POINTWISE:
+                if (layer.op == OP_POINTWISE) {
+                    layer.kernel_size = 1;
+                    layer.padding = 0;
+                }
+                if (layer.op == OP_DEPTHWISE || layer.output_c == 0) {
+                    layer.output_c = c;
+                }
+                if (layer.stride < 1 || layer.kernel_size < 1 || layer.padding < 0 ||
+                    h + 2 * layer.padding < layer.kernel_size ||
+                    w + 2 * layer.padding < layer.kernel_size) {
+                    std::cerr << "Layer " << layer.name << " has kernel " << layer.kernel_size
+                              << ", stride " << layer.stride << " and padding " << layer.padding
+                              << ", which do not fit its " << h << "x" << w << " input" << std::endl;
+                    return false;
+                }
+                layer.output_h = (h + 2 * layer.padding - layer.kernel_size) / layer.stride + 1;
+                layer.output_w = (w + 2 * layer.padding - layer.kernel_size) / layer.stride + 1;
+                break;
+            case OP_GLOBAL_AVG_POOL:
+                layer.output_h = 1;
+                layer.output_w = 1;
+                layer.output_c = c;
+                break;
+            case OP_FC:
+                // Flattens whatever comes in
+                layer.input_h = 1;
+                layer.input_w = 1;
+                layer.input_c = h * w * c;
+                layer.kernel_size = 1;
+                layer.output_h = 1;
+                layer.output_w = 1;
+                break;
+            case OP_SOFTMAX:
+                layer.output_h = h;
+                layer.output_w = w;
+                layer.output_c = c;
+                break;
+        }
+
+        if (layer.output_h <= 0 || layer.output_w <= 0 || layer.output_c <= 0) {
+            std::cerr << "Layer " << layer.name << " has an empty output shape" << std::endl;
+            return false;
+        }
+        if (layer.has_weights() != (layer.kernel_elements() > 0)) {
+            std::cerr << "Layer " << layer.name << " weight index does not match its op" << std::endl;
+            return false;
+        }
+        if (layer.has_weights()) {
+            if (layer.weight_index != next_weight_index) {
+                std::cerr << "Layer " << layer.name << " has weight index " << layer.weight_index
+                          << ", expected " << next_weight_index << std::endl;
+                return false;
+            }
+            next_weight_index++;
+        }
+
+        h = layer.output_h;
+        w = layer.output_w;
+        c = layer.output_c;
+    }
+
+    return true;
+}
+
+NetworkGraph NetworkGraph::mobilenet_v1(float alpha, int resolution) {
+    NetworkGraph graph;
+    std::ostringstream model_name;
+    model_name << "mobilenet_v1_" << alpha << "_" << resolution;
+    graph.name = model_name.str();
+    graph.input_h = resolution;
+    graph.input_w = resolution;
+    graph.input_c = INPUT_CHANNELS;
+
+    LayerDesc layer;
+    layer.activation = ACTIVATION_RELU;
+    layer.kernel_scale = 1.0f;
+    layer.kernel_zero_point = 0;
+    layer.bias_scale = 1.0f;
+
+    int weight_index = 0;
+
+    layer.op = OP_CONV;
+    layer.name = "conv1";
+    layer.output_c = (int)(CONV1_FILTERS * alpha);
+    layer.kernel_size = CONV1_KERNEL_SIZE;
+    layer.stride = CONV1_STRIDE;
+    layer.padding = CONV1_PADDING;
+    layer.weight_index = weight_index++;
+    graph.layers.push_back(layer);
+
+    for (int block = 0; block < 13; block++) {
+        std::string suffix = std::to_string(block + 1);
+
+        layer.op = OP_DEPTHWISE;
+        layer.name = "conv_dw_" + suffix;
+        layer.output_c = 0;
+        layer.kernel_size = 3;
+        layer.stride = DEPTHWISE_BLOCKS[block][2];
+        layer.padding = 1;
+        layer.weight_index = weight_index++;
+        graph.layers.push_back(layer);
+
+        layer.op = OP_POINTWISE;
+        layer.name = "conv_pw_" + suffix;
+        layer.output_c = (int)(DEPTHWISE_BLOCKS[block][1] * alpha);
+        layer.kernel_size = 1;
+        layer.stride = 1;
+        layer.padding = 0;
+        layer.weight_index = weight_index++;
+        graph.layers.push_back(layer);
+    }
+
+    layer.op = OP_GLOBAL_AVG_POOL;
+    layer.name = "global_average_pooling";
+    layer.output_c = 0;
+    layer.kernel_size = 0;
+    layer.stride = 1;
+    layer.padding = 0;
+    layer.activation = ACTIVATION_NONE;
+    layer.weight_index = -1;
+    graph.layers.push_back(layer);
+
+    layer.op = OP_FC;
+    layer.name = "conv_preds";
+    layer.output_c = NUM_CLASSES;
+    layer.kernel_size = 1;
+    layer.weight_index = weight_index++;
+    graph.layers.push_back(layer);
+
+    layer.op = OP_SOFTMAX;
+    layer.name = "softmax";
+    layer.output_c = 0;
+    layer.kernel_size = 0;
+    layer.weight_index = -1;
+    graph.layers.push_back(layer);
+
+    graph.finalize();
+    return graph;
+}
+
+int NetworkGraph::num_weight_layers() const {
+    int count = 0;
+    for (size_t i = 0; i < layers.size(); i++) {
+        if (layers[i].has_weights()) {
+            count = std::max(count, layers[i].weight_index + 1);
+        }
+    }
+    return count;
+}
+
+int NetworkGraph::num_classes() const {
+    return layers.empty() ? 0 : layers.back().output_c;
+}
+
+size_t NetworkGraph::max_activation_elements() const {
+    size_t max_elements = 0;
+    for (size_t i = 0; i < layers.size(); i++) {
+        max_elements = std::max(max_elements, layers[i].output_elements());
+    }
+    return max_elements;
+}
+
+void NetworkGraph::print_summary() const {
+    std::cout << "Network " << name << ": " << input_h << "x" << input_w << "x" << input_c
+              << ", " << layers.size() << " layers, " << num_classes() << " classes" << std::endl;
+}
@@ -0,0 +1,82 @@
+#ifndef NETWORK_GRAPH_H
+#define NETWORK_GRAPH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "../../models/configs/mobilenet_config.h"
+
+// Layer operations understood by the executor
+enum LayerOp {
+    OP_CONV,            // Standard KxK convolution
+    OP_DEPTHWISE,       // Depthwise KxK convolution
+    OP_POINTWISE,       // 1x1 convolution
+    OP_GLOBAL_AVG_POOL,
+    OP_FC,              // Fully connected (1x1 conv on a 1x1 map)
+    OP_SOFTMAX
+};
+
+// Activation applied to a layer's output (matches CNNFPGADriver::activation)
+#define ACTIVATION_NONE -1
+#define ACTIVATION_RELU 0
+#define ACTIVATION_RELU6 1
+
+// One node of the layer graph. Spatial shapes are filled in by propagating
+// the input shape through the graph; channel counts come from the model.
+struct LayerDesc {
+    LayerOp op;
+    std::string name;
+
+    int input_h, input_w, input_c;
+    int output_h, output_w, output_c;
+
+    int kernel_size;
+    int stride;
+    int padding;
+    int activation;
+
+    int weight_index;           // layer_N_*.bin file index, -1 if none
+
+    float kernel_scale;
+    int32_t kernel_zero_point;
+    float bias_scale;
+
+    bool has_weights() const { return weight_index >= 0; }
+    size_t kernel_elements() const;
+    size_t input_elements() const { return (size_t)input_h * input_w * input_c; }
+    size_t output_elements() const { return (size_t)output_h * output_w * output_c; }
+};
+
+// Network description loaded from the model directory (network.txt, written
+// by quantize_model.py). Holds everything needed to size buffers and drive
+// either back end, so width-multiplier and resolution variants of
+// MobileNetV1 run through the same code.
+class NetworkGraph {
+private:
+    bool finalize();
+
+public:
+    std::string name;
+    int input_h, input_w, input_c;
+    std::vector<LayerDesc> layers;
+
+    NetworkGraph();
+
+    bool load(const std::string &path);
+
+    // Built-in MobileNetV1 description for weight directories that predate
+    // network.txt. alpha is the width multiplier, resolution the input size.
+    static NetworkGraph mobilenet_v1(float alpha, int resolution);
+
+    int num_weight_layers() const;
+    int num_classes() const;
+    size_t input_elements() const { return (size_t)input_h * input_w * input_c; }
+
+    // Largest intermediate activation, for sizing the ping-pong buffers
+    size_t max_activation_elements() const;
+
+    void print_summary() const;
+};
+
+#endif // NETWORK_GRAPH_H
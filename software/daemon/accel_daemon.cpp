@@ -0,0 +1,410 @@
+#include "accel_daemon.h"
+#include "../drivers/accel_client.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+// A client has this long to send its hello after connecting
+#define HELLO_TIMEOUT_MS 1000
+
+// Idle wake-up, so a stop request is noticed even without a signal
+#define IDLE_POLL_MS 1000
+
+#define MAX_EVENTS 16
+
+static const char *priority_names[ACCEL_PRIORITY_COUNT] = {"high", "normal", "low"};
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+AccelDaemon::AccelDaemon(CNNFPGADriver &driver)
+    : fpga(driver), listen_fd(-1), epoll_fd(-1), last_run(nullptr) {
+    for (int p = 0; p < ACCEL_PRIORITY_COUNT; p++) {
+        next_in_priority[p] = 0;
+    }
+}
+
+AccelDaemon::~AccelDaemon() {
+    shutdown();
+}
+
+bool AccelDaemon::start(const char *path) {
+    socket_path = path;
+    unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 8) != 0) {
+        std::cerr << "Cannot listen on " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) {
+        std::cerr << "Failed to set up epoll" << std::endl;
+        return false;
+    }
+    std::cout << "Accelerator daemon listening on " << path << std::endl;
+    return true;
+}
+
+bool AccelDaemon::send_welcome(int socket_fd, const AccelWelcome &welcome, const int *fds) {
+    char control[CMSG_SPACE(4 * sizeof(int))];
+    struct iovec iov;
+    iov.iov_base = (void*)&welcome;
+    iov.iov_len = sizeof(welcome);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fds) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(4 * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, 4 * sizeof(int));
+    }
+    return sendmsg(socket_fd, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(welcome);
+}
+
+void AccelDaemon::accept_client() {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) return;
+
+    // The hello is read synchronously; a client that never sends one only
+    // holds the daemon up for the timeout
+    struct timeval timeout;
+    timeout.tv_sec = HELLO_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (HELLO_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    AccelHello hello;
+    AccelWelcome welcome;
+    memset(&welcome, 0, sizeof(welcome));
+    welcome.status = -1;
+    if (recv(fd, &hello, sizeof(hello), 0) != (ssize_t)sizeof(hello) ||
+        hello.version != ACCEL_PROTOCOL_VERSION || hello.priority >= ACCEL_PRIORITY_COUNT ||
+        hello.arena_size > ACCEL_MAX_ARENA) {
+        send_welcome(fd, welcome, nullptr);
+        close(fd);
+        return;
+    }
+    hello.name[ACCEL_NAME_LENGTH - 1] = '\0';
+
+    Client *client = new Client();
+    client->socket_fd = fd;
+    client->priority = (AccelPriority)hello.priority;
+    client->name = hello.name;
+    client->consumed = 0;
+    client->last_end_ns = 0;
+    client->previous_failed = false;
+    client->arena = fpga.alloc_buffer(hello.arena_size ? (size_t)hello.arena_size
+                                                       : ACCEL_DEFAULT_ARENA);
+    client->ring_fd = (int)syscall(SYS_memfd_create, "cnn_accel_ring", 0);
+    client->ring = nullptr;
+    if (client->ring_fd >= 0 && ftruncate(client->ring_fd, sizeof(AccelRing)) == 0) {
+        void *map = mmap(nullptr, sizeof(AccelRing), PROT_READ | PROT_WRITE, MAP_SHARED,
+                         client->ring_fd, 0);
+        if (map != MAP_FAILED) client->ring = (AccelRing*)map;
+    }
+    client->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    client->completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    bool ok = client->arena.valid() && client->ring &&
+              client->doorbell_fd >= 0 && client->completion_fd >= 0;
+    if (ok) {
+        // memfd pages start zeroed: empty ring, zero accounting
+        welcome.status = 0;
+        welcome.arena_phys = client->arena.phys;
+        welcome.arena_offset = fpga.dma_pool().offset_of(client->arena);
+        welcome.arena_size = client->arena.size;
+        int fds[4] = {fpga.dma_pool().fd(), client->ring_fd, client->doorbell_fd,
+                      client->completion_fd};
+        ok = send_welcome(fd, welcome, fds);
+    } else {
+        send_welcome(fd, welcome, nullptr);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    ok = ok && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+    event.events = EPOLLIN;
+    event.data.fd = client->doorbell_fd;
+    ok = ok && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->doorbell_fd, &event) == 0;
+
+    clients[fd] = client;
+    doorbells[client->doorbell_fd] = client;
+    by_priority[client->priority].push_back(client);
+    if (!ok) {
+        std::cerr << "Refused client " << client->name << std::endl;
+        drop_client(client);
+        return;
+    }
+    std::cout << "Client " << client->name << " connected (priority "
+              << priority_names[client->priority] << ", " << (client->arena.size >> 20)
+              << " MB arena)" << std::endl;
+}
+
+void AccelDaemon::drop_client(Client *client) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->socket_fd, nullptr);
+    if (client->doorbell_fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->doorbell_fd, nullptr);
+    }
+    clients.erase(client->socket_fd);
+    doorbells.erase(client->doorbell_fd);
+
+    std::vector<Client*> &group = by_priority[client->priority];
+    for (size_t i = 0; i < group.size(); i++) {
+        if (group[i] != client) continue;
+        group.erase(group.begin() + i);
+        size_t &next = next_in_priority[client->priority];
+        if (next > i) next--;
+        if (next >= group.size()) next = 0;
+        break;
+    }
+    if (last_run == client) last_run = nullptr;
+
+    // Jobs still on the ring are dropped; none is running, since jobs run
+    // to completion before events are handled
+    if (client->ring) {
+        const AccelAccounting &a = client->ring->accounting;
+        std::cout << "Client " << client->name << " disconnected after " << a.jobs << " jobs ("
+                  << a.failed << " failed)" << std::endl;
+        DepartedClient gone;
+        gone.name = client->name;
+        gone.priority = client->priority;
+        gone.accounting = a;
+        departed.push_back(gone);
+        munmap(client->ring, sizeof(AccelRing));
+    }
+    fpga.free_buffer(client->arena);
+    if (client->ring_fd >= 0) close(client->ring_fd);
+    if (client->doorbell_fd >= 0) close(client->doorbell_fd);
+    if (client->completion_fd >= 0) close(client->completion_fd);
+    close(client->socket_fd);
+    delete client;
+}
+
+void AccelDaemon::handle_events(int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == listen_fd) {
+            accept_client();
+            continue;
+        }
+
+        // A doorbell only wakes the loop; pending work is read off the rings
+        std::map<int, Client*>::iterator it = doorbells.find(fd);
+        if (it != doorbells.end()) {
+            uint64_t count;
+            if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                drop_client(it->second);
+            }
+            continue;
+        }
+
+        // Clients send nothing after the hello, so any socket event is a
+        // hang-up or a protocol error
+        it = clients.find(fd);
+        if (it != clients.end()) {
+            drop_client(it->second);
+        }
+    }
+}
+
+bool AccelDaemon::has_pending(const Client *client) {
+    return client->ring->head.load(std::memory_order_acquire) > client->consumed;
+}
+
+AccelDaemon::Client* AccelDaemon::pick_client() {
+    for (int p = 0; p < ACCEL_PRIORITY_COUNT; p++) {
+        std::vector<Client*> &group = by_priority[p];
+        for (size_t i = 0; i < group.size(); i++) {
+            size_t index = (next_in_priority[p] + i) % group.size();
+            if (has_pending(group[index])) {
+                next_in_priority[p] = (index + 1) % group.size();
+                return group[index];
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool AccelDaemon::to_command(const Client *client, const AccelJob &job, LayerCommand *command) {
+    command->op = (CommandOp)job.op;
+    command->input_h = job.input_h;
+    command->input_w = job.input_w;
+    command->input_c = job.input_c;
+    command->output_c = job.output_c;
+    command->output_stride = job.output_stride;
+    command->input_pitch = job.input_pitch;
+    command->output_pitch = job.output_pitch;
+    command->kernel_size = job.kernel_size;
+    command->stride = job.stride;
+    command->padding = job.padding;
+    command->conv_mode = job.conv_mode;
+    command->act_type = job.act_type;
+    command->use_relu = job.use_relu != 0;
+    command->use_relu6 = job.use_relu6 != 0;
+
+    size_t sizes[4];
+    if (!accel_tensor_sizes(*command, &sizes[0], &sizes[1], &sizes[2], &sizes[3])) {
+        return false;
+    }
+
+    // Every tensor has to lie inside the client's own arena
+    const uint32_t phys[4] = {job.input, job.weights, job.bias, job.output};
+    char *virt[4] = {nullptr, nullptr, nullptr, nullptr};
+    for (int i = 0; i < 4; i++) {
+        if (sizes[i] == 0) continue;
+        if (phys[i] < client->arena.phys ||
+            (size_t)(phys[i] - client->arena.phys) + sizes[i] > client->arena.size) {
+            return false;
+        }
+        virt[i] = (char*)client->arena.virt + (phys[i] - client->arena.phys);
+    }
+    command->input = (const qint8_t*)virt[0];
+    command->weights = (const qint8_t*)virt[1];
+    command->bias = (const qint32_t*)virt[2];
+    command->output = (qint8_t*)virt[3];
+    return true;
+}
+
+void AccelDaemon::run_job(Client *client) {
+    uint64_t sequence = client->consumed + 1;
+    AccelJob &slot = client->ring->slots[sequence % ACCEL_RING_SLOTS];
+
+    // Work from a copy, so the client cannot change the job once checked
+    AccelJob job = slot;
+    AccelAccounting &accounting = client->ring->accounting;
+
+    // The previous client was preempted if it still had work but this one
+    // outranks it
+    if (last_run && last_run != client && last_run->priority > client->priority &&
+        has_pending(last_run)) {
+        last_run->ring->accounting.preempted++;
+    }
+    last_run = client;
+
+    uint64_t start = monotonic_ns();
+    bool ok = job.sequence == sequence &&
+              !((job.flags & ACCEL_JOB_AFTER_PREVIOUS) && client->previous_failed);
+    if (ok) {
+        LayerCommand command;
+        ok = to_command(client, job, &command);
+        CommandHandle handle = ok ? fpga.submit(command) : NO_COMMAND;
+        ok = handle != NO_COMMAND && fpga.wait(handle);
+    }
+    uint64_t end = monotonic_ns();
+
+    // Waiting starts when the job reaches the head of its own ring; time
+    // behind the client's own earlier jobs is not queueing
+    uint64_t ready = job.submit_ns > client->last_end_ns ? job.submit_ns : client->last_end_ns;
+    uint64_t wait = start > ready ? start - ready : 0;
+    accounting.jobs++;
+    if (!ok) accounting.failed++;
+    accounting.busy_ns += end - start;
+    accounting.wait_ns += wait;
+    if (wait > accounting.max_wait_ns) accounting.max_wait_ns = wait;
+
+    slot.status = ok ? 0 : -1;
+    client->consumed = sequence;
+    client->last_end_ns = end;
+    client->previous_failed = !ok;
+    client->ring->completed.store(sequence, std::memory_order_release);
+    uint64_t one = 1;
+    if (write(client->completion_fd, &one, sizeof(one)) < 0) {
+        // Only fails if the counter would overflow; the client polls the
+        // ring before sleeping, so nothing is lost
+    }
+}
+
+void AccelDaemon::run(volatile sig_atomic_t *stop, volatile sig_atomic_t *report) {
+    while (!*stop) {
+        if (*report) {
+            *report = 0;
+            print_accounting();
+        }
+
+        // One layer, then look at the rings again, so a newly queued
+        // high-priority job goes next
+        Client *client = pick_client();
+        if (client) {
+            run_job(client);
+            handle_events(0);
+        } else {
+            handle_events(IDLE_POLL_MS);
+        }
+    }
+}
+
+static void print_accounting_row(const std::string &name, AccelPriority priority,
+                                 const AccelAccounting &a) {
+    printf("%-20s %-7s %9llu %7llu %11.1f %13.1f %13.1f %10llu\n",
+           name.c_str(), priority_names[priority],
+           (unsigned long long)a.jobs, (unsigned long long)a.failed,
+           a.busy_ns / 1e6, a.jobs ? a.wait_ns / 1e3 / a.jobs : 0.0,
+           a.max_wait_ns / 1e3, (unsigned long long)a.preempted);
+}
+
+// Connected clients by priority, then those that have left
+void AccelDaemon::print_accounting() {
+    printf("\n%-20s %-7s %9s %7s %11s %13s %13s %10s\n", "Client", "Prio", "Jobs", "Failed",
+           "Busy (ms)", "Avg wait (us)", "Max wait (us)", "Preempted");
+    for (int p = 0; p < ACCEL_PRIORITY_COUNT; p++) {
+        for (size_t i = 0; i < by_priority[p].size(); i++) {
+            const Client *client = by_priority[p][i];
+            print_accounting_row(client->name, client->priority, client->ring->accounting);
+        }
+    }
+    if (!departed.empty()) {
+        printf("Disconnected:\n");
+    }
+    for (size_t i = 0; i < departed.size(); i++) {
+        print_accounting_row(departed[i].name, departed[i].priority, departed[i].accounting);
+    }
+    fflush(stdout);
+}
+
+void AccelDaemon::shutdown() {
+    while (!clients.empty()) {
+        drop_client(clients.begin()->second);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path.c_str());
+    }
+}
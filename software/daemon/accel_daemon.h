@@ -0,0 +1,84 @@
+#ifndef ACCEL_DAEMON_H
+#define ACCEL_DAEMON_H
+
+#include <stdint.h>
+#include <csignal>
+#include <map>
+#include <string>
+#include <vector>
+#include "../drivers/accel_protocol.h"
+#include "../drivers/cnn_fpga_driver.h"
+
+// Owns the accelerators on behalf of several processes. Each client gets
+// an arena of the driver's DMA pool and a job ring in shared memory; the
+// daemon runs one job (one layer) at a time, always taking the next job
+// of the highest-priority client that has one. Preemption therefore
+// happens at layer boundaries: a high-priority job waits for at most the
+// layer already running.
+class AccelDaemon {
+private:
+    CNNFPGADriver &fpga;
+    std::string socket_path;
+    int listen_fd;
+    int epoll_fd;
+
+    struct Client {
+        int socket_fd;
+        int doorbell_fd;
+        int completion_fd;
+        int ring_fd;
+        AccelRing *ring;
+        DmaBuffer arena;
+        AccelPriority priority;
+        std::string name;
+        uint64_t consumed;          // Last sequence taken off the ring
+        uint64_t last_end_ns;       // When the client's previous job finished
+        bool previous_failed;
+    };
+
+    // By socket and by doorbell descriptor, the keys epoll reports
+    std::map<int, Client*> clients;
+    std::map<int, Client*> doorbells;
+
+    // Clients in connection order per priority, and where round robin
+    // resumes in each
+    std::vector<Client*> by_priority[ACCEL_PRIORITY_COUNT];
+    size_t next_in_priority[ACCEL_PRIORITY_COUNT];
+
+    Client *last_run;
+
+    // Accounting of clients that have disconnected, whose rings are gone,
+    // in disconnection order
+    struct DepartedClient {
+        std::string name;
+        AccelPriority priority;
+        AccelAccounting accounting;
+    };
+    std::vector<DepartedClient> departed;
+
+    void accept_client();
+    bool send_welcome(int socket_fd, const AccelWelcome &welcome, const int *fds);
+    void drop_client(Client *client);
+    void handle_events(int timeout_ms);
+
+    static bool has_pending(const Client *client);
+    Client* pick_client();
+    void run_job(Client *client);
+    bool to_command(const Client *client, const AccelJob &job, LayerCommand *command);
+
+public:
+    explicit AccelDaemon(CNNFPGADriver &driver);
+    ~AccelDaemon();
+
+    // Listen on socket_path (replacing a stale socket file)
+    bool start(const char *path);
+
+    // Serve clients until *stop is set; prints the accounting whenever
+    // *report is set (and clears it)
+    void run(volatile sig_atomic_t *stop, volatile sig_atomic_t *report);
+
+    void print_accounting();
+    void shutdown();
+};
+
+#endif // ACCEL_DAEMON_H
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <string>
+#include <csignal>
+#include <cstring>
+#include "accel_daemon.h"
+#include "../drivers/cnn_fpga_driver.h"
+
+// SIGINT/SIGTERM stop the daemon, SIGUSR1 prints the per-client accounting
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t report_requested = 0;
+
+static void handle_stop(int) {
+    stop_requested = 1;
+}
+
+static void handle_report(int) {
+    report_requested = 1;
+}
+
+int main(int argc, char *argv[]) {
+    std::cout << "=== CNN Accelerator Daemon ===" << std::endl;
+    
+    // --sim: run on the simulated accelerator (no board required)
+    // --socket PATH: where clients connect (default ACCEL_SOCKET_PATH)
+    // --wait poll|irq|adaptive: how to wait for each layer (default adaptive)
+    bool simulate = false;
+    std::string socket_path = ACCEL_SOCKET_PATH;
+    CompletionMode completion = COMPLETION_ADAPTIVE;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--sim") simulate = true;
+        else if (arg == "--socket" && i + 1 < argc) socket_path = argv[++i];
+        else if (arg == "--wait" && i + 1 < argc) {
+            std::string mode(argv[++i]);
+            if (mode == "poll") completion = COMPLETION_POLL;
+            else if (mode == "irq") completion = COMPLETION_INTERRUPT;
+            else completion = COMPLETION_ADAPTIVE;
+        }
+    }
+    
+    // Handlers without SA_RESTART, so a signal wakes the idle epoll_wait
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    action.sa_handler = handle_report;
+    sigaction(SIGUSR1, &action, nullptr);
+    
+    CNNFPGADriver fpga;
+    if (!fpga.init(simulate)) {
+        std::cerr << "Failed to initialize FPGA driver" << std::endl;
+        return 1;
+    }
+    fpga.set_completion_mode(completion);
+    
+    AccelDaemon daemon(fpga);
+    if (!daemon.start(socket_path.c_str())) {
+        fpga.cleanup();
+        return 1;
+    }
+    daemon.run(&stop_requested, &report_requested);
+    
+    daemon.print_accounting();
+    daemon.shutdown();
+    fpga.cleanup();
+    return 0;
+}
@@ -0,0 +1,298 @@
+#include "accel_client.h"
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+// Largest span a single tensor may have; shapes beyond it are malformed
+#define MAX_TENSOR_BYTES 0x7FFFFFFFull
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Bytes spanned by rows rows of row_bytes, pitch bytes apart (0 = packed)
+static uint64_t rows_span(int rows, uint64_t row_bytes, int pitch) {
+    uint64_t step = pitch > 0 ? (uint64_t)pitch : row_bytes;
+    return (uint64_t)(rows - 1) * step + row_bytes;
+}
+
+bool accel_tensor_sizes(const LayerCommand &command, size_t *input, size_t *weights,
+                        size_t *bias, size_t *output) {
+    const LayerCommand &c = command;
+    uint64_t in = 0, w = 0, b = 0, out = 0;
+    if (c.input_h <= 0 || c.input_w <= 0 || c.input_c <= 0) return false;
+    uint64_t in_elements = (uint64_t)c.input_h * c.input_w * c.input_c;
+
+    switch (c.op) {
+        case CMD_CONV:
+        case CMD_MAX_POOL:
+        case CMD_AVG_POOL: {
+            if (c.kernel_size <= 0 || c.stride <= 0 || c.padding < 0) return false;
+            int out_h = (c.input_h + 2 * c.padding - c.kernel_size) / c.stride + 1;
+            int out_w = (c.input_w + 2 * c.padding - c.kernel_size) / c.stride + 1;
+            if (out_h <= 0 || out_w <= 0) return false;
+            uint64_t pixels = (uint64_t)out_h * out_w;
+            in = in_elements;
+            if (c.op != CMD_CONV) {
+                out = pixels * c.input_c;
+                break;
+            }
+            // A job carries one kernel and one image, so no separable blocks or batches
+            if (c.output_c <= 0 || c.output_stride < 0 || c.conv_mode == CONV_MODE_SEPARABLE ||
+                c.batch != 1) return false;
+            uint64_t window = (uint64_t)c.kernel_size * c.kernel_size;
+            w = c.conv_mode == CONV_MODE_DEPTHWISE ? window * c.input_c
+                                                   : window * c.input_c * c.output_c;
+            b = (uint64_t)c.output_c * sizeof(qint32_t);
+            uint64_t pitch = c.output_stride > 0 ? (uint64_t)c.output_stride : (uint64_t)c.output_c;
+            out = (pixels - 1) * pitch + c.output_c;
+            break;
+        }
+        case CMD_ACTIVATION:
+            in = out = in_elements;
+            break;
+        case CMD_GLOBAL_AVG_POOL:
+            in = in_elements;
+            out = c.input_c;
+            break;
+        case CMD_COPY: {
+            uint64_t row = (uint64_t)c.input_w * c.input_c;
+            if (c.input_pitch < 0 || c.output_pitch < 0) return false;
+            in = rows_span(c.input_h, row, c.input_pitch);
+            out = rows_span(c.input_h, row, c.output_pitch);
+            break;
+        }
+        default:
+            return false;
+    }
+    if (in > MAX_TENSOR_BYTES || w > MAX_TENSOR_BYTES || out > MAX_TENSOR_BYTES) return false;
+
+    *input = (size_t)in;
+    *weights = (size_t)w;
+    *bias = (size_t)b;
+    *output = (size_t)out;
+    return true;
+}
+
+AccelClient::AccelClient()
+    : socket_fd(-1), doorbell_fd(-1), completion_fd(-1), ring(nullptr), next_sequence(1) {
+}
+
+AccelClient::~AccelClient() {
+    disconnect();
+}
+
+bool AccelClient::receive_welcome(AccelWelcome *welcome, int fds[4]) {
+    char control[CMSG_SPACE(4 * sizeof(int))];
+    struct iovec iov;
+    iov.iov_base = welcome;
+    iov.iov_len = sizeof(*welcome);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof(*welcome) || welcome->status != 0) {
+        return false;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(4 * sizeof(int))) {
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 4 * sizeof(int));
+    return true;
+}
+
+bool AccelClient::connect(const char *socket_path, AccelPriority priority, size_t arena_size,
+                          const char *name) {
+    disconnect();
+
+    socket_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    if (socket_fd < 0 || ::connect(socket_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        std::cerr << "Cannot reach the accelerator daemon at " << socket_path << std::endl;
+        disconnect();
+        return false;
+    }
+
+    AccelHello hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.version = ACCEL_PROTOCOL_VERSION;
+    hello.priority = priority;
+    hello.arena_size = arena_size;
+    strncpy(hello.name, name, ACCEL_NAME_LENGTH - 1);
+
+    AccelWelcome welcome;
+    int fds[4] = {-1, -1, -1, -1};
+    if (send(socket_fd, &hello, sizeof(hello), MSG_NOSIGNAL) != (ssize_t)sizeof(hello) ||
+        !receive_welcome(&welcome, fds)) {
+        std::cerr << "Accelerator daemon refused the connection" << std::endl;
+        disconnect();
+        return false;
+    }
+
+    // fds: DMA pool, ring, doorbell, completion
+    doorbell_fd = fds[2];
+    completion_fd = fds[3];
+    void *map = mmap(nullptr, sizeof(AccelRing), PROT_READ | PROT_WRITE, MAP_SHARED, fds[1], 0);
+    close(fds[1]);
+    bool ok = map != MAP_FAILED &&
+              arena.open_shared(fds[0], (size_t)welcome.arena_offset,
+                                (size_t)welcome.arena_size, welcome.arena_phys);
+    if (map != MAP_FAILED) {
+        ring = (AccelRing*)map;
+    }
+    if (!ok) {
+        std::cerr << "Failed to map the accelerator daemon's shared memory" << std::endl;
+        disconnect();
+        return false;
+    }
+    next_sequence = ring->head.load(std::memory_order_acquire) + 1;
+    return true;
+}
+
+void AccelClient::disconnect() {
+    if (ring) {
+        munmap(ring, sizeof(AccelRing));
+        ring = nullptr;
+    }
+    arena.close_pool();
+    if (doorbell_fd >= 0) close(doorbell_fd);
+    if (completion_fd >= 0) close(completion_fd);
+    if (socket_fd >= 0) close(socket_fd);
+    doorbell_fd = completion_fd = socket_fd = -1;
+    failed_jobs.clear();
+}
+
+DmaBuffer AccelClient::alloc_buffer(size_t size) {
+    return arena.allocate(size);
+}
+
+void AccelClient::free_buffer(DmaBuffer &buffer) {
+    arena.free(buffer);
+}
+
+bool AccelClient::block_until_completed(uint64_t sequence) {
+    while (ring->completed.load(std::memory_order_acquire) < sequence) {
+        // The daemon bumps completed before it signals, so a wake-up is
+        // never lost between the check and the poll. The socket only
+        // becomes readable when the daemon goes away.
+        struct pollfd fds[2];
+        fds[0].fd = completion_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = socket_fd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (fds[1].revents) {
+            std::cerr << "Lost the accelerator daemon" << std::endl;
+            return false;
+        }
+        uint64_t count;
+        if (read(completion_fd, &count, sizeof(count)) < 0 && errno != EINTR && errno != EAGAIN) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t AccelClient::submit(const LayerCommand &command, bool after_previous) {
+    if (!ring) return 0;
+
+    size_t sizes[4];
+    if (!accel_tensor_sizes(command, &sizes[0], &sizes[1], &sizes[2], &sizes[3])) {
+        std::cerr << "Accelerator daemon cannot run this command" << std::endl;
+        return 0;
+    }
+    const void *tensors[4] = {command.input, command.weights, command.bias, command.output};
+    uint32_t phys[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        if (sizes[i] == 0) continue;
+        if (!arena.virt_to_phys(tensors[i], sizes[i], &phys[i])) {
+            std::cerr << "Tensor outside the accelerator daemon arena" << std::endl;
+            return 0;
+        }
+    }
+
+    // Wait for the slot's previous job, keeping its result if it failed
+    uint64_t sequence = next_sequence;
+    if (sequence > ACCEL_RING_SLOTS) {
+        uint64_t previous = sequence - ACCEL_RING_SLOTS;
+        if (!block_until_completed(previous)) return 0;
+        const AccelJob &old = ring->slots[previous % ACCEL_RING_SLOTS];
+        if (old.status != 0) failed_jobs.insert(previous);
+    }
+
+    AccelJob &job = ring->slots[sequence % ACCEL_RING_SLOTS];
+    memset(&job, 0, sizeof(job));
+    job.sequence = sequence;
+    job.submit_ns = monotonic_ns();
+    job.op = command.op;
+    job.flags = after_previous ? ACCEL_JOB_AFTER_PREVIOUS : 0;
+    job.input = phys[0];
+    job.weights = phys[1];
+    job.bias = phys[2];
+    job.output = phys[3];
+    job.input_h = command.input_h;
+    job.input_w = command.input_w;
+    job.input_c = command.input_c;
+    job.output_c = command.output_c;
+    job.output_stride = command.output_stride;
+    job.input_pitch = command.input_pitch;
+    job.output_pitch = command.output_pitch;
+    job.kernel_size = command.kernel_size;
+    job.stride = command.stride;
+    job.padding = command.padding;
+    job.conv_mode = command.conv_mode;
+    job.act_type = command.act_type;
+    job.use_relu = command.use_relu ? 1 : 0;
+    job.use_relu6 = command.use_relu6 ? 1 : 0;
+
+    ring->head.store(sequence, std::memory_order_release);
+    uint64_t one = 1;
+    if (write(doorbell_fd, &one, sizeof(one)) != (ssize_t)sizeof(one)) {
+        std::cerr << "Failed to ring the accelerator daemon" << std::endl;
+        return 0;
+    }
+    next_sequence++;
+    return sequence;
+}
+
+bool AccelClient::wait(uint64_t sequence) {
+    if (!ring || sequence == 0 || sequence >= next_sequence) return false;
+    if (!block_until_completed(sequence)) return false;
+
+    const AccelJob &job = ring->slots[sequence % ACCEL_RING_SLOTS];
+    if (job.sequence == sequence) {
+        return job.status == 0;
+    }
+    return failed_jobs.erase(sequence) == 0;
+}
+
+AccelAccounting AccelClient::accounting() const {
+    AccelAccounting snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    if (ring) snapshot = ring->accounting;
+    return snapshot;
+}
@@ -0,0 +1,64 @@
+#ifndef ACCEL_CLIENT_H
+#define ACCEL_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <set>
+#include "accel_protocol.h"
+#include "cnn_fpga_driver.h"
+#include "dma_allocator.h"
+
+// Bytes each tensor of a command spans (0 for unused ones); false if the
+// op is not one clients may queue or its shape is malformed. The client
+// and the daemon both check jobs with it.
+bool accel_tensor_sizes(const LayerCommand &command, size_t *input, size_t *weights,
+                        size_t *bias, size_t *output);
+
+// Uses the accelerators through the accelerator daemon instead of owning
+// the driver, so several processes can share the board. Tensors live in
+// the client's arena of the daemon's DMA pool; layers are queued on the
+// shared ring and run in submission order. One thread per client.
+class AccelClient {
+private:
+    int socket_fd;
+    int doorbell_fd;
+    int completion_fd;
+    AccelRing *ring;
+    DmaAllocator arena;
+
+    uint64_t next_sequence;
+
+    // Jobs that failed and whose slot has since been reused, until wait()
+    // reports them
+    std::set<uint64_t> failed_jobs;
+
+    bool receive_welcome(AccelWelcome *welcome, int fds[4]);
+    bool block_until_completed(uint64_t sequence);
+
+public:
+    AccelClient();
+    ~AccelClient();
+
+    bool connect(const char *socket_path, AccelPriority priority, size_t arena_size,
+                 const char *name);
+    void disconnect();
+    bool connected() const { return ring != nullptr; }
+
+    // Device-visible tensors inside the arena
+    DmaBuffer alloc_buffer(size_t size);
+    void free_buffer(DmaBuffer &buffer);
+
+    // Queue one layer; every tensor must be in the arena. With
+    // after_previous the job fails without running if the one before it
+    // failed. Blocks while the ring is full. Returns the job's sequence
+    // number, 0 if the command was rejected.
+    uint64_t submit(const LayerCommand &command, bool after_previous);
+
+    // Block until the job has run; true if it succeeded
+    bool wait(uint64_t sequence);
+
+    // The daemon's accounting for this client
+    AccelAccounting accounting() const;
+};
+
+#endif // ACCEL_CLIENT_H
@@ -0,0 +1,105 @@
+#ifndef ACCEL_PROTOCOL_H
+#define ACCEL_PROTOCOL_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Shared between the accelerator daemon (cnn_accel_daemon), which owns the
+// driver, and the processes that use the accelerators through it.
+//
+// A client connects to the daemon's unix socket and sends an AccelHello.
+// The daemon carves the client an arena out of its DMA pool and answers
+// with an AccelWelcome plus four descriptors (SCM_RIGHTS): the DMA pool,
+// the client's AccelRing (a memfd), the doorbell eventfd the client writes
+// after queuing jobs and the completion eventfd the daemon writes after
+// finishing them. Closing the socket disconnects.
+
+#define ACCEL_SOCKET_PATH "/run/cnn_accel.sock"
+#define ACCEL_PROTOCOL_VERSION 2
+#define ACCEL_RING_SLOTS 64
+#define ACCEL_NAME_LENGTH 32
+
+// Default arena when the client asks for 0 bytes, and the largest one
+#define ACCEL_DEFAULT_ARENA (16 * 1024 * 1024)
+#define ACCEL_MAX_ARENA (64 * 1024 * 1024)
+
+// The daemon always runs the highest-priority pending job next, round
+// robin between clients of equal priority. Jobs are single layers, so a
+// high-priority client waits for at most one layer of anyone else.
+enum AccelPriority {
+    ACCEL_PRIORITY_HIGH,
+    ACCEL_PRIORITY_NORMAL,
+    ACCEL_PRIORITY_LOW,
+    ACCEL_PRIORITY_COUNT
+};
+
+// Fail without running if the client's previous job failed
+#define ACCEL_JOB_AFTER_PREVIOUS (1u << 0)
+
+// One layer, with the fields of a LayerCommand. Tensors are bus addresses
+// inside the client's arena (0 = unused); the daemon rejects anything
+// outside it. CMD_PROGRAM, separable convs and registered weights are not
+// available to clients.
+struct AccelJob {
+    uint64_t sequence;          // 1 for the client's first job, then +1 per job
+    uint64_t submit_ns;         // CLOCK_MONOTONIC when queued
+    uint32_t op;                // CommandOp
+    uint32_t flags;             // ACCEL_JOB_*
+    uint32_t input;
+    uint32_t weights;
+    uint32_t bias;
+    uint32_t output;
+    int32_t input_h, input_w, input_c;
+    int32_t output_c;
+    int32_t output_stride;
+    int32_t input_pitch;
+    int32_t output_pitch;
+    int32_t kernel_size;
+    int32_t stride;
+    int32_t padding;
+    int32_t conv_mode;
+    int32_t act_type;
+    int32_t use_relu;
+    int32_t use_relu6;
+    int32_t status;             // Set by the daemon: 0 done, -1 failed
+};
+
+// Per-client usage, updated by the daemon after every job. Readers get a
+// snapshot that may be mid-update.
+struct AccelAccounting {
+    uint64_t jobs;              // Jobs run, failed ones included
+    uint64_t failed;
+    uint64_t busy_ns;           // Accelerator time spent on the client's jobs
+    uint64_t wait_ns;           // Queueing time, summed: from when a job was both
+                                // submitted and next on its ring to its start
+    uint64_t max_wait_ns;
+    uint64_t preempted;         // Times a higher-priority client ran ahead of
+                                // a job this client had pending
+};
+
+// Single-producer ring in shared memory. The client fills
+// slots[sequence % ACCEL_RING_SLOTS], bumps head and rings the doorbell;
+// the daemon runs jobs in order and bumps completed after each. A slot may
+// be refilled once its job has completed.
+struct AccelRing {
+    std::atomic<uint64_t> head;         // Last sequence queued
+    std::atomic<uint64_t> completed;    // Last sequence finished
+    AccelAccounting accounting;
+    AccelJob slots[ACCEL_RING_SLOTS];
+};
+
+struct AccelHello {
+    uint32_t version;           // ACCEL_PROTOCOL_VERSION
+    uint32_t priority;          // AccelPriority
+    uint64_t arena_size;        // Bytes of DMA memory wanted, 0 = default
+    char name[ACCEL_NAME_LENGTH];
+};
+
+struct AccelWelcome {
+    int32_t status;             // 0 accepted, -1 refused (no descriptors follow)
+    uint32_t arena_phys;        // Bus address of the arena
+    uint64_t arena_offset;      // Arena's offset in the DMA pool descriptor
+    uint64_t arena_size;
+};
+
+#endif // ACCEL_PROTOCOL_H
@@ -0,0 +1,65 @@
+#ifndef AXI_DMA_H
+#define AXI_DMA_H
+
+#include <stdint.h>
+
+// Xilinx AXI DMA (PG021) in scatter-gather mode. Register macros are byte
+// offsets from AXI_DMA_BASE_ADDR. In this design MM2S is looped back into
+// S2MM through an AXI-Stream FIFO, so one MM2S packet gathered from any
+// number of source segments lands in any number of destination segments.
+#define AXI_DMA_MM2S_DMACR 0x00
+#define AXI_DMA_MM2S_DMASR 0x04
+#define AXI_DMA_MM2S_CURDESC 0x08
+#define AXI_DMA_MM2S_TAILDESC 0x10
+#define AXI_DMA_S2MM_DMACR 0x30
+#define AXI_DMA_S2MM_DMASR 0x34
+#define AXI_DMA_S2MM_CURDESC 0x38
+#define AXI_DMA_S2MM_TAILDESC 0x40
+
+// DMACR bits
+#define AXI_DMA_CR_RUN (1u << 0)
+#define AXI_DMA_CR_RESET (1u << 2)
+#define AXI_DMA_CR_IOC_IRQ_EN (1u << 12)
+#define AXI_DMA_CR_ERR_IRQ_EN (1u << 14)
+#define AXI_DMA_CR_IRQ_THRESHOLD_1 (1u << 16)
+
+// DMASR bits
+#define AXI_DMA_SR_HALTED (1u << 0)
+#define AXI_DMA_SR_IDLE (1u << 1)
+#define AXI_DMA_SR_SG_INCLUDED (1u << 3)
+#define AXI_DMA_SR_DMA_INT_ERR (1u << 4)
+#define AXI_DMA_SR_DMA_SLV_ERR (1u << 5)
+#define AXI_DMA_SR_DMA_DEC_ERR (1u << 6)
+#define AXI_DMA_SR_SG_INT_ERR (1u << 8)
+#define AXI_DMA_SR_SG_SLV_ERR (1u << 9)
+#define AXI_DMA_SR_SG_DEC_ERR (1u << 10)
+#define AXI_DMA_SR_ERRORS 0x770u
+#define AXI_DMA_SR_IOC_IRQ (1u << 12)
+#define AXI_DMA_SR_ERR_IRQ (1u << 14)
+
+// Scatter-gather descriptor, 64-byte aligned in device memory
+struct AxiDmaDescriptor {
+    uint32_t next;                  // Bus address of the next descriptor
+    uint32_t next_msb;
+    uint32_t buffer;                // Bus address of this segment
+    uint32_t buffer_msb;
+    uint32_t reserved[2];
+    uint32_t control;               // Length, plus SOF/EOF on MM2S
+    uint32_t status;                // Bytes moved, completion and error bits
+    uint32_t app[5];
+    uint32_t pad[3];
+};
+
+#define AXI_DMA_DESC_ALIGN 64
+#define AXI_DMA_DESC_LENGTH_MASK 0x03FFFFFFu
+#define AXI_DMA_DESC_TXSOF (1u << 27)
+#define AXI_DMA_DESC_TXEOF (1u << 26)
+#define AXI_DMA_DESC_RXEOF (1u << 26)
+#define AXI_DMA_DESC_COMPLETE (1u << 31)
+#define AXI_DMA_DESC_ERRORS (7u << 28)
+
+// Longest segment one descriptor carries; the block design sets the
+// buffer length register to 23 bits
+#define AXI_DMA_MAX_SEGMENT (1u << 22)
+
+#endif // AXI_DMA_H
@@ -1,81 +1,136 @@
 #include "cnn_fpga_driver.h"
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sched.h>
 #include <unistd.h>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 
-#define PAGE_SIZE 4096
-#define MAP_SIZE (PAGE_SIZE * 256)
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-CNNFPGADriver::CNNFPGADriver() 
-    : mem_fd(-1), fpga_base(nullptr), dma_base(nullptr),
-      input_buffer_phys(nullptr), output_buffer_phys(nullptr), 
-      weight_buffer_phys(nullptr),
-      input_buffer_virt(nullptr), output_buffer_virt(nullptr),
-      weight_buffer_virt(nullptr),
-      buffer_size(CONV_INPUT_BUFFER_SIZE * sizeof(qint8_t)) {
+CNNFPGADriver::CNNFPGADriver()
+    : mem_fd(-1), sim(nullptr), next_weight_handle(1), next_program_handle(1), dma_sg(false),
+      completion_mode(COMPLETION_ADAPTIVE), completion_timeout_ms(COMPLETION_TIMEOUT_MS),
+      cycle_count(0), next_handle(1), completed_through(NO_COMMAND), queue_stopping(false),
+      stats_start_ns(0) {
+    static const char *names[ENGINE_COUNT] = {"conv", "activation", "pooling", "classifier", "dma"};
+    static const uint32_t bases[ENGINE_COUNT] = {CONV_BASE_ADDR, ACTIVATION_BASE_ADDR, POOLING_BASE_ADDR,
+                                                 CLASSIFIER_BASE_ADDR, AXI_DMA_BASE_ADDR};
+    static const char *uio_names[ENGINE_COUNT] = {CONV_UIO_NAME, ACTIVATION_UIO_NAME, POOLING_UIO_NAME,
+                                                  CLASSIFIER_UIO_NAME, AXI_DMA_UIO_NAME};
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        engines[i].id = (EngineId)i;
+        engines[i].name = names[i];
+        engines[i].base_addr = bases[i];
+        engines[i].uio_name = uio_names[i];
+        engines[i].regs = nullptr;
+        engines[i].ns_per_op = 0.0;
+    }
 }
 
 CNNFPGADriver::~CNNFPGADriver() {
     cleanup();
 }
 
-bool CNNFPGADriver::init() {
-    // Open /dev/mem for memory-mapped I/O
-    mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
-    if (mem_fd < 0) {
-        std::cerr << "Failed to open /dev/mem" << std::endl;
-        return false;
-    }
+bool CNNFPGADriver::init(bool simulate) {
+    if (simulate) {
+        // Host testing: memfd-backed pool and an in-process register model
+        if (!dma.open_memfd(SIM_DMA_POOL_SIZE)) {
+            return false;
+        }
+        sim = new FpgaSimulator(dma);
+        for (int i = 0; i < ENGINE_COUNT; i++) {
+            if (!engines[i].irq.open_eventfd()) {
+                return false;
+            }
+            sim->attach_irq(engines[i].base_addr, &engines[i].irq);
+        }
+    } else {
+        // Open /dev/mem for memory-mapped I/O
+        mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+        if (mem_fd < 0) {
+            std::cerr << "Failed to open /dev/mem" << std::endl;
+            return false;
+        }
     
-    // Map FPGA register space
-    fpga_base = map_physical_memory(FPGA_BASE_ADDR, MAP_SIZE);
-    if (fpga_base == nullptr) {
-        std::cerr << "Failed to map FPGA registers" << std::endl;
-        return false;
-    }
+        // Physically contiguous pool for every DMA buffer
+        if (!dma.open_udmabuf(UDMABUF_NAME)) {
+            std::cerr << "Failed to open DMA buffer pool" << std::endl;
+            return false;
+        }
     
-    // Allocate physically contiguous buffers for DMA
-    input_buffer_virt = allocate_contiguous_memory(buffer_size, &input_buffer_phys);
-    output_buffer_virt = allocate_contiguous_memory(buffer_size, &output_buffer_phys);
-    weight_buffer_virt = allocate_contiguous_memory(WEIGHT_BUFFER_SIZE * sizeof(qint8_t), 
-                                                     &weight_buffer_phys);
+        for (int i = 0; i < ENGINE_COUNT; i++) {
+            Engine &engine = engines[i];
     
-    if (!input_buffer_virt || !output_buffer_virt || !weight_buffer_virt) {
-        std::cerr << "Failed to allocate DMA buffers" << std::endl;
-        return false;
+            // Each block's own register window
+            engine.regs = map_physical_memory(engine.base_addr, ACCEL_BLOCK_SIZE);
+            if (engine.regs == nullptr) {
+                std::cerr << "Failed to map " << engine.name << " accelerator registers" << std::endl;
+                return false;
+            }
+    
+            // Done interrupt; without it every wait on this block polls
+            if (!engine.irq.open_uio(engine.uio_name)) {
+                std::cerr << "Interrupt for the " << engine.name
+                          << " accelerator unavailable, falling back to polling" << std::endl;
+            }
+    
+            reset_engine(engine);
+            usleep(1000);
+        }
+    }
+    
+    // Without scatter-gather the DMA engine's copies run on the CPU
+    dma_sg = (read_reg(engines[ENGINE_DMA], AXI_DMA_MM2S_DMASR) & AXI_DMA_SR_SG_INCLUDED) != 0;
+    if (!dma_sg) {
+        std::cerr << "AXI DMA has no scatter-gather engine, copies fall back to memcpy" << std::endl;
     }
     
-    // Reset FPGA accelerator
-    write_reg(CONV_CTRL_REG, CTRL_RESET_BIT);
-    usleep(1000);
-    write_reg(CONV_CTRL_REG, 0);
+    stats_start_ns = now_ns();
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        engines[i].thread = std::thread(&CNNFPGADriver::engine_loop, this, (EngineId)i);
+    }
     
-    std::cout << "FPGA driver initialized successfully" << std::endl;
+    std::cout << (sim ? "FPGA driver running on the simulated backend"
+                      : "FPGA driver initialized successfully") << std::endl;
     return true;
 }
 
 void CNNFPGADriver::cleanup() {
-    if (fpga_base) {
-        unmap_memory(fpga_base, MAP_SIZE);
-        fpga_base = nullptr;
-    }
+    stop_queue();
     
-    if (input_buffer_virt) {
-        free_contiguous_memory(input_buffer_virt, buffer_size);
-        input_buffer_virt = nullptr;
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        if (engines[i].regs) {
+            unmap_memory(engines[i].regs, ACCEL_BLOCK_SIZE);
+            engines[i].regs = nullptr;
+        }
     }
     
-    if (output_buffer_virt) {
-        free_contiguous_memory(output_buffer_virt, buffer_size);
-        output_buffer_virt = nullptr;
+    // Stop the simulator before the memory it works on goes away
+    if (sim) {
+        delete sim;
+        sim = nullptr;
     }
     
-    if (weight_buffer_virt) {
-        free_contiguous_memory(weight_buffer_virt, WEIGHT_BUFFER_SIZE * sizeof(qint8_t));
-        weight_buffer_virt = nullptr;
+    release_all_weights();
+    release_all_programs();
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        Engine &engine = engines[i];
+        engine.irq.close_line();
+        dma.free(engine.input_staging);
+        dma.free(engine.output_staging);
+        dma.free(engine.weight_staging);
+        dma.free(engine.bias_staging);
+        dma.free(engine.pw_weight_staging);
+        dma.free(engine.pw_bias_staging);
     }
+    dma.free(dma_descriptors);
+    dma.close_pool();
     
     if (mem_fd >= 0) {
         close(mem_fd);
@@ -98,45 +153,412 @@ void CNNFPGADriver::unmap_memory(void *addr, size_t size) {
     }
 }
 
-void* CNNFPGADriver::allocate_contiguous_memory(size_t size, void **phys_addr) {
-    // In a real implementation, this would use CMA (Contiguous Memory Allocator)
-    // or UIO (Userspace I/O) framework
-    // For now, using regular malloc (not truly contiguous)
-    // TODO: Implement proper CMA allocation via /dev/udmabuf or similar
+DmaBuffer CNNFPGADriver::alloc_buffer(size_t size) {
+    return dma.allocate(size);
+}
+
+void CNNFPGADriver::free_buffer(DmaBuffer &buffer) {
+    dma.free(buffer);
+}
+
+bool CNNFPGADriver::is_device_buffer(const void *ptr, size_t size) const {
+    uint32_t phys;
+    return dma.virt_to_phys(ptr, size, &phys);
+}
+
+bool CNNFPGADriver::in_place(const void *ptr, size_t size, bool written, uint32_t *phys) const {
+    return dma.virt_to_phys(ptr, size, phys) && *phys % AXI_WORD_BYTES == 0 &&
+           (!written || size % AXI_WORD_BYTES == 0);
+}
+
+bool CNNFPGADriver::device_address(const void *ptr, size_t size, DmaBuffer &staging,
+                                   bool copy_in, uint32_t *phys) {
+    if (in_place(ptr, size, !copy_in, phys)) {
+        return true;
+    }
+    
+    if (staging.size < size) {
+        dma.free(staging);
+        staging = dma.allocate(size);
+        if (!staging.valid()) {
+            return false;
+        }
+    }
+    if (copy_in) {
+        memcpy(staging.virt, ptr, size);
+    }
+    *phys = staging.phys;
+    return true;
+}
+
+WeightHandle CNNFPGADriver::register_weights(const qint8_t *kernel, size_t kernel_size,
+                                             const qint32_t *bias, size_t bias_count) {
+    RegisteredWeights entry;
+    entry.kernel = dma.allocate(kernel_size);
+    entry.bias = dma.allocate(bias_count * sizeof(qint32_t));
+    if (!entry.kernel.valid() || !entry.bias.valid()) {
+        dma.free(entry.kernel);
+        dma.free(entry.bias);
+        return NO_WEIGHTS;
+    }
+    memcpy(entry.kernel.virt, kernel, kernel_size);
+    memcpy(entry.bias.virt, bias, bias_count * sizeof(qint32_t));
     
-    void *virt = malloc(size);
-    if (virt) {
-        memset(virt, 0, size);
-        // In real implementation, get physical address via /proc/self/pagemap
-        *phys_addr = virt;  // Placeholder
+    std::lock_guard<std::mutex> lock(weights_mutex);
+    WeightHandle handle = next_weight_handle++;
+    registered_weights[handle] = entry;
+    return handle;
+}
+
+void CNNFPGADriver::release_weights(WeightHandle handle) {
+    std::lock_guard<std::mutex> lock(weights_mutex);
+    std::map<WeightHandle, RegisteredWeights>::iterator it = registered_weights.find(handle);
+    if (it != registered_weights.end()) {
+        dma.free(it->second.kernel);
+        dma.free(it->second.bias);
+        registered_weights.erase(it);
+    }
+}
+
+void CNNFPGADriver::release_all_weights() {
+    std::lock_guard<std::mutex> lock(weights_mutex);
+    std::map<WeightHandle, RegisteredWeights>::iterator it;
+    for (it = registered_weights.begin(); it != registered_weights.end(); ++it) {
+        dma.free(it->second.kernel);
+        dma.free(it->second.bias);
     }
-    return virt;
+    registered_weights.clear();
 }
 
-void CNNFPGADriver::free_contiguous_memory(void *virt_addr, size_t size) {
-    if (virt_addr) {
-        free(virt_addr);
+bool CNNFPGADriver::weight_addresses(WeightHandle handle, size_t kernel_size, size_t bias_size,
+                                     uint32_t *kernel_phys, uint32_t *bias_phys) {
+    std::lock_guard<std::mutex> lock(weights_mutex);
+    std::map<WeightHandle, RegisteredWeights>::iterator it = registered_weights.find(handle);
+    if (it == registered_weights.end() ||
+        it->second.kernel.size < kernel_size || it->second.bias.size < bias_size) {
+        return false;
     }
+    *kernel_phys = it->second.kernel.phys;
+    *bias_phys = it->second.bias.phys;
+    return true;
 }
 
-void CNNFPGADriver::write_reg(uint32_t offset, uint32_t value) {
-    if (fpga_base) {
-        *((volatile uint32_t*)((char*)fpga_base + offset)) = value;
+void CNNFPGADriver::write_reg(Engine &engine, uint32_t offset, uint32_t value) {
+    if (sim) {
+        sim->write_reg(engine.base_addr + offset, value);
+    } else if (engine.regs) {
+        *((volatile uint32_t*)((char*)engine.regs + offset)) = value;
     }
 }
 
-uint32_t CNNFPGADriver::read_reg(uint32_t offset) {
-    if (fpga_base) {
-        return *((volatile uint32_t*)((char*)fpga_base + offset));
+uint32_t CNNFPGADriver::read_reg(Engine &engine, uint32_t offset) {
+    if (sim) {
+        return sim->read_reg(engine.base_addr + offset);
+    }
+    if (engine.regs) {
+        return *((volatile uint32_t*)((char*)engine.regs + offset));
     }
     return 0;
 }
 
-void CNNFPGADriver::wait_for_completion() {
-    // Poll status register until done bit is set
-    while (!(read_reg(CONV_STATUS_REG) & STATUS_DONE_BIT)) {
-        usleep(10);
+bool CNNFPGADriver::engine_done(Engine &engine) {
+    if (engine.id == ENGINE_DMA) {
+        // S2MM finishes last; an error on either channel ends the transfer
+        return (read_reg(engine, AXI_DMA_S2MM_DMASR) & (AXI_DMA_SR_IOC_IRQ | AXI_DMA_SR_ERRORS)) != 0 ||
+               (read_reg(engine, AXI_DMA_MM2S_DMASR) & AXI_DMA_SR_ERRORS) != 0;
+    }
+    return (read_reg(engine, ACCEL_STATUS_REG) & STATUS_DONE_BIT) != 0;
+}
+
+void CNNFPGADriver::acknowledge(Engine &engine) {
+    if (engine.id == ENGINE_DMA) {
+        write_reg(engine, AXI_DMA_MM2S_DMASR, AXI_DMA_SR_IOC_IRQ | AXI_DMA_SR_ERR_IRQ);
+        write_reg(engine, AXI_DMA_S2MM_DMASR, AXI_DMA_SR_IOC_IRQ | AXI_DMA_SR_ERR_IRQ);
+    } else {
+        write_reg(engine, ACCEL_IRQ_STATUS_REG, IRQ_DONE_BIT);
+    }
+}
+
+void CNNFPGADriver::reset_engine(Engine &engine) {
+    if (engine.id == ENGINE_DMA) {
+        // Resets both channels; the bit clears itself once the core is idle
+        write_reg(engine, AXI_DMA_MM2S_DMACR, AXI_DMA_CR_RESET);
+        for (int i = 0; i < 1000 && (read_reg(engine, AXI_DMA_MM2S_DMACR) & AXI_DMA_CR_RESET); i++) {
+            usleep(1);
+        }
+        return;
+    }
+    write_reg(engine, ACCEL_CTRL_REG, CTRL_RESET_BIT);
+    write_reg(engine, ACCEL_CTRL_REG, 0);
+}
+
+void CNNFPGADriver::set_completion_mode(CompletionMode mode, int timeout_ms) {
+    completion_mode = mode;
+    completion_timeout_ms = timeout_ms;
+}
+
+bool CNNFPGADriver::spin_until_done(Engine &engine, uint64_t budget_ns) {
+    uint64_t deadline = now_ns() + budget_ns;
+    do {
+        if (engine_done(engine)) {
+            return true;
+        }
+    } while (now_ns() < deadline);
+    return false;
+}
+
+bool CNNFPGADriver::block_until_done(Engine &engine, int timeout_ms) {
+    uint64_t deadline = now_ns() + (uint64_t)timeout_ms * 1000000;
+    
+    for (;;) {
+        // The interrupt may have fired before we got here
+        if (engine_done(engine)) {
+            return true;
+        }
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            return false;
+        }
+        int remaining_ms = (int)((deadline - now + 999999) / 1000000);
+        if (!engine.irq.wait(remaining_ms)) {
+            return engine_done(engine);
+        }
+    }
+}
+
+bool CNNFPGADriver::wait_for_completion(Engine &engine, uint64_t ops, uint32_t layers) {
+    uint64_t start = now_ns();
+    int timeout_ms = completion_timeout_ms * (int)layers;
+    uint64_t timeout_ns = (uint64_t)timeout_ms * 1000000;
+    bool use_irq = engine.irq.is_open() && completion_mode != COMPLETION_POLL;
+    double ns_per_op = engine.ns_per_op;
+    bool done;
+    
+    if (!use_irq) {
+        // Spin, but yield so a second process on the core can still run
+        done = false;
+        while (!done && now_ns() - start < timeout_ns) {
+            done = engine_done(engine);
+            if (!done) sched_yield();
+        }
+    } else if (completion_mode == COMPLETION_ADAPTIVE && ns_per_op > 0.0 &&
+               ops * ns_per_op < ADAPTIVE_SPIN_LIMIT_US * 1000.0) {
+        // Short operation: a sleep would cost more than the operation itself.
+        // Spin for twice the estimate, then block for whatever is left.
+        done = spin_until_done(engine, (uint64_t)(2.0 * ops * ns_per_op) + 1000) ||
+               block_until_done(engine, timeout_ms);
+    } else {
+        done = block_until_done(engine, timeout_ms);
+    }
+    
+    acknowledge(engine);
+    
+    if (!done) {
+        uint32_t status = read_reg(engine, engine.id == ENGINE_DMA ? AXI_DMA_S2MM_DMASR : ACCEL_STATUS_REG);
+        std::cerr << "The " << engine.name << " accelerator timed out after "
+                  << timeout_ms << " ms (status 0x" << std::hex
+                  << status << std::dec << "), resetting" << std::endl;
+        reset_engine(engine);
+        return false;
+    }
+    
+    // Track throughput so the next spin/block decision has an estimate
+    if (ops > 0) {
+        double sample = (double)(now_ns() - start) / ops;
+        engine.ns_per_op = (ns_per_op > 0.0) ? 0.75 * ns_per_op + 0.25 * sample : sample;
+    }
+    return true;
+}
+
+bool CNNFPGADriver::run_engine(Engine &engine, uint64_t ops, PerfCounters *delta, uint32_t layers) {
+    // Arm the interrupt before starting so a fast operation cannot finish
+    // ahead of it
+    bool use_irq = engine.irq.is_open() && completion_mode != COMPLETION_POLL;
+    write_reg(engine, ACCEL_IRQ_STATUS_REG, IRQ_DONE_BIT);
+    write_reg(engine, ACCEL_IRQ_ENABLE_REG, use_irq ? IRQ_DONE_BIT : 0);
+    if (use_irq) {
+        engine.irq.arm();
+    }
+    
+    PerfCounters before, after;
+    read_perf_counters(engine, &before);
+    uint64_t start = now_ns();
+    
+    // Start computation
+    write_reg(engine, ACCEL_CTRL_REG, CTRL_START_BIT);
+    
+    if (!wait_for_completion(engine, ops, layers)) {
+        return false;
+    }
+    
+    uint64_t busy_ns = now_ns() - start;
+    read_perf_counters(engine, &after);
+    *delta = after.since(before);
+    
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    engine.stats.commands++;
+    engine.stats.busy_ns += busy_ns;
+    engine.stats.cycles += delta->total_cycles;
+    return true;
+}
+
+EngineId CNNFPGADriver::engine_for(CommandOp op) {
+    switch (op) {
+        case CMD_CONV:
+        case CMD_PROGRAM:
+            return ENGINE_CONV;
+        case CMD_ACTIVATION:
+            return ENGINE_ACTIVATION;
+        case CMD_MAX_POOL:
+        case CMD_AVG_POOL:
+        case CMD_GLOBAL_AVG_POOL:
+            return ENGINE_POOLING;
+        case CMD_CLASSIFY:
+            return ENGINE_CLASSIFIER;
+        case CMD_COPY:
+            return ENGINE_DMA;
+    }
+    return ENGINE_CONV;
+}
+
+bool CNNFPGADriver::completed(CommandHandle handle) const {
+    return handle <= completed_through || completed_early.count(handle) != 0;
+}
+
+bool CNNFPGADriver::dependencies_done(const LayerCommand &command) const {
+    for (size_t i = 0; i < command.depends_on.size(); i++) {
+        if (!completed(command.depends_on[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CNNFPGADriver::mark_completed(CommandHandle handle) {
+    if (handle != completed_through + 1) {
+        completed_early.insert(handle);
+        return;
+    }
+    completed_through = handle;
+    while (completed_early.erase(completed_through + 1)) {
+        completed_through++;
+    }
+}
+
+CommandHandle CNNFPGADriver::submit(const LayerCommand &command) {
+    Engine &engine = engines[engine_for(command.op)];
+    
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (!engine.thread.joinable() || queue_stopping) {
+        std::cerr << "FPGA command submitted before init()" << std::endl;
+        return NO_COMMAND;
+    }
+    for (size_t i = 0; i < command.depends_on.size(); i++) {
+        if (command.depends_on[i] >= next_handle) {
+            std::cerr << "FPGA command depends on unissued handle "
+                      << command.depends_on[i] << std::endl;
+            return NO_COMMAND;
+        }
+    }
+    
+    done_cv.wait(lock, [this, &engine] {
+        return engine.queue.size() < MAX_QUEUED_COMMANDS || queue_stopping;
+    });
+    
+    QueuedCommand queued;
+    queued.handle = next_handle++;
+    queued.command = command;
+    engine.queue.push_back(queued);
+    queue_cv.notify_all();
+    return queued.handle;
+}
+
+bool CNNFPGADriver::wait(CommandHandle handle) {
+    if (handle == NO_COMMAND) return false;
+    
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    done_cv.wait(lock, [this, handle] { return completed(handle); });
+    return failed_commands.count(handle) == 0;
+}
+
+bool CNNFPGADriver::is_complete(CommandHandle handle) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return completed(handle);
+}
+
+void CNNFPGADriver::engine_loop(EngineId id) {
+    Engine &engine = engines[id];
+    
+    for (;;) {
+        QueuedCommand current;
+        bool skip = false;
+        {
+            // Each block runs its commands in submission order; the head
+            // waits for dependencies queued on other blocks. Those always
+            // have lower handles, so the oldest unfinished command can run.
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this, &engine] {
+                return queue_stopping ||
+                       (!engine.queue.empty() && dependencies_done(engine.queue.front().command));
+            });
+            if (engine.queue.empty()) return;
+            current = engine.queue.front();
+            engine.queue.pop_front();
+    
+            // A failed dependency fails this command too; anything left at
+            // shutdown fails
+            skip = queue_stopping;
+            for (size_t i = 0; i < current.command.depends_on.size(); i++) {
+                if (failed_commands.count(current.command.depends_on[i])) {
+                    skip = true;
+                }
+            }
+        }
+    
+        bool ok = !skip && execute(engine, current.command);
+    
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (!ok) failed_commands.insert(current.handle);
+            mark_completed(current.handle);
+        }
+        done_cv.notify_all();
+        queue_cv.notify_all();
+    }
+}
+
+void CNNFPGADriver::stop_queue() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue_stopping = true;
+    }
+    queue_cv.notify_all();
+    done_cv.notify_all();
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        if (engines[i].thread.joinable()) {
+            engines[i].thread.join();
+        }
+    }
+}
+
+bool CNNFPGADriver::execute(Engine &engine, const LayerCommand &command) {
+    switch (command.op) {
+        case CMD_CONV:
+            return execute_conv(engine, command);
+        case CMD_PROGRAM:
+            return execute_program(engine, command);
+        case CMD_ACTIVATION:
+            return execute_activation(engine, command);
+        case CMD_MAX_POOL:
+        case CMD_AVG_POOL:
+        case CMD_GLOBAL_AVG_POOL:
+            return execute_pooling(engine, command);
+        case CMD_CLASSIFY:
+            return execute_classify(engine, command);
+        case CMD_COPY:
+            return execute_copy(engine, command);
     }
+    return false;
 }
 
 bool CNNFPGADriver::conv2d(
@@ -151,55 +573,763 @@ bool CNNFPGADriver::conv2d(
     int padding,
     bool use_relu
 ) {
-    // Copy input data to DMA buffer
-    size_t input_size = input_h * input_w * input_c * sizeof(qint8_t);
-    memcpy(input_buffer_virt, input, input_size);
-    
-    // Copy weights to DMA buffer
-    size_t weight_size = output_c * input_c * kernel_size * kernel_size * sizeof(qint8_t);
-    memcpy(weight_buffer_virt, weights, weight_size);
+    LayerCommand command;
+    command.op = CMD_CONV;
+    command.input = input;
+    command.weights = weights;
+    command.bias = bias;
+    command.output = output;
+    command.input_h = input_h;
+    command.input_w = input_w;
+    command.input_c = input_c;
+    command.output_c = output_c;
+    command.kernel_size = kernel_size;
+    command.stride = stride;
+    command.padding = padding;
+    command.use_relu = use_relu;
+    return wait(submit(command));
+}
+
+bool CNNFPGADriver::conv2d(
+    const qint8_t *input,
+    WeightHandle weights,
+    qint8_t *output,
+    int input_h, int input_w, int input_c,
+    int output_c,
+    int kernel_size,
+    int stride,
+    int padding,
+    bool use_relu
+) {
+    LayerCommand command;
+    command.op = CMD_CONV;
+    command.input = input;
+    command.weight_handle = weights;
+    command.output = output;
+    command.input_h = input_h;
+    command.input_w = input_w;
+    command.input_c = input_c;
+    command.output_c = output_c;
+    command.kernel_size = kernel_size;
+    command.stride = stride;
+    command.padding = padding;
+    command.use_relu = use_relu;
+    return wait(submit(command));
+}
+
+bool CNNFPGADriver::depthwise_conv2d(
+    const qint8_t *input,
+    const qint8_t *weights,
+    const qint32_t *bias,
+    qint8_t *output,
+    int input_h, int input_w, int channels,
+    int kernel_size,
+    int stride,
+    int padding
+) {
+    LayerCommand command;
+    command.op = CMD_CONV;
+    command.conv_mode = CONV_MODE_DEPTHWISE;
+    command.input = input;
+    command.weights = weights;
+    command.bias = bias;
+    command.output = output;
+    command.input_h = input_h;
+    command.input_w = input_w;
+    command.input_c = channels;
+    command.output_c = channels;
+    command.kernel_size = kernel_size;
+    command.stride = stride;
+    command.padding = padding;
+    return wait(submit(command));
+}
+
+bool CNNFPGADriver::pointwise_conv2d(
+    const qint8_t *input,
+    const qint8_t *weights,
+    const qint32_t *bias,
+    qint8_t *output,
+    int input_h, int input_w,
+    int input_c, int output_c
+) {
+    LayerCommand command;
+    command.op = CMD_CONV;
+    command.conv_mode = CONV_MODE_POINTWISE;
+    command.input = input;
+    command.weights = weights;
+    command.bias = bias;
+    command.output = output;
+    command.input_h = input_h;
+    command.input_w = input_w;
+    command.input_c = input_c;
+    command.output_c = output_c;
+    return wait(submit(command));
+}
+
+bool CNNFPGADriver::separable_block(
+    const qint8_t *input,
+    const qint8_t *dw_weights,
+    const qint32_t *dw_bias,
+    const qint8_t *pw_weights,
+    const qint32_t *pw_bias,
+    qint8_t *output,
+    int input_h, int input_w, int input_c,
+    int output_c,
+    int stride,
+    int padding,
+    bool dw_relu,
+    bool pw_relu
+) {
+    LayerCommand command;
+    command.op = CMD_CONV;
+    command.conv_mode = CONV_MODE_SEPARABLE;
+    command.input = input;
+    command.weights = dw_weights;
+    command.bias = dw_bias;
+    command.pw_weights = pw_weights;
+    command.pw_bias = pw_bias;
+    command.output = output;
+    command.input_h = input_h;
+    command.input_w = input_w;
+    command.input_c = input_c;
+    command.output_c = output_c;
+    command.kernel_size = 3;
+    command.stride = stride;
+    command.padding = padding;
+    command.mid_relu = dw_relu;
+    command.use_relu = pw_relu;
+    return wait(submit(command));
+}
+
+bool CNNFPGADriver::kernel_addresses(WeightHandle handle, const qint8_t *kernel, const qint32_t *bias,
+                                     size_t kernel_size, size_t bias_size,
+                                     DmaBuffer *kernel_staging, DmaBuffer *bias_staging,
+                                     uint32_t *kernel_phys, uint32_t *bias_phys) {
+    // Registered weights are already resident
+    if (handle != NO_WEIGHTS) {
+        if (!weight_addresses(handle, kernel_size, bias_size, kernel_phys, bias_phys)) {
+            std::cerr << "Invalid or undersized weight handle " << handle << std::endl;
+            return false;
+        }
+    } else if (!kernel_staging) {
+        if (!in_place(kernel, kernel_size, false, kernel_phys) ||
+            !in_place(bias, bias_size, false, bias_phys)) {
+            std::cerr << "Program weights must be registered or word aligned in DMA memory" << std::endl;
+            return false;
+        }
+    } else if (!device_address(kernel, kernel_size, *kernel_staging, true, kernel_phys) ||
+               !device_address(bias, bias_size, *bias_staging, true, bias_phys)) {
+        std::cerr << "Failed to allocate DMA staging buffers" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool CNNFPGADriver::conv_descriptor(Engine *engine, const LayerCommand &command,
+                                    ConvLayerDescriptor *desc, uint64_t *macs, size_t *output_size) {
+    const qint8_t *input = command.input;
+    const qint8_t *weights = command.weights;
+    const qint32_t *bias = command.bias;
+    qint8_t *output = command.output;
+    int input_h = command.input_h;
+    int input_w = command.input_w;
+    int input_c = command.input_c;
+    int output_c = command.output_c;
+    int kernel_size = command.kernel_size;
+    int stride = command.stride;
+    int padding = command.padding;
+    bool use_relu = command.use_relu;
+    int mode = command.conv_mode;
+    int output_stride = command.output_stride ? command.output_stride : output_c;
+    int images = command.batch;
     
-    // Configure accelerator
-    write_reg(CONV_INPUT_ADDR_REG, (uint32_t)(uintptr_t)input_buffer_phys);
-    write_reg(CONV_OUTPUT_ADDR_REG, (uint32_t)(uintptr_t)output_buffer_phys);
-    write_reg(CONV_WEIGHT_ADDR_REG, (uint32_t)(uintptr_t)weight_buffer_phys);
+    bool separable = mode == CONV_MODE_SEPARABLE;
     
-    // Pack configuration into register
-    uint32_t config = (input_h << 24) | (input_w << 16) | (input_c << 8) | output_c;
-    write_reg(CONV_CONFIG_REG, config);
+    // Daemon clients and programs hand these in unchecked; a zero stride
+    // or an empty output would otherwise reach the block. Kernel, stride
+    // and padding each have a byte of the config register.
+    if (input_h < 1 || input_w < 1 || input_c < 1 || output_c < 1 ||
+        kernel_size < 1 || kernel_size > 255 || stride < 1 || stride > 255 ||
+        padding < 0 || padding > 255 ||
+        input_h + 2 * padding < kernel_size || input_w + 2 * padding < kernel_size) {
+        std::cerr << "Conv command has kernel " << kernel_size << ", stride " << stride
+                  << " and padding " << padding << " for a " << input_h << "x" << input_w
+                  << "x" << input_c << " input" << std::endl;
+        return false;
+    }
     
-    // Start computation
-    write_reg(CONV_CTRL_REG, CTRL_START_BIT);
+    if (command.op != CMD_CONV || images < 1 ||
+        (mode == CONV_MODE_DEPTHWISE && (output_c != input_c || output_stride != output_c)) ||
+        (mode == CONV_MODE_POINTWISE && kernel_size != 1) ||
+        (separable && !CONV_SEPARABLE_FITS(input_w, input_c, kernel_size, stride, padding)) ||
+        output_stride < output_c) {
+        std::cerr << "Conv command shape does not fit its mode" << std::endl;
+        return false;
+    }
     
-    // Wait for completion
-    wait_for_completion();
+    // Output pixels are stored as whole bus words
+    if (output_c % AXI_WORD_BYTES || output_stride % AXI_WORD_BYTES) {
+        std::cerr << "Conv output channels and stride must be multiples of "
+                  << AXI_WORD_BYTES << std::endl;
+        return false;
+    }
     
-    // Copy output back
     int output_h = (input_h + 2 * padding - kernel_size) / stride + 1;
     int output_w = (input_w + 2 * padding - kernel_size) / stride + 1;
-    size_t output_size = output_h * output_w * output_c * sizeof(qint8_t);
-    memcpy(output, output_buffer_virt, output_size);
     
+    // Pooling happens in the streaming pipeline's output stage
+    bool streamed_pointwise = mode == CONV_MODE_POINTWISE && stride == 1 && padding == 0 &&
+                              input_c % AXI_WORD_BYTES == 0;
+    if (command.global_pool && ((!separable && !streamed_pointwise) || output_stride != output_c ||
+                                output_h * output_w > GAP_MAX_PIXELS)) {
+        std::cerr << "Conv command cannot pool its output on the accelerator" << std::endl;
+        return false;
+    }
+    
+    // A depthwise kernel has one k x k filter per channel; so has a
+    // separable block's first half, its second is input_c x output_c
+    int kernel_channels = (mode == CONV_MODE_DEPTHWISE || separable) ? input_c : output_c;
+    int weights_per_output = (mode == CONV_MODE_DEPTHWISE || separable) ? 1 : input_c;
+    
+    // A batch's maps follow each other, input and output
+    size_t input_size = (size_t)images * input_h * input_w * input_c * sizeof(qint8_t);
+    size_t weight_size = (size_t)kernel_channels * weights_per_output * kernel_size * kernel_size * sizeof(qint8_t);
+    size_t bias_size = kernel_channels * sizeof(qint32_t);
+    *output_size = command.global_pool ? (size_t)images * output_c
+                                       : ((size_t)images * output_h * output_w - 1) * output_stride + output_c;
+    
+    uint32_t input_phys, weight_phys, bias_phys, output_phys;
+    if (!kernel_addresses(command.weight_handle, weights, bias, weight_size, bias_size,
+                          engine ? &engine->weight_staging : nullptr,
+                          engine ? &engine->bias_staging : nullptr,
+                          &weight_phys, &bias_phys)) {
+        return false;
+    }
+    
+    uint32_t pw_weight_phys = 0, pw_bias_phys = 0;
+    if (separable &&
+        !kernel_addresses(command.pw_weight_handle, command.pw_weights, command.pw_bias,
+                          (size_t)output_c * input_c * sizeof(qint8_t), output_c * sizeof(qint32_t),
+                          engine ? &engine->pw_weight_staging : nullptr,
+                          engine ? &engine->pw_bias_staging : nullptr,
+                          &pw_weight_phys, &pw_bias_phys)) {
+        return false;
+    }
+    
+    // A slice shares its output with whoever computes the other channels,
+    // so it cannot go through a staging copy
+    if (output_stride != output_c && !in_place(output, *output_size, true, &output_phys)) {
+        std::cerr << "Conv slice output must be word aligned in DMA memory" << std::endl;
+        return false;
+    }
+    
+    // Tensors already in DMA memory are used in place; anything else goes
+    // through a staging buffer
+    if (!engine) {
+        if (!in_place(input, input_size, false, &input_phys) ||
+            !in_place(output, *output_size, true, &output_phys)) {
+            std::cerr << "Program feature maps must be word aligned in DMA memory" << std::endl;
+            return false;
+        }
+    } else if (!device_address(input, input_size, engine->input_staging, true, &input_phys) ||
+               !device_address(output, *output_size, engine->output_staging, false, &output_phys)) {
+        std::cerr << "Failed to allocate DMA staging buffers" << std::endl;
+        return false;
+    }
+    
+    memset(desc, 0, sizeof(*desc));
+    desc->input_addr = input_phys;
+    desc->output_addr = output_phys;
+    desc->weight_addr = weight_phys;
+    desc->bias_addr = bias_phys;
+    desc->config = CONV_CONFIG_PACK(kernel_size, stride, padding, mode, use_relu);
+    if (command.use_relu6) {
+        desc->config |= CONV_CONFIG_RELU6;
+    }
+    if (separable) {
+        desc->pw_weight_addr = pw_weight_phys;
+        desc->pw_bias_addr = pw_bias_phys;
+        if (command.mid_relu) {
+            desc->config |= CONV_CONFIG_MID_RELU;
+        }
+        if (command.mid_relu6) {
+            desc->config |= CONV_CONFIG_MID_RELU6;
+        }
+    }
+    if (command.global_pool) {
+        desc->config |= CONV_CONFIG_POOL;
+        desc->pool_reciprocal = GAP_RECIPROCAL(output_h * output_w);
+    }
+    desc->in_height = input_h;
+    desc->in_width = input_w;
+    desc->in_channels = input_c;
+    desc->out_channels = output_c;
+    desc->out_stride = output_stride;
+    desc->batch = images;
+    
+    *macs = (uint64_t)output_h * output_w * kernel_channels * weights_per_output * kernel_size * kernel_size;
+    if (separable) {
+        *macs += (uint64_t)output_h * output_w * output_c * input_c;
+    }
+    *macs *= images;
+    return true;
+}
+
+bool CNNFPGADriver::execute_conv(Engine &engine, const LayerCommand &command) {
+    ConvLayerDescriptor desc;
+    uint64_t macs;
+    size_t output_size;
+    if (!conv_descriptor(&engine, command, &desc, &macs, &output_size)) {
+        return false;
+    }
+    
+    // Configure accelerator
+    write_reg(engine, CONV_INPUT_ADDR_REG, desc.input_addr);
+    write_reg(engine, CONV_OUTPUT_ADDR_REG, desc.output_addr);
+    write_reg(engine, CONV_WEIGHT_ADDR_REG, desc.weight_addr);
+    write_reg(engine, CONV_BIAS_ADDR_REG, desc.bias_addr);
+    write_reg(engine, CONV_PW_WEIGHT_ADDR_REG, desc.pw_weight_addr);
+    write_reg(engine, CONV_PW_BIAS_ADDR_REG, desc.pw_bias_addr);
+    
+    write_reg(engine, CONV_IN_HEIGHT_REG, desc.in_height);
+    write_reg(engine, CONV_IN_WIDTH_REG, desc.in_width);
+    write_reg(engine, CONV_IN_CHANNELS_REG, desc.in_channels);
+    write_reg(engine, CONV_OUT_CHANNELS_REG, desc.out_channels);
+    write_reg(engine, CONV_OUT_STRIDE_REG, desc.out_stride);
+    write_reg(engine, CONV_POOL_RECIP_REG, desc.pool_reciprocal);
+    write_reg(engine, CONV_BATCH_REG, desc.batch);
+    write_reg(engine, CONV_CONFIG_REG, desc.config);
+    write_reg(engine, CONV_PROGRAM_LEN_REG, 0);
+    
+    PerfCounters layer;
+    if (!run_engine(engine, macs, &layer)) {
+        return false;
+    }
+    
+    cycle_count += layer.total_cycles;
+    if (command.perf) {
+        *command.perf = layer;
+    }
+    
+    // Copy output back only if it had to be staged
+    uint32_t output_phys;
+    if (!in_place(command.output, output_size, true, &output_phys)) {
+        memcpy(command.output, engine.output_staging.virt, output_size);
+    }
+    
+    return true;
+}
+
+ProgramHandle CNNFPGADriver::compile_program(const std::vector<LayerCommand> &layers) {
+    if (layers.empty() || layers.size() > CONV_PROGRAM_MAX_LAYERS) {
+        std::cerr << "Conv programs hold 1 to " << CONV_PROGRAM_MAX_LAYERS << " layers" << std::endl;
+        return NO_PROGRAM;
+    }
+    
+    Program program;
+    program.length = (uint32_t)layers.size();
+    program.macs = 0;
+    program.descriptors = dma.allocate(layers.size() * sizeof(ConvLayerDescriptor));
+    if (!program.descriptors.valid()) {
+        return NO_PROGRAM;
+    }
+    
+    ConvLayerDescriptor *desc = (ConvLayerDescriptor*)program.descriptors.virt;
+    for (size_t i = 0; i < layers.size(); i++) {
+        uint64_t macs;
+        size_t output_size;
+        if (!conv_descriptor(nullptr, layers[i], &desc[i], &macs, &output_size)) {
+            std::cerr << "Program layer " << i << " cannot run on the accelerator" << std::endl;
+            dma.free(program.descriptors);
+            return NO_PROGRAM;
+        }
+        program.macs += macs;
+    }
+    
+    // Every layer but the last announces the next, so the block loads that
+    // one's kernels and biases while it runs. Kernels are never a layer's
+    // output, so nothing prefetched can change under the prefetch.
+    for (size_t i = 0; i + 1 < layers.size(); i++) {
+        desc[i].config |= CONV_CONFIG_PREFETCH;
+    }
+    
+    std::lock_guard<std::mutex> lock(programs_mutex);
+    ProgramHandle handle = next_program_handle++;
+    programs[handle] = program;
+    return handle;
+}
+
+void CNNFPGADriver::release_program(ProgramHandle program) {
+    std::lock_guard<std::mutex> lock(programs_mutex);
+    std::map<ProgramHandle, Program>::iterator it = programs.find(program);
+    if (it != programs.end()) {
+        dma.free(it->second.descriptors);
+        programs.erase(it);
+    }
+}
+
+void CNNFPGADriver::release_all_programs() {
+    std::lock_guard<std::mutex> lock(programs_mutex);
+    std::map<ProgramHandle, Program>::iterator it;
+    for (it = programs.begin(); it != programs.end(); ++it) {
+        dma.free(it->second.descriptors);
+    }
+    programs.clear();
+}
+
+bool CNNFPGADriver::run_program(ProgramHandle program) {
+    LayerCommand command;
+    command.op = CMD_PROGRAM;
+    command.program = program;
+    return wait(submit(command));
+}
+
+bool CNNFPGADriver::execute_program(Engine &engine, const LayerCommand &command) {
+    Program program;
+    {
+        std::lock_guard<std::mutex> lock(programs_mutex);
+        std::map<ProgramHandle, Program>::iterator it = programs.find(command.program);
+        if (it == programs.end()) {
+            std::cerr << "Invalid program handle " << command.program << std::endl;
+            return false;
+        }
+        program = it->second;
+    }
+    
+    // Descriptor addresses are absolute, so the pointer bases are 0
+    write_reg(engine, CONV_INPUT_ADDR_REG, 0);
+    write_reg(engine, CONV_OUTPUT_ADDR_REG, 0);
+    write_reg(engine, CONV_WEIGHT_ADDR_REG, 0);
+    write_reg(engine, CONV_BIAS_ADDR_REG, 0);
+    write_reg(engine, CONV_PW_WEIGHT_ADDR_REG, 0);
+    write_reg(engine, CONV_PW_BIAS_ADDR_REG, 0);
+    write_reg(engine, CONV_PREFETCH_ADDR_REG, 0);
+    write_reg(engine, CONV_PROGRAM_ADDR_REG, program.descriptors.phys);
+    write_reg(engine, CONV_PROGRAM_LEN_REG, program.length);
+    
+    PerfCounters counters;
+    bool ok = run_engine(engine, program.macs, &counters, program.length);
+    write_reg(engine, CONV_PROGRAM_LEN_REG, 0);
+    if (!ok) {
+        return false;
+    }
+    
+    cycle_count += counters.total_cycles;
+    if (command.perf) {
+        *command.perf = counters;
+    }
+    return true;
+}
+
+bool CNNFPGADriver::execute_activation(Engine &engine, const LayerCommand &command) {
+    size_t size = (size_t)command.input_h * command.input_w * command.input_c;
+    
+    uint32_t input_phys, output_phys;
+    if (!device_address(command.input, size, engine.input_staging, true, &input_phys) ||
+        !device_address(command.output, size, engine.output_staging, false, &output_phys)) {
+        std::cerr << "Failed to allocate DMA staging buffers" << std::endl;
+        return false;
+    }
+    
+    write_reg(engine, ACT_INPUT_ADDR_REG, input_phys);
+    write_reg(engine, ACT_OUTPUT_ADDR_REG, output_phys);
+    write_reg(engine, ACT_SIZE_REG, (uint32_t)size);
+    write_reg(engine, ACT_TYPE_REG, command.act_type);
+    
+    PerfCounters counters;
+    if (!run_engine(engine, size, &counters)) {
+        return false;
+    }
+    if (command.perf) {
+        *command.perf = counters;
+    }
+    
+    if (!in_place(command.output, size, true, &output_phys)) {
+        memcpy(command.output, engine.output_staging.virt, size);
+    }
+    return true;
+}
+
+bool CNNFPGADriver::execute_pooling(Engine &engine, const LayerCommand &command) {
+    int input_h = command.input_h;
+    int input_w = command.input_w;
+    int channels = command.input_c;
+    int pool_size = command.kernel_size;
+    int stride = command.stride;
+    int padding = command.padding;
+    
+    uint32_t pool_type;
+    int output_h = 1;
+    int output_w = 1;
+    if (command.op == CMD_GLOBAL_AVG_POOL) {
+        pool_type = POOL_TYPE_GLOBAL_AVG;
+        pool_size = 0;
+        stride = 0;
+        padding = 0;
+        if (input_h * input_w > GAP_MAX_PIXELS) {
+            std::cerr << "Global average pooling takes at most " << GAP_MAX_PIXELS
+                      << " pixels" << std::endl;
+            return false;
+        }
+    } else {
+        pool_type = (command.op == CMD_MAX_POOL) ? POOL_TYPE_MAX : POOL_TYPE_AVG;
+        output_h = (input_h + 2 * padding - pool_size) / stride + 1;
+        output_w = (input_w + 2 * padding - pool_size) / stride + 1;
+    }
+    
+    // Pixels are read and written as whole bus words
+    if (channels % AXI_WORD_BYTES) {
+        std::cerr << "Pooling channels must be a multiple of " << AXI_WORD_BYTES << std::endl;
+        return false;
+    }
+    
+    size_t input_size = (size_t)input_h * input_w * channels;
+    size_t output_size = (size_t)output_h * output_w * channels;
+    
+    uint32_t input_phys, output_phys;
+    if (!device_address(command.input, input_size, engine.input_staging, true, &input_phys) ||
+        !device_address(command.output, output_size, engine.output_staging, false, &output_phys)) {
+        std::cerr << "Failed to allocate DMA staging buffers" << std::endl;
+        return false;
+    }
+    
+    write_reg(engine, POOL_INPUT_ADDR_REG, input_phys);
+    write_reg(engine, POOL_OUTPUT_ADDR_REG, output_phys);
+    write_reg(engine, POOL_IN_HEIGHT_REG, input_h);
+    write_reg(engine, POOL_IN_WIDTH_REG, input_w);
+    write_reg(engine, POOL_CHANNELS_REG, channels);
+    write_reg(engine, POOL_CONFIG_REG, POOL_CONFIG_PACK(pool_size, stride, padding, pool_type));
+    if (pool_type == POOL_TYPE_GLOBAL_AVG) {
+        write_reg(engine, POOL_RECIP_REG, GAP_RECIPROCAL(input_h * input_w));
+    }
+    
+    PerfCounters counters;
+    if (!run_engine(engine, input_size, &counters)) {
+        return false;
+    }
+    if (command.perf) {
+        *command.perf = counters;
+    }
+    
+    if (!in_place(command.output, output_size, true, &output_phys)) {
+        memcpy(command.output, engine.output_staging.virt, output_size);
+    }
+    return true;
+}
+
+bool CNNFPGADriver::execute_classify(Engine &engine, const LayerCommand &command) {
+    int inputs = command.input_c;
+    int classes = command.output_c;
+    int top_k = command.top_k;
+    
+    // The feature vector is read as whole bus words
+    if (inputs <= 0 || inputs % AXI_WORD_BYTES || inputs > CLASSIFIER_MAX_INPUTS ||
+        classes <= 0 || classes > CLASSIFIER_MAX_CLASSES ||
+        top_k < 1 || top_k > CLASSIFIER_MAX_TOP_K || top_k > classes) {
+        std::cerr << "Classifier takes up to " << CLASSIFIER_MAX_INPUTS << " inputs (a multiple of "
+                  << AXI_WORD_BYTES << "), " << CLASSIFIER_MAX_CLASSES << " classes and top "
+                  << CLASSIFIER_MAX_TOP_K << std::endl;
+        return false;
+    }
+    
+    size_t kernel_size = (size_t)inputs * classes;
+    size_t output_size = sizeof(ClassifierOutput);
+    uint32_t input_phys, output_phys, weight_phys, bias_phys;
+    if (!device_address(command.input, inputs, engine.input_staging, true, &input_phys) ||
+        !device_address(command.output, output_size, engine.output_staging, false, &output_phys)) {
+        std::cerr << "Failed to allocate DMA staging buffers" << std::endl;
+        return false;
+    }
+    if (!kernel_addresses(command.weight_handle, command.weights, command.bias,
+                          kernel_size, classes * sizeof(qint32_t),
+                          &engine.weight_staging, &engine.bias_staging, &weight_phys, &bias_phys)) {
+        return false;
+    }
+    
+    write_reg(engine, CLS_INPUT_ADDR_REG, input_phys);
+    write_reg(engine, CLS_OUTPUT_ADDR_REG, output_phys);
+    write_reg(engine, CLS_WEIGHT_ADDR_REG, weight_phys);
+    write_reg(engine, CLS_BIAS_ADDR_REG, bias_phys);
+    write_reg(engine, CLS_INPUTS_REG, inputs);
+    write_reg(engine, CLS_CLASSES_REG, classes);
+    write_reg(engine, CLS_TOP_K_REG, top_k);
+    
+    PerfCounters counters;
+    if (!run_engine(engine, kernel_size, &counters)) {
+        return false;
+    }
+    if (command.perf) {
+        *command.perf = counters;
+    }
+    
+    if (!in_place(command.output, output_size, true, &output_phys)) {
+        memcpy(command.output, engine.output_staging.virt, output_size);
+    }
+    return true;
+}
+
+void CNNFPGADriver::append_segments(std::vector<DmaSegment> &segments, uint32_t phys,
+                                    size_t pitch, int rows, size_t row_bytes) {
+    // Packed rows are one contiguous run; no descriptor may exceed
+    // AXI_DMA_MAX_SEGMENT either way
+    size_t run = (pitch == row_bytes) ? row_bytes * rows : row_bytes;
+    int runs = (pitch == row_bytes) ? 1 : rows;
+    for (int r = 0; r < runs; r++) {
+        uint32_t start = phys + (uint32_t)(r * pitch);
+        for (size_t done = 0; done < run; done += AXI_DMA_MAX_SEGMENT) {
+            DmaSegment segment;
+            segment.phys = start + (uint32_t)done;
+            segment.length = (uint32_t)(run - done < AXI_DMA_MAX_SEGMENT ? run - done : AXI_DMA_MAX_SEGMENT);
+            segments.push_back(segment);
+        }
+    }
+}
+
+bool CNNFPGADriver::run_dma_chain(Engine &engine, const std::vector<DmaSegment> &source,
+                                  const std::vector<DmaSegment> &destination, uint64_t bytes) {
+    size_t count = source.size() + destination.size();
+    size_t ring_size = count * sizeof(AxiDmaDescriptor);
+    if (dma_descriptors.size < ring_size) {
+        dma.free(dma_descriptors);
+        dma_descriptors = dma.allocate(ring_size);
+        if (!dma_descriptors.valid()) {
+            std::cerr << "Failed to allocate DMA descriptors" << std::endl;
+            return false;
+        }
+    }
+    
+    // The MM2S chain, one packet from SOF to EOF, then the S2MM chain it
+    // is scattered into
+    AxiDmaDescriptor *ring = (AxiDmaDescriptor*)dma_descriptors.virt;
+    memset(ring, 0, ring_size);
+    for (size_t i = 0; i < count; i++) {
+        const DmaSegment &segment = (i < source.size()) ? source[i] : destination[i - source.size()];
+        ring[i].next = dma_descriptors.phys + (uint32_t)((i + 1) * sizeof(AxiDmaDescriptor));
+        ring[i].buffer = segment.phys;
+        ring[i].control = segment.length;
+    }
+    ring[0].control |= AXI_DMA_DESC_TXSOF;
+    ring[source.size() - 1].control |= AXI_DMA_DESC_TXEOF;
+    
+    uint32_t desc = sizeof(AxiDmaDescriptor);
+    uint32_t mm2s_head = dma_descriptors.phys;
+    uint32_t mm2s_tail = mm2s_head + (uint32_t)(source.size() - 1) * desc;
+    uint32_t s2mm_head = mm2s_tail + desc;
+    uint32_t s2mm_tail = mm2s_head + (uint32_t)(count - 1) * desc;
+    
+    // CURDESC is only writable while a channel is halted, so each chain
+    // starts from reset. Only S2MM's interrupt is wired: it completes last,
+    // and an MM2S failure leaves it waiting until the timeout.
+    bool use_irq = engine.irq.is_open() && completion_mode != COMPLETION_POLL;
+    reset_engine(engine);
+    if (use_irq) {
+        engine.irq.arm();
+    }
+    write_reg(engine, AXI_DMA_MM2S_CURDESC, mm2s_head);
+    write_reg(engine, AXI_DMA_S2MM_CURDESC, s2mm_head);
+    write_reg(engine, AXI_DMA_MM2S_DMACR, AXI_DMA_CR_RUN);
+    write_reg(engine, AXI_DMA_S2MM_DMACR, AXI_DMA_CR_RUN | AXI_DMA_CR_IRQ_THRESHOLD_1 |
+              (use_irq ? AXI_DMA_CR_IOC_IRQ_EN | AXI_DMA_CR_ERR_IRQ_EN : 0));
+    
+    // Receiver first, so the stream never backs up into the FIFO
+    uint64_t start = now_ns();
+    write_reg(engine, AXI_DMA_S2MM_TAILDESC, s2mm_tail);
+    write_reg(engine, AXI_DMA_MM2S_TAILDESC, mm2s_tail);
+    
+    if (!wait_for_completion(engine, bytes)) {
+        return false;
+    }
+    uint64_t busy_ns = now_ns() - start;
+    
+    uint32_t errors = (read_reg(engine, AXI_DMA_MM2S_DMASR) | read_reg(engine, AXI_DMA_S2MM_DMASR)) &
+                      AXI_DMA_SR_ERRORS;
+    if (errors) {
+        std::cerr << "AXI DMA transfer failed (status 0x" << std::hex << errors << std::dec
+                  << "), resetting" << std::endl;
+        reset_engine(engine);
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    engine.stats.commands++;
+    engine.stats.busy_ns += busy_ns;
     return true;
 }
 
+bool CNNFPGADriver::execute_copy(Engine &engine, const LayerCommand &command) {
+    int rows = command.input_h;
+    size_t row_bytes = (size_t)command.input_w * command.input_c;
+    size_t src_pitch = command.input_pitch ? (size_t)command.input_pitch : row_bytes;
+    size_t dst_pitch = command.output_pitch ? (size_t)command.output_pitch : row_bytes;
+    if (rows <= 0 || row_bytes == 0 || src_pitch < row_bytes || dst_pitch < row_bytes) {
+        std::cerr << "Copy command shape is invalid" << std::endl;
+        return false;
+    }
+    
+    // Staging would put the CPU back in the data path, so both ends must
+    // already be device-visible
+    size_t src_span = (rows - 1) * src_pitch + row_bytes;
+    size_t dst_span = (rows - 1) * dst_pitch + row_bytes;
+    uint32_t src_phys, dst_phys;
+    if (!dma.virt_to_phys(command.input, src_span, &src_phys) ||
+        !dma.virt_to_phys(command.output, dst_span, &dst_phys)) {
+        std::cerr << "Copy source and destination must be in DMA memory" << std::endl;
+        return false;
+    }
+    
+    if (!dma_sg) {
+        uint64_t start = now_ns();
+        for (int r = 0; r < rows; r++) {
+            memcpy(command.output + r * dst_pitch, command.input + r * src_pitch, row_bytes);
+        }
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        engine.stats.commands++;
+        engine.stats.busy_ns += now_ns() - start;
+        return true;
+    }
+    
+    std::vector<DmaSegment> source, destination;
+    append_segments(source, src_phys, src_pitch, rows, row_bytes);
+    append_segments(destination, dst_phys, dst_pitch, rows, row_bytes);
+    return run_dma_chain(engine, source, destination, (uint64_t)rows * row_bytes);
+}
+
+bool CNNFPGADriver::copy(qint8_t *dst, const qint8_t *src, size_t size) {
+    return copy_rows(dst, size, src, size, 1, size);
+}
+
+bool CNNFPGADriver::copy_rows(
+    qint8_t *dst, size_t dst_pitch,
+    const qint8_t *src, size_t src_pitch,
+    int rows, size_t row_bytes
+) {
+    LayerCommand command;
+    command.op = CMD_COPY;
+    command.input = src;
+    command.output = dst;
+    command.input_h = rows;
+    command.input_w = (int)row_bytes;
+    command.input_c = 1;
+    command.input_pitch = (int)src_pitch;
+    command.output_pitch = (int)dst_pitch;
+    return wait(submit(command));
+}
+
 bool CNNFPGADriver::activation(
     const qint8_t *input,
     qint8_t *output,
     int size,
     int act_type
 ) {
-    // Simple ReLU can be done efficiently in software for small sizes
-    // For large sizes, use FPGA accelerator
-    for (int i = 0; i < size; i++) {
-        if (act_type == 0) {  // ReLU
-            output[i] = (input[i] > 0) ? input[i] : 0;
-        } else if (act_type == 1) {  // ReLU6
-            qint8_t val = (input[i] > 0) ? input[i] : 0;
-            output[i] = (val < 6) ? val : 6;
-        }
-    }
-    return true;
+    LayerCommand command;
+    command.op = CMD_ACTIVATION;
+    command.input = input;
+    command.output = output;
+    command.input_h = 1;
+    command.input_w = 1;
+    command.input_c = size;
+    command.act_type = act_type;
+    return wait(submit(command));
 }
 
 bool CNNFPGADriver::max_pooling(
@@ -209,33 +1339,17 @@ bool CNNFPGADriver::max_pooling(
     int pool_size,
     int stride
 ) {
-    int output_h = (input_h - pool_size) / stride + 1;
-    int output_w = (input_w - pool_size) / stride + 1;
-    
-    for (int oh = 0; oh < output_h; oh++) {
-        for (int ow = 0; ow < output_w; ow++) {
-            for (int c = 0; c < channels; c++) {
-                qint8_t max_val = -128;
-                
-                for (int ph = 0; ph < pool_size; ph++) {
-                    for (int pw = 0; pw < pool_size; pw++) {
-                        int ih = oh * stride + ph;
-                        int iw = ow * stride + pw;
-                        int idx = (ih * input_w + iw) * channels + c;
-                        
-                        if (input[idx] > max_val) {
-                            max_val = input[idx];
-                        }
-                    }
-                }
-                
-                int out_idx = (oh * output_w + ow) * channels + c;
-                output[out_idx] = max_val;
-            }
-        }
-    }
-    
-    return true;
+    LayerCommand command;
+    command.op = CMD_MAX_POOL;
+    command.input = input;
+    command.output = output;
+    command.input_h = input_h;
+    command.input_w = input_w;
+    command.input_c = channels;
+    command.output_c = channels;
+    command.kernel_size = pool_size;
+    command.stride = stride;
+    return wait(submit(command));
 }
 
 bool CNNFPGADriver::global_avg_pooling(
@@ -243,27 +1357,81 @@ bool CNNFPGADriver::global_avg_pooling(
     qint8_t *output,
     int height, int width, int channels
 ) {
-    int spatial_size = height * width;
-    
-    for (int c = 0; c < channels; c++) {
-        int32_t sum = 0;
-        
-        for (int s = 0; s < spatial_size; s++) {
-            sum += input[s * channels + c];
-        }
-        
-        output[c] = (qint8_t)(sum / spatial_size);
-    }
-    
-    return true;
+    LayerCommand command;
+    command.op = CMD_GLOBAL_AVG_POOL;
+    command.input = input;
+    command.output = output;
+    command.input_h = height;
+    command.input_w = width;
+    command.input_c = channels;
+    command.output_c = channels;
+    return wait(submit(command));
+}
+
+bool CNNFPGADriver::classify(
+    const qint8_t *input,
+    const qint8_t *weights,
+    const qint32_t *bias,
+    ClassifierOutput *result,
+    int inputs, int classes,
+    int top_k
+) {
+    LayerCommand command;
+    command.op = CMD_CLASSIFY;
+    command.input = input;
+    command.weights = weights;
+    command.bias = bias;
+    command.output = (qint8_t*)result;
+    command.input_h = 1;
+    command.input_w = 1;
+    command.input_c = inputs;
+    command.output_c = classes;
+    command.top_k = top_k;
+    return wait(submit(command));
+}
+
+void CNNFPGADriver::read_perf_counters(Engine &engine, PerfCounters *counters) {
+    counters->total_cycles = read_reg(engine, ACCEL_PERF_TOTAL_CYCLES_REG);
+    counters->busy_cycles = read_reg(engine, ACCEL_PERF_BUSY_CYCLES_REG);
+    counters->read_beats = read_reg(engine, ACCEL_PERF_READ_BEATS_REG);
+    counters->write_beats = read_reg(engine, ACCEL_PERF_WRITE_BEATS_REG);
+    counters->read_stall_cycles = read_reg(engine, ACCEL_PERF_READ_STALL_REG);
+    counters->write_stall_cycles = read_reg(engine, ACCEL_PERF_WRITE_STALL_REG);
 }
 
 uint64_t CNNFPGADriver::get_cycle_count() {
-    // Read hardware cycle counter if available
-    // Otherwise return 0
-    return 0;
+    // The hardware counters are 32-bit; per-layer deltas are summed here
+    return cycle_count;
 }
 
 void CNNFPGADriver::reset_cycle_counter() {
-    // Reset hardware cycle counter
+    cycle_count = 0;
+}
+
+EngineStats CNNFPGADriver::engine_stats(EngineId engine) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    EngineStats stats = engines[engine].stats;
+    stats.elapsed_ns = now_ns() - stats_start_ns;
+    return stats;
+}
+
+void CNNFPGADriver::reset_engine_stats() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        engines[i].stats = EngineStats();
+    }
+    stats_start_ns = now_ns();
+}
+
+void CNNFPGADriver::print_utilization() {
+    uint64_t elapsed_ns = engine_stats(ENGINE_CONV).elapsed_ns;
+    printf("\nAccelerator utilization over %.1f ms:\n", elapsed_ns / 1e6);
+    printf("  %-12s %8s %10s %7s %12s\n", "block", "ops", "busy ms", "util%", "cycles");
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        EngineStats stats = engine_stats((EngineId)i);
+        printf("  %-12s %8llu %10.3f %7.1f %12llu\n", engines[i].name,
+               (unsigned long long)stats.commands, stats.busy_ns / 1e6,
+               elapsed_ns ? 100.0 * stats.busy_ns / elapsed_ns : 0.0,
+               (unsigned long long)stats.cycles);
+    }
 }
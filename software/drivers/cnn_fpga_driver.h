@@ -3,46 +3,388 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include "../models/configs/mobilenet_config.h"
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "../../models/configs/mobilenet_config.h"
+#include "axi_dma.h"
+#include "dma_allocator.h"
+#include "fpga_simulator.h"
+#include "irq_line.h"
+#include "perf_profile.h"
+
+// How the driver waits for an accelerator to finish a layer
+enum CompletionMode {
+    COMPLETION_POLL,        // Spin on the status register
+    COMPLETION_INTERRUPT,   // Block on the interrupt line
+    COMPLETION_ADAPTIVE     // Spin for layers expected to be short, block otherwise
+};
+
+// Give up on a layer after this long and reset the accelerator
+#define COMPLETION_TIMEOUT_MS 1000
+
+// Adaptive mode spins when a layer is expected to finish within this many
+// microseconds - below the cost of a sleep/wake-up round trip on the A9
+#define ADAPTIVE_SPIN_LIMIT_US 50
+
+// Identifies a submitted command; handles increase in submission order
+typedef uint64_t CommandHandle;
+#define NO_COMMAND 0
+
+// Weights registered in device memory; 0 is never a valid handle
+typedef uint32_t WeightHandle;
+#define NO_WEIGHTS 0
+
+// Compiled conv program; 0 is never a valid handle
+typedef uint32_t ProgramHandle;
+#define NO_PROGRAM 0
+
+// Submissions beyond this many commands queued on one accelerator block
+// until one of them completes
+#define MAX_QUEUED_COMMANDS 64
+
+// Accelerator blocks and the DMA engine, each with its own register window,
+// interrupt line and command queue; they run concurrently
+enum EngineId {
+    ENGINE_CONV,
+    ENGINE_ACTIVATION,
+    ENGINE_POOLING,
+    ENGINE_CLASSIFIER,
+    ENGINE_DMA,
+    ENGINE_COUNT
+};
+
+// CMD_CONV runs on the conv block, CMD_ACTIVATION on the activation block,
+// the pooling commands on the pooling block, CMD_CLASSIFY on the classifier
+// block and CMD_COPY on the DMA engine. CMD_PROGRAM runs a compiled
+// sequence of conv layers on the conv block.
+enum CommandOp {
+    CMD_CONV,
+    CMD_ACTIVATION,
+    CMD_MAX_POOL,
+    CMD_AVG_POOL,
+    CMD_GLOBAL_AVG_POOL,
+    CMD_COPY,
+    CMD_PROGRAM,
+    CMD_CLASSIFY
+};
+
+// Usage of one accelerator block since init() or reset_engine_stats()
+struct EngineStats {
+    uint64_t commands;      // Operations completed
+    uint64_t busy_ns;       // Wall time from start to done, summed
+    uint64_t cycles;        // Accelerator cycles, from the block's counters
+    uint64_t elapsed_ns;    // Wall time the statistics cover
+
+    EngineStats() : commands(0), busy_ns(0), cycles(0), elapsed_ns(0) {}
+};
+
+// One layer for an accelerator. Pointers must stay valid until the
+// command completes; tensors outside DMA memory are staged when the
+// command starts, not when it is submitted.
+//
+// Depthwise conv takes weights [input_c][k][k] and needs output_c equal to
+// input_c; pointwise needs kernel_size 1. A dense or pointwise conv can
+// compute a slice of a wider layer: output points at the slice's first
+// channel and output_stride is the full layer's channel count. A slice's
+// output must be in DMA memory.
+// A separable conv runs a 3x3 depthwise conv (weights and bias, input_c
+// channels) straight into a pointwise one (pw_weights [output_c][input_c]
+// and pw_bias) without the intermediate map leaving the chip. mid_relu
+// (or mid_relu6) applies ReLU (ReLU6) to the depthwise output, use_relu
+// (use_relu6) to the final one. The padded input row must fit the conv
+// block's line buffers (CONV_SEPARABLE_FITS).
+// With global_pool, a pointwise (1x1 stride 1, input_c a multiple of
+// AXI_WORD_BYTES) or separable conv averages its output over the map on
+// the conv block and output receives just the output_c averages, as a
+// following global average pooling command would have written them. The
+// map must be at most GAP_MAX_PIXELS and cannot be a slice.
+// Activation treats the input as input_h * input_w * input_c elements.
+// Pooling uses kernel_size, stride and padding for its window; global
+// average pooling ignores them.
+// Classify runs a fully connected layer of input_c inputs (a multiple of
+// AXI_WORD_BYTES) and output_c classes, weights [output_c][input_c], and
+// writes a ClassifierOutput to output: the top_k best classes and the
+// softmax denominator instead of the logits.
+// A copy moves input_h rows of input_w * input_c bytes from input to
+// output, input_pitch and output_pitch bytes apart (0 = packed rows), so a
+// tile can be cut out of or placed into a larger tensor. Both ends must be
+// in DMA memory.
+struct LayerCommand {
+    CommandOp op;
+    const qint8_t *input;
+    const qint8_t *weights;
+    const qint32_t *bias;
+    qint8_t *output;
+
+    // Registered weights; when set, weights and bias are ignored and no
+    // weight bytes are copied
+    WeightHandle weight_handle;
+    ProgramHandle program;  // CMD_PROGRAM: what to run; the tensor fields are unused
+
+    // CONV_MODE_SEPARABLE: the pointwise half, as pointers or registered
+    const qint8_t *pw_weights;
+    const qint32_t *pw_bias;
+    WeightHandle pw_weight_handle;
+    bool mid_relu;
+    bool mid_relu6;
+    bool global_pool;       // CMD_CONV: write the output's global average pooling
+
+    int input_h, input_w, input_c;
+    int output_c;
+    int output_stride;      // Channels between output pixels, 0 = output_c
+    int input_pitch;        // CMD_COPY: bytes between source rows
+    int output_pitch;       // CMD_COPY: bytes between destination rows
+    int kernel_size;
+    int stride;
+    int padding;
+    bool use_relu;
+    bool use_relu6;         // CMD_CONV: clamp the output to [0, 6] on the conv block
+    int conv_mode;          // CONV_MODE_*, for CMD_CONV
+    int batch;              // CMD_CONV: images through the one set of weights, maps back to back
+    int act_type;           // ACT_TYPE_*, for CMD_ACTIVATION
+    int top_k;              // CMD_CLASSIFY: classes ranked, 1 to CLASSIFIER_MAX_TOP_K
+
+    // Earlier commands this one needs; if any of them failed, this one
+    // fails without running
+    std::vector<CommandHandle> depends_on;
+
+    // If set, receives the layer's performance counter deltas. Valid once
+    // the command has completed successfully.
+    PerfCounters *perf;
+
+    LayerCommand()
+        : op(CMD_CONV), input(nullptr), weights(nullptr), bias(nullptr), output(nullptr),
+          weight_handle(NO_WEIGHTS), program(NO_PROGRAM),
+          pw_weights(nullptr), pw_bias(nullptr), pw_weight_handle(NO_WEIGHTS), mid_relu(false),
+          mid_relu6(false), global_pool(false),
+          input_h(0), input_w(0), input_c(0), output_c(0), output_stride(0),
+          input_pitch(0), output_pitch(0),
+          kernel_size(1), stride(1), padding(0), use_relu(false), use_relu6(false),
+          conv_mode(CONV_MODE_DENSE), batch(1),
+          act_type(ACT_TYPE_RELU), top_k(1),
+          perf(nullptr) {}
+};
 
 // FPGA driver class for hardware-accelerated CNN operations
 class CNNFPGADriver {
 private:
     int mem_fd;                     // File descriptor for /dev/mem
-    void *fpga_base;                // Mapped FPGA register base address
-    void *dma_base;                 // Mapped DMA controller base
-    
-    // Memory buffers (physically contiguous)
-    void *input_buffer_phys;
-    void *output_buffer_phys;
-    void *weight_buffer_phys;
-    
-    void *input_buffer_virt;
-    void *output_buffer_virt;
-    void *weight_buffer_virt;
-    
-    size_t buffer_size;
-    
+
+    // Device-visible memory (u-dma-buf on the board, memfd when simulated)
+    DmaAllocator dma;
+    FpgaSimulator *sim;             // Non-null when running without hardware
+
     // Helper functions
     void* map_physical_memory(uint32_t addr, size_t size);
     void unmap_memory(void *addr, size_t size);
-    void* allocate_contiguous_memory(size_t size, void **phys_addr);
-    void free_contiguous_memory(void *virt_addr, size_t size);
-    
-    void write_reg(uint32_t offset, uint32_t value);
-    uint32_t read_reg(uint32_t offset);
-    
-    void wait_for_completion();
-    
+
+    // Whether the accelerators can use [ptr, ptr+size) where it is: in
+    // device memory and starting on a bus word. Their ports write whole
+    // words, so an output must also be a whole number of them.
+    bool in_place(const void *ptr, size_t size, bool written, uint32_t *phys) const;
+
+    // Bus address of [ptr, ptr+size): the buffer itself if in_place(),
+    // otherwise the staging buffer (filled if copy_in, else an output)
+    bool device_address(const void *ptr, size_t size, DmaBuffer &staging,
+                        bool copy_in, uint32_t *phys);
+
+    // Device-resident weights, by handle
+    struct RegisteredWeights {
+        DmaBuffer kernel;
+        DmaBuffer bias;
+    };
+    std::mutex weights_mutex;
+    std::map<WeightHandle, RegisteredWeights> registered_weights;
+    WeightHandle next_weight_handle;
+
+    bool weight_addresses(WeightHandle handle, size_t kernel_size, size_t bias_size,
+                          uint32_t *kernel_phys, uint32_t *bias_phys);
+    // Bus addresses of a conv layer's kernel and bias: registered, in DMA
+    // memory, or (when staging buffers are given) staged
+    bool kernel_addresses(WeightHandle handle, const qint8_t *kernel, const qint32_t *bias,
+                          size_t kernel_size, size_t bias_size,
+                          DmaBuffer *kernel_staging, DmaBuffer *bias_staging,
+                          uint32_t *kernel_phys, uint32_t *bias_phys);
+    void release_all_weights();
+
+    // Compiled conv programs: descriptors in device memory, by handle
+    struct Program {
+        DmaBuffer descriptors;
+        uint32_t length;
+        uint64_t macs;
+    };
+    std::mutex programs_mutex;
+    std::map<ProgramHandle, Program> programs;
+    ProgramHandle next_program_handle;
+
+    void release_all_programs();
+
+    struct QueuedCommand {
+        CommandHandle handle;
+        LayerCommand command;
+    };
+
+    // One accelerator block. Its thread drains its queue in order, so the
+    // block starts the next operation as soon as the previous one is done.
+    struct Engine {
+        EngineId id;
+        const char *name;
+        uint32_t base_addr;
+        const char *uio_name;
+        void *regs;                 // Mapped register window (hardware only)
+        IrqLine irq;
+        double ns_per_op;           // Running estimate of throughput, 0 until measured
+        std::thread thread;
+        std::deque<QueuedCommand> queue;
+
+        // Staging buffers, used only when a caller passes memory that is
+        // not device-visible. Grown on demand.
+        DmaBuffer input_staging;
+        DmaBuffer output_staging;
+        DmaBuffer weight_staging;
+        DmaBuffer bias_staging;
+        DmaBuffer pw_weight_staging;
+        DmaBuffer pw_bias_staging;
+
+        // Usage statistics, under queue_mutex
+        EngineStats stats;
+    };
+    Engine engines[ENGINE_COUNT];
+
+    void write_reg(Engine &engine, uint32_t offset, uint32_t value);
+    uint32_t read_reg(Engine &engine, uint32_t offset);
+
+    // Status, interrupt acknowledge and reset differ between the
+    // accelerator blocks and the DMA engine
+    bool engine_done(Engine &engine);
+    void acknowledge(Engine &engine);
+    void reset_engine(Engine &engine);
+
+    // Descriptor ring for the DMA engine, grown on demand; dma_sg is false
+    // when the core has no scatter-gather support and copies fall back to
+    // the CPU
+    struct DmaSegment {
+        uint32_t phys;
+        uint32_t length;
+    };
+    DmaBuffer dma_descriptors;
+    bool dma_sg;
+
+    static void append_segments(std::vector<DmaSegment> &segments, uint32_t phys,
+                                size_t pitch, int rows, size_t row_bytes);
+    bool run_dma_chain(Engine &engine, const std::vector<DmaSegment> &source,
+                       const std::vector<DmaSegment> &destination, uint64_t bytes);
+
+    // Completion handling
+    CompletionMode completion_mode;
+    int completion_timeout_ms;
+
+    bool spin_until_done(Engine &engine, uint64_t budget_ns);
+    bool block_until_done(Engine &engine, int timeout_ms);
+    bool wait_for_completion(Engine &engine, uint64_t ops, uint32_t layers = 1);
+
+    // Start the configured operation and wait for it; ops scales the
+    // completion estimate and layers the timeout. Fills delta with the
+    // block's counter deltas.
+    bool run_engine(Engine &engine, uint64_t ops, PerfCounters *delta, uint32_t layers = 1);
+
+    // Conv accelerator cycles since reset_cycle_counter(), widened to 64 bits
+    std::atomic<uint64_t> cycle_count;
+    void read_perf_counters(Engine &engine, PerfCounters *counters);
+
+    // Commands are numbered across all engines; they complete out of order
+    // once several blocks run, so completion is everything up to
+    // completed_through plus the handles in completed_early
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;       // work queued, a dependency done, or stopping
+    std::condition_variable done_cv;        // a command completed
+    CommandHandle next_handle;
+    CommandHandle completed_through;
+    std::set<CommandHandle> completed_early;
+    std::set<CommandHandle> failed_commands;
+    bool queue_stopping;
+    uint64_t stats_start_ns;
+
+    static EngineId engine_for(CommandOp op);
+    bool completed(CommandHandle handle) const;         // queue_mutex held
+    bool dependencies_done(const LayerCommand &command) const;
+    void mark_completed(CommandHandle handle);
+
+    void engine_loop(EngineId id);
+    bool execute(Engine &engine, const LayerCommand &command);
+    // The registers one conv layer needs, as a program descriptor. With an
+    // engine, tensors outside DMA memory go through its staging buffers;
+    // without one they are rejected.
+    bool conv_descriptor(Engine *engine, const LayerCommand &command, ConvLayerDescriptor *desc,
+                         uint64_t *macs, size_t *output_size);
+    bool execute_conv(Engine &engine, const LayerCommand &command);
+    bool execute_program(Engine &engine, const LayerCommand &command);
+    bool execute_activation(Engine &engine, const LayerCommand &command);
+    bool execute_pooling(Engine &engine, const LayerCommand &command);
+    bool execute_classify(Engine &engine, const LayerCommand &command);
+    bool execute_copy(Engine &engine, const LayerCommand &command);
+    void stop_queue();
+
 public:
     CNNFPGADriver();
     ~CNNFPGADriver();
-    
-    // Initialization and cleanup
-    bool init();
+
+    // Initialization and cleanup. Maps every accelerator block and starts
+    // its queue. With simulate set, registers and DMA memory are modelled
+    // in-process (no /dev/mem or u-dma-buf needed).
+    bool init(bool simulate = false);
     void cleanup();
-    
-    // Layer execution functions
+
+    // Device-visible tensors. Layer calls on pointers inside these buffers
+    // run without staging copies.
+    DmaBuffer alloc_buffer(size_t size);
+    void free_buffer(DmaBuffer &buffer);
+    bool is_device_buffer(const void *ptr, size_t size) const;
+
+    // The pool behind alloc_buffer(), for sharing buffers with other
+    // processes (its fd, and a buffer's offset within it)
+    const DmaAllocator& dma_pool() const { return dma; }
+
+    // Copy a layer's kernel and bias into device memory once; layer calls
+    // then pass the handle instead of host pointers. Safe to call from a
+    // loader thread while commands run.
+    WeightHandle register_weights(const qint8_t *kernel, size_t kernel_size,
+                                  const qint32_t *bias, size_t bias_count);
+    void release_weights(WeightHandle handle);
+
+    // Compile conv layers (CMD_CONV commands, run in order) into one program
+    // the conv block walks on its own: one START and one interrupt for all
+    // of them, each layer's kernels prefetched while the one before runs.
+    // Every tensor must be in DMA memory and weights registered or
+    // device-resident. A program can be run any number of times; release it
+    // only once no run is queued.
+    ProgramHandle compile_program(const std::vector<LayerCommand> &layers);
+    void release_program(ProgramHandle program);
+    bool run_program(ProgramHandle program);
+
+    // Interrupt, polling or adaptive completion. Interrupt modes fall back
+    // to polling when no interrupt line could be opened.
+    void set_completion_mode(CompletionMode mode, int timeout_ms = COMPLETION_TIMEOUT_MS);
+    CompletionMode get_completion_mode() const { return completion_mode; }
+
+    // Asynchronous execution. submit() queues the command on the block that
+    // runs its op and returns NO_COMMAND if it was rejected (driver not
+    // initialized, or a dependency on a handle not yet issued). A command
+    // starts once its dependencies, on any block, have finished. wait()
+    // blocks until the command has finished and reports whether it
+    // succeeded.
+    CommandHandle submit(const LayerCommand &command);
+    bool wait(CommandHandle handle);
+    bool is_complete(CommandHandle handle);
+
+    // Layer execution functions (synchronous: submit and wait)
     bool conv2d(
         const qint8_t *input,
         const qint8_t *weights,
@@ -55,7 +397,19 @@ public:
         int padding,
         bool use_relu
     );
-    
+
+    bool conv2d(
+        const qint8_t *input,
+        WeightHandle weights,
+        qint8_t *output,
+        int input_h, int input_w, int input_c,
+        int output_c,
+        int kernel_size,
+        int stride,
+        int padding,
+        bool use_relu
+    );
+
     bool depthwise_conv2d(
         const qint8_t *input,
         const qint8_t *weights,
@@ -66,7 +420,7 @@ public:
         int stride,
         int padding
     );
-    
+
     bool pointwise_conv2d(
         const qint8_t *input,
         const qint8_t *weights,
@@ -75,14 +429,31 @@ public:
         int input_h, int input_w,
         int input_c, int output_c
     );
-    
+
+    // Depthwise 3x3 (ReLU if dw_relu) into pointwise (ReLU if pw_relu) as
+    // one conv block command
+    bool separable_block(
+        const qint8_t *input,
+        const qint8_t *dw_weights,
+        const qint32_t *dw_bias,
+        const qint8_t *pw_weights,
+        const qint32_t *pw_bias,
+        qint8_t *output,
+        int input_h, int input_w, int input_c,
+        int output_c,
+        int stride,
+        int padding,
+        bool dw_relu,
+        bool pw_relu
+    );
+
     bool activation(
         const qint8_t *input,
         qint8_t *output,
         int size,
-        int act_type  // 0=ReLU, 1=ReLU6
+        int act_type  // ACT_TYPE_RELU or ACT_TYPE_RELU6
     );
-    
+
     bool max_pooling(
         const qint8_t *input,
         qint8_t *output,
@@ -90,16 +461,41 @@ public:
         int pool_size,
         int stride
     );
-    
+
     bool global_avg_pooling(
         const qint8_t *input,
         qint8_t *output,
         int height, int width, int channels
     );
-    
-    // Performance monitoring
+
+    // Fully connected layer ranked on the classifier block: the top_k best
+    // classes and the softmax denominator land in result
+    bool classify(
+        const qint8_t *input,
+        const qint8_t *weights,
+        const qint32_t *bias,
+        ClassifierOutput *result,
+        int inputs, int classes,
+        int top_k
+    );
+
+    // Copies between device buffers on the DMA engine; the CPU only writes
+    // descriptors. Pitches are bytes between row starts.
+    bool copy(qint8_t *dst, const qint8_t *src, size_t size);
+    bool copy_rows(
+        qint8_t *dst, size_t dst_pitch,
+        const qint8_t *src, size_t src_pitch,
+        int rows, size_t row_bytes
+    );
+
+    // Performance monitoring: cycles the conv accelerator has been running
     uint64_t get_cycle_count();
     void reset_cycle_counter();
+
+    // Per-block utilization: share of wall time each block spent running
+    EngineStats engine_stats(EngineId engine);
+    void reset_engine_stats();
+    void print_utilization();
 };
 
 #endif // CNN_FPGA_DRIVER_H
@@ -0,0 +1,104 @@
+#include "coexec_planner.h"
+#include "../common/cpu_convolution.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// Calibration layer: a mid-network pointwise conv
+#define CALIBRATION_SIZE 14
+#define CALIBRATION_CHANNELS 128
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+CoExecPlanner::CoExecPlanner()
+    : cpu_ns_per_mac(0.0), fpga_ns_per_mac(0.0), fpga_overhead_ns(0.0), calibrated(false) {
+}
+
+bool CoExecPlanner::calibrate(CNNFPGADriver &fpga) {
+    const int size = CALIBRATION_SIZE;
+    const int c = CALIBRATION_CHANNELS;
+    const uint64_t macs_per_channel = (uint64_t)size * size * c;
+
+    // Device buffers so the accelerator timings include no staging copies
+    DmaBuffer input = fpga.alloc_buffer(size * size * c);
+    DmaBuffer output = fpga.alloc_buffer(size * size * c);
+    DmaBuffer kernel = fpga.alloc_buffer(c * c);
+    DmaBuffer bias = fpga.alloc_buffer(c * sizeof(qint32_t));
+    bool ok = input.valid() && output.valid() && kernel.valid() && bias.valid();
+
+    double cpu_best = 0.0, fpga_full = 0.0, fpga_one = 0.0;
+    if (ok) {
+        for (int i = 0; i < size * size * c; i++) ((qint8_t*)input.virt)[i] = (qint8_t)(i * 7);
+        for (int i = 0; i < c * c; i++) ((qint8_t*)kernel.virt)[i] = (qint8_t)(i * 13);
+        memset(bias.virt, 0, c * sizeof(qint32_t));
+
+        const qint8_t *in = (const qint8_t*)input.virt;
+        const qint8_t *w = (const qint8_t*)kernel.virt;
+        const qint32_t *b = (const qint32_t*)bias.virt;
+        qint8_t *out = (qint8_t*)output.virt;
+
+        for (int run = 0; run < COEXEC_CALIBRATION_RUNS && ok; run++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            CPUConvolution::conv2d(in, w, b, out, size, size, c, c, 1, 1, 0);
+            double t = elapsed_ns(start);
+            if (run == 0 || t < cpu_best) cpu_best = t;
+
+            // A full layer and a one-word layer (the narrowest output the
+            // accelerator stores): the difference is the per-MAC cost, what
+            // is left of the small one the overhead
+            start = std::chrono::steady_clock::now();
+            ok = fpga.conv2d(in, w, b, out, size, size, c, c, 1, 1, 0, false);
+            t = elapsed_ns(start);
+            if (run == 0 || t < fpga_full) fpga_full = t;
+
+            start = std::chrono::steady_clock::now();
+            ok = ok && fpga.conv2d(in, w, b, out, size, size, c, AXI_WORD_BYTES, 1, 1, 0, false);
+            t = elapsed_ns(start);
+            if (run == 0 || t < fpga_one) fpga_one = t;
+        }
+    }
+
+    fpga.free_buffer(input);
+    fpga.free_buffer(output);
+    fpga.free_buffer(kernel);
+    fpga.free_buffer(bias);
+    if (!ok) {
+        std::cerr << "Co-execution calibration failed" << std::endl;
+        return false;
+    }
+
+    cpu_ns_per_mac = cpu_best / (macs_per_channel * c);
+    fpga_ns_per_mac = (fpga_full > fpga_one)
+        ? (fpga_full - fpga_one) / (macs_per_channel * (c - AXI_WORD_BYTES))
+        : fpga_full / (macs_per_channel * c);
+    fpga_overhead_ns = fpga_one - fpga_ns_per_mac * macs_per_channel * AXI_WORD_BYTES;
+    if (fpga_overhead_ns < 0.0) fpga_overhead_ns = 0.0;
+    calibrated = true;
+    return true;
+}
+
+int CoExecPlanner::fpga_channels(uint64_t macs_per_channel, int output_c) const {
+    if (!calibrated || macs_per_channel == 0) return output_c;
+
+    // overhead + n * m * f == (output_c - n) * m * c, solved for n
+    double m = (double)macs_per_channel;
+    double n = (output_c * m * cpu_ns_per_mac - fpga_overhead_ns) /
+               (m * (fpga_ns_per_mac + cpu_ns_per_mac));
+    // The accelerator's share is whole bus words of channels
+    int fpga = (int)(n + 0.5) / AXI_WORD_BYTES * AXI_WORD_BYTES;
+    if (fpga < 0) fpga = 0;
+    if (output_c - fpga < COEXEC_MIN_CPU_CHANNELS) fpga = output_c;
+    return fpga;
+}
+
+void CoExecPlanner::print() const {
+    if (!calibrated) return;
+    double share = fpga_ns_per_mac + cpu_ns_per_mac > 0.0
+        ? 100.0 * cpu_ns_per_mac / (fpga_ns_per_mac + cpu_ns_per_mac) : 0.0;
+    printf("Co-execution cost model: CPU %.3f ns/MAC, FPGA %.3f ns/MAC + %.1f us per layer "
+           "(large layers: %.0f%% of channels on the FPGA)\n",
+           cpu_ns_per_mac, fpga_ns_per_mac, fpga_overhead_ns / 1000.0, share);
+}
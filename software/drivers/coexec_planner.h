@@ -0,0 +1,39 @@
+#ifndef COEXEC_PLANNER_H
+#define COEXEC_PLANNER_H
+
+#include <stdint.h>
+#include "cnn_fpga_driver.h"
+
+// Splitting a layer only pays off when the CPU gets at least this many
+// output channels; below that the whole layer stays on the accelerator
+#define COEXEC_MIN_CPU_CHANNELS 4
+
+// Timed runs per calibration measurement; the fastest one counts
+#define COEXEC_CALIBRATION_RUNS 3
+
+// Decides how a conv layer's output channels are split between the
+// accelerator and the CPU so both halves finish at the same time. Each side
+// is modelled as linear in MACs, the accelerator with a fixed per-command
+// overhead on top; the three constants are measured once by calibrate().
+class CoExecPlanner {
+private:
+    double cpu_ns_per_mac;
+    double fpga_ns_per_mac;
+    double fpga_overhead_ns;
+    bool calibrated;
+
+public:
+    CoExecPlanner();
+
+    // Time a representative pointwise layer on both engines
+    bool calibrate(CNNFPGADriver &fpga);
+    bool is_calibrated() const { return calibrated; }
+
+    // Output channels [0, n) go to the accelerator, [n, output_c) to the
+    // CPU. Returns output_c (no split) until calibrated.
+    int fpga_channels(uint64_t macs_per_channel, int output_c) const;
+
+    void print() const;
+};
+
+#endif // COEXEC_PLANNER_H
@@ -0,0 +1,199 @@
+#include "dma_allocator.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+DmaAllocator::DmaAllocator()
+    : pool_fd(-1), pool_virt(nullptr), pool_phys(0), pool_size(0), map_delta(0) {
+}
+
+DmaAllocator::~DmaAllocator() {
+    close_pool();
+}
+
+static bool read_sysfs_value(const std::string &path, unsigned long long *value) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) {
+        return false;
+    }
+    bool ok = fscanf(f, "%llx", value) == 1;
+    fclose(f);
+    return ok;
+}
+
+bool DmaAllocator::map_pool(size_t size) {
+    pool_virt = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, pool_fd, 0);
+    if (pool_virt == MAP_FAILED) {
+        pool_virt = nullptr;
+        return false;
+    }
+    pool_size = size;
+    free_blocks.clear();
+    used_blocks.clear();
+    free_blocks[0] = size;
+    return true;
+}
+
+bool DmaAllocator::open_udmabuf(const char *name) {
+    std::string sysfs = std::string("/sys/class/u-dma-buf/") + name;
+    unsigned long long phys = 0, size = 0;
+
+    // phys_addr is printed in hex, size in decimal
+    FILE *f = fopen((sysfs + "/size").c_str(), "r");
+    if (!f || fscanf(f, "%llu", &size) != 1 || !read_sysfs_value(sysfs + "/phys_addr", &phys)) {
+        if (f) fclose(f);
+        std::cerr << "u-dma-buf " << name << " not found (is the u-dma-buf module loaded?)" << std::endl;
+        return false;
+    }
+    fclose(f);
+
+    // O_SYNC gives an uncached mapping, so the PL sees CPU writes without
+    // explicit cache maintenance
+    pool_fd = open((std::string("/dev/") + name).c_str(), O_RDWR | O_SYNC);
+    if (pool_fd < 0) {
+        std::cerr << "Failed to open /dev/" << name << std::endl;
+        return false;
+    }
+
+    pool_phys = (uint32_t)phys;
+    return map_pool((size_t)size);
+}
+
+bool DmaAllocator::open_memfd(size_t size) {
+    pool_fd = (int)syscall(SYS_memfd_create, "cnn_dma_pool", 0);
+    if (pool_fd < 0 || ftruncate(pool_fd, size) != 0) {
+        std::cerr << "Failed to create memfd DMA pool" << std::endl;
+        return false;
+    }
+
+    pool_phys = SIM_DMA_PHYS_BASE;
+    return map_pool(size);
+}
+
+bool DmaAllocator::open_shared(int fd, size_t offset, size_t size, uint32_t phys) {
+    pool_fd = fd;
+
+    // mmap offsets must be page aligned; the window need not be
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+    void *map = mmap(nullptr, size + (offset - start), PROT_READ | PROT_WRITE, MAP_SHARED,
+                     pool_fd, (off_t)start);
+    if (map == MAP_FAILED) {
+        std::cerr << "Failed to map shared DMA pool window" << std::endl;
+        return false;
+    }
+
+    map_delta = offset - start;
+    pool_virt = (char*)map + map_delta;
+    pool_phys = phys;
+    pool_size = size;
+    free_blocks.clear();
+    used_blocks.clear();
+    free_blocks[0] = size;
+    return true;
+}
+
+void DmaAllocator::close_pool() {
+    if (pool_virt) {
+        munmap((char*)pool_virt - map_delta, pool_size + map_delta);
+        pool_virt = nullptr;
+        map_delta = 0;
+    }
+    if (pool_fd >= 0) {
+        close(pool_fd);
+        pool_fd = -1;
+    }
+    free_blocks.clear();
+    used_blocks.clear();
+    pool_size = 0;
+}
+
+DmaBuffer DmaAllocator::allocate(size_t size) {
+    DmaBuffer buffer;
+    size_t aligned = (size + DMA_ALIGNMENT - 1) & ~(size_t)(DMA_ALIGNMENT - 1);
+    if (aligned == 0) aligned = DMA_ALIGNMENT;
+
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+
+    // First fit; every block offset stays DMA_ALIGNMENT aligned
+    for (std::map<size_t, size_t>::iterator it = free_blocks.begin();
+         it != free_blocks.end(); ++it) {
+        if (it->second < aligned) continue;
+
+        size_t offset = it->first;
+        size_t remaining = it->second - aligned;
+        free_blocks.erase(it);
+        if (remaining > 0) {
+            free_blocks[offset + aligned] = remaining;
+        }
+        used_blocks[offset] = aligned;
+
+        buffer.virt = (char*)pool_virt + offset;
+        buffer.phys = pool_phys + (uint32_t)offset;
+        buffer.size = size;
+        return buffer;
+    }
+
+    std::cerr << "DMA pool exhausted allocating " << size << " bytes" << std::endl;
+    return buffer;
+}
+
+void DmaAllocator::coalesce() {
+    std::map<size_t, size_t>::iterator it = free_blocks.begin();
+    while (it != free_blocks.end()) {
+        std::map<size_t, size_t>::iterator next = it;
+        ++next;
+        if (next != free_blocks.end() && it->first + it->second == next->first) {
+            it->second += next->second;
+            free_blocks.erase(next);
+        } else {
+            it = next;
+        }
+    }
+}
+
+void DmaAllocator::free(DmaBuffer &buffer) {
+    if (!buffer.valid()) return;
+
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    size_t offset = (size_t)((char*)buffer.virt - (char*)pool_virt);
+    std::map<size_t, size_t>::iterator it = used_blocks.find(offset);
+    if (it != used_blocks.end()) {
+        free_blocks[offset] = it->second;
+        used_blocks.erase(it);
+        coalesce();
+    }
+    buffer = DmaBuffer();
+}
+
+bool DmaAllocator::virt_to_phys(const void *ptr, size_t size, uint32_t *phys) const {
+    const char *p = (const char*)ptr;
+    const char *base = (const char*)pool_virt;
+    if (!pool_virt || p < base || p + size > base + pool_size) {
+        return false;
+    }
+    *phys = pool_phys + (uint32_t)(p - base);
+    return true;
+}
+
+void* DmaAllocator::phys_to_virt(uint32_t phys, size_t size) const {
+    if (!pool_virt || phys < pool_phys || (size_t)(phys - pool_phys) + size > pool_size) {
+        return nullptr;
+    }
+    return (char*)pool_virt + (phys - pool_phys);
+}
+
+size_t DmaAllocator::bytes_free() {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    size_t total = 0;
+    for (std::map<size_t, size_t>::iterator it = free_blocks.begin();
+         it != free_blocks.end(); ++it) {
+        total += it->second;
+    }
+    return total;
+}
@@ -0,0 +1,80 @@
+#ifndef DMA_ALLOCATOR_H
+#define DMA_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <mutex>
+
+// Default u-dma-buf device providing the CMA-backed pool on the board
+#define UDMABUF_NAME "udmabuf0"
+
+// Host stand-in: size of the memfd pool and the bus address it pretends to
+// live at (inside the DDR window of docs/architecture.md)
+#define SIM_DMA_POOL_SIZE (128 * 1024 * 1024)
+#define SIM_DMA_PHYS_BASE 0x30000000
+
+// Alignment of every allocation (AXI burst / cache line friendly)
+#define DMA_ALIGNMENT 64
+
+// A device-visible tensor: CPU mapping plus the bus address the
+// accelerators use
+struct DmaBuffer {
+    void *virt;
+    uint32_t phys;
+    size_t size;
+
+    DmaBuffer() : virt(nullptr), phys(0), size(0) {}
+    bool valid() const { return virt != nullptr; }
+};
+
+// Allocates device-visible buffers out of one physically contiguous pool.
+// On the board the pool is a u-dma-buf (CMA) region mapped uncached, so
+// no cache maintenance is needed; on a host it is a memfd with a fake bus
+// address, which the simulated accelerator translates back.
+class DmaAllocator {
+private:
+    int pool_fd;
+    void *pool_virt;
+    uint32_t pool_phys;
+    size_t pool_size;
+    size_t map_delta;           // Bytes mapped ahead of pool_virt (page rounding)
+
+    std::mutex alloc_mutex;
+    std::map<size_t, size_t> free_blocks;   // offset -> size
+    std::map<size_t, size_t> used_blocks;   // offset -> size
+
+    bool map_pool(size_t size);
+    void coalesce();
+
+public:
+    DmaAllocator();
+    ~DmaAllocator();
+
+    // Board: /dev/<name>, physical address and size from sysfs
+    bool open_udmabuf(const char *name);
+
+    // Host: anonymous memfd pool
+    bool open_memfd(size_t size);
+
+    // Client of another process's pool: the window [offset, offset+size) of
+    // the pool behind fd, whose bus address is phys. Takes ownership of fd.
+    bool open_shared(int fd, size_t offset, size_t size, uint32_t phys);
+
+    void close_pool();
+
+    DmaBuffer allocate(size_t size);
+    void free(DmaBuffer &buffer);
+
+    // True if [ptr, ptr+size) lies inside the pool; fills *phys if so
+    bool virt_to_phys(const void *ptr, size_t size, uint32_t *phys) const;
+    void* phys_to_virt(uint32_t phys, size_t size) const;
+
+    int fd() const { return pool_fd; }
+    size_t offset_of(const DmaBuffer &buffer) const {
+        return (size_t)((char*)buffer.virt - (char*)pool_virt);
+    }
+    size_t bytes_free();
+};
+
+#endif // DMA_ALLOCATOR_H
@@ -0,0 +1,951 @@
+#include "fpga_simulator.h"
+#include "../common/cpu_convolution.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#define SIM_BLOCK_CONV 0
+#define SIM_BLOCK_ACTIVATION 1
+#define SIM_BLOCK_POOLING 2
+#define SIM_BLOCK_CLASSIFIER 3
+
+FpgaSimulator::FpgaSimulator(DmaAllocator &mem)
+    : memory(mem), stopping(false) {
+    for (int i = 0; i < SIM_BLOCK_COUNT; i++) {
+        Block &b = blocks[i];
+        memset(b.regs, 0, sizeof(b.regs));
+        b.status = STATUS_IDLE_BIT;
+        b.irq_status = 0;
+        b.perf_total_cycles = 0;
+        b.perf_busy_cycles = 0;
+        b.perf_read_beats = 0;
+        b.perf_write_beats = 0;
+        b.perf_read_stall = 0;
+        b.perf_write_stall = 0;
+        b.irq = nullptr;
+        b.start_pending = false;
+    }
+    memset(dma.regs, 0, sizeof(dma.regs));
+    dma.regs[AXI_DMA_MM2S_DMASR / 4] = AXI_DMA_SR_HALTED | AXI_DMA_SR_SG_INCLUDED;
+    dma.regs[AXI_DMA_S2MM_DMASR / 4] = AXI_DMA_SR_HALTED | AXI_DMA_SR_SG_INCLUDED;
+    dma.tails_pending = 0;
+    dma.irq = nullptr;
+    dma.start_pending = false;
+    for (int i = 0; i < SIM_BLOCK_COUNT; i++) {
+        blocks[i].worker = std::thread(&FpgaSimulator::worker_loop, this, i);
+    }
+    dma.worker = std::thread(&FpgaSimulator::dma_loop, this);
+}
+
+FpgaSimulator::~FpgaSimulator() {
+    {
+        std::lock_guard<std::mutex> lock(sim_mutex);
+        stopping = true;
+    }
+    sim_cv.notify_all();
+    for (int i = 0; i < SIM_BLOCK_COUNT; i++) {
+        blocks[i].worker.join();
+    }
+    dma.worker.join();
+}
+
+bool FpgaSimulator::decode(uint32_t addr, int *block, uint32_t *offset) {
+    if (addr < FPGA_BASE_ADDR) return false;
+    uint32_t index = (addr - FPGA_BASE_ADDR) / ACCEL_BLOCK_SIZE;
+    *offset = (addr - FPGA_BASE_ADDR) % ACCEL_BLOCK_SIZE;
+    if (index >= SIM_BLOCK_COUNT || *offset / 4 >= SIM_BLOCK_REG_COUNT) return false;
+    *block = (int)index;
+    return true;
+}
+
+void FpgaSimulator::attach_irq(uint32_t block_base, IrqLine *line) {
+    int block;
+    uint32_t offset;
+    if (block_base == AXI_DMA_BASE_ADDR) {
+        std::lock_guard<std::mutex> lock(sim_mutex);
+        dma.irq = line;
+    } else if (decode(block_base, &block, &offset)) {
+        std::lock_guard<std::mutex> lock(sim_mutex);
+        blocks[block].irq = line;
+    }
+}
+
+void FpgaSimulator::write_reg(uint32_t addr, uint32_t value) {
+    int block;
+    uint32_t offset;
+    if (addr >= AXI_DMA_BASE_ADDR && addr - AXI_DMA_BASE_ADDR < ACCEL_BLOCK_SIZE) {
+        std::lock_guard<std::mutex> lock(sim_mutex);
+        dma_write_reg(addr - AXI_DMA_BASE_ADDR, value);
+        return;
+    }
+    if (!decode(addr, &block, &offset)) return;
+    Block &b = blocks[block];
+
+    if (offset == ACCEL_CTRL_REG) {
+        if (value & CTRL_RESET_BIT) {
+            b.status = STATUS_IDLE_BIT;
+            b.irq_status = 0;
+        } else if (value & CTRL_START_BIT) {
+            std::lock_guard<std::mutex> lock(sim_mutex);
+            b.status = 0;
+            b.start_pending = true;
+            sim_cv.notify_all();
+        }
+        return;
+    }
+    if (offset == ACCEL_IRQ_STATUS_REG) {
+        b.irq_status &= ~value;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    b.regs[offset / 4] = value;
+}
+
+uint32_t FpgaSimulator::read_reg(uint32_t addr) {
+    int block;
+    uint32_t offset;
+    if (addr >= AXI_DMA_BASE_ADDR && addr - AXI_DMA_BASE_ADDR < ACCEL_BLOCK_SIZE) {
+        uint32_t index = (addr - AXI_DMA_BASE_ADDR) / 4;
+        std::lock_guard<std::mutex> lock(sim_mutex);
+        return index < SIM_DMA_REG_COUNT ? dma.regs[index] : 0;
+    }
+    if (!decode(addr, &block, &offset)) return 0;
+    Block &b = blocks[block];
+
+    if (offset == ACCEL_STATUS_REG) return b.status;
+    if (offset == ACCEL_IRQ_STATUS_REG) return b.irq_status;
+    if (offset == ACCEL_PERF_TOTAL_CYCLES_REG) return b.perf_total_cycles;
+    if (offset == ACCEL_PERF_BUSY_CYCLES_REG) return b.perf_busy_cycles;
+    if (offset == ACCEL_PERF_READ_BEATS_REG) return b.perf_read_beats;
+    if (offset == ACCEL_PERF_WRITE_BEATS_REG) return b.perf_write_beats;
+    if (offset == ACCEL_PERF_READ_STALL_REG) return b.perf_read_stall;
+    if (offset == ACCEL_PERF_WRITE_STALL_REG) return b.perf_write_stall;
+
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    return b.regs[offset / 4];
+}
+
+void FpgaSimulator::worker_loop(int block) {
+    Block &b = blocks[block];
+    uint32_t regs[SIM_BLOCK_REG_COUNT];
+    IrqLine *irq;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(sim_mutex);
+            sim_cv.wait(lock, [this, &b] { return b.start_pending || stopping; });
+            if (stopping) return;
+            b.start_pending = false;
+            memcpy(regs, b.regs, sizeof(regs));
+            irq = b.irq;
+        }
+
+        Cost cost;
+        bool ok = false;
+        switch (block) {
+            case SIM_BLOCK_CONV: ok = run_conv(regs, &cost); break;
+            case SIM_BLOCK_ACTIVATION: ok = run_activation(regs, &cost); break;
+            case SIM_BLOCK_POOLING: ok = run_pooling(regs, &cost); break;
+            case SIM_BLOCK_CLASSIFIER: ok = run_classifier(regs, &cost); break;
+        }
+
+        // A bus fault leaves a real core stuck busy; do the same so the
+        // driver's timeout path sees it
+        if (!ok) continue;
+
+        b.perf_total_cycles += (uint32_t)(cost.busy + cost.read_beats + cost.read_stall +
+                                          cost.write_beats + cost.write_stall);
+        b.perf_busy_cycles += (uint32_t)cost.busy;
+        b.perf_read_beats += (uint32_t)(cost.read_beats + cost.hidden_reads);
+        b.perf_write_beats += (uint32_t)cost.write_beats;
+        b.perf_read_stall += (uint32_t)cost.read_stall;
+        b.perf_write_stall += (uint32_t)cost.write_stall;
+
+        b.status = STATUS_DONE_BIT | STATUS_IDLE_BIT;
+        if (regs[ACCEL_IRQ_ENABLE_REG / 4] & IRQ_DONE_BIT) {
+            b.irq_status |= IRQ_DONE_BIT;
+            if (irq) irq->signal();
+        }
+    }
+}
+
+void FpgaSimulator::dma_write_reg(uint32_t offset, uint32_t value) {
+    uint32_t index = offset / 4;
+    if (index >= SIM_DMA_REG_COUNT) return;
+
+    switch (offset) {
+        case AXI_DMA_MM2S_DMACR:
+        case AXI_DMA_S2MM_DMACR:
+            if (value & AXI_DMA_CR_RESET) {
+                // A reset on either channel resets the whole core
+                memset(dma.regs, 0, sizeof(dma.regs));
+                dma.regs[AXI_DMA_MM2S_DMASR / 4] = AXI_DMA_SR_HALTED | AXI_DMA_SR_SG_INCLUDED;
+                dma.regs[AXI_DMA_S2MM_DMASR / 4] = AXI_DMA_SR_HALTED | AXI_DMA_SR_SG_INCLUDED;
+                dma.tails_pending = 0;
+                return;
+            }
+            dma.regs[index] = value;
+            if (value & AXI_DMA_CR_RUN) {
+                dma.regs[index + 1] &= ~AXI_DMA_SR_HALTED;
+            } else {
+                dma.regs[index + 1] |= AXI_DMA_SR_HALTED;
+            }
+            return;
+        case AXI_DMA_MM2S_DMASR:
+        case AXI_DMA_S2MM_DMASR:
+            // Interrupt bits are write-one-to-clear, the rest read-only
+            dma.regs[index] &= ~(value & (AXI_DMA_SR_IOC_IRQ | AXI_DMA_SR_ERR_IRQ));
+            return;
+        case AXI_DMA_MM2S_TAILDESC:
+        case AXI_DMA_S2MM_TAILDESC: {
+            // Writing the tail of a running channel starts its fetch; the
+            // stream moves once both ends are armed
+            uint32_t control = (offset == AXI_DMA_MM2S_TAILDESC) ? AXI_DMA_MM2S_DMACR : AXI_DMA_S2MM_DMACR;
+            dma.regs[index] = value;
+            if (!(dma.regs[control / 4] & AXI_DMA_CR_RUN)) return;
+            dma.regs[control / 4 + 1] &= ~AXI_DMA_SR_IDLE;
+            dma.tails_pending |= (offset == AXI_DMA_MM2S_TAILDESC) ? 1 : 2;
+            if (dma.tails_pending == 3) {
+                dma.tails_pending = 0;
+                dma.start_pending = true;
+                sim_cv.notify_all();
+            }
+            return;
+        }
+        default:
+            dma.regs[index] = value;
+            return;
+    }
+}
+
+void FpgaSimulator::dma_loop() {
+    uint32_t regs[SIM_DMA_REG_COUNT];
+    IrqLine *irq;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(sim_mutex);
+            sim_cv.wait(lock, [this] { return dma.start_pending || stopping; });
+            if (stopping) return;
+            dma.start_pending = false;
+            memcpy(regs, dma.regs, sizeof(regs));
+            irq = dma.irq;
+        }
+
+        uint32_t errors = run_dma(regs);
+
+        bool raise;
+        {
+            std::lock_guard<std::mutex> lock(sim_mutex);
+            uint32_t flags = errors ? (errors | AXI_DMA_SR_ERR_IRQ | AXI_DMA_SR_HALTED)
+                                    : (AXI_DMA_SR_IOC_IRQ | AXI_DMA_SR_IDLE);
+            dma.regs[AXI_DMA_MM2S_DMASR / 4] |= flags;
+            dma.regs[AXI_DMA_S2MM_DMASR / 4] |= flags;
+            if (!errors) {
+                dma.regs[AXI_DMA_MM2S_CURDESC / 4] = regs[AXI_DMA_MM2S_TAILDESC / 4];
+                dma.regs[AXI_DMA_S2MM_CURDESC / 4] = regs[AXI_DMA_S2MM_TAILDESC / 4];
+            }
+            raise = (dma.regs[AXI_DMA_S2MM_DMACR / 4] &
+                     (errors ? AXI_DMA_CR_ERR_IRQ_EN : AXI_DMA_CR_IOC_IRQ_EN)) != 0;
+        }
+        if (raise && irq) irq->signal();
+    }
+}
+
+uint32_t FpgaSimulator::run_dma(const uint32_t *regs) {
+    // MM2S gathers every segment up to its tail into one packet
+    dma.stream.clear();
+    uint32_t addr = regs[AXI_DMA_MM2S_CURDESC / 4];
+    for (int n = 0;; n++) {
+        AxiDmaDescriptor *desc = (AxiDmaDescriptor*)memory.phys_to_virt(addr, sizeof(AxiDmaDescriptor));
+        if (n == SIM_DMA_MAX_DESCRIPTORS) return AXI_DMA_SR_SG_INT_ERR;
+        if (!desc || addr % AXI_DMA_DESC_ALIGN) return AXI_DMA_SR_SG_DEC_ERR;
+
+        uint32_t length = desc->control & AXI_DMA_DESC_LENGTH_MASK;
+        const uint8_t *src = (const uint8_t*)memory.phys_to_virt(desc->buffer, length);
+        if (!src || length == 0) {
+            std::cerr << "Simulator: DMA source segment outside the DMA pool" << std::endl;
+            return AXI_DMA_SR_DMA_DEC_ERR;
+        }
+        dma.stream.insert(dma.stream.end(), src, src + length);
+        desc->status = AXI_DMA_DESC_COMPLETE | length;
+        if (addr == regs[AXI_DMA_MM2S_TAILDESC / 4]) break;
+        addr = desc->next;
+    }
+
+    // S2MM scatters it; running out of descriptors before the end of the
+    // packet is an internal error
+    size_t offset = 0;
+    addr = regs[AXI_DMA_S2MM_CURDESC / 4];
+    for (int n = 0;; n++) {
+        AxiDmaDescriptor *desc = (AxiDmaDescriptor*)memory.phys_to_virt(addr, sizeof(AxiDmaDescriptor));
+        if (n == SIM_DMA_MAX_DESCRIPTORS) return AXI_DMA_SR_SG_INT_ERR;
+        if (!desc || addr % AXI_DMA_DESC_ALIGN) return AXI_DMA_SR_SG_DEC_ERR;
+
+        uint32_t length = desc->control & AXI_DMA_DESC_LENGTH_MASK;
+        if (length > dma.stream.size() - offset) length = (uint32_t)(dma.stream.size() - offset);
+        uint8_t *dst = (uint8_t*)memory.phys_to_virt(desc->buffer, length);
+        if (!dst || length == 0) {
+            std::cerr << "Simulator: DMA destination segment outside the DMA pool" << std::endl;
+            return AXI_DMA_SR_DMA_DEC_ERR;
+        }
+        memcpy(dst, &dma.stream[offset], length);
+        offset += length;
+
+        bool last = (offset == dma.stream.size());
+        desc->status = AXI_DMA_DESC_COMPLETE | length | (last ? AXI_DMA_DESC_RXEOF : 0);
+        if (last) break;
+        if (addr == regs[AXI_DMA_S2MM_TAILDESC / 4]) return AXI_DMA_SR_DMA_INT_ERR;
+        addr = desc->next;
+    }
+    return 0;
+}
+
+// Bursts needed to move beats, each paying the bus latency once
+static uint64_t burst_latency(uint64_t beats, uint64_t latency) {
+    return (beats + AXI_BURST_LEN - 1) / AXI_BURST_LEN * latency;
+}
+
+// Bus words a run of length elements starting at element first touches
+static uint64_t run_words(uint64_t first, uint64_t length) {
+    if (length == 0) return 0;
+    return (first + length - 1) / AXI_WORD_BYTES - first / AXI_WORD_BYTES + 1;
+}
+
+// The accelerators' ports address whole bus words
+static bool word_aligned(uint32_t addr) {
+    return addr % AXI_WORD_BYTES == 0;
+}
+
+// Global average pooling as the hardware computes it: per-channel sums
+// scaled by the reciprocal register (GAP_RECIPROCAL), not divided
+static void reciprocal_pool(const qint8_t *input, qint8_t *output, size_t pixels, int channels,
+                            uint32_t reciprocal) {
+    for (int c = 0; c < channels; c++) {
+        int64_t sum = 0;
+        for (size_t p = 0; p < pixels; p++) {
+            sum += input[p * channels + c];
+        }
+        int64_t average = (int64_t)(((uint64_t)(sum < 0 ? -sum : sum) * reciprocal) >> GAP_RECIP_SHIFT);
+        output[c] = (qint8_t)(sum < 0 ? -average : average);
+    }
+}
+
+bool FpgaSimulator::run_conv(const uint32_t *regs, Cost *cost) {
+    uint32_t length = regs[CONV_PROGRAM_LEN_REG / 4];
+    if (length == 0) {
+        return run_conv_layer(regs, cost);
+    }
+    if (length > CONV_PROGRAM_MAX_LAYERS) return false;
+
+    const ConvLayerDescriptor *program = (const ConvLayerDescriptor*)memory.phys_to_virt(
+        regs[CONV_PROGRAM_ADDR_REG / 4], length * sizeof(ConvLayerDescriptor));
+    if (!program) {
+        std::cerr << "Simulator: conv program outside the DMA pool" << std::endl;
+        return false;
+    }
+
+    // Program mode: each descriptor goes into a copy of the register file
+    // and runs as if the host had written it. Descriptor addresses are
+    // offsets from the address registers, as the HLS pointers would be.
+    // A descriptor is one burst. After one with CONV_CONFIG_PREFETCH, the
+    // next descriptor and its layer's preload are read while that layer
+    // runs; only what outlasts the layer still costs time.
+    uint32_t layer_regs[SIM_BLOCK_REG_COUNT];
+    memcpy(layer_regs, regs, sizeof(layer_regs));
+    uint64_t desc_beats = sizeof(ConvLayerDescriptor) / (AXI_DATA_WIDTH / 8);
+    uint64_t previous = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        const ConvLayerDescriptor &desc = program[i];
+        layer_regs[CONV_INPUT_ADDR_REG / 4] = regs[CONV_INPUT_ADDR_REG / 4] + desc.input_addr;
+        layer_regs[CONV_OUTPUT_ADDR_REG / 4] = regs[CONV_OUTPUT_ADDR_REG / 4] + desc.output_addr;
+        layer_regs[CONV_WEIGHT_ADDR_REG / 4] = regs[CONV_WEIGHT_ADDR_REG / 4] + desc.weight_addr;
+        layer_regs[CONV_BIAS_ADDR_REG / 4] = regs[CONV_BIAS_ADDR_REG / 4] + desc.bias_addr;
+        layer_regs[CONV_PW_WEIGHT_ADDR_REG / 4] = regs[CONV_PW_WEIGHT_ADDR_REG / 4] + desc.pw_weight_addr;
+        layer_regs[CONV_PW_BIAS_ADDR_REG / 4] = regs[CONV_PW_BIAS_ADDR_REG / 4] + desc.pw_bias_addr;
+        layer_regs[CONV_CONFIG_REG / 4] = desc.config;
+        layer_regs[CONV_IN_HEIGHT_REG / 4] = desc.in_height;
+        layer_regs[CONV_IN_WIDTH_REG / 4] = desc.in_width;
+        layer_regs[CONV_IN_CHANNELS_REG / 4] = desc.in_channels;
+        layer_regs[CONV_OUT_CHANNELS_REG / 4] = desc.out_channels;
+        layer_regs[CONV_OUT_STRIDE_REG / 4] = desc.out_stride;
+        layer_regs[CONV_POOL_RECIP_REG / 4] = desc.pool_reciprocal;
+        layer_regs[CONV_BATCH_REG / 4] = desc.batch;
+
+        Cost layer;
+        if (!run_conv_layer(layer_regs, &layer)) return false;
+        if (i > 0 && (program[i - 1].config & CONV_CONFIG_PREFETCH)) {
+            uint64_t prefetch = desc_beats + SIM_AXI_READ_LATENCY + layer.preload +
+                                burst_latency(layer.preload, SIM_AXI_READ_LATENCY);
+            layer.read_beats -= layer.preload;
+            layer.read_stall -= burst_latency(layer.preload, SIM_AXI_READ_LATENCY);
+            layer.hidden_reads += desc_beats + layer.preload;
+            if (prefetch > previous) layer.read_stall += prefetch - previous;
+        } else {
+            layer.read_beats += desc_beats;
+            layer.read_stall += SIM_AXI_READ_LATENCY;
+        }
+        cost->busy += layer.busy;
+        cost->read_beats += layer.read_beats;
+        cost->read_stall += layer.read_stall;
+        cost->write_beats += layer.write_beats;
+        cost->write_stall += layer.write_stall;
+        cost->hidden_reads += layer.hidden_reads;
+        previous = layer.busy + layer.read_beats + layer.read_stall + layer.write_beats + layer.write_stall;
+    }
+    return true;
+}
+
+// Pointwise stages of the streaming pipeline over pixels output pixels:
+// per block of CONV_PW_PIXELS, output channel groups of CONV_PE_NUM stream
+// through the array with their weights reloaded a word per cycle,
+// CONV_SIMD_FACTOR input channels of one pixel per cycle over at least
+// SIM_PW_PIPELINE_DEPTH rows. The store packs a pixel of a group per cycle
+// and writes each finished pixel a word per cycle, or when pooling adds it
+// to the sums (at least GAP_MIN_WORDS cycles) and writes each of the
+// images' averages after its last pixel. A batch's pixels follow each
+// other, so blocks span images.
+static void pointwise_stages(uint64_t images, uint64_t pixels, uint64_t in_c, uint64_t out_c, bool pool,
+                             uint64_t *weights, uint64_t *compute, uint64_t *store) {
+    pixels *= images;
+    uint64_t groups = (out_c + CONV_PE_NUM - 1) / CONV_PE_NUM;
+    uint64_t steps = (in_c + CONV_SIMD_FACTOR - 1) / CONV_SIMD_FACTOR;
+    uint64_t blocks = (pixels + CONV_PW_PIXELS - 1) / CONV_PW_PIXELS;
+    *weights = blocks * groups * CONV_PE_NUM * steps * CONV_SIMD_FACTOR / AXI_WORD_BYTES;
+    *compute = 0;
+    for (uint64_t base = 0; base < pixels; base += CONV_PW_PIXELS) {
+        uint64_t rows = std::max<uint64_t>(std::min<uint64_t>(CONV_PW_PIXELS, pixels - base),
+                                           SIM_PW_PIPELINE_DEPTH);
+        *compute += groups * (steps * rows + SIM_PW_PIPELINE_DEPTH);
+    }
+    uint64_t words = out_c / AXI_WORD_BYTES;
+    *store = pixels * groups + pixels * (pool ? std::max<uint64_t>(words, SIM_GAP_MIN_WORDS) : words) +
+             (pool ? 2 * words * images : 0);
+}
+
+// The pointwise engine (1x1, stride 1): the bias once, then the input
+// streams in a word per cycle while the array works through the blocks.
+// The stages overlap, so the slowest sets the time, plus the first
+// block's read before the array can start.
+void FpgaSimulator::pointwise_cost(uint64_t images, uint64_t pixels, uint64_t in_c, uint64_t out_c, bool pool,
+                                   Cost *cost) {
+    uint64_t weights, compute, store;
+    pointwise_stages(images, pixels, in_c, out_c, pool, &weights, &compute, &store);
+    pixels *= images;
+    uint64_t blocks = (pixels + CONV_PW_PIXELS - 1) / CONV_PW_PIXELS;
+    uint64_t read = pixels * in_c / AXI_WORD_BYTES;
+    uint64_t bias_beats = out_c * sizeof(qint32_t) / AXI_WORD_BYTES;
+    uint64_t weight_beats = blocks * out_c * in_c / AXI_WORD_BYTES;
+
+    cost->read_beats = bias_beats + read + weight_beats;
+    cost->read_stall = burst_latency(bias_beats, SIM_AXI_READ_LATENCY);
+    cost->preload = bias_beats;
+    cost->write_beats = (pool ? images : pixels) * out_c / AXI_WORD_BYTES;
+    cost->busy = compute;
+
+    uint64_t fill = std::min<uint64_t>(CONV_PW_PIXELS, pixels) * in_c / AXI_WORD_BYTES;
+    uint64_t total = std::max(std::max(read, weights), std::max(compute, store)) + fill;
+    uint64_t accounted = compute + read + weight_beats + cost->write_beats;
+    if (total > accounted) cost->read_stall += total - accounted;
+}
+
+// The depthwise engine (3x3, stride 1 or 2): weights and bias once, then
+// the padded rows the windows cover stream through the line buffers. The
+// reader moves one word per cycle, padding included, the window stage
+// takes CONV_DW_LANES channels per cycle and the writer one word per
+// cycle; they overlap, so the slowest sets the time. A batch's images go
+// through one after the other behind the one preload.
+void FpgaSimulator::depthwise_cost(int images, int input_h, int input_w, int channels, int stride, int padding,
+                                   int output_h, int output_w, Cost *cost) {
+    uint64_t c = channels;
+    uint64_t weight_beats = run_words(0, c * 9) + c * sizeof(qint32_t) / AXI_WORD_BYTES;
+    cost->read_beats = weight_beats;
+    cost->read_stall = burst_latency(weight_beats, SIM_AXI_READ_LATENCY);
+    cost->preload = weight_beats;
+
+    int padded_h = (output_h - 1) * stride + 3;
+    int padded_w = (output_w - 1) * stride + 3;
+    uint64_t covered_h = std::min(padded_h - padding, input_h);
+    uint64_t covered_w = std::min(padded_w - padding, input_w);
+    uint64_t input_beats = images * covered_h * covered_w * c / AXI_WORD_BYTES;
+
+    uint64_t read = (uint64_t)images * padded_h * padded_w * c / AXI_WORD_BYTES;
+    uint64_t compute = (uint64_t)images * padded_h * padded_w * c / CONV_DW_LANES;
+    uint64_t write = (uint64_t)images * output_h * output_w * c / AXI_WORD_BYTES;
+    cost->busy = compute;
+    cost->read_beats += input_beats;
+    cost->write_beats = write;
+
+    uint64_t total = std::max(std::max(read, compute), write) + SIM_CONV_PIPELINE_DEPTH;
+    uint64_t accounted = compute + input_beats + write;
+    if (total > accounted) cost->read_stall += total - accounted;
+}
+
+// A separable block on the streaming pipeline: depthwise weights and both
+// biases once for the batch, then the depthwise stages as in depthwise_cost feed the
+// pointwise ones as in pointwise_cost. The intermediate map never leaves
+// the chip, so the only feature map traffic is the block's input and
+// output.
+void FpgaSimulator::separable_cost(int images, int input_h, int input_w, int channels, int output_c, int stride,
+                                   int padding, int output_h, int output_w, bool pool, Cost *cost) {
+    uint64_t c = channels;
+    uint64_t out_c = output_c;
+    uint64_t preload = run_words(0, c * 9) + (c + out_c) * sizeof(qint32_t) / AXI_WORD_BYTES;
+    cost->read_beats = preload;
+    cost->read_stall = burst_latency(preload, SIM_AXI_READ_LATENCY);
+    cost->preload = preload;
+
+    int padded_h = (output_h - 1) * stride + 3;
+    int padded_w = (output_w - 1) * stride + 3;
+    uint64_t covered_h = std::min(padded_h - padding, input_h);
+    uint64_t covered_w = std::min(padded_w - padding, input_w);
+    uint64_t input_beats = images * covered_h * covered_w * c / AXI_WORD_BYTES;
+
+    uint64_t pixels = (uint64_t)images * output_h * output_w;
+    uint64_t blocks = (pixels + CONV_PW_PIXELS - 1) / CONV_PW_PIXELS;
+    uint64_t read = (uint64_t)images * padded_h * padded_w * c / AXI_WORD_BYTES;
+    uint64_t window = (uint64_t)images * padded_h * padded_w * c / CONV_DW_LANES;
+    uint64_t weight_beats = blocks * out_c * c / AXI_WORD_BYTES;
+    uint64_t weights, compute, store;
+    pointwise_stages(images, (uint64_t)output_h * output_w, c, out_c, pool, &weights, &compute, &store);
+
+    cost->busy = std::max(window, compute);
+    cost->read_beats += input_beats + weight_beats;
+    cost->write_beats = (pool ? images : pixels) * out_c / AXI_WORD_BYTES;
+
+    // The first block needs its share of the input read before the array
+    // starts
+    uint64_t fill = read * std::min<uint64_t>(CONV_PW_PIXELS, pixels) / pixels + SIM_CONV_PIPELINE_DEPTH;
+    uint64_t total = std::max(std::max(read, window), std::max(std::max(weights, compute), store)) + fill;
+    uint64_t accounted = cost->busy + input_beats + weight_beats + cost->write_beats;
+    if (total > accounted) cost->read_stall += total - accounted;
+}
+
+bool FpgaSimulator::run_conv_layer(const uint32_t *regs, Cost *cost) {
+    uint32_t config = regs[CONV_CONFIG_REG / 4];
+    int kernel_size = (config >> 24) & 0xFF;
+    int stride = (config >> 16) & 0xFF;
+    int padding = (config >> 8) & 0xFF;
+    int mode = (config >> 4) & 3;
+    bool use_relu = config & 1;
+    bool mid_relu = (config & CONV_CONFIG_MID_RELU) != 0;
+    bool use_relu6 = (config & CONV_CONFIG_RELU6) != 0;
+    bool mid_relu6 = (config & CONV_CONFIG_MID_RELU6) != 0;
+    bool pool = (config & CONV_CONFIG_POOL) != 0;
+
+    int input_h = regs[CONV_IN_HEIGHT_REG / 4];
+    int input_w = regs[CONV_IN_WIDTH_REG / 4];
+    int input_c = regs[CONV_IN_CHANNELS_REG / 4];
+    int output_c = regs[CONV_OUT_CHANNELS_REG / 4];
+    int output_stride = regs[CONV_OUT_STRIDE_REG / 4] ? regs[CONV_OUT_STRIDE_REG / 4] : output_c;
+    int images = regs[CONV_BATCH_REG / 4] ? regs[CONV_BATCH_REG / 4] : 1;
+    if (stride == 0 || kernel_size == 0 || output_stride < output_c) return false;
+    if (mode == CONV_MODE_DEPTHWISE && (output_c != input_c || output_stride != output_c)) return false;
+    if (mode == CONV_MODE_POINTWISE && kernel_size != 1) return false;
+    bool separable = mode == CONV_MODE_SEPARABLE;
+    if (separable && !CONV_SEPARABLE_FITS(input_w, input_c, kernel_size, stride, padding)) return false;
+    if (output_c % AXI_WORD_BYTES || output_stride % AXI_WORD_BYTES) return false;
+    int kernel_channels = (mode == CONV_MODE_DEPTHWISE || separable) ? input_c : output_c;
+    int weights_per_output = (mode == CONV_MODE_DEPTHWISE || separable) ? 1 : input_c;
+
+    int output_h = (input_h + 2 * padding - kernel_size) / stride + 1;
+    int output_w = (input_w + 2 * padding - kernel_size) / stride + 1;
+
+    // A batch's maps follow each other, input and output
+    size_t input_size = (size_t)input_h * input_w * input_c;
+    size_t weight_size = (size_t)kernel_channels * weights_per_output * kernel_size * kernel_size;
+    size_t pixels = (size_t)output_h * output_w;
+    size_t output_size = pool ? (size_t)images * output_c : (images * pixels - 1) * output_stride + output_c;
+
+    // Only the streaming pipeline pools; the core would do nothing
+    bool streamed_pointwise = mode == CONV_MODE_POINTWISE && stride == 1 && padding == 0 &&
+                              input_c % AXI_WORD_BYTES == 0;
+    if (pool && ((!separable && !streamed_pointwise) || output_stride != output_c)) return false;
+
+    const qint8_t *input = (const qint8_t*)memory.phys_to_virt(regs[CONV_INPUT_ADDR_REG / 4],
+                                                               images * input_size);
+    const qint8_t *weights = (const qint8_t*)memory.phys_to_virt(regs[CONV_WEIGHT_ADDR_REG / 4], weight_size);
+    const qint32_t *bias = (const qint32_t*)memory.phys_to_virt(regs[CONV_BIAS_ADDR_REG / 4],
+                                                                kernel_channels * sizeof(qint32_t));
+    qint8_t *output = (qint8_t*)memory.phys_to_virt(regs[CONV_OUTPUT_ADDR_REG / 4], output_size);
+
+    // A real accelerator would fault on the bus; report it instead
+    if (!input || !weights || !bias || !output) {
+        std::cerr << "Simulator: conv buffer outside the DMA pool" << std::endl;
+        return false;
+    }
+    if (!word_aligned(regs[CONV_INPUT_ADDR_REG / 4]) || !word_aligned(regs[CONV_WEIGHT_ADDR_REG / 4]) ||
+        !word_aligned(regs[CONV_BIAS_ADDR_REG / 4]) || !word_aligned(regs[CONV_OUTPUT_ADDR_REG / 4]) ||
+        (separable && (!word_aligned(regs[CONV_PW_WEIGHT_ADDR_REG / 4]) ||
+                       !word_aligned(regs[CONV_PW_BIAS_ADDR_REG / 4])))) {
+        std::cerr << "Simulator: conv buffer not word aligned" << std::endl;
+        return false;
+    }
+
+    // A pooled layer's map only exists on chip
+    std::vector<qint8_t> map;
+    qint8_t *pooled = output;
+    if (pool) {
+        map.resize(images * pixels * output_c);
+        output = map.data();
+    }
+
+    if (separable) {
+        const qint8_t *pw_weights = (const qint8_t*)memory.phys_to_virt(
+            regs[CONV_PW_WEIGHT_ADDR_REG / 4], (size_t)output_c * input_c);
+        const qint32_t *pw_bias = (const qint32_t*)memory.phys_to_virt(
+            regs[CONV_PW_BIAS_ADDR_REG / 4], output_c * sizeof(qint32_t));
+        if (!pw_weights || !pw_bias) {
+            std::cerr << "Simulator: conv buffer outside the DMA pool" << std::endl;
+            return false;
+        }
+        // The intermediate map, which the hardware keeps in its FIFOs
+        std::vector<qint8_t> mid(pixels * input_c);
+        for (int n = 0; n < images; n++) {
+            CPUConvolution::depthwise_conv2d(input + n * input_size, weights, bias, mid.data(), input_h,
+                                             input_w, input_c, kernel_size, stride, padding);
+            if (mid_relu) {
+                CPUConvolution::relu(mid.data(), (int)mid.size());
+            }
+            if (mid_relu6) {
+                CPUConvolution::relu6(mid.data(), (int)mid.size());
+            }
+            CPUConvolution::conv2d_channels(mid.data(), pw_weights, pw_bias, output + n * pixels * output_stride,
+                                            output_h, output_w, input_c, 1, 1, 0, 0, output_c, output_stride);
+        }
+    } else if (mode == CONV_MODE_DEPTHWISE) {
+        for (int n = 0; n < images; n++) {
+            CPUConvolution::depthwise_conv2d(input + n * input_size, weights, bias, output + n * pixels * output_c,
+                                             input_h, input_w, input_c, kernel_size, stride, padding);
+        }
+    } else {
+        for (int n = 0; n < images; n++) {
+            CPUConvolution::conv2d_channels(input + n * input_size, weights, bias, output + n * pixels * output_stride,
+                                            input_h, input_w, input_c, kernel_size, stride, padding, 0,
+                                            output_c, output_stride);
+        }
+    }
+    if (use_relu) {
+        for (size_t p = 0; p < images * pixels; p++) {
+            CPUConvolution::relu(output + p * output_stride, output_c);
+        }
+    }
+    if (use_relu6) {
+        for (size_t p = 0; p < images * pixels; p++) {
+            CPUConvolution::relu6(output + p * output_stride, output_c);
+        }
+    }
+    if (pool) {
+        for (int n = 0; n < images; n++) {
+            reciprocal_pool(output + n * pixels * output_c, pooled + n * output_c, pixels, output_c,
+                            regs[CONV_POOL_RECIP_REG / 4]);
+        }
+    }
+
+    if (separable) {
+        separable_cost(images, input_h, input_w, input_c, output_c, stride, padding, output_h, output_w, pool,
+                       cost);
+        return true;
+    }
+    if (streamed_pointwise) {
+        pointwise_cost(images, pixels, input_c, output_c, pool, cost);
+        return true;
+    }
+
+    int padded_w = (output_w - 1) * stride + 3;
+    if (mode == CONV_MODE_DEPTHWISE && kernel_size == 3 && (stride == 1 || stride == 2) &&
+        input_c % AXI_WORD_BYTES == 0 && padded_w * input_c <= CONV_DW_LINE_LENGTH) {
+        depthwise_cost(images, input_h, input_w, input_c, stride, padding, output_h, output_w, cost);
+        return true;
+    }
+
+    // The tiled engine works in TILE_HEIGHT x TILE_WIDTH x TILE_CHANNELS
+    // output tiles. Per tile step the load stage clears the input window a
+    // pixel per cycle, unpacks its in-image part and the weight tile an
+    // element per cycle, the compute stage runs one tap per cycle across
+    // all output lanes and the store stage writes each output tile a word
+    // per cycle. The stages overlap, so the layer takes its slowest stage
+    // plus one step to fill the pipeline and one to drain it. A batch runs
+    // each tile step once per image; with one input group the images share
+    // the step's weight tile.
+    bool depthwise = mode == CONV_MODE_DEPTHWISE;
+    uint64_t k = kernel_size;
+    uint64_t taps = k * k;
+    uint64_t in_c = input_c;
+    uint64_t out_c = output_c;
+    uint64_t tile_pixels = TILE_HEIGHT * TILE_WIDTH;
+    uint64_t rows = (output_h + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    uint64_t cols = (output_w + TILE_WIDTH - 1) / TILE_WIDTH;
+    uint64_t out_groups = (out_c + TILE_CHANNELS - 1) / TILE_CHANNELS;
+    uint64_t in_groups = depthwise ? 1 : (in_c + TILE_CHANNELS - 1) / TILE_CHANNELS;
+    uint64_t in_tile_h = (TILE_HEIGHT - 1) * stride + k;
+    uint64_t in_tile_w = (TILE_WIDTH - 1) * stride + k;
+    uint64_t output_tiles = rows * cols * out_groups;
+    uint64_t steps = output_tiles * in_groups;
+    uint64_t weight_loads = in_groups == 1 ? steps : steps * images;
+
+    // Words actually moved: the in-image part of every input window as one
+    // run per tile row when a group holds every input channel, else one
+    // per pixel; each output channel's kernel slice per step; the bias once
+    uint64_t input_elements = 0, input_beats = 0, weight_beats = 0;
+    for (uint64_t tr = 0; tr < rows; tr++) {
+        int64_t top = (int64_t)(tr * TILE_HEIGHT * stride) - padding;
+        for (uint64_t tc = 0; tc < cols; tc++) {
+            int64_t left = (int64_t)(tc * TILE_WIDTH * stride) - padding;
+            int64_t first_col = std::max<int64_t>(left, 0);
+            int64_t valid_cols = std::min<int64_t>(left + in_tile_w, input_w) - first_col;
+            for (uint64_t og = 0; og < out_groups; og++) {
+                for (int n = 0; n < images; n++) {
+                    for (uint64_t ig = 0; ig < in_groups; ig++) {
+                        uint64_t ic_base = (depthwise ? og : ig) * TILE_CHANNELS;
+                        uint64_t group_channels = std::min<uint64_t>(in_c - ic_base, TILE_CHANNELS);
+                        for (int64_t ih = std::max<int64_t>(top, 0);
+                             valid_cols > 0 && ih < std::min<int64_t>(top + in_tile_h, input_h); ih++) {
+                            uint64_t row = n * input_size + ((uint64_t)ih * input_w + first_col) * in_c + ic_base;
+                            if (group_channels == in_c) {
+                                input_beats += run_words(row, valid_cols * in_c);
+                            } else {
+                                for (int64_t c = 0; c < valid_cols; c++) {
+                                    input_beats += run_words(row + c * in_c, group_channels);
+                                }
+                            }
+                            input_elements += valid_cols * group_channels;
+                        }
+                        if (n > 0 && in_groups == 1) continue;
+                        uint64_t kernel_length = (depthwise ? 1 : group_channels) * taps;
+                        uint64_t last = std::min<uint64_t>(out_c, (og + 1) * TILE_CHANNELS);
+                        for (uint64_t o = og * TILE_CHANNELS; o < last; o++) {
+                            uint64_t first = depthwise ? o * taps : (o * in_c + ic_base) * taps;
+                            weight_beats += run_words(first, kernel_length);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    uint64_t bias_beats = out_c * sizeof(qint32_t) / AXI_WORD_BYTES;
+
+    uint64_t step_weights = TILE_CHANNELS * (depthwise ? 1 : TILE_CHANNELS) * taps;
+    uint64_t step_load = in_tile_h * in_tile_w * (1 + TILE_CHANNELS) + step_weights;
+    uint64_t load = steps * images * in_tile_h * in_tile_w + weight_loads * step_weights + input_elements;
+    uint64_t compute = images * output_tiles * tile_pixels *
+                       ((depthwise ? 1 : in_c) * taps + in_groups * SIM_CONV_PIPELINE_DEPTH);
+    uint64_t tile_store = tile_pixels * TILE_CHANNELS / AXI_WORD_BYTES;
+    uint64_t store = bias_beats + images * output_tiles * tile_store;
+
+    cost->read_beats = input_beats + weight_beats + bias_beats;
+    cost->write_beats = images * pixels * out_c / AXI_WORD_BYTES;
+    cost->busy = compute;
+
+    // Whatever the overlapped load and store stages add on top of compute
+    // counts as read stall
+    uint64_t total = std::max(std::max(load, compute), store) + step_load + tile_store;
+    uint64_t accounted = cost->busy + cost->read_beats + cost->write_beats;
+    cost->read_stall = total > accounted ? total - accounted : 0;
+    return true;
+}
+
+bool FpgaSimulator::run_activation(const uint32_t *regs, Cost *cost) {
+    int size = regs[ACT_SIZE_REG / 4];
+    uint32_t act_type = regs[ACT_TYPE_REG / 4];
+
+    const qint8_t *input = (const qint8_t*)memory.phys_to_virt(regs[ACT_INPUT_ADDR_REG / 4], size);
+    qint8_t *output = (qint8_t*)memory.phys_to_virt(regs[ACT_OUTPUT_ADDR_REG / 4], size);
+    if (!input || !output || size <= 0) {
+        std::cerr << "Simulator: activation buffer outside the DMA pool" << std::endl;
+        return false;
+    }
+    if (!word_aligned(regs[ACT_INPUT_ADDR_REG / 4]) || !word_aligned(regs[ACT_OUTPUT_ADDR_REG / 4])) {
+        std::cerr << "Simulator: activation buffer not word aligned" << std::endl;
+        return false;
+    }
+
+    // The core streams word by word, so in place is fine
+    memmove(output, input, size);
+    if (act_type == ACT_TYPE_RELU6) {
+        CPUConvolution::relu6(output, size);
+    } else {
+        CPUConvolution::relu(output, size);
+    }
+
+    // One pipelined pass of a word per cycle with sequential bursts both
+    // ways
+    uint64_t words = run_words(0, size);
+    cost->busy = words;
+    cost->read_beats = words;
+    cost->read_stall = burst_latency(words, SIM_AXI_READ_LATENCY);
+    cost->write_beats = words;
+    cost->write_stall = burst_latency(words, SIM_AXI_WRITE_LATENCY);
+    return true;
+}
+
+bool FpgaSimulator::run_pooling(const uint32_t *regs, Cost *cost) {
+    uint32_t config = regs[POOL_CONFIG_REG / 4];
+    int pool_size = (config >> 24) & 0xFF;
+    int stride = (config >> 16) & 0xFF;
+    int padding = (config >> 8) & 0xFF;
+    int pool_type = config & 3;
+
+    int input_h = regs[POOL_IN_HEIGHT_REG / 4];
+    int input_w = regs[POOL_IN_WIDTH_REG / 4];
+    int channels = regs[POOL_CHANNELS_REG / 4];
+    if (channels % AXI_WORD_BYTES) return false;
+
+    int output_h = 1;
+    int output_w = 1;
+    if (pool_type != POOL_TYPE_GLOBAL_AVG) {
+        if (stride == 0 || pool_size == 0) return false;
+        output_h = (input_h + 2 * padding - pool_size) / stride + 1;
+        output_w = (input_w + 2 * padding - pool_size) / stride + 1;
+    }
+
+    size_t input_size = (size_t)input_h * input_w * channels;
+    size_t output_size = (size_t)output_h * output_w * channels;
+    const qint8_t *input = (const qint8_t*)memory.phys_to_virt(regs[POOL_INPUT_ADDR_REG / 4], input_size);
+    qint8_t *output = (qint8_t*)memory.phys_to_virt(regs[POOL_OUTPUT_ADDR_REG / 4], output_size);
+    if (!input || !output) {
+        std::cerr << "Simulator: pooling buffer outside the DMA pool" << std::endl;
+        return false;
+    }
+    if (!word_aligned(regs[POOL_INPUT_ADDR_REG / 4]) || !word_aligned(regs[POOL_OUTPUT_ADDR_REG / 4])) {
+        std::cerr << "Simulator: pooling buffer not word aligned" << std::endl;
+        return false;
+    }
+    uint64_t words = channels / AXI_WORD_BYTES;
+
+    if (pool_type == POOL_TYPE_GLOBAL_AVG) {
+        size_t spatial = (size_t)input_h * input_w;
+        reciprocal_pool(input, output, spatial, channels, regs[POOL_RECIP_REG / 4]);
+
+        // One sequential pass of a word per cycle (at least GAP_MIN_WORDS
+        // per pixel) into the sums, which are cleared first and scaled and
+        // written a word per cycle at the end
+        uint64_t beats = input_size / AXI_WORD_BYTES;
+        cost->busy = spatial * std::max<uint64_t>(words, SIM_GAP_MIN_WORDS) + 2 * words;
+        cost->read_beats = beats;
+        cost->read_stall = burst_latency(beats, SIM_AXI_READ_LATENCY);
+        cost->write_beats = words;
+        cost->write_stall = burst_latency(words, SIM_AXI_WRITE_LATENCY);
+        return true;
+    }
+
+    for (int oh = 0; oh < output_h; oh++) {
+        for (int ow = 0; ow < output_w; ow++) {
+            int taps = 0;
+            for (int c = 0; c < channels; c++) {
+                int32_t acc = (pool_type == POOL_TYPE_MAX) ? -128 : 0;
+                taps = 0;
+                for (int ph = 0; ph < pool_size; ph++) {
+                    for (int pw = 0; pw < pool_size; pw++) {
+                        int ih = oh * stride + ph - padding;
+                        int iw = ow * stride + pw - padding;
+                        if (ih < 0 || ih >= input_h || iw < 0 || iw >= input_w) continue;
+                        qint8_t v = input[((size_t)ih * input_w + iw) * channels + c];
+                        if (pool_type == POOL_TYPE_MAX) {
+                            if (v > acc) acc = v;
+                        } else {
+                            acc += v;
+                        }
+                        taps++;
+                    }
+                }
+                if (pool_type != POOL_TYPE_MAX) {
+                    acc /= pool_size * pool_size;
+                }
+                output[((size_t)oh * output_w + ow) * channels + c] = (qint8_t)acc;
+            }
+
+            // One burst of the pixel's words per in-bounds tap, II=1 per
+            // output word, one write burst per pixel
+            cost->read_beats += (uint64_t)taps * words;
+            cost->read_stall += (uint64_t)taps * SIM_AXI_READ_LATENCY;
+        }
+    }
+    uint64_t pixels = (uint64_t)output_h * output_w;
+    cost->busy = pixels * words;
+    cost->write_beats = pixels * words;
+    cost->write_stall = pixels * SIM_AXI_WRITE_LATENCY;
+    return true;
+}
+
+bool FpgaSimulator::run_classifier(const uint32_t *regs, Cost *cost) {
+    int inputs = regs[CLS_INPUTS_REG / 4];
+    int classes = regs[CLS_CLASSES_REG / 4];
+    int top_k = regs[CLS_TOP_K_REG / 4];
+    if (inputs <= 0 || inputs % AXI_WORD_BYTES || inputs > CLASSIFIER_MAX_INPUTS ||
+        classes <= 0 || classes > CLASSIFIER_MAX_CLASSES ||
+        top_k < 1 || top_k > CLASSIFIER_MAX_TOP_K || top_k > classes) {
+        return false;
+    }
+
+    size_t kernel_size = (size_t)inputs * classes;
+    const qint8_t *input = (const qint8_t*)memory.phys_to_virt(regs[CLS_INPUT_ADDR_REG / 4], inputs);
+    const qint8_t *weights = (const qint8_t*)memory.phys_to_virt(regs[CLS_WEIGHT_ADDR_REG / 4], kernel_size);
+    const qint32_t *bias = (const qint32_t*)memory.phys_to_virt(regs[CLS_BIAS_ADDR_REG / 4],
+                                                                classes * sizeof(qint32_t));
+    ClassifierOutput *output = (ClassifierOutput*)memory.phys_to_virt(regs[CLS_OUTPUT_ADDR_REG / 4],
+                                                                      sizeof(ClassifierOutput));
+    if (!input || !weights || !bias || !output) {
+        std::cerr << "Simulator: classifier buffer outside the DMA pool" << std::endl;
+        return false;
+    }
+    if (!word_aligned(regs[CLS_INPUT_ADDR_REG / 4]) || !word_aligned(regs[CLS_WEIGHT_ADDR_REG / 4]) ||
+        !word_aligned(regs[CLS_BIAS_ADDR_REG / 4]) || !word_aligned(regs[CLS_OUTPUT_ADDR_REG / 4])) {
+        std::cerr << "Simulator: classifier buffer not word aligned" << std::endl;
+        return false;
+    }
+
+    std::vector<qint8_t> logits(classes);
+    CPUConvolution::fully_connected(input, weights, bias, logits.data(), inputs, classes);
+
+    // Ranked as the core inserts them: a class only passes strictly
+    // smaller logits, so ties stay in class order
+    uint64_t histogram[256] = {0};
+    int ranked = 0;
+    int best_classes[CLASSIFIER_MAX_TOP_K];
+    for (int o = 0; o < classes; o++) {
+        histogram[logits[o] + 128]++;
+        int slot = ranked;
+        while (slot > 0 && logits[o] > logits[best_classes[slot - 1]]) slot--;
+        if (slot >= top_k) continue;
+        for (int j = std::min(ranked, top_k - 1); j > slot; j--) {
+            best_classes[j] = best_classes[j - 1];
+        }
+        best_classes[slot] = o;
+        ranked = std::min(ranked + 1, top_k);
+    }
+
+    static const uint32_t exp_table[CLASSIFIER_EXP_TERMS] = CLASSIFIER_EXP_TABLE;
+    int best = logits[best_classes[0]];
+    uint64_t exp_sum = 0;
+    for (int d = 0; d < CLASSIFIER_EXP_TERMS && best - d >= -128; d++) {
+        exp_sum += histogram[best - d + 128] * exp_table[d];
+    }
+
+    ClassifierOutput result;
+    memset(&result, 0, sizeof(result));
+    result.exp_sum_low = (uint32_t)exp_sum;
+    result.exp_sum_high = (uint32_t)(exp_sum >> 32);
+    for (int j = 0; j < top_k; j++) {
+        result.top[j] = CLASSIFIER_ENTRY(best_classes[j], logits[best_classes[j]]);
+    }
+    memcpy(output, &result, sizeof(result));
+
+    // Features and biases are loaded first; then a word of weights per
+    // cycle (at least SIM_CLS_MIN_WORDS per class) as one sequential
+    // burst, the histogram clear before and the exp sum after it
+    uint64_t words = inputs / AXI_WORD_BYTES;
+    uint64_t bias_beats = run_words(0, (uint64_t)classes * sizeof(qint32_t));
+    uint64_t weight_beats = (uint64_t)classes * words;
+    uint64_t out_words = run_words(0, (2 + top_k) * sizeof(uint32_t));
+    cost->busy = 256 + (uint64_t)classes * std::max<uint64_t>(words, SIM_CLS_MIN_WORDS) +
+                 CLASSIFIER_EXP_TERMS;
+    cost->read_beats = words + bias_beats + weight_beats;
+    cost->read_stall = burst_latency(words, SIM_AXI_READ_LATENCY) +
+                       burst_latency(bias_beats, SIM_AXI_READ_LATENCY) +
+                       burst_latency(weight_beats, SIM_AXI_READ_LATENCY);
+    cost->write_beats = out_words;
+    cost->write_stall = burst_latency(out_words, SIM_AXI_WRITE_LATENCY);
+    return true;
+}
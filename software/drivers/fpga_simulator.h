@@ -0,0 +1,137 @@
+#ifndef FPGA_SIMULATOR_H
+#define FPGA_SIMULATOR_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../../models/configs/mobilenet_config.h"
+#include "axi_dma.h"
+#include "dma_allocator.h"
+#include "irq_line.h"
+
+// Size of each simulated register block in 32-bit registers
+#define SIM_BLOCK_REG_COUNT 64
+
+// Blocks modelled, in address order from FPGA_BASE_ADDR: conv, activation,
+// pooling, classifier
+#define SIM_BLOCK_COUNT 4
+
+// AXI DMA registers modelled, up to S2MM_TAILDESC_MSB
+#define SIM_DMA_REG_COUNT 18
+
+// Descriptors one chain may hold before the model treats it as unterminated
+#define SIM_DMA_MAX_DESCRIPTORS 65536
+
+// Bus latency per burst assumed by the performance counter model (HP port
+// behind the SmartConnect)
+#define SIM_AXI_READ_LATENCY 40
+#define SIM_AXI_WRITE_LATENCY 12
+
+// Pipeline depth of the conv engine's reduce loop, paid once per output
+// pixel and input tile
+#define SIM_CONV_PIPELINE_DEPTH 6
+
+// Depth of the pointwise array's multiply-add pipeline
+#define SIM_PW_PIPELINE_DEPTH 8
+
+// Cycles per pixel a pooled sum bank needs between updates (GAP_MIN_WORDS)
+#define SIM_GAP_MIN_WORDS 4
+
+// Cycles per class the classifier's MAC loop takes at least (CLS_MIN_WORDS)
+#define SIM_CLS_MIN_WORDS 4
+
+// Register-level model of the accelerators for testing without a board.
+// CNNFPGADriver routes its register accesses here (by bus address) instead
+// of /dev/mem. Each block has its own worker thread: setting START hands
+// the operation to it, it runs with the CPU reference kernels on the DMA
+// pool (translated from bus addresses), then raises DONE and, if enabled,
+// the block's interrupt line - so blocks run concurrently and the driver
+// sees the same asynchronous completion as on hardware. The performance
+// counters advance by what the HLS kernel's loop structure would take.
+// The AXI DMA is modelled too: once both channels have a tail descriptor,
+// its own worker walks the MM2S chain, streams the bytes into the S2MM
+// chain, writes back descriptor status and raises the S2MM interrupt.
+class FpgaSimulator {
+private:
+    // Cycles one operation takes, by phase
+    struct Cost {
+        uint64_t busy;
+        uint64_t read_beats;
+        uint64_t read_stall;
+        uint64_t write_beats;
+        uint64_t write_stall;
+        uint64_t preload;           // Of read_beats: a streamed conv layer's kernels and
+                                    // biases, loaded before its stream in one burst each
+        uint64_t hidden_reads;      // Beats read alongside other work: counted, not timed
+
+        Cost() : busy(0), read_beats(0), read_stall(0), write_beats(0), write_stall(0),
+                 preload(0), hidden_reads(0) {}
+    };
+
+    struct Block {
+        uint32_t regs[SIM_BLOCK_REG_COUNT];
+        std::atomic<uint32_t> status;
+        std::atomic<uint32_t> irq_status;
+        std::atomic<uint32_t> perf_total_cycles;
+        std::atomic<uint32_t> perf_busy_cycles;
+        std::atomic<uint32_t> perf_read_beats;
+        std::atomic<uint32_t> perf_write_beats;
+        std::atomic<uint32_t> perf_read_stall;
+        std::atomic<uint32_t> perf_write_stall;
+        IrqLine *irq;
+        std::thread worker;
+        bool start_pending;
+    };
+
+    struct DmaEngine {
+        uint32_t regs[SIM_DMA_REG_COUNT];
+        uint32_t tails_pending;         // Channels given a tail since the last transfer
+        IrqLine *irq;                   // S2MM completion
+        std::thread worker;
+        bool start_pending;
+        std::vector<uint8_t> stream;    // The looped-back AXI-Stream packet
+    };
+
+    DmaAllocator &memory;
+    Block blocks[SIM_BLOCK_COUNT];
+    DmaEngine dma;
+    std::mutex sim_mutex;
+    std::condition_variable sim_cv;
+    bool stopping;
+
+    // Block index and register offset of a bus address; false outside every block
+    bool decode(uint32_t addr, int *block, uint32_t *offset);
+
+    void worker_loop(int block);
+    bool run_conv(const uint32_t *regs, Cost *cost);
+    bool run_conv_layer(const uint32_t *regs, Cost *cost);
+    static void pointwise_cost(uint64_t images, uint64_t pixels, uint64_t in_c, uint64_t out_c, bool pool,
+                               Cost *cost);
+    static void depthwise_cost(int images, int input_h, int input_w, int channels, int stride, int padding,
+                               int output_h, int output_w, Cost *cost);
+    static void separable_cost(int images, int input_h, int input_w, int channels, int output_c, int stride,
+                               int padding, int output_h, int output_w, bool pool, Cost *cost);
+    bool run_activation(const uint32_t *regs, Cost *cost);
+    bool run_pooling(const uint32_t *regs, Cost *cost);
+    bool run_classifier(const uint32_t *regs, Cost *cost);
+
+    void dma_write_reg(uint32_t offset, uint32_t value);    // sim_mutex held
+    void dma_loop();
+    uint32_t run_dma(const uint32_t *regs);                 // Returns DMASR error bits
+
+public:
+    explicit FpgaSimulator(DmaAllocator &mem);
+    ~FpgaSimulator();
+
+    // Interrupt line raised by the block at block_base; attach before
+    // starting anything on it
+    void attach_irq(uint32_t block_base, IrqLine *line);
+
+    void write_reg(uint32_t addr, uint32_t value);
+    uint32_t read_reg(uint32_t addr);
+};
+
+#endif // FPGA_SIMULATOR_H
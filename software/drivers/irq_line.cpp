@@ -0,0 +1,123 @@
+#include "irq_line.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+IrqLine::IrqLine() : irq_fd(-1), is_uio(false) {
+}
+
+IrqLine::~IrqLine() {
+    close_line();
+}
+
+bool IrqLine::open_uio(const char *name) {
+    // UIO numbering depends on probe order, so look the device up by the
+    // name given in the device tree
+    DIR *dir = opendir("/sys/class/uio");
+    if (!dir) {
+        std::cerr << "No UIO devices (is uio_pdrv_genirq loaded?)" << std::endl;
+        return false;
+    }
+
+    std::string device;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strncmp(entry->d_name, "uio", 3) != 0) continue;
+
+        std::ifstream name_file(std::string("/sys/class/uio/") + entry->d_name + "/name");
+        std::string uio_name;
+        if (std::getline(name_file, uio_name) && uio_name == name) {
+            device = std::string("/dev/") + entry->d_name;
+            break;
+        }
+    }
+    closedir(dir);
+
+    if (device.empty()) {
+        std::cerr << "No UIO device named " << name << std::endl;
+        return false;
+    }
+
+    irq_fd = open(device.c_str(), O_RDWR | O_CLOEXEC);
+    if (irq_fd < 0) {
+        std::cerr << "Failed to open " << device << std::endl;
+        return false;
+    }
+    is_uio = true;
+    return true;
+}
+
+bool IrqLine::open_eventfd() {
+    irq_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (irq_fd < 0) {
+        std::cerr << "Failed to create interrupt eventfd" << std::endl;
+        return false;
+    }
+    is_uio = false;
+    return true;
+}
+
+void IrqLine::close_line() {
+    if (irq_fd >= 0) {
+        close(irq_fd);
+        irq_fd = -1;
+    }
+}
+
+bool IrqLine::arm() {
+    if (irq_fd < 0) return false;
+
+    if (is_uio) {
+        // Drain a stale count without blocking, then unmask
+        struct pollfd pfd = { irq_fd, POLLIN, 0 };
+        uint32_t count;
+        if (poll(&pfd, 1, 0) > 0 && read(irq_fd, &count, sizeof(count)) < 0) {
+            return false;
+        }
+        uint32_t enable = 1;
+        return write(irq_fd, &enable, sizeof(enable)) == sizeof(enable);
+    }
+
+    uint64_t count;
+    while (read(irq_fd, &count, sizeof(count)) == sizeof(count)) {
+    }
+    return true;
+}
+
+bool IrqLine::wait(int timeout_ms) {
+    if (irq_fd < 0) return false;
+
+    struct pollfd pfd = { irq_fd, POLLIN, 0 };
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret <= 0) {
+        return false;
+    }
+
+    // Consume the event: UIO hands out a 32-bit count, eventfd a 64-bit one
+    if (is_uio) {
+        uint32_t count;
+        return read(irq_fd, &count, sizeof(count)) == sizeof(count);
+    }
+    uint64_t count;
+    return read(irq_fd, &count, sizeof(count)) == sizeof(count);
+}
+
+void IrqLine::signal() {
+    if (irq_fd < 0 || is_uio) return;
+
+    uint64_t one = 1;
+    if (write(irq_fd, &one, sizeof(one)) != sizeof(one)) {
+        std::cerr << "Failed to signal interrupt eventfd" << std::endl;
+    }
+}
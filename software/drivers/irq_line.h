@@ -0,0 +1,41 @@
+#ifndef IRQ_LINE_H
+#define IRQ_LINE_H
+
+#include <stdint.h>
+
+// One accelerator interrupt as a pollable file descriptor. On the board
+// this is a UIO device (uio_pdrv_genirq): every read() returns the running
+// interrupt count and the kernel masks the line until user space writes 1
+// back. On a host it is an eventfd that the simulator signals.
+class IrqLine {
+private:
+    int irq_fd;
+    bool is_uio;
+
+public:
+    IrqLine();
+    ~IrqLine();
+
+    // Board: the /dev/uioN whose sysfs name matches
+    bool open_uio(const char *name);
+
+    // Host: eventfd stand-in
+    bool open_eventfd();
+
+    void close_line();
+    bool is_open() const { return irq_fd >= 0; }
+    int fd() const { return irq_fd; }
+
+    // Unmask the line (UIO) and discard any event already pending, so the
+    // next wait() only returns for an interrupt raised after this call
+    bool arm();
+
+    // Block until the interrupt fires or timeout_ms passes. Returns false
+    // on timeout or error.
+    bool wait(int timeout_ms);
+
+    // Raise the interrupt (eventfd only; used by the simulator)
+    void signal();
+};
+
+#endif // IRQ_LINE_H
@@ -0,0 +1,69 @@
+#include "perf_profile.h"
+#include <cstdio>
+
+void PerfProfile::record(const std::string &layer, const PerfCounters &counters) {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+
+    std::map<std::string, Entry>::iterator it = entries.find(layer);
+    if (it == entries.end()) {
+        it = entries.insert(std::make_pair(layer, Entry())).first;
+        order.push_back(layer);
+    }
+
+    Entry &e = it->second;
+    e.runs++;
+    e.total_cycles += counters.total_cycles;
+    e.busy_cycles += counters.busy_cycles;
+    e.read_beats += counters.read_beats;
+    e.write_beats += counters.write_beats;
+    e.read_stall_cycles += counters.read_stall_cycles;
+    e.write_stall_cycles += counters.write_stall_cycles;
+}
+
+void PerfProfile::clear() {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    entries.clear();
+    order.clear();
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+void PerfProfile::print(int clock_mhz) {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    if (order.empty()) return;
+
+    printf("\nAccelerator profile (per run, %d MHz):\n", clock_mhz);
+    printf("  %-20s %12s %9s %6s %10s %10s %7s %7s\n",
+           "layer", "cycles", "ms", "busy%", "rd beats", "wr beats", "rd st%", "wr st%");
+
+    Entry sum;
+    for (size_t i = 0; i < order.size(); i++) {
+        const Entry &e = entries[order[i]];
+        uint64_t cycles = e.total_cycles / e.runs;
+        printf("  %-20s %12llu %9.3f %6.1f %10llu %10llu %7.1f %7.1f\n",
+               order[i].c_str(), (unsigned long long)cycles,
+               cycles / (clock_mhz * 1000.0),
+               percent(e.busy_cycles, e.total_cycles),
+               (unsigned long long)(e.read_beats / e.runs),
+               (unsigned long long)(e.write_beats / e.runs),
+               percent(e.read_stall_cycles, e.total_cycles),
+               percent(e.write_stall_cycles, e.total_cycles));
+
+        sum.total_cycles += cycles;
+        sum.busy_cycles += e.busy_cycles / e.runs;
+        sum.read_beats += e.read_beats / e.runs;
+        sum.write_beats += e.write_beats / e.runs;
+        sum.read_stall_cycles += e.read_stall_cycles / e.runs;
+        sum.write_stall_cycles += e.write_stall_cycles / e.runs;
+    }
+
+    printf("  %-20s %12llu %9.3f %6.1f %10llu %10llu %7.1f %7.1f\n",
+           "total", (unsigned long long)sum.total_cycles,
+           sum.total_cycles / (clock_mhz * 1000.0),
+           percent(sum.busy_cycles, sum.total_cycles),
+           (unsigned long long)sum.read_beats, (unsigned long long)sum.write_beats,
+           percent(sum.read_stall_cycles, sum.total_cycles),
+           percent(sum.write_stall_cycles, sum.total_cycles));
+}
@@ -0,0 +1,68 @@
+#ifndef PERF_PROFILE_H
+#define PERF_PROFILE_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One snapshot or difference of an accelerator's performance counters
+struct PerfCounters {
+    uint32_t total_cycles;
+    uint32_t busy_cycles;
+    uint32_t read_beats;
+    uint32_t write_beats;
+    uint32_t read_stall_cycles;
+    uint32_t write_stall_cycles;
+
+    PerfCounters()
+        : total_cycles(0), busy_cycles(0), read_beats(0), write_beats(0),
+          read_stall_cycles(0), write_stall_cycles(0) {}
+
+    // Counters wrap at 2^32, so unsigned subtraction is correct as long as
+    // a single layer runs for less than 2^32 cycles
+    PerfCounters since(const PerfCounters &before) const {
+        PerfCounters d;
+        d.total_cycles = total_cycles - before.total_cycles;
+        d.busy_cycles = busy_cycles - before.busy_cycles;
+        d.read_beats = read_beats - before.read_beats;
+        d.write_beats = write_beats - before.write_beats;
+        d.read_stall_cycles = read_stall_cycles - before.read_stall_cycles;
+        d.write_stall_cycles = write_stall_cycles - before.write_stall_cycles;
+        return d;
+    }
+};
+
+// Per-layer accelerator profile: counter deltas summed over every frame,
+// keyed by layer name and printed in the order layers first ran. Safe to
+// record into from several frames at once.
+class PerfProfile {
+private:
+    struct Entry {
+        uint64_t runs;
+        uint64_t total_cycles;
+        uint64_t busy_cycles;
+        uint64_t read_beats;
+        uint64_t write_beats;
+        uint64_t read_stall_cycles;
+        uint64_t write_stall_cycles;
+
+        Entry()
+            : runs(0), total_cycles(0), busy_cycles(0), read_beats(0), write_beats(0),
+              read_stall_cycles(0), write_stall_cycles(0) {}
+    };
+
+    std::mutex profile_mutex;
+    std::map<std::string, Entry> entries;
+    std::vector<std::string> order;
+
+public:
+    void record(const std::string &layer, const PerfCounters &counters);
+    void clear();
+
+    // Table of per-frame averages, with cycles converted at clock_mhz
+    void print(int clock_mhz);
+};
+
+#endif // PERF_PROFILE_H
@@ -2,172 +2,1198 @@
 #include <vector>
 #include <chrono>
 #include <cstring>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <map>
+#include <future>
+#include <deque>
 #include "../drivers/cnn_fpga_driver.h"
+#include "../drivers/accel_client.h"
+#include "../drivers/coexec_planner.h"
+#include "../common/cpu_convolution.h"
+#include "../common/model_weights.h"
+#include "../common/epoch_slot.h"
+#include "../common/cpu_backend.h"
+#include "../common/graph_executor.h"
 #include "../../models/configs/mobilenet_config.h"
 
-class MobileNetFPGA {
+// Frames in flight at once: while one frame finishes on the CPU (pooling,
+// FC, softmax) the accelerator already runs the next frame's convolutions
+#define FRAME_PIPELINE_DEPTH 2
+
+// Classes the classifier block ranks per frame; the rest read 0
+#define CLASSIFIER_TOP_K 5
+
+// The command for one conv layer, its activation included
+static void conv_command(const LayerDesc &layer, const qint8_t *input,
+                         const LayerWeights &weights, int mode, qint8_t *output,
+                         LayerCommand *command) {
+    command->op = CMD_CONV;
+    command->conv_mode = mode;
+    command->input = input;
+    command->weight_handle = weights.device_handle;
+    command->output = output;
+    command->input_h = layer.input_h;
+    command->input_w = layer.input_w;
+    command->input_c = layer.input_c;
+    command->output_c = layer.output_c;
+    command->kernel_size = layer.kernel_size;
+    command->stride = layer.stride;
+    command->padding = layer.padding;
+    
+    // The conv block clamps with either in its output stage
+    command->use_relu = layer.activation == ACTIVATION_RELU;
+    command->use_relu6 = layer.activation == ACTIVATION_RELU6;
+}
+
+// A depthwise layer and the pointwise layer after it as one separable conv
+// command, the depthwise activation applied between the halves
+static void separable_command(const LayerDesc &dw, const qint8_t *input, const LayerWeights &dw_weights,
+                              const LayerDesc &pw, const LayerWeights &pw_weights, qint8_t *output,
+                              LayerCommand *command) {
+    conv_command(dw, input, dw_weights, CONV_MODE_SEPARABLE, output, command);
+    command->output_c = pw.output_c;
+    command->pw_weight_handle = pw_weights.device_handle;
+    command->mid_relu = dw.activation == ACTIVATION_RELU;
+    command->mid_relu6 = dw.activation == ACTIVATION_RELU6;
+    command->use_relu = pw.activation == ACTIVATION_RELU;
+    command->use_relu6 = pw.activation == ACTIVATION_RELU6;
+}
+
+// Uploads each layer's weights into DMA memory once, at load time, in the
+// layout the file stores them (the accelerator reads depthwise kernels as
+// [c][k][k] directly)
+class FPGAWeightUploader : public WeightUploader {
 private:
-    CNNFPGADriver fpga;
+    CNNFPGADriver &fpga;
+    
+public:
+    explicit FPGAWeightUploader(CNNFPGADriver &driver) : fpga(driver) {}
+    
+    uint32_t upload(const LayerDesc &, const LayerWeights &weights) {
+        return fpga.register_weights(weights.kernel.data(), weights.kernel.size(),
+                                     weights.bias.data(), weights.bias.size());
+    }
+    
+    void release(uint32_t handle) {
+        fpga.release_weights(handle);
+    }
+};
+
+// Queues convolution, activation and pooling layers on the FPGA driver
+// without waiting for them; each lands on its own accelerator block, so one
+// frame's pooling overlaps the next frame's convolutions. The FC layer
+// feeding the softmax runs on the classifier block, which returns only the
+// best classes; any other FC layer runs on the CPU once the queued layers
+// are done.
+class FPGABackend : public LayerBackend {
+private:
+    CNNFPGADriver &fpga;
+    CPUBackend cpu;
+    
+    // Feature-map buffers handed to the executor, by CPU address
+    std::map<qint8_t*, DmaBuffer> device_buffers;
+    
+    // Most recent command of this frame; each layer depends on the one before
+    CommandHandle last_command;
+    
+    // Counter deltas of the layers queued since the last finish(), recorded
+    // into the profile once they have run (deque keeps addresses stable)
+    PerfProfile *profile;
+    std::deque<std::pair<const LayerDesc*, PerfCounters> > samples;
     
-    // Model weights
-    std::vector<std::vector<qint8_t>> conv_weights;
-    std::vector<std::vector<qint32_t>> conv_biases;
-    std::vector<qint8_t> fc_weights;
-    std::vector<qint32_t> fc_bias;
+    // Set when dense and pointwise layers are split with the CPU
+    const CoExecPlanner *planner;
     
-    // Feature map buffers
-    std::vector<qint8_t> buffer1;
-    std::vector<qint8_t> buffer2;
+    // Images each conv command takes through its weights
+    int batch;
+    
+    // The frame's conv layers compiled into one conv block program, and the
+    // profile entry its runs are recorded under
+    ProgramHandle program;
+    LayerDesc program_desc;
+    
+    // Where the classifier block writes this frame's ranking
+    DmaBuffer classifier_output;
+    
+    // Profile entries of fused layers (depthwise/pointwise pairs and
+    // pooled pointwise layers), by their last layer
+    std::map<const LayerDesc*, LayerDesc> fused_descs;
+    
+    const LayerDesc& fused_desc(const LayerDesc &first, const LayerDesc &last) {
+        std::map<const LayerDesc*, LayerDesc>::iterator it = fused_descs.find(&last);
+        if (it == fused_descs.end()) {
+            it = fused_descs.insert(std::make_pair(&last, last)).first;
+            it->second.name = first.name + "+" + last.name;
+        }
+        return it->second;
+    }
+    
+    // Weights are referenced by their device handle, so no weight bytes
+    // move per frame
+    bool submit_conv(const LayerDesc &layer, const qint8_t *input,
+                     const LayerWeights &weights, int mode, qint8_t *output) {
+        if (!weights.device_handle) {
+            std::cerr << layer.name << " has no device copy of its weights" << std::endl;
+            return false;
+        }
+        LayerCommand command;
+        conv_command(layer, input, weights, mode, output, &command);
+        
+        if (planner && mode != CONV_MODE_DEPTHWISE) {
+            uint64_t macs_per_channel = (uint64_t)layer.output_h * layer.output_w *
+                                        layer.input_c * layer.kernel_size * layer.kernel_size;
+            int fpga_channels = planner->fpga_channels(macs_per_channel, layer.output_c);
+            if (fpga_channels < layer.output_c) {
+                return co_execute(layer, command, weights, fpga_channels);
+            }
+        }
+        
+        return submit(layer, command);
+    }
+    
+    // Channels [0, fpga_channels) on the accelerator and the rest on this
+    // thread at the same time, both writing straight into the shared output
+    bool co_execute(const LayerDesc &layer, LayerCommand &command,
+                    const LayerWeights &weights, int fpga_channels) {
+        // The CPU half reads the input directly, so it has to be complete
+        if (!finish()) return false;
+        
+        if (fpga_channels > 0) {
+            command.output_c = fpga_channels;
+            command.output_stride = layer.output_c;
+            if (!submit(layer, command)) return false;
+        }
+        
+        qint8_t *output = command.output;
+        CPUConvolution::conv2d_channels(command.input, weights.kernel.data(), weights.bias.data(),
+                                        output, layer.input_h, layer.input_w, layer.input_c,
+                                        layer.kernel_size, layer.stride, layer.padding,
+                                        fpga_channels, layer.output_c, layer.output_c);
+        int cpu_channels = layer.output_c - fpga_channels;
+        for (int p = 0; p < layer.output_h * layer.output_w; p++) {
+            if (layer.activation == ACTIVATION_RELU) {
+                CPUConvolution::relu(output + p * layer.output_c + fpga_channels, cpu_channels);
+            } else if (layer.activation == ACTIVATION_RELU6) {
+                CPUConvolution::relu6(output + p * layer.output_c + fpga_channels, cpu_channels);
+            }
+        }
+        return true;
+    }
+    
+    // Queue behind the frame's previous command; conv commands carry the
+    // batch
+    bool submit(const LayerDesc &layer, LayerCommand &command) {
+        if (command.op == CMD_CONV) {
+            command.batch = batch;
+        }
+        if (last_command != NO_COMMAND) {
+            command.depends_on.push_back(last_command);
+        }
+        if (profile) {
+            samples.push_back(std::make_pair(&layer, PerfCounters()));
+            command.perf = &samples.back().second;
+        }
+        last_command = fpga.submit(command);
+        return last_command != NO_COMMAND;
+    }
     
 public:
-    MobileNetFPGA() {
-        buffer1.resize(MAX_FEATURE_MAP_HEIGHT * MAX_FEATURE_MAP_WIDTH * MAX_FEATURE_MAP_CHANNELS);
-        buffer2.resize(MAX_FEATURE_MAP_HEIGHT * MAX_FEATURE_MAP_WIDTH * MAX_FEATURE_MAP_CHANNELS);
+    FPGABackend(CNNFPGADriver &driver, PerfProfile *perf_profile)
+        : fpga(driver), last_command(NO_COMMAND), profile(perf_profile), planner(nullptr), batch(1),
+          program(NO_PROGRAM) {
+        program_desc.name = "program";
     }
     
-    bool init() {
-        std::cout << "Initializing FPGA accelerator..." << std::endl;
-        if (!fpga.init()) {
-            std::cerr << "Failed to initialize FPGA driver" << std::endl;
+    ~FPGABackend() {
+        fpga.release_program(program);
+        fpga.free_buffer(classifier_output);
+    }
+    
+    void set_planner(const CoExecPlanner *coexec_planner) {
+        planner = coexec_planner;
+    }
+    
+    // The conv block takes any batch; co-execution splits layers per image
+    bool set_batch(int images) {
+        if (planner && images > 1) return false;
+        batch = images;
+        return true;
+    }
+    
+    // The frame's first layer waits for handle (its input copy)
+    void start_after(CommandHandle handle) {
+        last_command = handle;
+    }
+    
+    const char* name() const { return "FPGA"; }
+    
+    // Feature maps live in DMA memory so every layer runs without staging
+    // copies
+    qint8_t* allocate_buffer(size_t size) {
+        DmaBuffer buffer = fpga.alloc_buffer(size);
+        if (!buffer.valid()) return nullptr;
+        device_buffers[(qint8_t*)buffer.virt] = buffer;
+        return (qint8_t*)buffer.virt;
+    }
+    
+    void free_buffer(qint8_t *ptr) {
+        std::map<qint8_t*, DmaBuffer>::iterator it = device_buffers.find(ptr);
+        if (it != device_buffers.end()) {
+            fpga.free_buffer(it->second);
+            device_buffers.erase(it);
+        }
+    }
+    
+    bool finish() {
+        if (last_command == NO_COMMAND) return true;
+        bool ok = fpga.wait(last_command);
+        last_command = NO_COMMAND;
+        
+        if (ok) {
+            for (size_t i = 0; i < samples.size(); i++) {
+                profile->record(samples[i].first->name, samples[i].second);
+            }
+        }
+        samples.clear();
+        return ok;
+    }
+    
+    // The leading conv, depthwise and pointwise layers, up to
+    // CONV_PROGRAM_MAX_LAYERS commands, depthwise and pointwise pairs fused
+    // where they fit. Co-executed layers are split per frame, so
+    // co-execution compiles nothing. Returns the graph layers taken, not
+    // the commands.
+    int compile(const std::vector<BoundLayer> &layers) {
+        fpga.release_program(program);
+        program = NO_PROGRAM;
+        if (planner) return 0;
+        
+        std::vector<LayerCommand> commands;
+        size_t i = 0;
+        for (; i < layers.size() && commands.size() < CONV_PROGRAM_MAX_LAYERS; i++) {
+            const LayerDesc &layer = *layers[i].layer;
+            int mode;
+            if (layer.op == OP_CONV) mode = CONV_MODE_DENSE;
+            else if (layer.op == OP_DEPTHWISE) mode = CONV_MODE_DEPTHWISE;
+            else if (layer.op == OP_POINTWISE) mode = CONV_MODE_POINTWISE;
+            else break;
+            if (!layers[i].weights->device_handle) break;
+            
+            LayerCommand command;
+            if (i + 1 < layers.size() && layers[i + 1].layer->op == OP_POINTWISE &&
+                can_fuse_separable(layer, *layers[i + 1].layer)) {
+                const BoundLayer &pw = layers[i + 1];
+                if (!pw.weights->device_handle) break;
+                separable_command(layer, layers[i].input, *layers[i].weights, *pw.layer, *pw.weights,
+                                  layers[i].output, &command);
+                i++;
+            } else {
+                conv_command(layer, layers[i].input, *layers[i].weights, mode, layers[i].output, &command);
+            }
+            
+            // Pool the last pointwise output on the way out
+            const LayerDesc &last = *layers[i].layer;
+            if (i + 1 < layers.size() && last.op == OP_POINTWISE &&
+                layers[i + 1].layer->op == OP_GLOBAL_AVG_POOL &&
+                can_fuse_pool(last, *layers[i + 1].layer)) {
+                command.global_pool = true;
+                command.output = layers[i + 1].output;
+                i++;
+            }
+            command.batch = batch;
+            commands.push_back(command);
+        }
+        if (commands.empty()) return 0;
+        
+        program = fpga.compile_program(commands);
+        return program != NO_PROGRAM ? (int)i : 0;
+    }
+    
+    bool run_compiled() {
+        LayerCommand command;
+        command.op = CMD_PROGRAM;
+        command.program = program;
+        return submit(program_desc, command);
+    }
+    
+    bool conv2d(const LayerDesc &layer, const qint8_t *input,
+                const LayerWeights &weights, qint8_t *output) {
+        return submit_conv(layer, input, weights, CONV_MODE_DENSE, output);
+    }
+    
+    bool depthwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                          const LayerWeights &weights, qint8_t *output) {
+        return submit_conv(layer, input, weights, CONV_MODE_DEPTHWISE, output);
+    }
+    
+    bool pointwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                          const LayerWeights &weights, qint8_t *output) {
+        return submit_conv(layer, input, weights, CONV_MODE_POINTWISE, output);
+    }
+    
+    // The conv block's separable mode, when the depthwise input rows fit its
+    // line buffers. Co-execution splits pointwise layers by channel, so it
+    // runs them on their own.
+    bool can_fuse_separable(const LayerDesc &dw, const LayerDesc &pw) const {
+        return !planner && pw.input_c == dw.output_c &&
+               pw.stride == 1 && pw.padding == 0 &&
+               CONV_SEPARABLE_FITS(dw.input_w, dw.input_c, dw.kernel_size, dw.stride, dw.padding);
+    }
+    
+    bool separable_block(const LayerDesc &dw, const qint8_t *input, const LayerWeights &dw_weights,
+                         const LayerDesc &pw, const LayerWeights &pw_weights, qint8_t *output) {
+        if (!dw_weights.device_handle || !pw_weights.device_handle) {
+            std::cerr << dw.name << "+" << pw.name << " has no device copy of its weights" << std::endl;
             return false;
         }
-        std::cout << "FPGA initialized successfully" << std::endl;
+        LayerCommand command;
+        separable_command(dw, input, dw_weights, pw, pw_weights, output, &command);
+        
+        return submit(fused_desc(dw, pw), command);
+    }
+    
+    // The conv block pools in its streaming output stage, after the
+    // activation
+    bool can_fuse_pool(const LayerDesc &pw, const LayerDesc &pool) const {
+        return !planner && pw.stride == 1 && pw.padding == 0 &&
+               pw.input_c % AXI_WORD_BYTES == 0 && pool.input_h * pool.input_w <= GAP_MAX_PIXELS;
+    }
+    
+    bool pointwise_pool(const LayerDesc &pw, const qint8_t *input, const LayerWeights &weights,
+                        const LayerDesc &pool, qint8_t *output) {
+        if (!weights.device_handle) {
+            std::cerr << pw.name << " has no device copy of its weights" << std::endl;
+            return false;
+        }
+        LayerCommand command;
+        conv_command(pw, input, weights, CONV_MODE_POINTWISE, output, &command);
+        command.global_pool = true;
+        return submit(fused_desc(pw, pool), command);
+    }
+    
+    bool separable_pool(const LayerDesc &dw, const qint8_t *input, const LayerWeights &dw_weights,
+                        const LayerDesc &pw, const LayerWeights &pw_weights, const LayerDesc &pool,
+                        qint8_t *output) {
+        if (!dw_weights.device_handle || !pw_weights.device_handle) {
+            std::cerr << dw.name << "+" << pw.name << " has no device copy of its weights" << std::endl;
+            return false;
+        }
+        LayerCommand command;
+        separable_command(dw, input, dw_weights, pw, pw_weights, output, &command);
+        command.global_pool = true;
+        return submit(fused_desc(fused_desc(dw, pw), pool), command);
+    }
+    
+    bool global_avg_pool(const LayerDesc &layer, const qint8_t *input, qint8_t *output) {
+        LayerCommand command;
+        command.op = CMD_GLOBAL_AVG_POOL;
+        command.input = input;
+        command.output = output;
+        command.input_h = layer.input_h;
+        command.input_w = layer.input_w;
+        command.input_c = layer.input_c;
+        command.output_c = layer.input_c;
+        return submit(layer, command);
+    }
+    
+    // Fully connected layer (CPU - small overhead)
+    bool fully_connected(const LayerDesc &layer, const qint8_t *input,
+                         const LayerWeights &weights, qint8_t *output) {
+        if (!finish()) return false;
+        return cpu.fully_connected(layer, input, weights, output);
+    }
+    
+    bool can_classify(const LayerDesc &fc, int top_k) const {
+        return fc.input_c % AXI_WORD_BYTES == 0 && fc.input_c <= CLASSIFIER_MAX_INPUTS &&
+               fc.output_c <= CLASSIFIER_MAX_CLASSES && top_k <= CLASSIFIER_MAX_TOP_K &&
+               top_k <= fc.output_c;
+    }
+    
+    // Queued behind the frame's last layer like any other; only the
+    // ranking comes back over the bus
+    bool classify(const LayerDesc &fc, const qint8_t *input, const LayerWeights &weights,
+                  int top_k, ClassifierResult *result) {
+        if (!weights.device_handle) {
+            std::cerr << fc.name << " has no device copy of its weights" << std::endl;
+            return false;
+        }
+        if (top_k < 1 || top_k > CLASSIFIER_MAX_TOP_K) {
+            std::cerr << fc.name << ": the classifier ranks 1 to " << CLASSIFIER_MAX_TOP_K
+                      << " classes, not " << top_k << std::endl;
+            return false;
+        }
+        if (!classifier_output.valid()) {
+            classifier_output = fpga.alloc_buffer(sizeof(ClassifierOutput));
+            if (!classifier_output.valid()) return false;
+        }
+        LayerCommand command;
+        command.op = CMD_CLASSIFY;
+        command.input = input;
+        command.weight_handle = weights.device_handle;
+        command.output = (qint8_t*)classifier_output.virt;
+        command.input_h = 1;
+        command.input_w = 1;
+        command.input_c = fc.input_c;
+        command.output_c = fc.output_c;
+        command.top_k = top_k;
+        if (!submit(fc, command) || !finish()) return false;
+        
+        const ClassifierOutput *output = (const ClassifierOutput*)classifier_output.virt;
+        result->count = top_k;
+        for (int k = 0; k < top_k; k++) {
+            result->classes[k] = CLASSIFIER_ENTRY_CLASS(output->top[k]);
+            result->logits[k] = CLASSIFIER_ENTRY_LOGIT(output->top[k]);
+        }
+        uint64_t exp_sum = ((uint64_t)output->exp_sum_high << 32) | output->exp_sum_low;
+        result->exp_sum = (double)exp_sum / (double)(1ull << CLASSIFIER_EXP_SHIFT);
         return true;
     }
+};
+
+// Copies each layer's weights into the daemon client's arena once, at load
+// time; the daemon only takes tensors from there
+class ArenaWeightUploader : public WeightUploader {
+private:
+    AccelClient &client;
+    std::map<uint32_t, std::pair<DmaBuffer, DmaBuffer> > uploads;   // kernel, bias
+    uint32_t next_handle;
+    
+public:
+    explicit ArenaWeightUploader(AccelClient &accel) : client(accel), next_handle(1) {}
+    
+    uint32_t upload(const LayerDesc &, const LayerWeights &weights) {
+        size_t bias_size = weights.bias.size() * sizeof(qint32_t);
+        DmaBuffer kernel = client.alloc_buffer(weights.kernel.size());
+        DmaBuffer bias = client.alloc_buffer(bias_size);
+        if (!kernel.valid() || !bias.valid()) {
+            client.free_buffer(kernel);
+            client.free_buffer(bias);
+            return 0;
+        }
+        memcpy(kernel.virt, weights.kernel.data(), weights.kernel.size());
+        memcpy(bias.virt, weights.bias.data(), bias_size);
+        uploads[next_handle] = std::make_pair(kernel, bias);
+        return next_handle++;
+    }
+    
+    void release(uint32_t handle) {
+        std::map<uint32_t, std::pair<DmaBuffer, DmaBuffer> >::iterator it = uploads.find(handle);
+        if (it == uploads.end()) return;
+        client.free_buffer(it->second.first);
+        client.free_buffer(it->second.second);
+        uploads.erase(it);
+    }
+    
+    const qint8_t* kernel(uint32_t handle) {
+        return (const qint8_t*)uploads[handle].first.virt;
+    }
+    
+    const qint32_t* bias(uint32_t handle) {
+        return (const qint32_t*)uploads[handle].second.virt;
+    }
+};
+
+// Queues the frame's layers on the accelerator daemon, each job chained
+// to the one before; the FC layer runs here once they are done
+class DaemonBackend : public LayerBackend {
+private:
+    AccelClient &client;
+    ArenaWeightUploader &uploader;
+    CPUBackend cpu;
+    std::map<qint8_t*, DmaBuffer> arena_buffers;
+    uint64_t last_job;
+    
+    bool submit(const LayerCommand &command) {
+        last_job = client.submit(command, last_job != 0);
+        return last_job != 0;
+    }
+    
+    bool submit_conv(const LayerDesc &layer, const qint8_t *input,
+                     const LayerWeights &weights, int mode, qint8_t *output) {
+        LayerCommand command;
+        conv_command(layer, input, weights, mode, output, &command);
+        command.weight_handle = NO_WEIGHTS;
+        command.weights = uploader.kernel(weights.device_handle);
+        command.bias = uploader.bias(weights.device_handle);
+        return submit(command);
+    }
+    
+public:
+    DaemonBackend(AccelClient &accel, ArenaWeightUploader &arena_uploader)
+        : client(accel), uploader(arena_uploader), last_job(0) {}
+    
+    const char* name() const { return "FPGA (daemon)"; }
+    
+    qint8_t* allocate_buffer(size_t size) {
+        DmaBuffer buffer = client.alloc_buffer(size);
+        if (!buffer.valid()) return nullptr;
+        arena_buffers[(qint8_t*)buffer.virt] = buffer;
+        return (qint8_t*)buffer.virt;
+    }
+    
+    void free_buffer(qint8_t *ptr) {
+        std::map<qint8_t*, DmaBuffer>::iterator it = arena_buffers.find(ptr);
+        if (it != arena_buffers.end()) {
+            client.free_buffer(it->second);
+            arena_buffers.erase(it);
+        }
+    }
+    
+    bool finish() {
+        if (last_job == 0) return true;
+        bool ok = client.wait(last_job);
+        last_job = 0;
+        return ok;
+    }
+    
+    bool conv2d(const LayerDesc &layer, const qint8_t *input,
+                const LayerWeights &weights, qint8_t *output) {
+        return submit_conv(layer, input, weights, CONV_MODE_DENSE, output);
+    }
+    
+    bool depthwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                          const LayerWeights &weights, qint8_t *output) {
+        return submit_conv(layer, input, weights, CONV_MODE_DEPTHWISE, output);
+    }
+    
+    bool pointwise_conv2d(const LayerDesc &layer, const qint8_t *input,
+                          const LayerWeights &weights, qint8_t *output) {
+        return submit_conv(layer, input, weights, CONV_MODE_POINTWISE, output);
+    }
+    
+    bool global_avg_pool(const LayerDesc &layer, const qint8_t *input, qint8_t *output) {
+        LayerCommand command;
+        command.op = CMD_GLOBAL_AVG_POOL;
+        command.input = input;
+        command.output = output;
+        command.input_h = layer.input_h;
+        command.input_w = layer.input_w;
+        command.input_c = layer.input_c;
+        command.output_c = layer.input_c;
+        return submit(command);
+    }
+    
+    bool fully_connected(const LayerDesc &layer, const qint8_t *input,
+                         const LayerWeights &weights, qint8_t *output) {
+        if (!finish()) return false;
+        return cpu.fully_connected(layer, input, weights, output);
+    }
+};
+
+// Runs frames through the accelerator daemon instead of owning the board,
+// so it can share the accelerators with other processes. Frames run one at
+// a time; the daemon interleaves them with other clients' layers.
+class MobileNetDaemonClient {
+private:
+    AccelClient client;
+    ArenaWeightUploader uploader;
+    DaemonBackend backend;
+    GraphExecutor executor;
+    ModelWeights *weights;
+    DmaBuffer input;
+    
+public:
+    MobileNetDaemonClient()
+        : uploader(client), backend(client, uploader), executor(backend), weights(nullptr) {}
+    
+    ~MobileNetDaemonClient() {
+        cleanup();
+    }
+    
+    bool init(const std::string &socket_path, AccelPriority priority) {
+        std::cout << "Connecting to the accelerator daemon..." << std::endl;
+        return client.connect(socket_path.c_str(), priority, ACCEL_DEFAULT_ARENA,
+                              "cnn_inference_hw");
+    }
     
     bool load_weights(const std::string &weights_dir) {
         std::cout << "Loading quantized weights from " << weights_dir << std::endl;
-        // TODO: Implement weight loading
-        return true;
+        weights = new ModelWeights(&uploader);
+        if (!weights->load(weights_dir)) {
+            return false;
+        }
+        weights->graph().print_summary();
+        input = client.alloc_buffer(weights->graph().input_elements());
+        return input.valid() && executor.prepare(weights->graph());
     }
     
-    void inference(const qint8_t *input_image, float *output_probs) {
+    // Where the next image should be written (the client's arena)
+    qint8_t* input_buffer() {
+        return (qint8_t*)input.virt;
+    }
+    
+    size_t input_size() const {
+        return weights->graph().input_elements();
+    }
+    
+    int num_classes() const {
+        return weights->graph().num_classes();
+    }
+    
+    bool inference(float *output_probs, bool verbose) {
         auto start = std::chrono::high_resolution_clock::now();
+        executor.verbose = verbose;
+        if (!executor.run(*weights, (const qint8_t*)input.virt, output_probs)) {
+            return false;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        std::cout << "FPGA Inference time: " << duration.count() << " ms" << std::endl;
+        return true;
+    }
+    
+    // What the daemon has accounted to this client
+    void print_accounting() {
+        AccelAccounting a = client.accounting();
+        std::cout << "Daemon accounting: " << a.jobs << " jobs (" << a.failed << " failed), "
+                  << a.busy_ns / 1000000.0 << " ms on the accelerators, wait avg "
+                  << (a.jobs ? a.wait_ns / 1000.0 / a.jobs : 0.0) << " us, max "
+                  << a.max_wait_ns / 1000.0 << " us, preempted " << a.preempted
+                  << " times" << std::endl;
+    }
+    
+    // The executor's buffers go with it; the client disconnects last
+    void cleanup() {
+        client.free_buffer(input);
+        delete weights;
+        weights = nullptr;
+    }
+};
+
+class MobileNetFPGA {
+private:
+    CNNFPGADriver fpga;
+    FPGAWeightUploader uploader;
+    PerfProfile profile;
+    
+    // Calibrated only with co-execution on
+    CoExecPlanner planner;
+    
+    // Run each frame's conv layers as one conv block program
+    bool use_programs;
+    
+    // Images per frame; each conv layer takes them all through its weights
+    int batch;
+    
+    // Active weight set and the network description it belongs to. Each
+    // frame pins the set it starts with; a reload swaps in a new set between
+    // frames and the old one is freed once no frame still uses it.
+    EpochSlot<ModelWeights> active_weights;
+    std::thread reload_thread;
+    std::atomic<bool> reload_busy;
+    
+    // Where the camera (or the caller) puts the next image. Each submitted
+    // frame snapshots it into its own input on the DMA engine, so pixels
+    // never pass through the CPU.
+    DmaBuffer capture;
+    
+    // Everything one in-flight frame owns: its own back end (for the
+    // command chain and kernel scratch), feature maps, input image and
+    // result
+    struct FrameContext {
+        FPGABackend backend;
+        GraphExecutor executor;
+        DmaBuffer input;
+        CommandHandle input_copy;
+        std::vector<float> probs;
+        std::future<bool> result;
+        std::chrono::high_resolution_clock::time_point start;
         
-        qint8_t *current_input = (qint8_t*)input_image;
-        qint8_t *current_output = buffer1.data();
-        
-        int h = INPUT_HEIGHT, w = INPUT_WIDTH, c = INPUT_CHANNELS;
+        FrameContext(CNNFPGADriver &fpga, PerfProfile *profile)
+            : backend(fpga, profile), executor(backend), input_copy(NO_COMMAND) {
+            executor.top_k = CLASSIFIER_TOP_K;
+        }
+    };
+    FrameContext *frames[FRAME_PIPELINE_DEPTH];
+    int next_frame;         // Context the next submit_frame() uses
+    int oldest_frame;       // Context wait_frame() collects
+    int frames_in_flight;
+    int frames_submitted;
+    
+    bool run_frame(FrameContext *ctx) {
+        // Free weight sets retired by earlier swaps, then pin the current one
+        // for the whole frame
+        active_weights.reclaim();
+        EpochSlot<ModelWeights>::Guard weights = active_weights.pin();
+        if (!weights.get() || ctx->input_copy == NO_COMMAND) return false;
         
-        // First convolution layer: 224x224x3 -> 112x112x32 (FPGA)
-        std::cout << "Conv1 (FPGA): " << h << "x" << w << "x" << c << " -> ";
-        fpga.conv2d(current_input, conv_weights[0].data(), conv_biases[0].data(),
-                   current_output, h, w, c, CONV1_FILTERS,
-                   CONV1_KERNEL_SIZE, CONV1_STRIDE, CONV1_PADDING, true);
-        h = 112; w = 112; c = 32;
-        std::cout << h << "x" << w << "x" << c << std::endl;
+        ctx->backend.start_after(ctx->input_copy);
+        return ctx->executor.run(*weights.get(), (const qint8_t*)ctx->input.virt,
+                                 ctx->probs.data());
+    }
+    
+    // Wait for the oldest frame in flight and take it out of the pipeline.
+    // Returns its context, or null if there was none or it failed.
+    FrameContext *retire_frame() {
+        if (frames_in_flight == 0) {
+            return nullptr;
+        }
+        FrameContext *ctx = frames[oldest_frame];
+        bool ok = ctx->result.get();
+        oldest_frame = (oldest_frame + 1) % FRAME_PIPELINE_DEPTH;
+        frames_in_flight--;
+        return ok ? ctx : nullptr;
+    }
+    
+public:
+    MobileNetFPGA()
+        : uploader(fpga), use_programs(false), batch(1), reload_busy(false), next_frame(0), oldest_frame(0),
+          frames_in_flight(0), frames_submitted(0) {
+        for (int i = 0; i < FRAME_PIPELINE_DEPTH; i++) {
+            frames[i] = nullptr;
+        }
+    }
+    
+    ~MobileNetFPGA() {
+        if (reload_thread.joinable()) {
+            reload_thread.join();
+        }
+        cleanup();
+    }
+    
+    // With coexec, dense and pointwise layers are split between the
+    // accelerator and the CPU by a cost model calibrated here. With
+    // programs, each frame context compiles its conv layers once and then
+    // starts them with a single command per frame. A frame is images images.
+    bool init(bool simulate, CompletionMode completion, bool coexec, bool programs, int images) {
+        use_programs = programs;
+        batch = images;
+        std::cout << "Initializing FPGA accelerator..." << std::endl;
+        if (!fpga.init(simulate)) {
+            std::cerr << "Failed to initialize FPGA driver" << std::endl;
+            return false;
+        }
+        fpga.set_completion_mode(completion);
         
-        // Depthwise separable convolution blocks (FPGA accelerated)
-        for (int block = 0; block < 13; block++) {
-            std::swap(current_input, current_output);
-            
-            int in_c = DEPTHWISE_BLOCKS[block][0];
-            int out_c = DEPTHWISE_BLOCKS[block][1];
-            int stride = DEPTHWISE_BLOCKS[block][2];
-            
-            std::cout << "Block " << block + 1 << " (FPGA): " << h << "x" << w << "x" << in_c << " -> ";
-            
-            // Depthwise convolution (FPGA)
-            fpga.conv2d(current_input, conv_weights[block*2+1].data(),
-                       conv_biases[block*2+1].data(),
-                       current_output, h, w, in_c, in_c, 3, stride, 1, true);
-            
-            if (stride == 2) {
-                h /= 2; w /= 2;
+        if (coexec) {
+            if (!planner.calibrate(fpga)) {
+                return false;
             }
+            planner.print();
             
-            std::swap(current_input, current_output);
-            
-            // Pointwise convolution (FPGA)
-            fpga.conv2d(current_input, conv_weights[block*2+2].data(),
-                       conv_biases[block*2+2].data(),
-                       current_output, h, w, in_c, out_c, 1, 1, 0, true);
-            
-            c = out_c;
-            std::cout << h << "x" << w << "x" << c << std::endl;
+            // Calibration layers are not part of any frame
+            fpga.reset_cycle_counter();
+            fpga.reset_engine_stats();
         }
+        std::cout << "FPGA initialized successfully" << std::endl;
+        return true;
+    }
+    
+    // In streaming mode this returns immediately and layers become available
+    // to inference() as the background loader reaches them
+    bool load_weights(const std::string &weights_dir, bool streaming) {
+        std::cout << "Loading quantized weights from " << weights_dir
+                  << (streaming ? " (streaming)" : "") << std::endl;
+        ModelWeights *weights = new ModelWeights(&uploader);
+        bool ok = streaming ? weights->start_streaming(weights_dir)
+                            : weights->load(weights_dir);
+        if (!ok) {
+            delete weights;
+            return false;
+        }
+        weights->graph().print_summary();
         
-        // Global average pooling (FPGA)
-        std::vector<qint8_t> gap_output(1024);
-        fpga.global_avg_pooling(current_output, gap_output.data(), h, w, c);
-        std::cout << "Global Avg Pool (FPGA): " << h << "x" << w << "x" << c << " -> 1024" << std::endl;
-        
-        // Fully connected layer (CPU - small overhead)
-        std::vector<qint8_t> fc_output(NUM_CLASSES);
-        for (int o = 0; o < NUM_CLASSES; o++) {
-            int32_t acc = fc_bias[o];
-            for (int i = 0; i < FC_INPUT_SIZE; i++) {
-                acc += gap_output[i] * fc_weights[o * FC_INPUT_SIZE + i];
+        // Size the capture buffer and each frame's feature map and input
+        // buffers from the graph and the batch
+        fpga.free_buffer(capture);
+        capture = fpga.alloc_buffer(weights->graph().input_elements() * batch);
+        if (!capture.valid()) {
+            delete weights;
+            return false;
+        }
+        for (int i = 0; i < FRAME_PIPELINE_DEPTH; i++) {
+            if (!frames[i]) {
+                frames[i] = new FrameContext(fpga, &profile);
+                frames[i]->backend.set_planner(planner.is_calibrated() ? &planner : nullptr);
+                frames[i]->executor.use_programs = use_programs;
+                frames[i]->executor.batch = batch;
+            }
+            FrameContext *ctx = frames[i];
+            ctx->executor.prepare(weights->graph());
+            fpga.free_buffer(ctx->input);
+            ctx->input = fpga.alloc_buffer(weights->graph().input_elements() * batch);
+            ctx->probs.assign(weights->graph().num_classes() * batch, 0.0f);
+            if (!ctx->input.valid()) {
+                delete weights;
+                return false;
             }
-            fc_output[o] = (qint8_t)std::max(-128, std::min(127, acc >> 8));
         }
-        
-        // Softmax (CPU)
-        float max_val = -1e9;
-        for (int i = 0; i < NUM_CLASSES; i++) {
-            float val = (float)fc_output[i];
-            if (val > max_val) max_val = val;
+        active_weights.publish(weights);
+        return true;
+    }
+    
+    // Where the next frame's images should be written (DMA memory), back to
+    // back. It may be rewritten once the last submitted frame has started.
+    qint8_t* capture_buffer() {
+        return (qint8_t*)capture.virt;
+    }
+    
+    // Load a new weight set on a background thread and swap it in once it is
+    // complete. Frames keep running on the current set in the meantime.
+    bool reload_weights_async(const std::string &weights_dir) {
+        if (reload_busy.exchange(true)) {
+            return false;
+        }
+        if (reload_thread.joinable()) {
+            reload_thread.join();
         }
         
-        float sum = 0.0f;
-        for (int i = 0; i < NUM_CLASSES; i++) {
-            output_probs[i] = std::exp((float)fc_output[i] - max_val);
-            sum += output_probs[i];
+        reload_thread = std::thread([this, weights_dir]() {
+            ModelWeights *weights = new ModelWeights(&uploader);
+            if (weights->load(weights_dir) && compatible(weights->graph())) {
+                active_weights.publish(weights);
+                std::cout << "Reloaded weights from " << weights_dir << std::endl;
+            } else {
+                delete weights;
+                std::cerr << "Reload failed, keeping current weights" << std::endl;
+            }
+            reload_busy = false;
+        });
+        return true;
+    }
+    
+    // A hot swap may change the variant's internals but not its input or
+    // output shape, which callers have sized their buffers for
+    bool compatible(const NetworkGraph &graph) {
+        EpochSlot<ModelWeights>::Guard current = active_weights.pin();
+        return graph.input_elements() == current->graph().input_elements() &&
+               graph.num_classes() == current->graph().num_classes();
+    }
+    
+    size_t input_size() {
+        EpochSlot<ModelWeights>::Guard current = active_weights.pin();
+        return current->graph().input_elements();
+    }
+    
+    int num_classes() {
+        EpochSlot<ModelWeights>::Guard current = active_weights.pin();
+        return current->graph().num_classes();
+    }
+    
+    // Start the frame in capture_buffer() and return without waiting.
+    // Fails if FRAME_PIPELINE_DEPTH frames are already in flight.
+    bool submit_frame() {
+        if (frames_in_flight == FRAME_PIPELINE_DEPTH) {
+            return false;
         }
+        FrameContext *ctx = frames[next_frame];
         
-        for (int i = 0; i < NUM_CLASSES; i++) {
-            output_probs[i] /= sum;
+        // The DMA copy is queued ahead of the frame's layers, which depend
+        // on it
+        LayerCommand copy;
+        copy.op = CMD_COPY;
+        copy.input = (const qint8_t*)capture.virt;
+        copy.output = (qint8_t*)ctx->input.virt;
+        copy.input_h = 1;
+        copy.input_w = (int)capture.size;
+        copy.input_c = 1;
+        ctx->input_copy = fpga.submit(copy);
+        
+        // Only the first frame lists its layers; later ones would interleave
+        ctx->executor.verbose = (frames_submitted == 0);
+        ctx->start = std::chrono::high_resolution_clock::now();
+        ctx->result = std::async(std::launch::async, &MobileNetFPGA::run_frame, this, ctx);
+        
+        next_frame = (next_frame + 1) % FRAME_PIPELINE_DEPTH;
+        frames_in_flight++;
+        frames_submitted++;
+        return true;
+    }
+    
+    // Wait for the oldest frame in flight and copy out its probabilities,
+    // num_classes() per image
+    bool wait_frame(float *output_probs) {
+        FrameContext *ctx = retire_frame();
+        if (!ctx) {
+            return false;
         }
         
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        memcpy(output_probs, ctx->probs.data(), ctx->probs.size() * sizeof(float));
         
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - ctx->start);
         std::cout << "FPGA Inference time: " << duration.count() << " ms" << std::endl;
+        return true;
+    }
+    
+    int in_flight() const {
+        return frames_in_flight;
+    }
+    
+    // Rerun every image of the capture buffer on the CPU, one at a time,
+    // and compare its top classes with output_probs (num_classes() per
+    // image, as wait_frame() left them). A batch that mixes up its images'
+    // maps shows up here even when the first image comes out right.
+    bool check_images(const float *output_probs) {
+        EpochSlot<ModelWeights>::Guard weights = active_weights.pin();
+        const NetworkGraph &graph = weights->graph();
+        int classes = graph.num_classes();
+        int top_k = std::min(CLASSIFIER_TOP_K, classes);
+        
+        CPUBackend cpu;
+        GraphExecutor reference(cpu);
+        reference.verbose = false;
+        std::vector<float> expected(classes);
+        
+        // Equal probabilities rank in class order, as on the classifier block
+        auto rank = [classes](const float *probs) {
+            std::vector<int> order(classes);
+            for (int c = 0; c < classes; c++) order[c] = c;
+            std::stable_sort(order.begin(), order.end(),
+                             [probs](int a, int b) { return probs[a] > probs[b]; });
+            return order;
+        };
+        
+        int mismatches = 0;
+        for (int n = 0; n < batch; n++) {
+            const qint8_t *input = (const qint8_t*)capture.virt + n * graph.input_elements();
+            if (!reference.run(*weights.get(), input, expected.data())) {
+                std::cerr << "CPU reference failed on image " << n << std::endl;
+                return false;
+            }
+            const float *actual = output_probs + n * classes;
+            std::vector<int> want = rank(expected.data());
+            std::vector<int> got = rank(actual);
+            for (int k = 0; k < top_k; k++) {
+                if (got[k] != want[k] || std::fabs(actual[got[k]] - expected[want[k]]) > 1e-5f) {
+                    std::cerr << "Image " << n << ": rank " << k << " is class " << got[k] << " at "
+                              << actual[got[k]] << ", CPU has class " << want[k] << " at "
+                              << expected[want[k]] << std::endl;
+                    mismatches++;
+                    break;
+                }
+            }
+        }
+        std::cout << "Checked " << batch << " images against the CPU: "
+                  << (mismatches ? "MISMATCH" : "ok") << std::endl;
+        return mismatches == 0;
+    }
+    
+    // Per-layer hardware counters, averaged over the frames run so far,
+    // and how busy each accelerator block was
+    void print_profile() {
+        profile.print(FPGA_CLOCK_MHZ);
+        std::cout << "Conv accelerator active for " << fpga.get_cycle_count()
+                  << " cycles over " << frames_submitted << " frames";
+        if (batch > 1) {
+            std::cout << " of " << batch << " images";
+        }
+        std::cout << std::endl;
+        fpga.print_utilization();
+    }
+    
+    // Single frame, synchronously
+    bool inference(float *output_probs) {
+        return submit_frame() && wait_frame(output_probs);
     }
     
     void cleanup() {
+        while (frames_in_flight > 0) {
+            retire_frame();
+        }
+        for (int i = 0; i < FRAME_PIPELINE_DEPTH; i++) {
+            if (frames[i]) {
+                fpga.free_buffer(frames[i]->input);
+                delete frames[i];
+                frames[i] = nullptr;
+            }
+        }
+        fpga.free_buffer(capture);
         fpga.cleanup();
     }
 };
 
+// Set by SIGHUP: reload the weights directory without restarting
+static volatile sig_atomic_t reload_requested = 0;
+
+static void handle_sighup(int) {
+    reload_requested = 1;
+}
+
+static void print_top5(const float *output_probs, int num_classes) {
+    std::vector<std::pair<int, float>> predictions;
+    for (int i = 0; i < num_classes; i++) {
+        predictions.push_back({i, output_probs[i]});
+    }
+    // Stable, so equal probabilities list in class order, as the
+    // classifier block ranks them
+    std::stable_sort(predictions.begin(), predictions.end(),
+                     [](const std::pair<int, float> &a, const std::pair<int, float> &b) {
+                         return a.second > b.second;
+                     });
+    
+    std::cout << "\nTop-5 Predictions:" << std::endl;
+    for (int i = 0; i < std::min(5, num_classes); i++) {
+        std::cout << "  Class " << predictions[i].first 
+                  << ": " << (predictions[i].second * 100.0f) << "%" << std::endl;
+    }
+}
+
+// Frames one after another through the accelerator daemon
+static int run_daemon_client(const std::string &socket_path, AccelPriority priority,
+                             const std::string &weights_dir, int num_frames, bool show_profile) {
+    MobileNetDaemonClient model;
+    if (!model.init(socket_path, priority)) {
+        return 1;
+    }
+    if (!model.load_weights(weights_dir)) {
+        std::cerr << "Failed to load weights" << std::endl;
+        return 1;
+    }
+    
+    qint8_t *input_image = model.input_buffer();
+    for (size_t i = 0; i < model.input_size(); i++) {
+        input_image[i] = (qint8_t)(rand() % 256 - 128);
+    }
+    
+    std::vector<float> output_probs(model.num_classes());
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < num_frames; frame++) {
+        if (!model.inference(output_probs.data(), frame == 0)) {
+            std::cerr << "Inference failed" << std::endl;
+            return 1;
+        }
+    }
+    if (num_frames > 1) {
+        auto end = std::chrono::high_resolution_clock::now();
+        double total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        std::cout << "Throughput: " << (num_frames * 1000.0 / total_ms) << " fps" << std::endl;
+    }
+    
+    print_top5(output_probs.data(), model.num_classes());
+    if (show_profile) {
+        model.print_accounting();
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     std::cout << "=== MobileNet FPGA-Accelerated Implementation ===" << std::endl;
     
+    // --stream: overlap weight loading with the first inference
+    // --frames N: run N frames; send SIGHUP to hot-swap the weights meanwhile
+    // --weights DIR: model directory (weights plus network.txt)
+    // --sim: run on the simulated accelerator (no board required)
+    // --wait poll|irq|adaptive: how to wait for each layer (default adaptive)
+    // --profile: print per-layer accelerator counters and per-block
+    //   utilization at the end
+    // --coexec: split conv and pointwise layers between the FPGA and the CPU
+    // --program: compile the conv layers into one accelerator program, run
+    //   with a single command and interrupt per frame
+    // --batch N: run N images per frame, each conv layer taking all of them
+    //   through its weights at once (prints the first image's top 5)
+    // --check: rerun every image of the last frame on the CPU and compare
+    //   its top classes, exiting non-zero on a mismatch
+    // --daemon high|normal|low: run as a client of cnn_accel_daemon at that
+    //   priority instead of owning the accelerators (--socket PATH to choose
+    //   the daemon; --profile then prints the daemon's accounting)
+    bool streaming = false;
+    bool simulate = false;
+    bool show_profile = false;
+    bool coexec = false;
+    bool programs = false;
+    bool use_daemon = false;
+    bool check = false;
+    AccelPriority priority = ACCEL_PRIORITY_NORMAL;
+    std::string socket_path = ACCEL_SOCKET_PATH;
+    CompletionMode completion = COMPLETION_ADAPTIVE;
+    int num_frames = 1;
+    int batch = 1;
+    std::string weights_dir = "../models/quantized/weights";
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--stream") streaming = true;
+        else if (arg == "--frames" && i + 1 < argc) num_frames = atoi(argv[++i]);
+        else if (arg == "--weights" && i + 1 < argc) weights_dir = argv[++i];
+        else if (arg == "--sim") simulate = true;
+        else if (arg == "--profile") show_profile = true;
+        else if (arg == "--coexec") coexec = true;
+        else if (arg == "--program") programs = true;
+        else if (arg == "--batch" && i + 1 < argc) batch = std::max(atoi(argv[++i]), 1);
+        else if (arg == "--check") check = true;
+        else if (arg == "--socket" && i + 1 < argc) socket_path = argv[++i];
+        else if (arg == "--daemon" && i + 1 < argc) {
+            std::string level(argv[++i]);
+            use_daemon = true;
+            if (level == "high") priority = ACCEL_PRIORITY_HIGH;
+            else if (level == "low") priority = ACCEL_PRIORITY_LOW;
+            else priority = ACCEL_PRIORITY_NORMAL;
+        }
+        else if (arg == "--wait" && i + 1 < argc) {
+            std::string mode(argv[++i]);
+            if (mode == "poll") completion = COMPLETION_POLL;
+            else if (mode == "irq") completion = COMPLETION_INTERRUPT;
+            else completion = COMPLETION_ADAPTIVE;
+        }
+    }
+    if (use_daemon) {
+        return run_daemon_client(socket_path, priority, weights_dir, num_frames, show_profile);
+    }
+    signal(SIGHUP, handle_sighup);
+    
     MobileNetFPGA model;
     
     // Initialize FPGA
-    if (!model.init()) {
+    if (!model.init(simulate, completion, coexec, programs, batch)) {
         return 1;
     }
     
     // Load weights
-    if (!model.load_weights("../models/quantized/weights")) {
+    if (!model.load_weights(weights_dir, streaming)) {
         std::cerr << "Failed to load weights" << std::endl;
         return 1;
     }
     
-    // Prepare input image
-    std::vector<qint8_t> input_image(INPUT_HEIGHT * INPUT_WIDTH * INPUT_CHANNELS);
-    for (size_t i = 0; i < input_image.size(); i++) {
+    // Dummy input at the model's resolution, written where a camera
+    // would DMA its frames
+    qint8_t *input_image = model.capture_buffer();
+    for (size_t i = 0; i < model.input_size() * batch; i++) {
         input_image[i] = (qint8_t)(rand() % 256 - 128);
     }
     
-    // Run inference
-    std::vector<float> output_probs(NUM_CLASSES);
-    model.inference(input_image.data(), output_probs.data());
+    // Run inference, keeping up to FRAME_PIPELINE_DEPTH frames in flight
+    int num_classes = model.num_classes();
+    std::vector<float> output_probs(num_classes * batch);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < num_frames || model.in_flight() > 0; frame++) {
+        if (reload_requested) {
+            reload_requested = 0;
+            model.reload_weights_async(weights_dir);
+        }
+        if (model.in_flight() == FRAME_PIPELINE_DEPTH || frame >= num_frames) {
+            if (!model.wait_frame(output_probs.data())) {
+                std::cerr << "Inference failed" << std::endl;
+                return 1;
+            }
+        }
+        if (frame < num_frames) {
+            model.submit_frame();
+        }
+    }
+    if (num_frames > 1) {
+        auto end = std::chrono::high_resolution_clock::now();
+        double total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        std::cout << "Pipelined throughput: " << (num_frames * 1000.0 / total_ms) << " fps";
+        if (batch > 1) {
+            std::cout << ", " << (num_frames * batch * 1000.0 / total_ms) << " images/s";
+        }
+        std::cout << std::endl;
+    }
+    
+    print_top5(output_probs.data(), num_classes);
     
-    // Find top-5 predictions
-    std::vector<std::pair<int, float>> predictions;
-    for (int i = 0; i < NUM_CLASSES; i++) {
-        predictions.push_back({i, output_probs[i]});
+    if (check && !model.check_images(output_probs.data())) {
+        return 1;
     }
-    std::sort(predictions.begin(), predictions.end(),
-              [](const auto &a, const auto &b) { return a.second > b.second; });
     
-    std::cout << "\nTop-5 Predictions:" << std::endl;
-    for (int i = 0; i < 5; i++) {
-        std::cout << "  Class " << predictions[i].first 
-                  << ": " << (predictions[i].second * 100.0f) << "%" << std::endl;
+    if (show_profile) {
+        model.print_profile();
     }
     
     model.cleanup();